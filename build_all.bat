@@ -46,6 +46,16 @@ msbuild "%SCRIPT_DIR%solutions\markusaksli_default\markusaksli_default.sln" /p:C
 msbuild "%SCRIPT_DIR%solutions\markusaksli_fast\markusaksli_fast.sln" /p:Configuration=Release
 msbuild "%SCRIPT_DIR%solutions\markusaksli_default_threaded\markusaksli_default_threaded.sln" /p:Configuration=Release
 msbuild "%SCRIPT_DIR%solutions\markusaksli_fast_threaded\markusaksli_fast_threaded.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%solutions\markusaksli_columnar\markusaksli_columnar.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\text_to_columnar\text_to_columnar.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_server\brc_server.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_client\brc_client.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_loadgen\brc_loadgen.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\range_index\range_index.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_merge\brc_merge.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_coordinator\brc_coordinator.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_query\brc_query.sln" /p:Configuration=Release
+msbuild "%SCRIPT_DIR%tools\brc_sample\brc_sample.sln" /p:Configuration=Release
 jai "%SCRIPT_DIR%solutions\markusaksli_fast_threaded_jai\build.jai" -o
 
 endlocal
@@ -8,11 +8,13 @@ param(
 
 # --- Paths relative to this script ---
 $DATA_FILE = Join-Path $RootDir "data\1brc.txt"
+$COLUMNAR_DATA_FILE = Join-Path $RootDir "data\1brc.1brc" # Converted with tools\text_to_columnar, the columnar solutions read this instead
 $VALIDATION_FILE = Join-Path $RootDir "data\validation.txt"
 $OUTPUT_CSV = Join-Path $RootDir $OutputCsv
 
 # --- List of programs to benchmark ---
 $PROGRAMS = @(
+    "solutions\markusaksli_columnar\x64\Release\markusaksli_columnar.exe",
     "solutions\markusaksli_fast_threaded_jai\markusaksli_fast_threaded_jai.exe",
     "solutions\markusaksli_fast_threaded\x64\Release\markusaksli_fast_threaded.exe",
     "solutions\markusaksli_default_threaded\x64\Release\markusaksli_default_threaded.exe",
@@ -110,12 +112,21 @@ foreach ($program in $PROGRAMS) {
         Write-Warning "Program not found: $EXE_PATH"
         continue
     }
+
+    $INPUT_FILE = $DATA_FILE
+    if ($programName -like "*columnar*") {
+        $INPUT_FILE = $COLUMNAR_DATA_FILE
+        if (-not (Test-Path $INPUT_FILE)) {
+            Write-Warning "Columnar data file not found: $INPUT_FILE"
+            continue
+        }
+    }
     
     # Warmup runs
     for ($i = 0; $i -lt $WarmupRuns; $i++) {
         Write-Host "  Warmup run $($i + 1)/$WarmupRuns..." -ForegroundColor Gray
         $tempFile = [System.IO.Path]::GetTempFileName()
-        $process = Start-Process -FilePath $EXE_PATH -ArgumentList $DATA_FILE -PassThru -NoNewWindow -Wait -RedirectStandardOutput $tempFile
+        $process = Start-Process -FilePath $EXE_PATH -ArgumentList $INPUT_FILE -PassThru -NoNewWindow -Wait -RedirectStandardOutput $tempFile
         Remove-Item $tempFile -ErrorAction SilentlyContinue
     }
     	
@@ -137,7 +148,7 @@ foreach ($program in $PROGRAMS) {
             
             # Use temporary file to capture output with proper encoding
             $tempFile = [System.IO.Path]::GetTempFileName()
-            $process = Start-Process -FilePath $EXE_PATH -ArgumentList $DATA_FILE -PassThru -NoNewWindow -Wait -RedirectStandardOutput $tempFile
+            $process = Start-Process -FilePath $EXE_PATH -ArgumentList $INPUT_FILE -PassThru -NoNewWindow -Wait -RedirectStandardOutput $tempFile
             $output = [System.IO.File]::ReadAllText($tempFile, [System.Text.Encoding]::UTF8)
             
             $sw.Stop()
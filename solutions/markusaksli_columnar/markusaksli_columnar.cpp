@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/base/simd.h"
+#include "../../src/brc/columnar.h"
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+struct StationData
+{
+	s16 min = 32767;
+	s16 max = -32768;
+	u32 count = 0;
+	s64 sum = 0;
+
+	__forceinline void Add(s16 temp)
+	{
+		if (temp < min) min = temp;
+		if (temp > max) max = temp;
+		++count;
+		sum += temp;
+	}
+
+	__forceinline void Merge(const StationData& other)
+	{
+		if (other.max > max) max = other.max;
+		if (other.min < min) min = other.min;
+		count += other.count;
+		sum += other.sum;
+	}
+};
+
+struct ThreadMemory
+{
+	std::thread* thread;
+	const ColumnarFile* file;
+	std::atomic<u64>* nextBlock;
+	Array<StationData> stations; // Dense by station id, no hashing at all
+};
+
+// Rows of a sorted block are grouped by id, find where the current id's run ends 16 ids at a time
+__forceinline u32 RunEnd(const u16* ids, u32 pos, const u32 rows)
+{
+	const __m256i target = _mm256_set1_epi16((short)ids[pos]);
+	while (pos + 16 <= rows)
+	{
+		const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + pos));
+		const u32 mismatch = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, target));
+		if (mismatch != 0) return pos + _tzcnt_u32(mismatch) / 2;
+		pos += 16;
+	}
+	const u16 id = ids[pos];
+	while (pos < rows && ids[pos] == id) ++pos;
+	return pos;
+}
+
+__forceinline u32 RunEnd(const u32* ids, u32 pos, const u32 rows)
+{
+	const __m256i target = _mm256_set1_epi32((int)ids[pos]);
+	while (pos + 8 <= rows)
+	{
+		const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + pos));
+		const u32 mismatch = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi32(chunk, target));
+		if (mismatch != 0) return pos + _tzcnt_u32(mismatch) / 4;
+		pos += 8;
+	}
+	const u32 id = ids[pos];
+	while (pos < rows && ids[pos] == id) ++pos;
+	return pos;
+}
+
+// Min, max and sum of a run of temperatures 16 at a time, the s32 lanes are flushed every 64K rows so they can't overflow
+__forceinline void AddRun(StationData& stationData, const s16* temps, u32 pos, const u32 end)
+{
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i vmin = _mm256_set1_epi16(32767);
+	__m256i vmax = _mm256_set1_epi16(-32768);
+	s64 sum = 0;
+
+	stationData.count += end - pos;
+	while (pos + 16 <= end)
+	{
+		const u32 batchEnd = (end - pos > 65536) ? pos + 65536 : end;
+		__m256i vsum = _mm256_setzero_si256();
+		for (; pos + 16 <= batchEnd; pos += 16)
+		{
+			const __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(temps + pos));
+			vmin = _mm256_min_epi16(vmin, t);
+			vmax = _mm256_max_epi16(vmax, t);
+			vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(t, ones));
+		}
+		sum += SIMD_HSumS32(vsum);
+	}
+
+	s16 min = SIMD_HMinS16(vmin);
+	s16 max = SIMD_HMaxS16(vmax);
+	for (; pos < end; pos++)
+	{
+		const s16 t = temps[pos];
+		if (t < min) min = t;
+		if (t > max) max = t;
+		sum += t;
+	}
+
+	if (min < stationData.min) stationData.min = min;
+	if (max > stationData.max) stationData.max = max;
+	stationData.sum += sum;
+}
+
+template <typename ID>
+void AggregateBlock(StationData* stations, const ID* ids, const s16* temps, const u32 rows, const bool sorted)
+{
+	if (sorted)
+	{
+		u32 pos = 0;
+		while (pos < rows)
+		{
+			const u32 end = RunEnd(ids, pos, rows);
+			AddRun(stations[ids[pos]], temps, pos, end);
+			pos = end;
+		}
+	}
+	else
+	{
+		for (u32 i = 0; i < rows; i++)
+		{
+			stations[ids[i]].Add(temps[i]);
+		}
+	}
+}
+
+void Aggregate(ThreadMemory* mem)
+{
+	const ColumnarFile& file = *mem->file;
+	const u32 numStations = file.trailer->numStations;
+	mem->stations.InitMalloc(numStations);
+	for (u32 i = 0; i < numStations; i++)
+	{
+		mem->stations[i] = StationData();
+	}
+
+	const bool sorted = file.SortedBlocks();
+	for (;;)
+	{
+		const u64 block = mem->nextBlock->fetch_add(1, std::memory_order_relaxed);
+		if (block >= file.trailer->numBlocks) break;
+
+		const u32 rows = file.blocks[block].rows;
+		if (file.IdBytes() == 2)
+		{
+			AggregateBlock(mem->stations.data, (const u16*)file.BlockIds(block), file.BlockTemps(block), rows, sorted);
+		}
+		else
+		{
+			AggregateBlock(mem->stations.data, (const u32*)file.BlockIds(block), file.BlockTemps(block), rows, sorted);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: %s [file.1brc]\n", argv[0]);
+		return 1;
+	}
+
+	ColumnarFile file;
+	if (!file.Open(argv[1]))
+	{
+		printf("%s is not a columnar measurement file\n", argv[1]);
+		return 1;
+	}
+
+	u32 numThreads = std::thread::hardware_concurrency() - 1;
+	if (numThreads == 0) numThreads = 1;
+	if (numThreads > file.trailer->numBlocks) numThreads = file.trailer->numBlocks > 0 ? (u32)file.trailer->numBlocks : 1;
+
+	std::atomic<u64> nextBlock{ 0 };
+	Array<ThreadMemory> mem;
+	mem.InitMallocZero(numThreads);
+	for (u32 i = 0; i < numThreads; i++)
+	{
+		mem[i].file = &file;
+		mem[i].nextBlock = &nextBlock;
+	}
+	ThreadMemory& mainMem = mem[numThreads - 1];
+
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		mem[i].thread = new std::thread(Aggregate, &mem[i]);
+	}
+	Aggregate(&mainMem);
+
+	// Ids are shared by every thread so the merge is just a dense loop
+	const u32 numStations = file.trailer->numStations;
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		mem[i].thread->join();
+		for (u32 j = 0; j < numStations; j++)
+		{
+			mainMem.stations[j].Merge(mem[i].stations[j]);
+		}
+	}
+
+	Array<u32> sortedStations;
+	sortedStations.InitMalloc(numStations);
+	u32 numSeen = 0;
+	for (u32 i = 0; i < numStations; i++)
+	{
+		if (mainMem.stations[i].count > 0) sortedStations[numSeen++] = i;
+	}
+
+	std::sort(sortedStations.data, sortedStations.data + numSeen,
+		[&](const u32 a, const u32 b) {
+			return file.StationName(a) < file.StationName(b);
+		});
+
+	StringBuffer writeBuf(numSeen * 128ull + 16);
+
+	writeBuf.Push('{');
+
+	bool first = true;
+	for (u32 i = 0; i < numSeen; i++)
+	{
+		if (!first)
+		{
+			writeBuf.Push(", ");
+		}
+		const StationData& stationData = mainMem.stations[sortedStations[i]];
+		writeBuf.Push(file.StationName(sortedStations[i]));
+		writeBuf.Push('=');
+		Push1DecimalDouble(writeBuf, stationData.min * 0.1);
+		writeBuf.Push('/');
+		Push1DecimalDoubleRoundTowardPositive(writeBuf, (stationData.sum * 0.1) / stationData.count);
+		writeBuf.Push('/');
+		Push1DecimalDouble(writeBuf, stationData.max * 0.1);
+		first = false;
+	}
+
+	writeBuf.Push('}');
+
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+
+	std::cout.write(writeBuf.data, writeBuf.size);
+
+	return 0;
+}
@@ -6,6 +6,10 @@
 #include "../../src/base/hash_map.h"
 #include "../../src/base/platform_io.h"
 #include "../../src/base/simd.h"
+#include "../../src/brc/checkpoint.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/partial_aggregate.h"
+#include "../../src/brc/result_cache.h"
 
 void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
 {
@@ -62,8 +66,8 @@ struct ThreadMemory
 {
 	std::thread* thread;
 	HashMap<String, StationData> map;
-	char* pos;
-	const char* parseEnd;
+	WorkQueue* work;
+	UnitReader reader;
 };
 
 inline double ParseTempAsDouble(char*& pos)
@@ -95,58 +99,191 @@ inline double ParseTempAsDouble(char*& pos)
 void Parse(ThreadMemory* mem)
 {
 	mem->map.InitAuto(100);
-	while (mem->pos < mem->parseEnd)
+	for (;;)
 	{
-		String readString;
-		readString.data = mem->pos;
-		SIMD_SeekToChar(mem->pos, ';');
-		readString.len = mem->pos - readString.data;
+		WorkUnit* unit = mem->work->Take();
+		if (unit == nullptr) break;
 
-		u32* insertionIndex;
-		auto result = mem->map.FindOrGetInsertionIndex(readString, insertionIndex);
-		StationData* stationData;
-		if (result)
+		char* pos;
+		const char* parseEnd;
+		if (!mem->reader.Begin(*unit, pos, parseEnd)) exit(1);
+
+		const u64 stationsBefore = mem->map.items.size;
+		while (pos < parseEnd)
+		{
+			String readString;
+			readString.data = pos;
+			SIMD_SeekToChar(pos, ';');
+			readString.len = pos - readString.data;
+
+			u32* insertionIndex;
+			auto result = mem->map.FindOrGetInsertionIndex(readString, insertionIndex);
+			StationData* stationData;
+			if (result)
+			{
+				stationData = &result->v;
+			}
+			else
+			{
+				mem->map.InsertIndexed(readString, StationData(), insertionIndex);
+				stationData = &mem->map.items.Last().v;
+			}
+			pos++;
+
+			stationData->Add(ParseTempAsDouble(pos));
+		}
+
+		// New names from a decompressed block still point into the decode buffer
+		for (u64 i = stationsBefore; i < mem->map.items.size; i++)
 		{
-			stationData = &result->v;
+			String& name = mem->map.items[i].k;
+			if (mem->reader.NeedsCopy(name.data)) name = mem->reader.Persist(name.data, name.len);
 		}
-		else
+		mem->work->Done(*unit);
+	}
+}
+
+void PrintResults(ThreadMemory& mainMem)
+{
+	Array<u64> sortedStations;
+	sortedStations.InitMalloc(mainMem.map.items.size);
+	ForVector(sortedStations, i)
+	{
+		sortedStations[i] = i;
+	}
+
+	std::sort(sortedStations.data, sortedStations.data + sortedStations.size,
+		[&](const u64 a, const u64 b) {
+			return mainMem.map.items[a].k < mainMem.map.items[b].k;
+		});
+
+	StringBuffer writeBuf(mainMem.map.items.size * 128ull + 16); // Names are < 100 bytes
+
+	writeBuf.Push('{');
+
+	bool first = true;
+	for (u64 i = 0; i < mainMem.map.items.size; i++)
+	{
+		if (!first)
 		{
-			mem->map.InsertIndexed(readString, StationData(), insertionIndex);
-			stationData = &mem->map.items.Last().v;
+			writeBuf.Push(", ");
 		}
-		mem->pos++;
+		const auto& pair = mainMem.map.items[sortedStations[i]];
+		const StationData& stationData = pair.v;
+		writeBuf.PushF(pair.k, '=');
+		Push1DecimalDouble(writeBuf, stationData.min);
+		writeBuf.Push('/');
+		Push1DecimalDoubleRoundTowardPositive(writeBuf, stationData.sum / stationData.count);
+		writeBuf.Push('/');
+		Push1DecimalDouble(writeBuf, stationData.max);
+		first = false;
+	}
+
+	writeBuf.Push('}');
 
-		stationData->Add(ParseTempAsDouble(mem->pos));
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+
+	std::cout.write(writeBuf.data, writeBuf.size);
+}
+
+// The usual output, or with -partial the exact aggregates for tools/brc_merge
+int OutputResults(ThreadMemory& mainMem, const InputOptions& inputOptions)
+{
+	if (inputOptions.partialPath != nullptr)
+	{
+		const bool written = WritePartialAggregate(inputOptions.partialPath, mainMem.map.items.size, [&](const u64 i, String& name, PartialRecord& record)
+		{
+			const StationData& stationData = mainMem.map.items[i].v;
+			name = mainMem.map.items[i].k;
+			record.sum = (s64)round(stationData.sum * 10);
+			record.count = stationData.count;
+			record.min = (s16)round(stationData.min * 10);
+			record.max = (s16)round(stationData.max * 10);
+		});
+		if (!written)
+		{
+			printf("failed to write %s\n", inputOptions.partialPath);
+			return 1;
+		}
+		return 0;
 	}
+
+	PrintResults(mainMem);
+	return 0;
 }
 
 int main(int argc, char* argv[])
 {
-	MappedFileHandle file;
-	file.OpenRead(argv[1]);
-	char* fileEnd = &file.data[file.length];
-	char* pos = file.data + 3; // Skip BOM
+	InputOptions inputOptions;
+	Vector<const char*> patterns(16);
+	for (int i = 1; i < argc; i++)
+	{
+		bool error = false;
+		if (ParseInputOption(argc, argv, i, inputOptions, error))
+		{
+			if (error) return 1;
+			continue;
+		}
+		patterns.Push(argv[i]);
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-noindex] [-buildindex] [-indexmb mb] [-rows start:end] [-range start:end] [-progress] [-cache dir] [-cachehash] [-checkpoint file] [-partial file] [file or glob]...\n", argv[0]);
+		return 1;
+	}
 
 	// u32 numThreads = 2;
 	u32 numThreads = std::thread::hardware_concurrency() - 1;
-	u64 perThreadBytes = file.length / numThreads;
-	Array<ThreadMemory> mem;
-	mem.InitMallocZero(numThreads);
+	if (numThreads == 0) numThreads = 1;
 
-	// Partition the file
-	for (u32 i = 0; i < numThreads; i++)
+	// Every path or glob is treated as part of one logical input, split into line aligned chunks
+	InputSet input;
+	if (!input.Open(patterns, inputOptions, numThreads)) return 1;
+
+	// A cached result for the exact same inputs skips the scan entirely
+	ResultCache cache;
+	if (inputOptions.cacheDir != nullptr)
 	{
-		mem[i].pos = pos;
-		if (i != numThreads - 1)
+		cache.Init(inputOptions.cacheDir, "markusaksli_default_threaded", sizeof(StationData), input, inputOptions, numThreads);
+		if (cache.Lookup())
 		{
-			pos += perThreadBytes;
-			SIMD_SeekToChar(pos, '\n');
-			pos++;
-			mem[i].parseEnd = pos;
+			Array<ThreadMemory> cached;
+			cached.InitMallocZero(1);
+			cached[0].map.InitAuto(cache.NumStations() > 100 ? cache.NumStations() : 100);
+			for (u64 i = 0; i < cache.NumStations(); i++)
+			{
+				StationData stationData;
+				memcpy(&stationData, cache.Record(i), sizeof(StationData));
+				cached[0].map.Insert(cache.Name(i), stationData);
+			}
+			return OutputResults(cached[0], inputOptions);
 		}
 	}
+
+	// Append-only inputs only get parsed from where the last checkpoint stopped, its aggregates are merged in after
+	Checkpoint checkpoint;
+	if (inputOptions.checkpointPath != nullptr && !checkpoint.Begin(inputOptions.checkpointPath, "markusaksli_default_threaded", sizeof(StationData), input, inputOptions)) return 1;
+
+	WorkQueue work;
+	if (!input.Partition(work, inputOptions, numThreads)) return 1;
+
+	// No point spinning up threads that won't get any work
+	if (numThreads > work.units.size) numThreads = work.units.size > 0 ? (u32)work.units.size : 1;
+
+	ProgressReporter progress;
+	if (inputOptions.progress) progress.Start(&work);
+
+	Array<ThreadMemory> mem;
+	mem.InitMallocZero(numThreads);
+	for (u32 i = 0; i < numThreads; i++)
+	{
+		mem[i].work = &work;
+	}
 	ThreadMemory& mainMem = mem[numThreads - 1];
-	mainMem.parseEnd = fileEnd;
 
 	// Parse
 	for (u32 i = 0; i < numThreads - 1; i++)
@@ -176,48 +313,44 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	Array<u64> sortedStations;
-	sortedStations.InitMalloc(mainMem.map.items.size);
-	ForVector(sortedStations, i)
+	// Everything before the checkpoint offsets
+	for (u64 i = 0; i < checkpoint.NumStations(); i++)
 	{
-		sortedStations[i] = i;
+		StationData saved;
+		memcpy(&saved, checkpoint.Record(i), sizeof(StationData));
+		u32* insertionIndex;
+		auto result = mainMem.map.FindOrGetInsertionIndex(checkpoint.Name(i), insertionIndex);
+		if (result)
+		{
+			result->v.Merge(saved);
+		}
+		else
+		{
+			mainMem.map.InsertIndexed(checkpoint.Name(i), saved, insertionIndex);
+		}
 	}
 
-	std::sort(sortedStations.data, sortedStations.data + sortedStations.size,
-		[&](const u64 a, const u64 b) {
-			return mainMem.map.items[a].k < mainMem.map.items[b].k;
-		});
+	progress.Stop();
 
-	StringBuffer writeBuf(4 * KB);
-
-	writeBuf.Push('{');
-
-	bool first = true;
-	for (u64 i = 0; i < mainMem.map.items.size; i++)
+	if (inputOptions.checkpointPath != nullptr)
 	{
-		if (!first)
+		const bool stored = checkpoint.Store(input, mainMem.map.items.size, [&](const u64 i, String& name, const void*& record)
 		{
-			writeBuf.Push(", ");
-		}
-		const auto& pair = mainMem.map.items[sortedStations[i]];
-		const StationData& stationData = pair.v;
-		writeBuf.PushF(pair.k, '=');
-		Push1DecimalDouble(writeBuf, stationData.min);
-		writeBuf.Push('/');
-		Push1DecimalDoubleRoundTowardPositive(writeBuf, stationData.sum / stationData.count);
-		writeBuf.Push('/');
-		Push1DecimalDouble(writeBuf, stationData.max);
-		first = false;
+			name = mainMem.map.items[i].k;
+			record = &mainMem.map.items[i].v;
+		});
+		if (!stored) fprintf(stderr, "failed to write checkpoint %s\n", inputOptions.checkpointPath);
 	}
 
-	writeBuf.Push('}');
-
-#ifdef _WIN32
-	SetConsoleOutputCP(CP_UTF8);
-#endif
-	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
-
-	std::cout.write(writeBuf.data, writeBuf.size);
+	if (inputOptions.cacheDir != nullptr)
+	{
+		const bool stored = cache.Store(input, mainMem.map.items.size, sizeof(StationData), [&](const u64 i, String& name, const void*& record)
+		{
+			name = mainMem.map.items[i].k;
+			record = &mainMem.map.items[i].v;
+		});
+		if (!stored) fprintf(stderr, "result not cached (inputs changed recently or the cache dir isn't writable)\n");
+	}
 
-	return 0;
+	return OutputResults(mainMem, inputOptions);
 }
\ No newline at end of file
@@ -56,9 +56,6 @@ struct StationMapping
 	u32 data;
 };
 
-// Compact representation for key strings in a buffer, also allows us to index into the buffer instead of storing full pointers for the key strings
-StringBuffer strbuf(1 * KB);
-
 // Fixed size flat power of 2 map with linear probing
 struct FixedFlatHashMapPow2
 {
@@ -69,22 +66,26 @@ struct FixedFlatHashMapPow2
 		u16 name;
 		u8 namelen;
 		u8 valueIndex;
-
-		__forceinline bool operator<(const Entry& other) const
-		{
-			const int cmp = strncmp(&strbuf[name], &strbuf[other.name], (namelen < other.namelen) ? namelen : other.namelen);
-
-			if (cmp < 0) return true;
-			if (cmp > 0) return false;
-
-			return namelen < other.namelen;
-		}
 	};
 	Entry items[capacity];
 
+	// Compact representation for key strings in a buffer, also allows us to index into the buffer instead of storing full pointers for the key strings
+	StringBuffer strbuf;
+
 	FixedFlatHashMapPow2()
 	{
 		memset(items, 0, sizeof(Entry) * capacity);
+		strbuf.Init(1 * KB);
+	}
+
+	__forceinline bool Less(const Entry& a, const Entry& b) const
+	{
+		const int cmp = strncmp(&strbuf[a.name], &strbuf[b.name], (a.namelen < b.namelen) ? a.namelen : b.namelen);
+
+		if (cmp < 0) return true;
+		if (cmp > 0) return false;
+
+		return a.namelen < b.namelen;
 	}
 
 	__forceinline u32 FindOrInsert(const String& k, const HASH_T hash, u32& numStations, u32 stationToHeader[NUM_STATIONS])
@@ -355,7 +356,7 @@ int main(int argc, char* argv[])
 
 	std::sort(mapping.data, mapping.data + NUM_STATIONS,
 		[&](const StationMapping& a, const StationMapping& b) {
-			return map.items[a.header] < map.items[b.header];
+			return map.Less(map.items[a.header], map.items[b.header]);
 		});
 
 	StringBuffer writeBuf(4 * KB);
@@ -372,7 +373,7 @@ int main(int argc, char* argv[])
 		const StationMapping m = mapping[i];
 		const StationData& stationData = stations[m.data];
 		const auto header = map.items[m.header];
-		writeBuf.Push(&strbuf[header.name], header.namelen);
+		writeBuf.Push(&map.strbuf[header.name], header.namelen);
 		writeBuf.Push('=');
 		Push1DecimalDouble(writeBuf, stationData.min * 0.1);
 		writeBuf.Push('/');
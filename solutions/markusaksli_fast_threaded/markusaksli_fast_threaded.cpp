@@ -1,296 +1,497 @@
-#include <algorithm>
-#include <iomanip>
-#include <iostream>
+#include <chrono>
 
 #include "../../src/base/buf_string.h"
 #include "../../src/base/platform_io.h"
-#include "../../src/base/simd.h"
-
-#define NUM_STATIONS 100
-
-void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+#include "../../src/brc/checkpoint.h"
+#include "../../src/brc/engine.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/partial_aggregate.h"
+#include "../../src/brc/result_cache.h"
+#include "../../src/brc/result_writer.h"
+#include "../../src/brc/station_metadata.h"
+
+// -format, -output, -extremes, -join and -latbands
+struct OutputOptions
 {
-	s64 intPart = scaled / 10;
-	s64 decimal = std::abs(scaled % 10);
+	ResultFormat format = RESULT_FORMAT_TEXT;
+	const char* path = nullptr; // stdout
+	bool offsets = false; // Where each station's min and max came from
+	StationMetadata metadata;
+	double bandDegrees = 0; // Latitude bands instead of stations when set
+};
 
-	if (intPart == 0 && scaled < 0)
+// The stations, or the latitude bands they add up to, only the merged result is touched so the scan doesn't change
+bool WriteEngineResult(ResultWriter& writer, const OutputOptions& output, const brc::EngineResult& result, const u64 window = RESULT_NO_WINDOW)
+{
+	if (output.bandDegrees <= 0)
 	{
-		writeBuf.Push('-');
+		return WriteResults(writer, output.format, result.stations.size, [&](const u64 i, String& name, ResultRecordOffsets& record)
+		{
+			const brc::EngineStation& station = result.stations.data[i];
+			name = station.name;
+			record.min = station.data.min;
+			record.max = station.data.max;
+			record.sum = station.data.sum;
+			record.count = station.data.count;
+			record.minOffset = station.minOffset;
+			record.maxOffset = station.maxOffset;
+		}, window, output.offsets);
 	}
 
-	writeBuf.Push(intPart);
-	writeBuf.Push('.');
-	writeBuf.Push(static_cast<char>('0' + decimal));
+	LatitudeBands bands;
+	bands.Init(output.bandDegrees);
+	for (u64 i = 0; i < result.stations.size; i++)
+	{
+		const brc::EngineStation& station = result.stations.data[i];
+		bands.Add(output.metadata, station.name, station.hash, station.data.min, station.data.max, station.data.sum, station.data.count);
+	}
+	Vector<u32> used(bands.NumGroups());
+	for (u32 i = 0; i < bands.NumGroups(); i++)
+	{
+		if (bands.groups.data[i].stations > 0) used.Push(i);
+	}
+	const bool written = WriteResults(writer, output.format, used.size, [&](const u64 i, String& name, ResultRecord& record)
+	{
+		const StationGroup& group = bands.groups.data[used.data[i]];
+		name = bands.Name(used.data[i]);
+		record.min = group.min;
+		record.max = group.max;
+		record.sum = group.sum;
+		record.count = group.count;
+	}, window);
+	bands.Free();
+	return written;
 }
 
-void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+void SetupStdout()
 {
-	s64 scaled = static_cast<s64>(ceil(d * 10));
-	Push1DecimalDouble(writeBuf, scaled);
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
 }
 
-void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+// The usual output, or with -partial the exact aggregates for tools/brc_merge
+int OutputResults(const brc::EngineResult& result, const InputOptions& inputOptions, const OutputOptions& output)
 {
-	s64 scaled = static_cast<s64>(round(d * 10));
-	Push1DecimalDouble(writeBuf, scaled);
+	if (inputOptions.partialPath != nullptr)
+	{
+		const bool written = WritePartialAggregate(inputOptions.partialPath, result.stations.size, [&](const u64 i, String& name, PartialRecord& record)
+		{
+			const brc::EngineStation& station = result.stations.data[i];
+			name = station.name;
+			record.sum = station.data.sum;
+			record.count = station.data.count;
+			record.min = station.data.min;
+			record.max = station.data.max;
+		});
+		if (!written)
+		{
+			printf("failed to write %s\n", inputOptions.partialPath);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (output.path == nullptr) SetupStdout();
+	ResultWriter writer;
+	const bool written = writer.Open(output.path) && WriteEngineResult(writer, output, result);
+	if (!writer.Close() || !written)
+	{
+		fprintf(stderr, "failed to write %s\n", output.path != nullptr ? output.path : "stdout");
+		return 1;
+	}
+	return 0;
 }
 
-struct StationData
+// -window: a result per window in row order, text ones a line each
+int OutputWindows(const brc::EngineWindows& windows, const OutputOptions& output)
 {
-	s16 min = 32767;
-	s16 max = -32768;
-	u32 count = 0;
-	s64 sum = 0;
-
-	__forceinline void Add(s16 temp)
+	if (output.path == nullptr) SetupStdout();
+	ResultWriter writer;
+	bool written = writer.Open(output.path);
+	for (u64 i = 0; i < windows.windows.size && written; i++)
 	{
-		if (temp < min) min = temp;
-		if (temp > max) max = temp;
-		++count;
-		sum += temp;
+		written = WriteEngineResult(writer, output, windows.windows.data[i], i);
+		if (output.format == RESULT_FORMAT_TEXT) writer.Append("\n");
 	}
-
-	__forceinline void Merge(const StationData& other)
+	if (!writer.Close() || !written)
 	{
-		if (other.max > max) max = other.max;
-		if (other.min < min) min = other.min;
-		count += other.count;
-		sum += other.sum;
+		fprintf(stderr, "failed to write %s\n", output.path != nullptr ? output.path : "stdout");
+		return 1;
 	}
-};
+	return 0;
+}
 
-struct StationMapping
+// Stations saved by a result cache or a checkpoint, which hold the 16 byte StationData as is
+template <typename Saved>
+void LoadSaved(const Saved& saved, brc::EngineResult& result)
 {
-	u32 header;
-	u32 data;
-};
+	u64 nameBytes = 0;
+	for (u64 i = 0; i < saved.NumStations(); i++)
+	{
+		nameBytes += saved.Name(i).len;
+	}
+	result.Init(saved.NumStations(), nameBytes);
+	for (u64 i = 0; i < saved.NumStations(); i++)
+	{
+		brc::EngineStationData data;
+		memcpy(&data, saved.Record(i), sizeof(data));
+		result.Add(saved.Name(i), brc::EngineHash(saved.Name(i)), data, 0);
+	}
+	result.Sort();
+}
 
-// Use a fixed size flat power of 2 map with linear probing
-struct FixedFlatHashMapPow2
+// tail -f: parses complete lines as they get appended and publishes the result every intervalMs, never returns.
+// Stats go to stderr, the latency is from the file's modified time when an append was first seen to the result being printed.
+// The engine's threads stay around between rounds instead of starting new ones for every append.
+int Follow(brc::Engine& engine, InputSet& input, const InputOptions& inputOptions, const OutputOptions& output, const u32 intervalMs)
 {
-	static constexpr u64 capacity = 512;
-
-	struct Entry // Compact key struct to fit more in cache
+	constexpr u32 POLL_MS = 250; // In case a notification gets lost
+	InputFile& f = input.files[0];
+	FileWatcher watcher;
+	if (!watcher.Open(f.path))
 	{
-		const char* name;
-		u32 namelen;
-		u32 valueIndex;
-		HASH_T hash; // Didn't see much of a difference keeping the hash in here on single threaded but it saves us recalculating it during the merge
-
-		__forceinline bool operator<(const Entry& other) const
-		{
-			const int cmp = strncmp(name, other.name, (namelen < other.namelen) ? namelen : other.namelen);
+		printf("can't watch %s\n", (const char*)f.path);
+		return 1;
+	}
 
-			if (cmp < 0) return true;
-			if (cmp > 0) return false;
+	// Everything parsed so far, the result copies the names since the file is remapped every round
+	brc::EngineResult live;
+	live.Init(0, 0);
+	brc::EngineResult round;
 
-			return namelen < other.namelen;
-		}
-	};
-	Entry items[capacity];
-
-	void Init()
+	if (output.path == nullptr) SetupStdout();
+	ResultWriter writer;
+	if (!writer.Open(output.path))
 	{
-		memset(items, 0, sizeof(Entry) * capacity);
+		printf("can't write %s\n", output.path != nullptr ? output.path : "stdout");
+		return 1;
 	}
-
-	__forceinline u32 FindOrInsert(const String& k, const HASH_T hash, u32& numStations, u32 stationToHeader[NUM_STATIONS])
+	u64 consumed = 0;
+	u64 pendingBytes = 0;
+	s64 firstPendingTime = 0;
+	s64 lastPendingTime = 0;
+	double parseMs = 0;
+	auto nextPublish = std::chrono::steady_clock::now();
+	for (;;)
 	{
-		u32 idx = hash & (capacity - 1); // Requires power of 2 size
-		Entry* __restrict entries = items;
+		FileIdentity identity;
+		GetFileIdentity(f.path, identity);
+		if (identity.size < consumed)
+		{
+			fprintf(stderr, "%s was truncated, starting over\n", (const char*)f.path);
+			live.Init(0, 0);
+			consumed = 0;
+		}
 
-		for (;;)
+		if (identity.size > consumed && f.file.OpenRead(f.path))
 		{
-			Entry& e = entries[idx];
-			if (e.namelen == 0)
+			if (consumed == 0) consumed = SkipBOM(f.file) - f.file.data;
+			f.ranged = true;
+			f.rangeBegin = consumed;
+			f.rangeEnd = LastLineEnd(f.file, consumed); // The last line might still be half written
+			if (f.rangeEnd > f.rangeBegin)
 			{
-				assert(numStations < NUM_STATIONS);
-				e.hash = hash;
-				e.name = k.data;
-				e.namelen = k.len;
-				e.valueIndex = numStations;
-				stationToHeader[numStations] = idx;
-				u32 ret = numStations;
-				++numStations;
-				return ret;
+				const auto parseStart = std::chrono::steady_clock::now();
+				if (!engine.Run(input, inputOptions, round))
+				{
+					fprintf(stderr, "%s\n", round.error);
+					return 1;
+				}
+				live.Merge(round);
+				parseMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+
+				if (pendingBytes == 0) firstPendingTime = identity.modifiedTime;
+				lastPendingTime = identity.modifiedTime;
+				pendingBytes += f.rangeEnd - f.rangeBegin;
+				consumed = f.rangeEnd;
 			}
-			if (e.hash == hash && k.Equals(e.name, e.namelen)) return e.valueIndex;
-			idx = (idx + 1) & (capacity - 1);
+			f.file.Close();
 		}
-	}
-};
 
-struct ThreadMemory
-{
-	std::thread* thread;
-	char* pos;
-	const char* parseEnd;
-	FixedFlatHashMapPow2 map;
-	FixedArray<StationData, NUM_STATIONS> stations;
-	FixedArray<u32, NUM_STATIONS> stationToHeader;
-	u32 numStations = 0;
-};
+		auto now = std::chrono::steady_clock::now();
+		if (pendingBytes > 0 && now >= nextPublish)
+		{
+			WriteEngineResult(writer, output, live);
+			if (output.format == RESULT_FORMAT_TEXT) writer.Append("\n");
+			writer.Flush();
+
+			const s64 published = FileTimeNow();
+			const double ticksPerMs = FILE_TIME_TICKS_PER_SECOND / 1000.0;
+			fprintf(stderr, "published %.2f MB in %.2f ms of parsing, append to visible latency %.2f ms (oldest) %.2f ms (newest)\n",
+				(double)pendingBytes / MB, parseMs, (published - firstPendingTime) / ticksPerMs, (published - lastPendingTime) / ticksPerMs);
+			pendingBytes = 0;
+			parseMs = 0;
+			nextPublish = now + std::chrono::milliseconds(intervalMs);
+		}
 
-__forceinline s16 ParseTempAsS16SingleLoad(char*& pos)
-{
-	s16 sign = 1;
-	u64 data = *((u64*)pos);
-	u8 c = data & 0xff;
-	data = data >> 8;
-	if (c == '-')
-	{
-		sign = -1;
-		++pos;
-		c = data & 0xff;
-		data = data >> 8;
-	}
-	s16 tens = (c - '0') * 10;
-
-	c = data & 0xff;
-	data = data >> 8;
-	if (c != '.') {
-		tens = tens * 10 + (c - '0') * 10;
-		++pos;
-		data = data >> 8;
+		u32 waitMs = POLL_MS;
+		if (pendingBytes > 0)
+		{
+			const s64 untilPublish = std::chrono::duration_cast<std::chrono::milliseconds>(nextPublish - now).count();
+			waitMs = untilPublish <= 0 ? 0 : (untilPublish < POLL_MS ? (u32)untilPublish : POLL_MS);
+		}
+		watcher.Wait(waitMs);
 	}
-
-	c = data & 0xff;
-	tens = sign * (tens + c - '0');
-	pos += 4;
-
-	return tens;
 }
 
-__forceinline void SeekAndHash_1(char*& pos, HASH_T& hash)
+int main(int argc, char* argv[])
 {
-	while (*pos != ';')
+	brc::EngineOptions options;
+	InputOptions& inputOptions = options.input;
+	OutputOptions output;
+	Vector<const char*> patterns(16);
+	bool follow = false;
+	u32 intervalMs = 1000;
+	u64 windowRows = 0;
+	for (int i = 1; i < argc; i++)
 	{
-		fnv1aStep(*pos, hash);
-		++pos;
+		bool error = false;
+		if (_stricmp(argv[i], "-follow") == 0)
+		{
+			follow = true;
+			continue;
+		}
+		if (_stricmp(argv[i], "-interval") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing interval arg value\n");
+				return 1;
+			}
+			intervalMs = strtoul(argv[i], nullptr, 10);
+			continue;
+		}
+		if (_stricmp(argv[i], "-threads") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing threads arg value\n");
+				return 1;
+			}
+			options.threads = strtoul(argv[i], nullptr, 10); // Workers sharing a machine (see tools/brc_coordinator) shouldn't all take every core
+			continue;
+		}
+		if (_stricmp(argv[i], "-extremes") == 0)
+		{
+			options.aggregates |= brc::ENGINE_EXTREME_OFFSETS;
+			output.offsets = true;
+			continue;
+		}
+		if (_stricmp(argv[i], "-window") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing window arg value\n");
+				return 1;
+			}
+			windowRows = strtoull(argv[i], nullptr, 10);
+			if (windowRows == 0)
+			{
+				printf("-window takes a number of rows\n");
+				return 1;
+			}
+			continue;
+		}
+		if (_stricmp(argv[i], "-io") == 0)
+		{
+			i++;
+			if (i >= argc || (_stricmp(argv[i], "mapped") != 0 && _stricmp(argv[i], "read") != 0))
+			{
+				printf("-io takes mapped or read\n");
+				return 1;
+			}
+			options.io = _stricmp(argv[i], "read") == 0 ? brc::ENGINE_IO_READ : brc::ENGINE_IO_MAPPED;
+			continue;
+		}
+		if (_stricmp(argv[i], "-format") == 0)
+		{
+			i++;
+			if (i >= argc || !ParseResultFormat(argv[i], output.format))
+			{
+				printf("-format takes text, json, csv or binary\n");
+				return 1;
+			}
+			continue;
+		}
+		if (_stricmp(argv[i], "-join") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing join arg value\n");
+				return 1;
+			}
+			if (!output.metadata.Load(argv[i])) return 1;
+			continue;
+		}
+		if (_stricmp(argv[i], "-latbands") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing latbands arg value\n");
+				return 1;
+			}
+			output.bandDegrees = strtod(argv[i], nullptr);
+			if (output.bandDegrees <= 0 || output.bandDegrees > 180)
+			{
+				printf("-latbands takes degrees between 0 and 180\n");
+				return 1;
+			}
+			continue;
+		}
+		if (_stricmp(argv[i], "-output") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing output arg value\n");
+				return 1;
+			}
+			output.path = argv[i];
+			continue;
+		}
+		if (ParseInputOption(argc, argv, i, inputOptions, error))
+		{
+			if (error) return 1;
+			continue;
+		}
+		patterns.Push(argv[i]);
 	}
-}
 
-void Parse(ThreadMemory* mem)
-{
-	mem->map.Init();
-	for (u32 i = 0; i < NUM_STATIONS; i++)
+	if (patterns.size == 0)
 	{
-		mem->stations[i] = StationData();
+		printf("usage: %s [-noindex] [-buildindex] [-indexmb mb] [-rows start:end] [-range start:end] [-progress] [-cache dir] [-cachehash] [-checkpoint file] [-partial file] [-threads n] [-io mapped|read] [-format text|json|csv|binary] [-output file] [-extremes] [-join weather_stations.csv -latbands degrees] [-window rows] [-follow] [-interval ms] [file or glob]...\n", argv[0]);
+		return 1;
 	}
 
-	while (mem->pos < mem->parseEnd)
+	if (output.bandDegrees > 0 && (output.metadata.items == nullptr || inputOptions.partialPath != nullptr))
 	{
-		String readString;
-		readString.data = mem->pos;
-		HASH_T hash = FNV_PRIME;
-		SeekAndHash_1(mem->pos, hash);
-		readString.len = mem->pos - readString.data;
+		printf("-latbands needs -join [weather_stations.csv] and can't be combined with -partial\n");
+		return 1;
+	}
 
-		u32 result = mem->map.FindOrInsert(readString, hash, mem->numStations, mem->stationToHeader.data);
-		StationData& stationData = mem->stations[result];
-		mem->pos++;
+	if (output.offsets && (output.bandDegrees > 0 || inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr || inputOptions.partialPath != nullptr))
+	{
+		printf("-extremes can't be combined with -latbands, -cache, -checkpoint or -partial\n");
+		return 1;
+	}
 
-		stationData.Add(ParseTempAsS16SingleLoad(mem->pos));
+	if (windowRows > 0 && (follow || inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr || inputOptions.partialPath != nullptr))
+	{
+		printf("-window can't be combined with -follow, -cache, -checkpoint or -partial\n");
+		return 1;
 	}
-}
 
-int main(int argc, char* argv[])
-{
-	MappedFileHandle file;
-	file.OpenRead(argv[1]);
-	char* fileEnd = &file.data[file.length];
-	char* pos = file.data + 3; // Skip BOM
-
-	// u32 numThreads = 2;
-	u32 numThreads = std::thread::hardware_concurrency() - 1;
-	u64 perThreadBytes = file.length / numThreads;
-	Array<ThreadMemory> mem;
-	mem.InitMallocZero(numThreads);
-
-	// Partition the file
-	for (u32 i = 0; i < numThreads; i++)
+	brc::Engine engine;
+	engine.Init(options);
+	brc::EngineResult result;
+	brc::EngineWindows windows;
+
+	// Reads are only worth it for plain whole files, everything else needs the mapped input
+	if (options.io == brc::ENGINE_IO_READ)
 	{
-		mem[i].pos = pos;
-		if (i != numThreads - 1)
+		if (follow || inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr)
+		{
+			printf("-io read can't be combined with -follow, -cache or -checkpoint\n");
+			return 1;
+		}
+		if (windowRows > 0)
+		{
+			if (!engine.RunWindows(patterns, windowRows, windows))
+			{
+				printf("%s\n", windows.error);
+				return 1;
+			}
+			return OutputWindows(windows, output);
+		}
+		if (!engine.Run(patterns, result))
 		{
-			pos += perThreadBytes;
-			// No matter what kind of prefetching I try it just doesn't seem to beat default paging on windows
-			// PrefetchVirtualMemory(file.data, 64 * MB, 4 * MB);
-			SIMD_SeekToChar(pos, '\n');
-			pos++;
-			mem[i].parseEnd = pos;
+			printf("%s\n", result.error);
+			return 1;
 		}
+		return OutputResults(result, inputOptions, output);
 	}
-	ThreadMemory& mainMem = mem[numThreads - 1];
-	mainMem.parseEnd = fileEnd;
 
-	// Parse
-	for (u32 i = 0; i < numThreads - 1; i++)
+	// Every path or glob is treated as part of one logical input, split into line aligned chunks
+	InputSet input;
+	if (!input.Open(patterns, inputOptions, engine.numThreads)) return 1;
+
+	if (follow)
 	{
-		mem[i].thread = new std::thread(Parse, &mem[i]);
+		if (input.files.size != 1 || input.files[0].compressed.Good() || inputOptions.hasRows || inputOptions.hasRange || inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr || inputOptions.partialPath != nullptr)
+		{
+			printf("-follow takes exactly one text file and can't be combined with -rows, -range, -cache, -checkpoint or -partial\n");
+			return 1;
+		}
+		return Follow(engine, input, inputOptions, output, intervalMs);
 	}
-	Parse(&mainMem);
 
-	// Merge results
-	for (u32 i = 0; i < numThreads - 1; i++)
+	// Every windowRows rows of a time ordered input
+	if (windowRows > 0)
 	{
-		ThreadMemory& other = mem[i];
-		other.thread->join();
-		for (u64 j = 0; j < other.numStations; j++)
+		if (!engine.RunWindows(input, inputOptions, windowRows, windows))
 		{
-			const StationData& otherData = other.stations[j];
-			const auto& otherEntry = other.map.items[other.stationToHeader[j]];
-			u32 result = mainMem.map.FindOrInsert(String((char*)otherEntry.name, otherEntry.namelen), otherEntry.hash, mainMem.numStations, mainMem.stationToHeader.data);
-			StationData& stationData = mainMem.stations[result];
-			stationData.Merge(otherData);
+			printf("%s\n", windows.error);
+			return 1;
 		}
+		return OutputWindows(windows, output);
 	}
 
-	FixedArray<StationMapping, NUM_STATIONS> mapping;
-	for (u32 i = 0; i < NUM_STATIONS; i++)
+	// A cached result for the exact same inputs skips the scan entirely
+	ResultCache cache;
+	if (inputOptions.cacheDir != nullptr)
 	{
-		mapping[i].data = i;
-		mapping[i].header = mainMem.stationToHeader[i];
+		cache.Init(inputOptions.cacheDir, "markusaksli_fast_threaded", sizeof(brc::EngineStationData), input, inputOptions, engine.numThreads);
+		if (cache.Lookup())
+		{
+			LoadSaved(cache, result);
+			return OutputResults(result, inputOptions, output);
+		}
 	}
 
-	// Sort and output
-	std::sort(mapping.data, mapping.data + NUM_STATIONS,
-		[&](const StationMapping& a, const StationMapping& b) {
-			return mainMem.map.items[a.header] < mainMem.map.items[b.header];
-		});
+	// Append-only inputs only get parsed from where the last checkpoint stopped, its aggregates are merged in after
+	Checkpoint checkpoint;
+	if (inputOptions.checkpointPath != nullptr && !checkpoint.Begin(inputOptions.checkpointPath, "markusaksli_fast_threaded", sizeof(brc::EngineStationData), input, inputOptions)) return 1;
 
-	StringBuffer writeBuf(4 * KB);
+	if (!engine.Run(input, inputOptions, result))
+	{
+		printf("%s\n", result.error);
+		return 1;
+	}
 
-	writeBuf.Push('{');
+	// Everything before the checkpoint offsets
+	if (checkpoint.NumStations() > 0)
+	{
+		brc::EngineResult saved;
+		LoadSaved(checkpoint, saved);
+		result.Merge(saved);
+	}
 
-	bool first = true;
-	for (u32 i = 0; i < NUM_STATIONS; i++)
+	if (inputOptions.checkpointPath != nullptr)
 	{
-		if (!first)
+		const bool stored = checkpoint.Store(input, result.stations.size, [&](const u64 i, String& name, const void*& record)
 		{
-			writeBuf.Push(", ");
-		}
-		const StationMapping m = mapping[i];
-		const StationData& stationData = mainMem.stations[m.data];
-		const auto header = mainMem.map.items[m.header];
-		writeBuf.Push(header.name, header.namelen);
-		writeBuf.Push('=');
-		Push1DecimalDouble(writeBuf, stationData.min * 0.1);
-		writeBuf.Push('/');
-		Push1DecimalDoubleRoundTowardPositive(writeBuf, (stationData.sum * 0.1) / stationData.count);
-		writeBuf.Push('/');
-		Push1DecimalDouble(writeBuf, stationData.max * 0.1);
-		first = false;
+			name = result.stations.data[i].name;
+			record = &result.stations.data[i].data;
+		});
+		if (!stored) fprintf(stderr, "failed to write checkpoint %s\n", inputOptions.checkpointPath);
 	}
 
-	writeBuf.Push('}');
-
-#ifdef _WIN32
-	SetConsoleOutputCP(CP_UTF8);
-#endif
-	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
-
-	std::cout.write(writeBuf.data, writeBuf.size);
+	if (inputOptions.cacheDir != nullptr)
+	{
+		const bool stored = cache.Store(input, result.stations.size, sizeof(brc::EngineStationData), [&](const u64 i, String& name, const void*& record)
+		{
+			name = result.stations.data[i].name;
+			record = &result.stations.data[i].data;
+		});
+		if (!stored) fprintf(stderr, "result not cached (inputs changed recently or the cache dir isn't writable)\n");
+	}
 
-	return 0;
-}
\ No newline at end of file
+	return OutputResults(result, inputOptions, output);
+}
@@ -3,10 +3,24 @@
 #include "vector.h"
 #include "buf_string.h"
 
+#include <algorithm>
+
 #ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
+#include <fcntl.h>
+#include <glob.h>
 #include <unistd.h>
+#include <strings.h>
 #include <cerrno>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
 #else
 #define NOMINMAX
 #include <windows.h>
@@ -147,6 +161,45 @@ struct FileHandle
 	#endif
 	}
 
+	// Bytes read, less than asked for only at the end of the file, 0 on errors
+	u64 Read(void* data, u64 bytes) const
+	{
+	    if (!Good())
+	    {
+	        return 0;
+	    }
+
+	    char* ptr = (char*)data;
+	    u64 total = 0;
+	#ifdef _WIN32
+	    while (total < bytes)
+	    {
+	        DWORD read = 0;
+	        DWORD chunk = (bytes - total > U32_MAX) ? U32_MAX : (DWORD)(bytes - total);
+	        if (!::ReadFile(handle, ptr + total, chunk, &read, nullptr))
+	        {
+	            PrintLastWinError("ReadFile failed: ");
+	            return 0;
+	        }
+	        if (read == 0) break;
+	        total += read;
+	    }
+	#else
+	    while (total < bytes)
+	    {
+	        ssize_t r = ::read(fd, ptr + total, bytes - total);
+	        if (r < 0)
+	        {
+	            if (errno == EINTR) continue;
+	            return 0;
+	        }
+	        if (r == 0) break;
+	        total += r;
+	    }
+	#endif
+	    return total;
+	}
+
 	bool Append(const void* data, u64 bytes) const
 	{
 	    if (!Good())
@@ -172,7 +225,7 @@ struct FileHandle
 	}
 };
 
-inline FileHandle OpenUTF8FileWrite(const char* filename)
+inline FileHandle OpenFileWrite(const char* filename)
 {
 	FileHandle fh;
 #ifndef _WIN32
@@ -191,6 +244,31 @@ inline FileHandle OpenUTF8FileWrite(const char* filename)
 	}
 #endif
 
+	return fh;
+}
+
+inline FileHandle OpenFileRead(const char* filename)
+{
+	FileHandle fh;
+#ifndef _WIN32
+	fh.fd = ::open(filename, O_RDONLY);
+#else
+	fh.handle = ::CreateFileA(filename,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN,
+		NULL);
+#endif
+
+	return fh;
+}
+
+inline FileHandle OpenUTF8FileWrite(const char* filename)
+{
+	FileHandle fh = OpenFileWrite(filename);
+
 	if (fh.Good()) {
 		const unsigned char bom[] = { 0xEF, 0xBB, 0xBF };
 		if (!fh.Write(bom, 3)) return {};
@@ -308,7 +386,7 @@ struct MappedFileHandle
 
 		fileHandle = ::CreateFileA(filename,
 			GENERIC_READ,
-			FILE_SHARE_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE, // Files can still be appended to while we read them
 			NULL,
 			OPEN_EXISTING,
 			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
@@ -380,3 +458,208 @@ static bool PrefetchVirtualMemory(const void* base, const size_t bytes, const si
 	return true;
 }
 #endif
+
+inline bool HasWildcard(const char* path)
+{
+	for (const char* c = path; *c != '\0'; c++)
+	{
+		if (*c == '*' || *c == '?') return true;
+	}
+	return false;
+}
+
+// Expands a path with * or ? wildcards in the file name into the sorted list of matching files, plain paths are passed through as-is.
+// Paths are pushed null terminated into pathBuf so they can be passed straight to OpenRead.
+inline bool ExpandFilePattern(const char* pattern, StringBuffer& pathBuf, Vector<String>& paths)
+{
+	if (!HasWildcard(pattern))
+	{
+		paths.Push(pathBuf.PushStringF(pattern));
+		return true;
+	}
+
+	const u64 first = paths.size;
+
+#ifdef _WIN32
+	String dir = { (char*)pattern, 0 };
+	for (const char* c = pattern; *c != '\0'; c++)
+	{
+		if (*c == '/' || *c == '\\') dir.len = c - pattern + 1;
+	}
+
+	WIN32_FIND_DATAA findData;
+	HANDLE find = ::FindFirstFileA(pattern, &findData);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	do
+	{
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+		if (dir.len > 0)
+		{
+			paths.Push(pathBuf.PushStringF(dir, findData.cFileName));
+		}
+		else
+		{
+			paths.Push(pathBuf.PushStringF(findData.cFileName));
+		}
+	} while (::FindNextFileA(find, &findData));
+	::FindClose(find);
+#else
+	glob_t globResult;
+	if (::glob(pattern, GLOB_MARK, nullptr, &globResult) != 0)
+	{
+		globfree(&globResult);
+		return false;
+	}
+
+	for (size_t i = 0; i < globResult.gl_pathc; i++)
+	{
+		const char* match = globResult.gl_pathv[i];
+		const size_t len = strlen(match);
+		if (len == 0 || match[len - 1] == '/') continue; // GLOB_MARK marks directories with a trailing slash
+		paths.Push(pathBuf.PushStringF(match));
+	}
+	globfree(&globResult);
+#endif
+
+	// Keep shard order deterministic regardless of what order the OS gives us
+	std::sort(paths.data + first, paths.data + paths.size);
+	return paths.size > first;
+}
+
+// Everything that changes when a file is replaced or written to, times are in the platform's file time units (100 ns ticks on Windows, ns elsewhere)
+struct FileIdentity
+{
+	u64 device;
+	u64 inode;
+	u64 size;
+	s64 modifiedTime;
+	s64 changedTime; // Metadata change time, catches writes that restore the modified time
+};
+
+inline bool GetFileIdentity(const char* path, FileIdentity& identity)
+{
+	memset(&identity, 0, sizeof(identity));
+#ifdef _WIN32
+	HANDLE handle = ::CreateFileA(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	FILE_BASIC_INFO basic;
+	const bool good = ::GetFileInformationByHandle(handle, &info) && ::GetFileInformationByHandleEx(handle, FileBasicInfo, &basic, sizeof(basic));
+	::CloseHandle(handle);
+	if (!good) return false;
+
+	identity.device = info.dwVolumeSerialNumber;
+	identity.inode = ((u64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	identity.size = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	identity.modifiedTime = basic.LastWriteTime.QuadPart;
+	identity.changedTime = basic.ChangeTime.QuadPart;
+#else
+	struct stat st;
+	if (::stat(path, &st) != 0) return false;
+
+	identity.device = (u64)st.st_dev;
+	identity.inode = (u64)st.st_ino;
+	identity.size = (u64)st.st_size;
+	identity.modifiedTime = (s64)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+	identity.changedTime = (s64)st.st_ctim.tv_sec * 1000000000ll + st.st_ctim.tv_nsec;
+#endif
+	return true;
+}
+
+constexpr s64 FILE_TIME_TICKS_PER_SECOND =
+#ifdef _WIN32
+	10000000ll;
+#else
+	1000000000ll;
+#endif
+
+// Current time on the same clock as FileIdentity times
+inline s64 FileTimeNow()
+{
+#ifdef _WIN32
+	FILETIME ft;
+	::GetSystemTimeAsFileTime(&ft);
+	return (s64)(((u64)ft.dwHighDateTime << 32) | ft.dwLowDateTime);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (s64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+#endif
+}
+
+// Atomically puts a finished file in place of another one, readers see either the old or the new file
+inline bool RenameFileOverwrite(const char* from, const char* to)
+{
+#ifdef _WIN32
+	return ::MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return ::rename(from, to) == 0;
+#endif
+}
+
+// Wakes up when a file might have been written to, for following files that are still being appended to.
+// Callers should still check the file on a timeout, Windows only notifies per directory and can report size changes late.
+struct FileWatcher
+{
+#ifdef _WIN32
+	HANDLE change = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+	int fd = -1;
+#endif
+
+	bool Open(const char* path)
+	{
+#ifdef _WIN32
+		char dir[MAX_PATH];
+		const char* slash = strrchr(path, '\\');
+		const char* forward = strrchr(path, '/');
+		if (forward > slash) slash = forward;
+		const u64 dirLen = slash != nullptr ? slash - path : 0;
+		if (dirLen + 2 > sizeof(dir)) return false;
+		memcpy(dir, path, dirLen);
+		if (dirLen == 0) dir[0] = '.';
+		dir[dirLen == 0 ? 1 : dirLen] = '\0';
+		change = ::FindFirstChangeNotificationA(dir, FALSE, FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+		return change != INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+		fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0) return false;
+		return ::inotify_add_watch(fd, path, IN_MODIFY) >= 0;
+#else
+		return true; // Just polls
+#endif
+	}
+
+	// Returns once the file might have changed or after timeoutMs
+	void Wait(const u32 timeoutMs)
+	{
+#ifdef _WIN32
+		if (::WaitForSingleObject(change, timeoutMs) == WAIT_OBJECT_0) ::FindNextChangeNotification(change);
+#elif defined(__linux__)
+		pollfd p = { fd, POLLIN, 0 };
+		if (::poll(&p, 1, (int)timeoutMs) > 0)
+		{
+			char events[4096];
+			while (::read(fd, events, sizeof(events)) > 0) {}
+		}
+#else
+		::usleep(timeoutMs * 1000);
+#endif
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (change != INVALID_HANDLE_VALUE) ::FindCloseChangeNotification(change);
+		change = INVALID_HANDLE_VALUE;
+#elif defined(__linux__)
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "platform_io.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+// A child process that inherits our stdout/stderr, polled for its exit instead of waited on so one thread can keep track of many
+struct ChildProcess
+{
+#ifdef _WIN32
+	HANDLE process = NULL;
+#else
+	pid_t pid = -1;
+#endif
+
+	bool Running() const
+	{
+#ifdef _WIN32
+		return process != NULL;
+#else
+		return pid > 0;
+#endif
+	}
+
+	// args[0] is looked up in PATH like a shell would
+	bool Start(const Vector<const char*>& args)
+	{
+#ifdef _WIN32
+		u64 bytes = 1;
+		for (u64 i = 0; i < args.size; i++)
+		{
+			bytes += strlen(args.data[i]) * 2 + 3;
+		}
+		StringBuffer commandLine(bytes);
+		for (u64 i = 0; i < args.size; i++)
+		{
+			if (i > 0) commandLine.Push(' ');
+			commandLine.Push('"');
+			for (const char* c = args.data[i]; *c != '\0'; c++)
+			{
+				if (*c == '"') commandLine.Push('\\');
+				commandLine.Push(*c);
+			}
+			commandLine.Push('"');
+		}
+		commandLine.Terminate();
+
+		STARTUPINFOA startup = {};
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION info = {};
+		const BOOL started = ::CreateProcessA(NULL, commandLine.data, NULL, NULL, FALSE, 0, NULL, NULL, &startup, &info);
+		free(commandLine.data);
+		if (!started)
+		{
+			PrintLastWinError("CreateProcess failed: ");
+			return false;
+		}
+		::CloseHandle(info.hThread);
+		process = info.hProcess;
+		return true;
+#else
+		Array<char*> argv;
+		argv.InitMalloc(args.size + 1);
+		for (u64 i = 0; i < args.size; i++)
+		{
+			argv.data[i] = (char*)args.data[i];
+		}
+		argv.data[args.size] = nullptr;
+		const int result = ::posix_spawnp(&pid, args.data[0], nullptr, nullptr, argv.data, environ);
+		argv.Free();
+		if (result != 0)
+		{
+			pid = -1;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	// True once the process is gone, exitCode is 128 + the signal for processes that were killed
+	bool Finished(int& exitCode)
+	{
+		if (!Running()) return true;
+#ifdef _WIN32
+		if (::WaitForSingleObject(process, 0) != WAIT_OBJECT_0) return false;
+		DWORD code = 1;
+		::GetExitCodeProcess(process, &code);
+		::CloseHandle(process);
+		process = NULL;
+		exitCode = (int)code;
+		return true;
+#else
+		int status = 0;
+		const pid_t result = ::waitpid(pid, &status, WNOHANG);
+		if (result == 0) return false;
+		pid = -1;
+		if (result < 0) exitCode = 1;
+		else exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		return true;
+#endif
+	}
+
+	void Kill()
+	{
+		if (!Running()) return;
+#ifdef _WIN32
+		::TerminateProcess(process, 1);
+		::WaitForSingleObject(process, INFINITE);
+		::CloseHandle(process);
+		process = NULL;
+#else
+		::kill(pid, SIGKILL);
+		int status = 0;
+		::waitpid(pid, &status, 0);
+		pid = -1;
+#endif
+	}
+};
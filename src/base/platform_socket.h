@@ -0,0 +1,207 @@
+#pragma once
+
+// Unix domain stream sockets, which Windows 10 1803+ has as well. On Windows this has to be included before windows.h
+// (so before platform_io.h), otherwise the old winsock.h it pulls in clashes with winsock2.h.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET SocketHandle;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+typedef int SocketHandle;
+#define INVALID_SOCKET_HANDLE (-1)
+#endif
+
+#include "buf_string.h"
+
+#ifdef MSG_NOSIGNAL
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL // A client hanging up shouldn't SIGPIPE the server
+#else
+#define SOCKET_SEND_FLAGS 0
+#endif
+
+inline bool InitSockets()
+{
+#ifdef _WIN32
+	WSADATA wsa;
+	return ::WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
+#else
+	return true;
+#endif
+}
+
+struct LocalSocket
+{
+	SocketHandle handle = INVALID_SOCKET_HANDLE;
+
+	bool Good() const
+	{
+		return handle != INVALID_SOCKET_HANDLE;
+	}
+
+	void Close()
+	{
+		if (!Good()) return;
+#ifdef _WIN32
+		::closesocket(handle);
+#else
+		::close(handle);
+#endif
+		handle = INVALID_SOCKET_HANDLE;
+	}
+
+	bool SendAll(const void* data, u64 bytes) const
+	{
+		const char* pos = (const char*)data;
+		while (bytes > 0)
+		{
+			const int chunk = bytes > (1 << 30) ? (1 << 30) : (int)bytes;
+			const auto sent = ::send(handle, pos, chunk, SOCKET_SEND_FLAGS);
+			if (sent <= 0)
+			{
+#ifndef _WIN32
+				if (sent < 0 && errno == EINTR) continue;
+#endif
+				return false;
+			}
+			pos += sent;
+			bytes -= sent;
+		}
+		return true;
+	}
+
+	// Returns 0 when the other side hung up, negative on errors
+	s64 Recv(void* data, const u64 bytes) const
+	{
+		for (;;)
+		{
+			const auto received = ::recv(handle, (char*)data, bytes > (1 << 30) ? (1 << 30) : (int)bytes, 0);
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR) continue;
+#endif
+			return received;
+		}
+	}
+};
+
+inline bool MakeLocalAddress(const char* path, sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	const u64 len = strlen(path);
+	if (len >= sizeof(address.sun_path)) return false;
+	memcpy(address.sun_path, path, len);
+	return true;
+}
+
+// Replaces a stale socket file left behind by a server that didn't shut down cleanly
+inline bool ListenLocal(const char* path, LocalSocket& listener, const int backlog = 128)
+{
+	sockaddr_un address;
+	if (!MakeLocalAddress(path, address)) return false;
+
+#ifdef _WIN32
+	::DeleteFileA(path);
+#else
+	::unlink(path);
+#endif
+	listener.handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (!listener.Good()) return false;
+	if (::bind(listener.handle, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(listener.handle, backlog) != 0)
+	{
+		listener.Close();
+		return false;
+	}
+	return true;
+}
+
+inline bool AcceptLocal(const LocalSocket& listener, LocalSocket& client)
+{
+	client.handle = ::accept(listener.handle, nullptr, nullptr);
+	return client.Good();
+}
+
+inline bool ConnectLocal(const char* path, LocalSocket& socket)
+{
+	sockaddr_un address;
+	if (!MakeLocalAddress(path, address)) return false;
+
+	socket.handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (!socket.Good()) return false;
+	if (::connect(socket.handle, (const sockaddr*)&address, sizeof(address)) != 0)
+	{
+		socket.Close();
+		return false;
+	}
+	return true;
+}
+
+// Buffered reads of '\n' terminated lines and fixed size payloads off a socket
+struct SocketReader
+{
+	static constexpr u64 capacity = 64 * KB;
+
+	const LocalSocket* socket = nullptr;
+	char buf[capacity];
+	u64 begin = 0;
+	u64 end = 0;
+
+	explicit SocketReader(const LocalSocket* s) : socket(s) {}
+
+	bool Fill()
+	{
+		if (begin > 0)
+		{
+			memmove(buf, buf + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+		if (end == capacity) return false;
+		const s64 received = socket->Recv(buf + end, capacity - end);
+		if (received <= 0) return false;
+		end += received;
+		return true;
+	}
+
+	// The line is valid until the next read, without the '\n' (or a "\r\n")
+	bool ReadLine(String& line)
+	{
+		u64 scanned = begin;
+		for (;;)
+		{
+			const char* newline = (const char*)memchr(buf + scanned, '\n', end - scanned);
+			if (newline != nullptr)
+			{
+				line = String(buf + begin, newline - (buf + begin));
+				if (line.len > 0 && line.data[line.len - 1] == '\r') --line.len;
+				begin = newline + 1 - buf;
+				return true;
+			}
+			scanned = end - begin;
+			if (!Fill()) return false; // Disconnected, or a line longer than the buffer
+		}
+	}
+
+	bool ReadExact(char* dst, u64 bytes)
+	{
+		const u64 buffered = end - begin < bytes ? end - begin : bytes;
+		memcpy(dst, buf + begin, buffered);
+		begin += buffered;
+		dst += buffered;
+		bytes -= buffered;
+		while (bytes > 0)
+		{
+			const s64 received = socket->Recv(dst, bytes);
+			if (received <= 0) return false;
+			dst += received;
+			bytes -= received;
+		}
+		return true;
+	}
+};
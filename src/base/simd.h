@@ -1,5 +1,8 @@
 #pragma once
 #include <immintrin.h>
+#include <nmmintrin.h>
+
+#include <cstring>
 
 #include "type_macros.h"
 
@@ -58,3 +61,96 @@ inline void SIMD_Prefetch(const char* pos)
 {
 	_mm_prefetch(pos + 256, _MM_HINT_T0);
 }
+
+inline u64 SIMD_CountChar(const char* pos, const char* end, const char c)
+{
+	const __m256i target = _mm256_set1_epi8(c);
+	u64 count = 0;
+	while (pos + 32 <= end)
+	{
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+		u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, target));
+		count += _mm_popcnt_u32(mask);
+		pos += 32;
+	}
+	while (pos < end)
+	{
+		count += *pos == c;
+		++pos;
+	}
+	return count;
+}
+
+// Hardware CRC32C, it doesn't matter how the input is split up between calls so it works for streaming writes
+inline u32 SIMD_Crc32C(u32 crc, const char* pos, u64 len)
+{
+	u64 crc64 = ~crc;
+	while (len >= 8)
+	{
+		u64 word;
+		memcpy(&word, pos, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		pos += 8;
+		len -= 8;
+	}
+	u32 crc32 = (u32)crc64;
+	while (len > 0)
+	{
+		crc32 = _mm_crc32_u8(crc32, (u8)*pos);
+		++pos;
+		--len;
+	}
+	return ~crc32;
+}
+
+inline s16 SIMD_HMinS16(const __m256i v)
+{
+	__m128i m = _mm_min_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	m = _mm_min_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+	m = _mm_min_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_min_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (s16)_mm_extract_epi16(m, 0);
+}
+
+inline s16 SIMD_HMaxS16(const __m256i v)
+{
+	__m128i m = _mm_max_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+	m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+	m = _mm_max_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (s16)_mm_extract_epi16(m, 0);
+}
+
+inline s64 SIMD_HSumS32(const __m256i v)
+{
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (s32)_mm_cvtsi128_si32(s);
+}
+
+// dst[i] += src[i], count is a multiple of 8
+inline void SIMD_AddU32(u32* dst, const u32* src, const u64 count)
+{
+	for (u64 i = 0; i < count; i += 8)
+	{
+		const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+		const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi32(a, b));
+	}
+}
+
+// Sum of count u32s as a u64, count is a multiple of 8
+inline u64 SIMD_SumU32(const u32* src, const u64 count)
+{
+	__m256i sum = _mm256_setzero_si256();
+	for (u64 i = 0; i < count; i += 8)
+	{
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+		sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+	}
+	u64 lanes[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
@@ -1,12 +1,15 @@
 #pragma once
-typedef unsigned char u8;
-typedef signed char s8;
-typedef unsigned short u16;
-typedef signed short s16;
-typedef unsigned long u32;
-typedef signed long s32;
-typedef signed long long s64;
-typedef unsigned long long u64;
+#include <cstdint>
+
+// Fixed width so structs that get written to disk have the same layout on every platform (long is 64 bits outside of Windows)
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint64_t u64;
 
 constexpr u64 KB = 1024ULL;
 constexpr u64 MB = KB * 1024ULL;
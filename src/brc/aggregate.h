@@ -0,0 +1,314 @@
+#pragma once
+#include <immintrin.h>
+
+#include <type_traits>
+
+#include "histogram.h"
+#include "thresholds.h"
+
+// Per-station aggregates put together at compile time from a list of aggregators. Aggregate<AggMin, AggMax, AggCount, AggSum>
+// derives from each of them in list order, so the fields are laid out in that order with the usual padding, which gives exactly
+// the 16 byte { s16 min, max; u32 count; s64 sum; } of the solutions. Add and Merge call every aggregator's own and are inlined
+// into one update, and whatever isn't in the list isn't in the struct or the loop.
+// An aggregator is a struct with its fields initialized to the empty state and
+//   template <typename Context> void Add(s16 temp, Context& ctx, u32 station)
+//   template <typename Context> void Merge(const Agg& other, Context& ctx, u32 station, const Context& otherCtx, u32 otherStation)
+// where the context carries whatever lives outside the struct (the histogram store, the threshold registers).
+
+#ifdef _MSC_VER
+#define AGGREGATE_EMPTY_BASES __declspec(empty_bases) // MSVC only leaves out the first empty base otherwise
+#else
+#define AGGREGATE_EMPTY_BASES
+#endif
+
+// A context with NewMin(station) and NewMax(station) hears about every new min and max, from inside the compare that found it (see
+// AggExtremeOffsets). For every other context these are nothing.
+template <typename Context>
+__forceinline auto AggregateNewMin(Context& ctx, const u32 station, int) -> decltype(ctx.NewMin(station), void())
+{
+	ctx.NewMin(station);
+}
+
+template <typename Context>
+__forceinline void AggregateNewMin(Context&, u32, long)
+{
+}
+
+template <typename Context>
+__forceinline auto AggregateNewMax(Context& ctx, const u32 station, int) -> decltype(ctx.NewMax(station), void())
+{
+	ctx.NewMax(station);
+}
+
+template <typename Context>
+__forceinline void AggregateNewMax(Context&, u32, long)
+{
+}
+
+struct AggMin
+{
+	s16 min = 32767;
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context& ctx, const u32 station)
+	{
+		if (temp < min)
+		{
+			min = temp;
+			AggregateNewMin(ctx, station, 0);
+		}
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggMin& other, Context&, u32, const Context&, u32)
+	{
+		if (other.min < min) min = other.min;
+	}
+};
+
+struct AggMax
+{
+	s16 max = -32768;
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context& ctx, const u32 station)
+	{
+		if (temp > max)
+		{
+			max = temp;
+			AggregateNewMax(ctx, station, 0);
+		}
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggMax& other, Context&, u32, const Context&, u32)
+	{
+		if (other.max > max) max = other.max;
+	}
+};
+
+struct AggCount
+{
+	u32 count = 0;
+
+	template <typename Context>
+	__forceinline void Add(s16, Context&, u32)
+	{
+		++count;
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggCount& other, Context&, u32, const Context&, u32)
+	{
+		count += other.count;
+	}
+};
+
+struct AggSum
+{
+	s64 sum = 0;
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context&, u32)
+	{
+		sum += temp;
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggSum& other, Context&, u32, const Context&, u32)
+	{
+		sum += other.sum;
+	}
+};
+
+// Exact, see src/brc/variance.h
+struct AggSumSquares
+{
+	u64 sumSquares = 0;
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context&, u32)
+	{
+		sumSquares += (u64)(temp * temp);
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggSumSquares& other, Context&, u32, const Context&, u32)
+	{
+		sumSquares += other.sumSquares;
+	}
+};
+
+// Where the min and max came from, as offsets into the input. Add has nothing to do: the context's NewMin/NewMax write the offset
+// of the current line when AggMin or AggMax take a new value, so it costs nothing on lines that don't. The mins and maxes have to
+// be compared to merge these, which the SSE merge of the first 16 bytes doesn't leave room for, so AggregateMergeExtremeOffsets
+// does it before Merge. A station's offsets are those of the first line with its min and max as long as every thread sees its
+// lines in input order and ties are merged to the lower offset.
+struct AggExtremeOffsets
+{
+	u64 minOffset = ~0ull;
+	u64 maxOffset = ~0ull;
+
+	template <typename Context>
+	__forceinline void Add(s16, Context&, u32)
+	{
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggExtremeOffsets&, Context&, u32, const Context&, u32)
+	{
+	}
+};
+
+// ctx.thresholds is a ThresholdRegisters
+template <u32 Groups>
+struct AggThresholds
+{
+	u32 past[Groups * THRESHOLD_GROUP] = {};
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context& ctx, u32)
+	{
+		ctx.thresholds.template Add<Groups>(past, temp);
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggThresholds& other, Context&, u32, const Context&, u32)
+	{
+		MergeThresholdCounts<Groups>(past, other.past);
+	}
+};
+
+// Nothing in the struct, ctx.hist is the HistogramStore that holds the distributions
+struct AggHistogram
+{
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context& ctx, const u32 station)
+	{
+		ctx.hist.Add(station, temp);
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const AggHistogram&, Context& ctx, const u32 station, const Context& otherCtx, const u32 otherStation)
+	{
+		ctx.hist.Merge(station, otherCtx.hist, otherStation);
+	}
+};
+
+template <typename... Aggs>
+struct Aggregate;
+
+// Merges every aggregator of the list one by one
+template <typename... Aggs>
+struct AggregateMerger
+{
+	template <typename Station, typename Context>
+	__forceinline static void Merge(Station& s, const Station& other, Context& ctx, const u32 station, const Context& otherCtx, const u32 otherStation)
+	{
+		const int expand[] = { 0, (static_cast<Aggs&>(s).Merge(static_cast<const Aggs&>(other), ctx, station, otherCtx, otherStation), 0)... };
+		(void)expand;
+		(void)s; (void)other; (void)ctx; (void)station; (void)otherCtx; (void)otherStation; // Unused with an empty list
+	}
+};
+
+// The 16 byte min/max/count/sum at the front is merged in one SSE register: a min and a max of the s16 lanes, a 32 bit add of
+// the count and a 64 bit add of the sum, blended together
+template <typename... Rest>
+struct AggregateMerger<AggMin, AggMax, AggCount, AggSum, Rest...>
+{
+	template <typename Station, typename Context>
+	__forceinline static void Merge(Station& s, const Station& other, Context& ctx, const u32 station, const Context& otherCtx, const u32 otherStation)
+	{
+		__m128i* dst = reinterpret_cast<__m128i*>(&s);
+		const __m128i a = _mm_loadu_si128(dst);
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&other));
+		const __m128i minMax = _mm_blend_epi16(_mm_min_epi16(a, b), _mm_max_epi16(a, b), 0x02);
+		const __m128i withCount = _mm_blend_epi16(minMax, _mm_add_epi32(a, b), 0x0c);
+		_mm_storeu_si128(dst, _mm_blend_epi16(withCount, _mm_add_epi64(a, b), 0xf0));
+		AggregateMerger<Rest...>::Merge(s, other, ctx, station, otherCtx, otherStation);
+	}
+};
+
+template <typename... Aggs>
+struct AGGREGATE_EMPTY_BASES Aggregate : Aggs...
+{
+	template <typename Agg>
+	static constexpr bool Has()
+	{
+		return std::is_base_of<Agg, Aggregate>::value;
+	}
+
+	template <typename Context>
+	__forceinline void Add(const s16 temp, Context& ctx, const u32 station)
+	{
+		const int expand[] = { 0, (static_cast<Aggs&>(*this).Add(temp, ctx, station), 0)... };
+		(void)expand;
+	}
+
+	template <typename Context>
+	__forceinline void Merge(const Aggregate& other, Context& ctx, const u32 station, const Context& otherCtx, const u32 otherStation)
+	{
+		AggregateMerger<Aggs...>::Merge(*this, other, ctx, station, otherCtx, otherStation);
+	}
+};
+
+// Aggregate<Aggs..., Agg> if Add, else Aggregate<Aggs...>
+template <bool Add, typename Agg, typename Station>
+struct AggregateAppendIf;
+
+template <typename Agg, typename... Aggs>
+struct AggregateAppendIf<true, Agg, Aggregate<Aggs...>>
+{
+	using type = Aggregate<Aggs..., Agg>;
+};
+
+template <typename Agg, typename... Aggs>
+struct AggregateAppendIf<false, Agg, Aggregate<Aggs...>>
+{
+	using type = Aggregate<Aggs...>;
+};
+
+// The aggregator if the aggregate has it, nullptr if not, for code that has to compile for every aggregate
+template <typename Agg, typename Station>
+const Agg* AggregateFind(const Station& s, std::true_type)
+{
+	return &static_cast<const Agg&>(s);
+}
+
+template <typename Agg, typename Station>
+const Agg* AggregateFind(const Station&, std::false_type)
+{
+	return nullptr;
+}
+
+template <typename Agg, typename Station>
+const Agg* AggregateFind(const Station& s)
+{
+	return AggregateFind<Agg>(s, std::integral_constant<bool, Station::template Has<Agg>()>());
+}
+
+// Before s.Merge(other): the offsets that go with the merged min and max, the lower one on a tie so the result doesn't depend on
+// which thread got there first
+template <typename Station>
+__forceinline void AggregateMergeExtremeOffsets(Station& s, const Station& other, std::true_type)
+{
+	AggExtremeOffsets& offsets = s;
+	const AggExtremeOffsets& otherOffsets = other;
+	if (other.min < s.min || (other.min == s.min && otherOffsets.minOffset < offsets.minOffset)) offsets.minOffset = otherOffsets.minOffset;
+	if (other.max > s.max || (other.max == s.max && otherOffsets.maxOffset < offsets.maxOffset)) offsets.maxOffset = otherOffsets.maxOffset;
+}
+
+template <typename Station>
+__forceinline void AggregateMergeExtremeOffsets(Station&, const Station&, std::false_type)
+{
+}
+
+template <typename Station>
+__forceinline void AggregateMergeExtremeOffsets(Station& s, const Station& other)
+{
+	AggregateMergeExtremeOffsets(s, other, std::integral_constant<bool, Station::template Has<AggExtremeOffsets>()>());
+}
+
+using AggregateMinMaxCountSum = Aggregate<AggMin, AggMax, AggCount, AggSum>;
+static_assert(sizeof(AggregateMinMaxCountSum) == 16 && alignof(AggregateMinMaxCountSum) == 8, "min/max/count/sum has to stay the 16 byte StationData");
+static_assert(sizeof(Aggregate<AggMin, AggMax, AggCount, AggSum, AggHistogram>) == 16, "an aggregator without fields takes no space");
@@ -0,0 +1,293 @@
+#pragma once
+#include <cstdio>
+
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+#include "input.h"
+#include "station_table.h"
+
+// Incremental aggregation over text files that only ever get appended to. A checkpoint holds the per-station aggregates of a run
+// and for every input file the line aligned offset it was parsed up to, its FileIdentity and CRC32Cs of the first and last block
+// before that offset. The next run checks the file is still the same one, parses only what was appended after the offsets and merges
+// the saved aggregates in.
+//
+// If anything doesn't check out (a file was replaced, shrank, was written to without growing, lost its first or last block before the
+// offset, or was dropped from the input) the saved aggregates are thrown away and everything is parsed again. A file that grew is
+// taken to have been appended to, an edit in the middle of the parsed part made together with an append isn't caught without reading
+// all of it. A partial last line is left for the next run.
+//
+//   [CheckpointHeader]
+//   [engine name]
+//   [CheckpointFileEntry * numFiles] [path bytes]
+//   [station table]                                 see station_table.h
+
+constexpr char CHECKPOINT_MAGIC[8] = { '1', 'B', 'R', 'C', 'C', 'K', 'P', '\0' };
+constexpr u32 CHECKPOINT_VERSION = 2;
+constexpr u64 CHECKPOINT_VERIFY_BYTES = 1 * MB;
+
+struct CheckpointHeader
+{
+	char magic[8];
+	u32 version;
+	u32 recordBytes;
+	u64 engineBytes;
+	u64 numFiles;
+	u64 pathBytes;
+	u64 numStations;
+	u64 namesBytes;
+	u64 reserved;
+};
+static_assert(sizeof(CheckpointHeader) == 64, "CheckpointHeader is written to disk as-is");
+
+struct CheckpointFileEntry
+{
+	u64 offset; // Everything before this was parsed, always right after a '\n' (or the BOM)
+	u64 headBytes;
+	u64 tailBytes;
+	u32 headCrc; // CRC32C of [0, headBytes)
+	u32 tailCrc; // CRC32C of [offset - tailBytes, offset)
+	u32 pathOffset;
+	u32 pathLen;
+	FileIdentity identity; // When the checkpoint was written, with size = the length that was parsed
+};
+static_assert(sizeof(CheckpointFileEntry) == 80, "CheckpointFileEntry is written to disk as-is");
+
+// One past the last '\n' of a file, anything after it is a line that is still being written
+inline u64 LastLineEnd(const MappedFileHandle& file, const u64 begin)
+{
+	u64 end = file.length;
+	while (end > begin && file.data[end - 1] != '\n') --end;
+	return end;
+}
+
+inline CheckpointFileEntry MakeCheckpointEntry(const char* path, const MappedFileHandle& file, const u64 offset)
+{
+	CheckpointFileEntry e = {};
+	GetFileIdentity(path, e.identity);
+	e.identity.size = file.length; // Anything appended while this run parsed is after it
+	e.offset = offset;
+	e.headBytes = offset < CHECKPOINT_VERIFY_BYTES ? offset : CHECKPOINT_VERIFY_BYTES;
+	e.tailBytes = e.headBytes;
+	e.headCrc = e.headBytes > 0 ? SIMD_Crc32C(0, file.data, e.headBytes) : 0;
+	e.tailCrc = e.tailBytes > 0 ? SIMD_Crc32C(0, file.data + offset - e.tailBytes, e.tailBytes) : 0;
+	return e;
+}
+
+// Same file as when the entry was written, or that file with more bytes after the ones it had then. A different identity at the same
+// or a smaller size means it was written to in place.
+inline bool CheckpointFileUnchanged(const CheckpointFileEntry& entry, const char* path)
+{
+	FileIdentity now;
+	if (!GetFileIdentity(path, now)) return false;
+	if (now.device != entry.identity.device || now.inode != entry.identity.inode) return false;
+	return memcmp(&now, &entry.identity, sizeof(FileIdentity)) == 0 || now.size > entry.identity.size;
+}
+
+struct Checkpoint
+{
+	const char* path = nullptr;
+	const char* engine = nullptr;
+	u32 recordBytes = 0;
+	bool resumed = false;
+
+	// Saved aggregates, copied out of the file so it can be replaced while they're still in use
+	StringBuffer names;
+	Array<u32> nameOffsets;
+	Array<char> records;
+	u64 numStations = 0;
+
+	// Loads the checkpoint at path if there is one and sets the range of every input file that still has to be parsed
+	bool Begin(const char* checkpointPath, const char* engineName, const u32 stationRecordBytes, InputSet& input, const InputOptions& options)
+	{
+		path = checkpointPath;
+		engine = engineName;
+		recordBytes = stationRecordBytes;
+
+		if (options.hasRows)
+		{
+			printf("-checkpoint can't be combined with -rows\n");
+			return false;
+		}
+		for (u64 i = 0; i < input.files.size; i++)
+		{
+			if (input.files[i].compressed.Good())
+			{
+				printf("-checkpoint only works on text files, %s is compressed\n", (const char*)input.files[i].path);
+				return false;
+			}
+		}
+
+		resumed = Load(input);
+		for (u64 i = 0; i < input.files.size; i++)
+		{
+			InputFile& f = input.files[i];
+			f.ranged = true;
+			if (!resumed) f.rangeBegin = f.file.Good() ? SkipBOM(f.file) - f.file.data : 0;
+			f.rangeEnd = f.file.Good() ? LastLineEnd(f.file, f.rangeBegin) : 0;
+		}
+		return true;
+	}
+
+	bool Load(InputSet& input)
+	{
+		MappedFileHandle file;
+		if (!file.OpenRead(path)) return false; // First run
+
+		const CheckpointHeader* header = (const CheckpointHeader*)file.data;
+		const u64 engineLen = strlen(engine);
+		u64 offset = sizeof(CheckpointHeader);
+		bool good = file.length >= offset
+			&& memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0
+			&& header->version == CHECKPOINT_VERSION
+			&& header->recordBytes == recordBytes
+			&& header->engineBytes == engineLen
+			&& file.length == StationTableEnd(TableOffset(engineLen, header->numFiles, header->pathBytes), header->numStations, header->namesBytes, recordBytes)
+			&& memcmp(file.data + offset, engine, engineLen) == 0;
+		if (!good)
+		{
+			fprintf(stderr, "%s isn't a checkpoint of this solution, scanning everything\n", path);
+			file.Close();
+			return false;
+		}
+
+		offset += engineLen;
+		const CheckpointFileEntry* entries = (const CheckpointFileEntry*)(file.data + offset);
+		offset += header->numFiles * sizeof(CheckpointFileEntry);
+		const char* paths = file.data + offset;
+		offset += header->pathBytes;
+
+		// Every saved file has to be in the input with its prefix unchanged, otherwise its rows are in the aggregates but not in the input
+		for (u64 e = 0; e < header->numFiles && good; e++)
+		{
+			const CheckpointFileEntry& entry = entries[e];
+			const String entryPath((char*)paths + entry.pathOffset, entry.pathLen);
+			InputFile* match = nullptr;
+			for (u64 i = 0; i < input.files.size; i++)
+			{
+				if (input.files[i].path == entryPath) match = &input.files[i];
+			}
+
+			const u64 length = match != nullptr && match->file.Good() ? match->file.length : 0;
+			if (match == nullptr)
+			{
+				fprintf(stderr, "checkpoint covers %.*s which isn't part of the input, scanning everything\n", (int)entryPath.len, entryPath.data);
+				good = false;
+			}
+			else if (length < entry.offset || entry.headBytes > entry.offset || entry.tailBytes > entry.offset
+				|| !CheckpointFileUnchanged(entry, match->path)
+				|| (entry.headBytes > 0 && SIMD_Crc32C(0, match->file.data, entry.headBytes) != entry.headCrc)
+				|| (entry.tailBytes > 0 && SIMD_Crc32C(0, match->file.data + entry.offset - entry.tailBytes, entry.tailBytes) != entry.tailCrc))
+			{
+				fprintf(stderr, "%.*s changed since the checkpoint, scanning everything\n", (int)entryPath.len, entryPath.data);
+				good = false;
+			}
+			else
+			{
+				match->rangeBegin = entry.offset;
+			}
+		}
+
+		if (good)
+		{
+			// Files that weren't there last time start from the top
+			for (u64 i = 0; i < input.files.size; i++)
+			{
+				InputFile& f = input.files[i];
+				bool saved = false;
+				for (u64 e = 0; e < header->numFiles; e++)
+				{
+					saved |= f.path == String((char*)paths + entries[e].pathOffset, entries[e].pathLen);
+				}
+				if (!saved) f.rangeBegin = f.file.Good() ? SkipBOM(f.file) - f.file.data : 0;
+			}
+
+			StationTableView saved;
+			saved.Init(file.data, offset, header->numStations, header->namesBytes, recordBytes);
+			numStations = saved.numStations;
+			nameOffsets.InitMalloc(numStations + 1);
+			memcpy(nameOffsets.data, saved.nameOffsets, (numStations + 1) * sizeof(u32));
+			names.Init(saved.namesBytes + 1);
+			PushBytes(names, saved.names, saved.namesBytes);
+			records.InitMalloc(numStations * recordBytes + 1);
+			memcpy(records.data, saved.records, numStations * recordBytes);
+		}
+
+		file.Close();
+		return good;
+	}
+
+	static u64 TableOffset(const u64 engineBytes, const u64 numFiles, const u64 pathBytes)
+	{
+		return sizeof(CheckpointHeader) + engineBytes + numFiles * sizeof(CheckpointFileEntry) + pathBytes;
+	}
+
+	// Saved stations to merge into the result, only when the checkpoint was resumed
+	u64 NumStations() const
+	{
+		return resumed ? numStations : 0;
+	}
+
+	String Name(const u64 i) const
+	{
+		return String(names.data + nameOffsets.data[i], nameOffsets.data[i + 1] - nameOffsets.data[i]);
+	}
+
+	const void* Record(const u64 i) const
+	{
+		return records.data + i * recordBytes;
+	}
+
+	// getStation(i, String& name, const void*& record) for every station of the merged result, written to a temp file and renamed over the old one
+	template <typename GetStation>
+	bool Store(const InputSet& input, const u64 numResultStations, GetStation getStation)
+	{
+		const u64 engineLen = strlen(engine);
+		u64 pathBytes = 0;
+		for (u64 i = 0; i < input.files.size; i++)
+		{
+			pathBytes += input.files.data[i].path.len;
+		}
+		StationTableWriter table;
+		table.Collect(numResultStations, recordBytes, getStation);
+
+		StringBuffer out(table.End(TableOffset(engineLen, input.files.size, pathBytes)) + 1);
+		CheckpointHeader h = {};
+		memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+		h.version = CHECKPOINT_VERSION;
+		h.recordBytes = recordBytes;
+		h.engineBytes = engineLen;
+		h.numFiles = input.files.size;
+		h.pathBytes = pathBytes;
+		h.numStations = numResultStations;
+		h.namesBytes = table.namesBytes;
+		PushBytes(out, &h, sizeof(h));
+		PushBytes(out, engine, engineLen);
+
+		u32 pathOffset = 0;
+		for (u64 i = 0; i < input.files.size; i++)
+		{
+			const InputFile& f = input.files.data[i];
+			CheckpointFileEntry e = f.file.Good() ? MakeCheckpointEntry(f.path, f.file, f.rangeEnd) : CheckpointFileEntry{};
+			e.pathOffset = pathOffset;
+			e.pathLen = (u32)f.path.len;
+			pathOffset += e.pathLen;
+			PushBytes(out, &e, sizeof(e));
+		}
+		for (u64 i = 0; i < input.files.size; i++)
+		{
+			PushBytes(out, input.files.data[i].path.data, input.files.data[i].path.len);
+		}
+
+		table.Push(out);
+		table.Free();
+
+		StringBuffer tempPath(strlen(path) + 16);
+		tempPath.PushStringF(path, ".tmp");
+		FileHandle fh = OpenFileWrite(tempPath);
+		if (!fh.Good()) return false;
+		const bool written = fh.Write(out.data, out.size);
+		fh.Close();
+		free(out.data);
+		return written && RenameFileOverwrite(tempPath, path);
+	}
+};
@@ -0,0 +1,298 @@
+#pragma once
+#include <atomic>
+#include <thread>
+
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+#include "../base/vector.h"
+
+// Sidecar index (<file>.idx) with line aligned chunk boundaries of a measurement file and line counts per chunk.
+// With it threads can be handed chunks without seeking to '\n', progress can be reported in exact rows and a row range can be
+// located by looking up its chunk instead of scanning the file. The header records the identity of the file it was built from
+// (inode, size, modified and changed time), so an index is dropped once the file is rewritten, even at the same length. A CRC32C
+// over the header and entries catches a damaged sidecar, and the entries are checked to be increasing line starts inside the file
+// before they're used.
+//
+// Boundaries sit on a fixed grid: every chunk after the first starts right after the first '\n' at or past k * chunkBytes.
+// That way the generator (one streaming pass) and the indexing pass (parallel over the finished file) produce the same index.
+
+constexpr char CHUNK_INDEX_MAGIC[8] = { '1', 'B', 'R', 'C', 'I', 'D', 'X', '\0' };
+constexpr u32 CHUNK_INDEX_VERSION = 3;
+constexpr u64 CHUNK_INDEX_DEFAULT_CHUNK_BYTES = 16 * MB;
+
+struct ChunkIndexHeader
+{
+	char magic[8];
+	u32 version;
+	u32 crc; // CRC32C of this header with crc = 0 followed by the entries
+	u64 chunkBytes;
+	u64 fileLength;
+	u64 numChunks;
+	u64 totalLines;
+	FileIdentity source; // An index that doesn't match the file's identity is stale
+};
+static_assert(sizeof(ChunkIndexHeader) == 88, "ChunkIndexHeader is written to disk as-is");
+
+struct ChunkIndexEntry
+{
+	u64 offset;    // File offset of the first byte of the chunk
+	u64 firstLine; // Row number of the first line in the chunk
+	u32 lines;
+	u32 reserved;
+};
+static_assert(sizeof(ChunkIndexEntry) == 24, "ChunkIndexEntry is written to disk as-is");
+
+struct ChunkIndex
+{
+	ChunkIndexHeader header = {};
+	Vector<ChunkIndexEntry> entries;
+
+	bool Good() const
+	{
+		return entries.size > 0;
+	}
+
+	u64 ChunkEnd(const u64 chunk) const
+	{
+		return chunk + 1 < entries.size ? entries.data[chunk + 1].offset : header.fileLength;
+	}
+
+	// Last chunk whose first line is <= row
+	u64 FindChunkForRow(const u64 row) const
+	{
+		assert(Good());
+		u64 lo = 0;
+		u64 hi = entries.size;
+		while (hi - lo > 1)
+		{
+			const u64 mid = (lo + hi) / 2;
+			if (entries.data[mid].firstLine <= row) lo = mid;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	// Pointer to the start of a row, only ever scans lines inside of one chunk
+	char* FindRow(char* fileData, const u64 row) const
+	{
+		if (row >= header.totalLines) return fileData + header.fileLength;
+
+		const u64 chunk = FindChunkForRow(row);
+		char* pos = fileData + entries.data[chunk].offset;
+		for (u64 i = entries.data[chunk].firstLine; i < row; i++)
+		{
+			pos = (char*)memchr(pos, '\n', fileData + header.fileLength - pos) + 1;
+		}
+		return pos;
+	}
+
+	void InitEntries(const u64 reserve)
+	{
+		if (entries.data == nullptr) entries.Init(reserve > 0 ? reserve : 1);
+		entries.size = 0;
+	}
+
+	// Every chunk starts a line inside the file, right after the one before it, and the line numbers add up
+	bool Consistent(const char* data, const u64 dataStart) const
+	{
+		u64 lines = 0;
+		for (u64 i = 0; i < entries.size; i++)
+		{
+			const ChunkIndexEntry& e = entries.data[i];
+			if (e.offset >= header.fileLength || e.firstLine != lines) return false;
+			if (i == 0 ? e.offset != dataStart : e.offset <= entries.data[i - 1].offset || data[e.offset - 1] != '\n') return false;
+			lines += e.lines;
+		}
+		return lines == header.totalLines;
+	}
+
+	static u32 Checksum(ChunkIndexHeader h, const void* entryData, const u64 entryBytes)
+	{
+		h.crc = 0;
+		return SIMD_Crc32C(SIMD_Crc32C(0, (const char*)&h, sizeof(h)), (const char*)entryData, entryBytes);
+	}
+
+	// The index at path if it was built from the mapped dataPath as it is now, dataStart is past the BOM
+	bool Load(const char* path, const char* dataPath, const MappedFileHandle& data, const u64 dataStart)
+	{
+		FileIdentity identity;
+		if (!GetFileIdentity(dataPath, identity)) return false;
+
+		MappedFileHandle file;
+		if (!file.OpenRead(path)) return false;
+
+		bool good = file.length >= sizeof(ChunkIndexHeader);
+		if (good)
+		{
+			memcpy(&header, file.data, sizeof(ChunkIndexHeader));
+			good = memcmp(header.magic, CHUNK_INDEX_MAGIC, sizeof(CHUNK_INDEX_MAGIC)) == 0
+				&& header.version == CHUNK_INDEX_VERSION
+				&& header.fileLength == data.length
+				&& memcmp(&header.source, &identity, sizeof(FileIdentity)) == 0
+				&& header.numChunks > 0
+				&& file.length == sizeof(ChunkIndexHeader) + header.numChunks * sizeof(ChunkIndexEntry)
+				&& header.crc == Checksum(header, file.data + sizeof(ChunkIndexHeader), header.numChunks * sizeof(ChunkIndexEntry));
+		}
+
+		if (good)
+		{
+			InitEntries(header.numChunks);
+			while (entries.size < header.numChunks) entries.PushReuse();
+			memcpy(entries.data, file.data + sizeof(ChunkIndexHeader), header.numChunks * sizeof(ChunkIndexEntry));
+			good = Consistent(data.data, dataStart);
+			if (!good) entries.size = 0;
+		}
+
+		file.Close();
+		return good;
+	}
+
+	// Stamped with the identity of dataPath, which has to be written completely by now
+	bool Write(const char* path, const char* dataPath)
+	{
+		assert(Good());
+		if (!GetFileIdentity(dataPath, header.source)) return false;
+		header.crc = Checksum(header, entries.data, entries.Bytes());
+		FileHandle fh = OpenFileWrite(path);
+		if (!fh.Good()) return false;
+		const bool ok = fh.Write(&header, sizeof(header)) && fh.Write(entries.data, entries.Bytes());
+		fh.Close();
+		return ok;
+	}
+
+	void FinishHeader(const u64 chunkBytes, const u64 fileLength)
+	{
+		memcpy(header.magic, CHUNK_INDEX_MAGIC, sizeof(CHUNK_INDEX_MAGIC));
+		header.version = CHUNK_INDEX_VERSION;
+		header.crc = 0;
+		header.chunkBytes = chunkBytes;
+		header.fileLength = fileLength;
+		header.numChunks = entries.size;
+
+		u64 lines = 0;
+		for (u64 i = 0; i < entries.size; i++)
+		{
+			entries.data[i].firstLine = lines;
+			lines += entries.data[i].lines;
+		}
+		header.totalLines = lines;
+	}
+};
+
+// Builds the index while a file is being written, fed with consecutive buffers that each end on a full line
+struct ChunkIndexBuilder
+{
+	ChunkIndex* index = nullptr;
+	u64 chunkBytes = 0;
+	u64 offset = 0;
+	u64 nextGrid = 0;
+	ChunkIndexEntry current = {};
+
+	void Init(ChunkIndex* index, const u64 dataStart, const u64 chunkBytes)
+	{
+		this->index = index;
+		this->chunkBytes = chunkBytes;
+		offset = dataStart;
+		nextGrid = chunkBytes;
+		while (nextGrid <= dataStart) nextGrid += chunkBytes;
+		current = {};
+		current.offset = dataStart;
+		index->InitEntries(64);
+	}
+
+	void Accumulate(const char* data, const u64 len)
+	{
+		current.lines += (u32)SIMD_CountChar(data, data + len, '\n');
+		offset += len;
+	}
+
+	void Feed(const char* data, u64 len)
+	{
+		while (len > 0)
+		{
+			if (offset + len <= nextGrid)
+			{
+				Accumulate(data, len);
+				return;
+			}
+
+			const u64 skip = nextGrid > offset ? nextGrid - offset : 0;
+			const char* newline = (const char*)memchr(data + skip, '\n', len - skip);
+			if (newline == nullptr)
+			{
+				Accumulate(data, len); // The boundary is in the next buffer
+				return;
+			}
+
+			const u64 n = newline - data + 1;
+			Accumulate(data, n);
+			data += n;
+			len -= n;
+
+			index->entries.Push(current);
+			current = {};
+			current.offset = offset;
+			while (nextGrid <= offset - 1) nextGrid += chunkBytes;
+		}
+	}
+
+	void Finish()
+	{
+		if (offset > current.offset)
+		{
+			index->entries.Push(current);
+		}
+		index->FinishHeader(chunkBytes, offset);
+	}
+};
+
+// One time indexing pass over an existing file, boundaries are found up front and the chunks are then counted in parallel
+inline void BuildChunkIndex(ChunkIndex& index, const char* data, const u64 dataStart, const u64 fileLength, const u64 chunkBytes, u32 numThreads)
+{
+	index.InitEntries(fileLength / chunkBytes + 1);
+
+	ChunkIndexEntry entry = {};
+	entry.offset = dataStart;
+	index.entries.Push(entry);
+	for (u64 grid = chunkBytes; grid < fileLength; grid += chunkBytes)
+	{
+		if (grid < index.entries.Last().offset) continue; // The previous boundary's line already crossed this grid point
+
+		const char* newline = (const char*)memchr(data + grid, '\n', fileLength - grid);
+		if (newline == nullptr) break;
+		entry.offset = newline - data + 1;
+		if (entry.offset >= fileLength) break;
+		index.entries.Push(entry);
+	}
+	index.header.fileLength = fileLength;
+
+	std::atomic<u64> next{ 0 };
+	auto work = [&]()
+	{
+		for (;;)
+		{
+			const u64 chunk = next.fetch_add(1, std::memory_order_relaxed);
+			if (chunk >= index.entries.size) return;
+			ChunkIndexEntry& e = index.entries.data[chunk];
+			const u64 end = index.ChunkEnd(chunk);
+			e.lines = (u32)SIMD_CountChar(data + e.offset, data + end, '\n');
+		}
+	};
+
+	if (numThreads == 0) numThreads = 1;
+	Array<std::thread*> threads;
+	threads.InitMalloc(numThreads);
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i] = new std::thread(work);
+	}
+	work();
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	threads.Free();
+
+	index.FinishHeader(chunkBytes, fileLength);
+}
@@ -0,0 +1,282 @@
+#pragma once
+#include "../base/platform_io.h"
+#include "../base/vector.h"
+
+// Dictionary encoded columnar measurement file (.1brc), meant to be mmapped:
+//
+//   [ColumnarHeader]                      64 bytes
+//   [block 0] [block 1] ...               every block starts on a page, ids then temps (each 64 byte aligned)
+//   [dictionary]                          u32 nameOffsets[numStations + 1], then the name bytes
+//   [ColumnarBlockEntry * numBlocks]      footer with block offsets for handing blocks to threads
+//   [ColumnarTrailer]                     last 64 bytes of the file
+//
+// Station ids are u16 (u32 with COLUMNAR_WIDE_IDS) indexes into the dictionary and temperatures are the s16 scaled by 10.
+// With COLUMNAR_SORTED_BLOCKS the rows inside each block are grouped by station id, which only loses the order within a block
+// but turns aggregation into SIMD reductions over runs of temperatures.
+
+constexpr char COLUMNAR_MAGIC[8] = { '1', 'B', 'R', 'C', 'C', 'O', 'L', '\0' };
+constexpr u32 COLUMNAR_VERSION = 1;
+constexpr u32 COLUMNAR_DEFAULT_BLOCK_ROWS = 1 << 20;
+
+enum ColumnarFlags : u32
+{
+	COLUMNAR_WIDE_IDS = 1 << 0,
+	COLUMNAR_SORTED_BLOCKS = 1 << 1,
+};
+
+struct ColumnarHeader
+{
+	char magic[8];
+	u32 version;
+	u32 flags;
+	u32 blockRows;
+	u32 reserved[11];
+};
+static_assert(sizeof(ColumnarHeader) == 64, "ColumnarHeader is written to disk as-is");
+
+struct ColumnarBlockEntry
+{
+	u64 offset;
+	u32 rows;
+	u32 reserved;
+};
+static_assert(sizeof(ColumnarBlockEntry) == 16, "ColumnarBlockEntry is written to disk as-is");
+
+struct ColumnarTrailer
+{
+	u64 dictOffset;
+	u64 footerOffset;
+	u64 numBlocks;
+	u64 numRows;
+	u32 numStations;
+	u32 reserved[5];
+	char magic[8];
+};
+static_assert(sizeof(ColumnarTrailer) == 64, "ColumnarTrailer is written to disk as-is");
+
+inline u64 AlignUp(const u64 x, const u64 alignment)
+{
+	return (x + alignment - 1) / alignment * alignment;
+}
+
+// Byte offset of the temperature column inside a block
+inline u64 ColumnarTempsOffset(const u32 rows, const u32 idBytes)
+{
+	return AlignUp((u64)rows * idBytes, 64);
+}
+
+struct ColumnarWriter
+{
+	FileHandle fh;
+	ColumnarHeader header = {};
+	u64 offset = 0;
+	u64 numRows = 0;
+	u32 idBytes = 2;
+	Vector<ColumnarBlockEntry> blocks;
+	Vector<u32> nameOffsets;
+	StringBuffer names;
+
+	// Block staging and the scratch used to group rows by station when sorting
+	Array<u32> ids;
+	Array<s16> temps;
+	Array<u32> sortedIds;
+	Array<s16> sortedTemps;
+	Vector<u32> stationCounts;
+	u32 blockFill = 0;
+	Array<char> encoded;
+
+	bool Open(const char* path, const u32 flags, const u32 blockRows = COLUMNAR_DEFAULT_BLOCK_ROWS)
+	{
+		fh = OpenFileWrite(path);
+		if (!fh.Good()) return false;
+
+		memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+		header.version = COLUMNAR_VERSION;
+		header.flags = flags;
+		header.blockRows = blockRows;
+		idBytes = (flags & COLUMNAR_WIDE_IDS) ? 4 : 2;
+
+		blocks.Init(1024);
+		nameOffsets.Init(1024);
+		nameOffsets.Push(0);
+		names.Init(idBytes == 2 ? 8 * MB : 128 * MB); // Names are at most 100 bytes
+		ids.InitMalloc(blockRows);
+		temps.InitMalloc(blockRows);
+		sortedIds.InitMalloc(blockRows);
+		sortedTemps.InitMalloc(blockRows);
+		stationCounts.Init(1024);
+		encoded.InitMalloc(AlignUp(ColumnarTempsOffset(blockRows, idBytes) + (u64)blockRows * sizeof(s16), PAGE_SIZE));
+
+		return WritePadded(&header, sizeof(header), PAGE_SIZE);
+	}
+
+	u32 MaxStations() const
+	{
+		return idBytes == 2 ? 1 << 16 : U32_MAX;
+	}
+
+	u32 NumStations() const
+	{
+		return (u32)nameOffsets.size - 1;
+	}
+
+	// Ids are handed out in the order names are added
+	u32 AddStation(const String& name)
+	{
+		assert(NumStations() < MaxStations());
+		names.Push(name.data, name.len);
+		nameOffsets.Push((u32)names.size);
+		return NumStations() - 1;
+	}
+
+	bool WritePadded(const void* data, const u64 bytes, const u64 alignment)
+	{
+		static const char zeros[PAGE_SIZE] = {};
+		if (!fh.Write(data, bytes)) return false;
+		offset += bytes;
+		const u64 padding = AlignUp(offset, alignment) - offset;
+		if (padding > 0 && !fh.Write(zeros, padding)) return false;
+		offset += padding;
+		return true;
+	}
+
+	__forceinline bool Add(const u32 id, const s16 temp)
+	{
+		ids.data[blockFill] = id;
+		temps.data[blockFill] = temp;
+		if (++blockFill == header.blockRows) return FlushBlock();
+		return true;
+	}
+
+	// Writes a block of rows that was filled externally (the generator fills blocks on its worker threads)
+	bool WriteBlock(const u32* blockIds, const s16* blockTemps, const u32 rows)
+	{
+		for (u32 i = 0; i < rows; i++)
+		{
+			if (!Add(blockIds[i], blockTemps[i])) return false;
+		}
+		return true;
+	}
+
+	// Counting sort by station id, stable so rows of a station keep their order
+	void SortBlock(u32 rows)
+	{
+		const u32 numStations = NumStations();
+		while (stationCounts.size < numStations + 1) stationCounts.PushReuse();
+		memset(stationCounts.data, 0, (numStations + 1) * sizeof(u32));
+		for (u32 i = 0; i < rows; i++) stationCounts.data[ids.data[i] + 1]++;
+		for (u32 s = 0; s < numStations; s++) stationCounts.data[s + 1] += stationCounts.data[s];
+		for (u32 i = 0; i < rows; i++)
+		{
+			const u32 dst = stationCounts.data[ids.data[i]]++;
+			sortedIds.data[dst] = ids.data[i];
+			sortedTemps.data[dst] = temps.data[i];
+		}
+		memcpy(ids.data, sortedIds.data, rows * sizeof(u32));
+		memcpy(temps.data, sortedTemps.data, rows * sizeof(s16));
+	}
+
+	bool FlushBlock()
+	{
+		const u32 rows = blockFill;
+		if (rows == 0) return true;
+		blockFill = 0;
+
+		if (header.flags & COLUMNAR_SORTED_BLOCKS) SortBlock(rows);
+
+		const u64 tempsOffset = ColumnarTempsOffset(rows, idBytes);
+		memset(encoded.data, 0, tempsOffset);
+		if (idBytes == 2)
+		{
+			u16* out = (u16*)encoded.data;
+			for (u32 i = 0; i < rows; i++) out[i] = (u16)ids.data[i];
+		}
+		else
+		{
+			memcpy(encoded.data, ids.data, rows * sizeof(u32));
+		}
+		memcpy(encoded.data + tempsOffset, temps.data, rows * sizeof(s16));
+
+		ColumnarBlockEntry entry = {};
+		entry.offset = offset;
+		entry.rows = rows;
+		blocks.Push(entry);
+		numRows += rows;
+
+		return WritePadded(encoded.data, tempsOffset + rows * sizeof(s16), PAGE_SIZE);
+	}
+
+	bool Finish()
+	{
+		if (!FlushBlock()) return false;
+
+		ColumnarTrailer trailer = {};
+		trailer.dictOffset = offset;
+		trailer.numStations = NumStations();
+		if (!fh.Write(nameOffsets.data, nameOffsets.Bytes())) return false;
+		offset += nameOffsets.Bytes();
+		if (!WritePadded(names.data, names.size, 64)) return false;
+
+		trailer.footerOffset = offset;
+		trailer.numBlocks = blocks.size;
+		trailer.numRows = numRows;
+		memcpy(trailer.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+		if (!WritePadded(blocks.data, blocks.Bytes(), 64)) return false;
+		if (!fh.Write(&trailer, sizeof(trailer))) return false;
+
+		fh.Close();
+		return true;
+	}
+};
+
+struct ColumnarFile
+{
+	MappedFileHandle file;
+	const ColumnarHeader* header = nullptr;
+	const ColumnarTrailer* trailer = nullptr;
+	const ColumnarBlockEntry* blocks = nullptr;
+	const u32* nameOffsets = nullptr;
+	const char* names = nullptr;
+
+	bool Open(const char* path)
+	{
+		if (!file.OpenRead(path)) return false;
+		if (file.length < sizeof(ColumnarHeader) + sizeof(ColumnarTrailer)) return false;
+
+		header = (const ColumnarHeader*)file.data;
+		trailer = (const ColumnarTrailer*)(file.data + file.length - sizeof(ColumnarTrailer));
+		if (memcmp(header->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0 || header->version != COLUMNAR_VERSION) return false;
+		if (memcmp(trailer->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0) return false;
+		if (trailer->footerOffset + trailer->numBlocks * sizeof(ColumnarBlockEntry) > file.length) return false;
+
+		blocks = (const ColumnarBlockEntry*)(file.data + trailer->footerOffset);
+		nameOffsets = (const u32*)(file.data + trailer->dictOffset);
+		names = (const char*)(nameOffsets + trailer->numStations + 1);
+		return true;
+	}
+
+	u32 IdBytes() const
+	{
+		return (header->flags & COLUMNAR_WIDE_IDS) ? 4 : 2;
+	}
+
+	bool SortedBlocks() const
+	{
+		return (header->flags & COLUMNAR_SORTED_BLOCKS) != 0;
+	}
+
+	const void* BlockIds(const u64 block) const
+	{
+		return file.data + blocks[block].offset;
+	}
+
+	const s16* BlockTemps(const u64 block) const
+	{
+		return (const s16*)(file.data + blocks[block].offset + ColumnarTempsOffset(blocks[block].rows, IdBytes()));
+	}
+
+	String StationName(const u32 id) const
+	{
+		return String((char*)names + nameOffsets[id], nameOffsets[id + 1] - nameOffsets[id]);
+	}
+};
@@ -0,0 +1,474 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+#include "../base/vector.h"
+#include "../third_party/zstd/zstd.h"
+
+// Block compressed measurement text (.zst), every block is an independent zstd frame holding whole lines:
+//
+//   [skippable frame: CompressedHeader]
+//   [zstd frame: block 0] [zstd frame: block 1] ...
+//   [skippable frame: CompressedBlockEntry * numBlocks, CompressedTrailer]   the trailer is the last 48 bytes of the file
+//
+// Any zstd tool can still decompress the whole thing since it ignores skippable frames, but with the block index the
+// engines hand blocks to threads and decompress them in parallel, each into its own small buffer that stays in cache.
+
+constexpr char COMPRESSED_MAGIC[8] = { '1', 'B', 'R', 'C', 'Z', 'S', 'T', '\0' };
+constexpr u32 COMPRESSED_VERSION = 1;
+constexpr u32 COMPRESSED_CODEC_ZSTD = 1;
+constexpr u64 COMPRESSED_DEFAULT_BLOCK_BYTES = 4 * MB;
+constexpr int COMPRESSED_DEFAULT_LEVEL = 3;
+constexpr u64 COMPRESSED_BLOCK_PADDING = 64; // Decode buffers are padded so the parsers can over-read the last line
+
+struct CompressedHeader
+{
+	char magic[8];
+	u32 version;
+	u32 codec;
+	u64 blockBytes; // Upper bound on the decompressed size of a block
+	s32 level;
+	u32 reserved[5];
+};
+static_assert(sizeof(CompressedHeader) == 48, "CompressedHeader is written to disk as-is");
+
+struct CompressedBlockEntry
+{
+	u64 offset;    // File offset of the block's zstd frame
+	u64 firstLine; // Row number of the first line in the block
+	u32 compressedBytes;
+	u32 rawBytes;
+	u32 lines;
+	u32 crc;       // CRC32C of the decompressed bytes, checked after every decode
+};
+static_assert(sizeof(CompressedBlockEntry) == 32, "CompressedBlockEntry is written to disk as-is");
+
+struct CompressedTrailer
+{
+	u64 footerOffset; // File offset of the first CompressedBlockEntry
+	u64 numBlocks;
+	u64 rawBytes;
+	u64 totalLines;
+	u64 reserved;
+	char magic[8];
+};
+static_assert(sizeof(CompressedTrailer) == 48, "CompressedTrailer is written to disk as-is");
+
+struct SkippableFrameHeader
+{
+	u32 magic;
+	u32 size;
+};
+
+inline bool IsCompressedFile(const MappedFileHandle& file)
+{
+	return file.length >= sizeof(SkippableFrameHeader) + sizeof(CompressedHeader)
+		&& memcmp(file.data + sizeof(SkippableFrameHeader), COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) == 0;
+}
+
+// Takes consecutive buffers that each end on a full line, cuts them into line aligned blocks and compresses batches of
+// blocks on all threads. The blocks are written in order so the output doesn't depend on the thread count.
+struct CompressedWriter
+{
+	struct PendingBlock
+	{
+		const char* data;
+		u64 len;
+		Array<char> out;
+		u64 compressedBytes;
+		u32 lines;
+		u32 crc;
+	};
+
+	FileHandle fh;
+	CompressedHeader header = {};
+	u64 offset = 0;
+	u64 rawBytes = 0;
+	u64 totalLines = 0;
+	Vector<CompressedBlockEntry> blocks;
+
+	u32 numThreads = 1;
+	Array<ZSTD_CCtx*> contexts;
+	Array<PendingBlock> pending; // A batch of a few blocks per thread
+	u64 numPending = 0;
+	Array<char> staging;         // Lines left over from the previous buffer that didn't fill a block
+	u64 stagingSize = 0;
+	bool good = true;
+
+	bool Open(const char* path, const u64 blockBytes = COMPRESSED_DEFAULT_BLOCK_BYTES, const int level = COMPRESSED_DEFAULT_LEVEL, u32 threads = 1)
+	{
+		fh = OpenFileWrite(path);
+		if (!fh.Good()) return false;
+
+		memcpy(header.magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+		header.version = COMPRESSED_VERSION;
+		header.codec = COMPRESSED_CODEC_ZSTD;
+		header.blockBytes = blockBytes;
+		header.level = level;
+
+		numThreads = threads > 0 ? threads : 1;
+		contexts.InitMalloc(numThreads);
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			contexts[i] = ZSTD_createCCtx();
+			ZSTD_CCtx_setParameter(contexts[i], ZSTD_c_compressionLevel, level);
+		}
+		pending.InitMallocZero(numThreads * 2ull);
+		for (u64 i = 0; i < pending.size; i++)
+		{
+			pending[i].out.InitMalloc(ZSTD_compressBound(blockBytes));
+		}
+		staging.InitMalloc(blockBytes);
+		blocks.Init(1024);
+
+		SkippableFrameHeader frame = { ZSTD_MAGIC_SKIPPABLE_START, sizeof(CompressedHeader) };
+		return Write(&frame, sizeof(frame)) && Write(&header, sizeof(header));
+	}
+
+	bool Write(const void* data, const u64 bytes)
+	{
+		if (!fh.Write(data, bytes)) return false;
+		offset += bytes;
+		return true;
+	}
+
+	void CompressPending(std::atomic<u64>* next, const u32 thread)
+	{
+		for (;;)
+		{
+			const u64 i = next->fetch_add(1, std::memory_order_relaxed);
+			if (i >= numPending) return;
+			PendingBlock& block = pending[i];
+			block.lines = (u32)SIMD_CountChar(block.data, block.data + block.len, '\n');
+			block.crc = SIMD_Crc32C(0, block.data, block.len);
+			block.compressedBytes = ZSTD_compress2(contexts[thread], block.out.data, block.out.size, block.data, block.len);
+		}
+	}
+
+	bool FlushPending()
+	{
+		if (numPending == 0) return good;
+
+		std::atomic<u64> next{ 0 };
+		const u32 workers = numPending < numThreads ? (u32)numPending : numThreads;
+		Array<std::thread*> threads;
+		threads.InitMalloc(workers);
+		for (u32 i = 0; i < workers - 1; i++)
+		{
+			threads[i] = new std::thread(&CompressedWriter::CompressPending, this, &next, i);
+		}
+		CompressPending(&next, workers - 1);
+		for (u32 i = 0; i < workers - 1; i++)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+		threads.Free();
+
+		for (u64 i = 0; i < numPending && good; i++)
+		{
+			const PendingBlock& block = pending[i];
+			if (ZSTD_isError(block.compressedBytes))
+			{
+				printf("zstd: %s\n", ZSTD_getErrorName(block.compressedBytes));
+				good = false;
+				break;
+			}
+
+			CompressedBlockEntry entry = {};
+			entry.offset = offset;
+			entry.firstLine = totalLines;
+			entry.compressedBytes = (u32)block.compressedBytes;
+			entry.rawBytes = (u32)block.len;
+			entry.lines = block.lines;
+			entry.crc = block.crc;
+			blocks.Push(entry);
+			rawBytes += block.len;
+			totalLines += block.lines;
+			good = Write(block.out.data, block.compressedBytes);
+		}
+		numPending = 0;
+		return good;
+	}
+
+	bool PushBlock(const char* data, const u64 len)
+	{
+		pending[numPending].data = data;
+		pending[numPending].len = len;
+		if (++numPending == pending.size) return FlushPending();
+		return good;
+	}
+
+	// Length of the longest run of whole lines that fits into a block
+	u64 CutBlock(const char* data, const u64 len) const
+	{
+		if (len <= header.blockBytes) return len;
+		for (u64 cut = header.blockBytes; cut > 0; cut--)
+		{
+			if (data[cut - 1] == '\n') return cut;
+		}
+		assert(false && "line longer than a block");
+		return header.blockBytes;
+	}
+
+	bool Append(const char* data, const u64 len)
+	{
+		const char* pos = data;
+		const char* end = data + len;
+
+		// Top up the leftover lines from the last buffer first, they have to be flushed before staging is reused
+		if (stagingSize > 0)
+		{
+			const u64 room = header.blockBytes - stagingSize;
+			if ((u64)(end - pos) <= room)
+			{
+				memcpy(staging.data + stagingSize, pos, end - pos);
+				stagingSize += end - pos;
+				return good;
+			}
+
+			u64 take = room;
+			while (take > 0 && pos[take - 1] != '\n') take--;
+			memcpy(staging.data + stagingSize, pos, take);
+			stagingSize += take;
+			pos += take;
+
+			if (!PushBlock(staging.data, stagingSize)) return false;
+			if (!FlushPending()) return false;
+			stagingSize = 0;
+		}
+
+		while ((u64)(end - pos) >= header.blockBytes)
+		{
+			const u64 cut = CutBlock(pos, end - pos);
+			if (!PushBlock(pos, cut)) return false;
+			pos += cut;
+		}
+		if (!FlushPending()) return false;
+
+		memcpy(staging.data, pos, end - pos);
+		stagingSize = end - pos;
+		return good;
+	}
+
+	bool Finish()
+	{
+		if (stagingSize > 0 && !PushBlock(staging.data, stagingSize)) return false;
+		if (!FlushPending()) return false;
+		stagingSize = 0;
+
+		CompressedTrailer trailer = {};
+		trailer.footerOffset = offset + sizeof(SkippableFrameHeader);
+		trailer.numBlocks = blocks.size;
+		trailer.rawBytes = rawBytes;
+		trailer.totalLines = totalLines;
+		memcpy(trailer.magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC));
+
+		SkippableFrameHeader frame = { ZSTD_MAGIC_SKIPPABLE_START + 0xE, (u32)(blocks.Bytes() + sizeof(trailer)) };
+		if (!Write(&frame, sizeof(frame)) || !Write(blocks.data, blocks.Bytes()) || !Write(&trailer, sizeof(trailer))) return false;
+
+		fh.Close();
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			ZSTD_freeCCtx(contexts[i]);
+		}
+		return true;
+	}
+};
+
+struct CompressedFile
+{
+	const CompressedHeader* header = nullptr;
+	const CompressedTrailer* trailer = nullptr;
+	const CompressedBlockEntry* blocks = nullptr;
+	const char* data = nullptr;
+
+	bool Good() const
+	{
+		return trailer != nullptr;
+	}
+
+	// Only for files that pass IsCompressedFile, false means the file is cut off or its block index is damaged. Every block has
+	// to lie between the header and the block index and decode into a buffer of blockBytes.
+	bool Open(const MappedFileHandle& file)
+	{
+		const u64 dataStart = sizeof(SkippableFrameHeader) + sizeof(CompressedHeader);
+		if (!IsCompressedFile(file) || file.length < dataStart + sizeof(CompressedTrailer)) return false;
+
+		const CompressedHeader* h = (const CompressedHeader*)(file.data + sizeof(SkippableFrameHeader));
+		const CompressedTrailer* t = (const CompressedTrailer*)(file.data + file.length - sizeof(CompressedTrailer));
+		if (h->version != COMPRESSED_VERSION || h->codec != COMPRESSED_CODEC_ZSTD) return false;
+		if (memcmp(t->magic, COMPRESSED_MAGIC, sizeof(COMPRESSED_MAGIC)) != 0) return false;
+		if (t->numBlocks > file.length / sizeof(CompressedBlockEntry) || t->footerOffset < dataStart) return false;
+		if (t->footerOffset + t->numBlocks * sizeof(CompressedBlockEntry) + sizeof(CompressedTrailer) != file.length) return false;
+
+		const CompressedBlockEntry* b = (const CompressedBlockEntry*)(file.data + t->footerOffset);
+		for (u64 i = 0; i < t->numBlocks; i++)
+		{
+			if (b[i].offset < dataStart || b[i].offset + b[i].compressedBytes > t->footerOffset || b[i].rawBytes > h->blockBytes) return false;
+		}
+
+		header = h;
+		trailer = t;
+		blocks = b;
+		data = file.data;
+		return true;
+	}
+
+	// Last block whose first line is <= row
+	u64 FindBlockForRow(const u64 row) const
+	{
+		u64 lo = 0;
+		u64 hi = trailer->numBlocks;
+		while (hi - lo > 1)
+		{
+			const u64 mid = (lo + hi) / 2;
+			if (blocks[mid].firstLine <= row) lo = mid;
+			else hi = mid;
+		}
+		return lo;
+	}
+};
+
+constexpr u64 PERSISTED_NAMES_BLOCK_BYTES = 1 * MB;
+
+// Station names copied out of decode buffers. Every distinct name is copied once per thread, so all the maps a thread fills (one
+// per row window with -window) share the copy, and the copies go into chained blocks that never move since the maps point into them.
+struct PersistedNames
+{
+	struct Slot
+	{
+		const char* name;
+		u32 len;
+		u32 hash;
+	};
+	Slot* slots = nullptr;
+	u64 capacity = 0;
+	u64 count = 0;
+	char* block = nullptr; // Starts with a pointer to the block before it
+	u64 blockUsed = 0;
+	u64 blockBytes = 0;
+
+	String Persist(const char* data, const u64 len)
+	{
+		if (capacity == 0)
+		{
+			capacity = 1024;
+			slots = (Slot*)calloc(capacity, sizeof(Slot));
+		}
+
+		const u32 hash = SIMD_Crc32C(0, data, len);
+		u64 idx = hash & (capacity - 1);
+		for (; slots[idx].name != nullptr; idx = (idx + 1) & (capacity - 1))
+		{
+			const Slot& slot = slots[idx];
+			if (slot.hash == hash && slot.len == len && memcmp(slot.name, data, len) == 0) return String((char*)slot.name, len);
+		}
+
+		if (block == nullptr || blockUsed + len > blockBytes)
+		{
+			const u64 bytes = sizeof(char*) + (len > PERSISTED_NAMES_BLOCK_BYTES ? len : PERSISTED_NAMES_BLOCK_BYTES);
+			char* next = (char*)malloc(bytes);
+			*(char**)next = block;
+			block = next;
+			blockUsed = sizeof(char*);
+			blockBytes = bytes;
+		}
+		char* copy = block + blockUsed;
+		memcpy(copy, data, len);
+		blockUsed += len;
+
+		slots[idx] = { copy, (u32)len, hash };
+		if (++count * 2 > capacity) Grow();
+		return String(copy, len);
+	}
+
+	void Grow()
+	{
+		const u64 newCapacity = capacity * 2;
+		Slot* newSlots = (Slot*)calloc(newCapacity, sizeof(Slot));
+		for (u64 i = 0; i < capacity; i++)
+		{
+			if (slots[i].name == nullptr) continue;
+			u64 idx = slots[i].hash & (newCapacity - 1);
+			while (newSlots[idx].name != nullptr) idx = (idx + 1) & (newCapacity - 1);
+			newSlots[idx] = slots[i];
+		}
+		free(slots);
+		slots = newSlots;
+		capacity = newCapacity;
+	}
+
+	// Forgets every copy, the slots are kept for the next run
+	void Clear()
+	{
+		while (block != nullptr)
+		{
+			char* previous = *(char**)block;
+			free(block);
+			block = previous;
+		}
+		blockUsed = 0;
+		blockBytes = 0;
+		if (slots != nullptr) memset(slots, 0, capacity * sizeof(Slot));
+		count = 0;
+	}
+
+	void Free()
+	{
+		Clear();
+		free(slots);
+		slots = nullptr;
+		capacity = 0;
+	}
+};
+
+// Per thread decompression state, the buffer is reused for every block so it stays warm in cache
+struct BlockDecoder
+{
+	ZSTD_DCtx* context = nullptr;
+	Array<char> buffer;
+	PersistedNames names;
+
+	bool Decode(const CompressedFile& file, const u64 block, char*& pos, const char*& end)
+	{
+		const CompressedBlockEntry& entry = file.blocks[block];
+		if (context == nullptr) context = ZSTD_createDCtx();
+		if (buffer.size < file.header->blockBytes + COMPRESSED_BLOCK_PADDING)
+		{
+			if (buffer.data != nullptr) buffer.Free();
+			buffer.InitMalloc(file.header->blockBytes + COMPRESSED_BLOCK_PADDING);
+		}
+
+		// zstd frames are written without their own checksum, the index's CRC catches a block that still decodes to the wrong bytes
+		const size_t decoded = ZSTD_decompressDCtx(context, buffer.data, buffer.size, file.data + entry.offset, entry.compressedBytes);
+		const char* error = ZSTD_isError(decoded) ? ZSTD_getErrorName(decoded)
+			: decoded != entry.rawBytes ? "size mismatch"
+			: SIMD_Crc32C(0, buffer.data, decoded) != entry.crc ? "checksum mismatch"
+			: nullptr;
+		if (error != nullptr)
+		{
+			fprintf(stderr, "failed to decompress block %llu: %s\n", (unsigned long long)block, error);
+			return false;
+		}
+		memset(buffer.data + decoded, 0, COMPRESSED_BLOCK_PADDING);
+
+		pos = buffer.data;
+		end = buffer.data + decoded;
+		return true;
+	}
+
+	// Names parsed out of a decode buffer have to be copied before the next block overwrites them
+	String Persist(const char* data, const u64 len)
+	{
+		return names.Persist(data, len);
+	}
+
+	bool Owns(const char* p) const
+	{
+		return buffer.data != nullptr && p >= buffer.data && p < buffer.data + buffer.size;
+	}
+};
@@ -0,0 +1,1133 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+#include "aggregate.h"
+#include "input.h"
+#include "variance.h"
+
+// The fast threaded engine (solutions/markusaksli_fast_threaded) as a library that services can call. Everything it needs lives
+// in the Engine, so any number of them can run side by side, and nothing is printed or exits: a run fills an EngineResult or
+// returns false with result.error set (input.h still prints what it can't open).
+//
+//   brc::EngineOptions options;
+//   options.threads = 4;
+//   brc::Engine engine;
+//   engine.Init(options);
+//   brc::EngineResult result;
+//   if (engine.Run("measurements*.txt", result)) { ... result.stations, sorted by name ... }
+//   result.Free();
+//   engine.Free();
+//
+// The parse threads are started once in Init and sleep between runs. Runs of one engine are serialized, use one engine per
+// concurrent caller. The hot loop is the solution's: an FNV hash while seeking the ';', linear probing in a power of 2 map of
+// { name, len, index, hash } and the single load temperature parse, only the map grows past 512 entries instead of asserting.
+
+namespace brc
+{
+
+enum EngineIO
+{
+	ENGINE_IO_MAPPED, // Memory mapped through input.h, the only one that uses chunk indexes, compressed files, -rows and -range
+	ENGINE_IO_READ,   // Every text file is read into memory first, for file systems where mapping is slow or not there
+};
+
+enum EngineAggregate
+{
+	ENGINE_MIN_MAX_MEAN = 0, // Always computed
+	ENGINE_STDDEV = 1,       // Adds the exact sum of squares, see variance.h
+	ENGINE_EXTREME_OFFSETS = 2, // Adds where the min and max came from, see AggExtremeOffsets
+};
+
+constexpr u32 ENGINE_MAP_INITIAL_CAPACITY = 512;
+constexpr u64 ENGINE_BUFFER_PADDING = 64; // Past the end of a text buffer, the temperature parse loads 8 bytes at a time
+constexpr u64 ENGINE_NO_OFFSET = ~0ull;
+
+struct EngineOptions
+{
+	u32 threads = 0; // 0 for every core but one
+	EngineIO io = ENGINE_IO_MAPPED;
+	u32 aggregates = ENGINE_MIN_MAX_MEAN;
+	InputOptions input; // Indexes, rows, ranges and progress. Caches, checkpoints and partials are up to the caller.
+};
+
+struct EngineStation
+{
+	String name;
+	HASH_T hash; // The key of the engine's station map, for joins like src/brc/station_metadata.h
+	AggregateMinMaxCountSum data; // The solutions' 16 byte StationData, so it can go to result_cache.h and checkpoint.h as is
+	u64 sumSquares; // 0 without ENGINE_STDDEV
+	u64 minOffset; // Logical input offsets (like -range's) of the first lines with the min and the max, ENGINE_NO_OFFSET without
+	u64 maxOffset; // ENGINE_EXTREME_OFFSETS
+
+	double Mean() const
+	{
+		return (data.sum * 0.1) / data.count;
+	}
+
+	double StdDev() const
+	{
+		return sqrt(PopulationVariance(data.count, data.sum, sumSquares)) * 0.1;
+	}
+};
+
+struct EngineNoContext
+{
+	template <typename Stations>
+	__forceinline void Begin(Stations&, u64)
+	{
+	}
+
+	__forceinline void Line(const char*)
+	{
+	}
+
+	__forceinline void NewStation(const String&, u32)
+	{
+	}
+};
+
+// ENGINE_EXTREME_OFFSETS: the offset of the line being parsed, written to the station only when AggMin or AggMax take its value
+template <typename Station>
+struct EngineOffsetContext
+{
+	Vector<Station>* stations; // The map's, its data moves when a station is added
+	u64 base; // UnitReader::OffsetBase
+	u64 line;
+
+	__forceinline void Begin(Vector<Station>& mapStations, const u64 offsetBase)
+	{
+		stations = &mapStations;
+		base = offsetBase;
+	}
+
+	__forceinline void Line(const char* pos)
+	{
+		line = base + (u64)pos;
+	}
+
+	__forceinline void NewStation(const String&, u32)
+	{
+	}
+
+	__forceinline void NewMin(const u32 station)
+	{
+		static_cast<AggExtremeOffsets&>(stations->data[station]).minOffset = line;
+	}
+
+	__forceinline void NewMax(const u32 station)
+	{
+		static_cast<AggExtremeOffsets&>(stations->data[station]).maxOffset = line;
+	}
+};
+
+// What the parse loop passes to the aggregators, nothing at all unless the station tracks offsets
+template <typename Station>
+using EngineContext = typename std::conditional<Station::template Has<AggExtremeOffsets>(), EngineOffsetContext<Station>, EngineNoContext>::type;
+
+// The hash of the engine's station maps, for stations that come from elsewhere
+inline HASH_T EngineHash(const String& name)
+{
+	HASH_T hash = FNV_PRIME;
+	for (u64 i = 0; i < name.len; i++)
+	{
+		fnv1aStep(name.data[i], hash);
+	}
+	return hash;
+}
+
+// Stations sorted by name, their names are copies so the result outlives the input and the engine
+struct EngineResult
+{
+	Vector<EngineStation> stations;
+	StringBuffer names;
+	u64 bytes = 0; // Text parsed, after decompression
+	const char* error = nullptr; // Why the last run failed
+
+	void Init(const u64 maxStations, const u64 nameBytes)
+	{
+		Free();
+		stations.Init(maxStations > 0 ? maxStations : 1);
+		names.Init(nameBytes + 1);
+		names.size = 0;
+		bytes = 0;
+		error = nullptr;
+	}
+
+	void Free()
+	{
+		free(stations.data);
+		stations.data = nullptr;
+		stations.size = 0;
+		stations.reserved = 0;
+		free(names.data);
+		names.data = nullptr;
+		names.size = 0;
+		names.reserved = 0;
+	}
+
+	// Stations from elsewhere (a cache, a checkpoint), Sort once they're all in
+	void Add(const String& name, const HASH_T hash, const AggregateMinMaxCountSum& data, const u64 sumSquares, const u64 minOffset = ENGINE_NO_OFFSET, const u64 maxOffset = ENGINE_NO_OFFSET)
+	{
+		EngineStation& s = stations.PushReuse();
+		s.name = names.PushStringCopy(name);
+		s.hash = hash;
+		s.data = data;
+		s.sumSquares = sumSquares;
+		s.minOffset = minOffset;
+		s.maxOffset = maxOffset;
+	}
+
+	void Sort()
+	{
+		std::sort(stations.data, stations.data + stations.size, [](const EngineStation& a, const EngineStation& b)
+		{
+			return a.name < b.name;
+		});
+	}
+
+	// Merges the stations of other into this one, both sorted
+	void Merge(const EngineResult& other)
+	{
+		EngineResult merged;
+		merged.Init(stations.size + other.stations.size, names.size + other.names.size);
+		merged.bytes = bytes + other.bytes;
+		EngineNoContext ctx;
+		u64 a = 0;
+		u64 b = 0;
+		while (a < stations.size || b < other.stations.size)
+		{
+			const EngineStation* mine = a < stations.size ? &stations.data[a] : nullptr;
+			const EngineStation* theirs = b < other.stations.size ? &other.stations.data[b] : nullptr;
+			if (theirs == nullptr || (mine != nullptr && mine->name < theirs->name))
+			{
+				merged.Add(mine->name, mine->hash, mine->data, mine->sumSquares, mine->minOffset, mine->maxOffset);
+				a++;
+			}
+			else if (mine == nullptr || theirs->name < mine->name)
+			{
+				merged.Add(theirs->name, theirs->hash, theirs->data, theirs->sumSquares, theirs->minOffset, theirs->maxOffset);
+				b++;
+			}
+			else
+			{
+				// Same tie break as AggregateMergeExtremeOffsets
+				const bool theirMin = theirs->data.min < mine->data.min || (theirs->data.min == mine->data.min && theirs->minOffset < mine->minOffset);
+				const bool theirMax = theirs->data.max > mine->data.max || (theirs->data.max == mine->data.max && theirs->maxOffset < mine->maxOffset);
+				merged.Add(mine->name, mine->hash, mine->data, mine->sumSquares + theirs->sumSquares, theirMin ? theirs->minOffset : mine->minOffset, theirMax ? theirs->maxOffset : mine->maxOffset);
+				merged.stations.Last().data.Merge(theirs->data, ctx, 0, ctx, 0);
+				a++;
+				b++;
+			}
+		}
+
+		Free();
+		stations = merged.stations;
+		names = merged.names;
+		bytes = merged.bytes;
+		merged.stations.data = nullptr;
+		merged.names.data = nullptr;
+	}
+};
+
+// Per-window results of a windowed run, window w is rows [w * windowRows, (w + 1) * windowRows) of the parsed input (so counted
+// from the first row of -rows), the last one has whatever is left
+struct EngineWindows
+{
+	u64 windowRows = 0;
+	u64 rows = 0;
+	Array<EngineResult> windows;
+	u64 bytes = 0; // Text parsed, after decompression
+	const char* error = nullptr; // Why the last run failed
+
+	void Init(const u64 rowsPerWindow, const u64 totalRows)
+	{
+		Free();
+		windowRows = rowsPerWindow;
+		rows = totalRows;
+		const u64 numWindows = (rows + windowRows - 1) / windowRows;
+		windows.InitMallocZero(numWindows > 0 ? numWindows : 1);
+		windows.size = numWindows;
+	}
+
+	void Free()
+	{
+		for (u64 i = 0; i < windows.size; i++)
+		{
+			windows.data[i].Free();
+		}
+		windows.Free();
+		windows.data = nullptr;
+		windows.size = 0;
+	}
+};
+
+// Open addressing, kept under half full so the probes stay short
+template <typename Station>
+struct EngineMap
+{
+	struct Entry // Compact key struct to fit more in cache
+	{
+		const char* name;
+		u32 namelen;
+		u32 valueIndex;
+		HASH_T hash; // Saves recalculating it during the merge
+	};
+	Entry* items = nullptr;
+	u64 capacity = 0;
+	u32 numStations = 0;
+	Vector<Station> stations;
+	Vector<u32> stationToHeader;
+
+	void Init(const u64 initialCapacity)
+	{
+		capacity = initialCapacity;
+		items = (Entry*)calloc(capacity, sizeof(Entry));
+		numStations = 0;
+		stations.Init(capacity / 2);
+		stationToHeader.Init(capacity / 2);
+	}
+
+	// The engine's maps live in malloced memory where nothing runs the destructors, one on the stack can still be freed early
+	void Free()
+	{
+		free(items);
+		free(stations.data);
+		free(stationToHeader.data);
+		items = nullptr;
+		stations.data = nullptr;
+		stationToHeader.data = nullptr;
+	}
+
+	void Grow()
+	{
+		const u64 newCapacity = capacity * 2;
+		Entry* newItems = (Entry*)calloc(newCapacity, sizeof(Entry));
+		for (u32 i = 0; i < numStations; i++)
+		{
+			const Entry& e = items[stationToHeader.data[i]];
+			u64 idx = e.hash & (newCapacity - 1);
+			while (newItems[idx].namelen != 0) idx = (idx + 1) & (newCapacity - 1);
+			newItems[idx] = e;
+			stationToHeader.data[i] = (u32)idx;
+		}
+		free(items);
+		items = newItems;
+		capacity = newCapacity;
+	}
+
+	__forceinline u32 FindOrInsert(const String& k, const HASH_T hash)
+	{
+		u64 idx = hash & (capacity - 1); // Requires power of 2 size
+		Entry* __restrict entries = items;
+
+		for (;;)
+		{
+			Entry& e = entries[idx];
+			if (e.namelen == 0)
+			{
+				e.hash = hash;
+				e.name = k.data;
+				e.namelen = (u32)k.len;
+				e.valueIndex = numStations;
+				stations.Push(Station());
+				stationToHeader.Push((u32)idx);
+				const u32 ret = numStations++;
+				if (numStations * 2ull > capacity) Grow();
+				return ret;
+			}
+			if (e.hash == hash && k.Equals(e.name, e.namelen)) return e.valueIndex;
+			idx = (idx + 1) & (capacity - 1);
+		}
+	}
+
+	const Entry& Header(const u32 station) const
+	{
+		return items[stationToHeader.data[station]];
+	}
+
+	String Name(const u32 station) const
+	{
+		const Entry& e = Header(station);
+		return String((char*)e.name, e.namelen);
+	}
+};
+
+template <typename Station>
+struct EngineThread
+{
+	EngineMap<Station> map;
+	UnitReader* reader;
+	bool failed;
+};
+
+__forceinline s16 EngineParseTemp(char*& pos)
+{
+	s16 sign = 1;
+	u64 data = *((u64*)pos);
+	u8 c = data & 0xff;
+	data = data >> 8;
+	if (c == '-')
+	{
+		sign = -1;
+		++pos;
+		c = data & 0xff;
+		data = data >> 8;
+	}
+	s16 tens = (c - '0') * 10;
+
+	c = data & 0xff;
+	data = data >> 8;
+	if (c != '.') {
+		tens = tens * 10 + (c - '0') * 10;
+		++pos;
+		data = data >> 8;
+	}
+
+	c = data & 0xff;
+	tens = sign * (tens + c - '0');
+	pos += 4;
+
+	return tens;
+}
+
+__forceinline void EngineSeekAndHash(char*& pos, HASH_T& hash)
+{
+	while (*pos != ';')
+	{
+		fnv1aStep(*pos, hash);
+		++pos;
+	}
+}
+
+// The station name of the line at pos and its hash, pos ends up on the ';'
+__forceinline String EngineParseName(char*& pos, HASH_T& hash)
+{
+	String readString;
+	readString.data = pos;
+	hash = FNV_PRIME;
+	EngineSeekAndHash(pos, hash);
+	readString.len = pos - readString.data;
+	return readString;
+}
+
+// The rest of a line whose name was parsed, pos ends up at the start of the next one. The context hears about every station the
+// line adds to the map before the temperature goes in.
+template <typename Station, typename Context>
+__forceinline void EngineAddLine(EngineMap<Station>& map, const String& name, const HASH_T hash, char*& pos, Context& ctx)
+{
+	const u32 stationsBefore = map.numStations;
+	const u32 result = map.FindOrInsert(name, hash);
+	if (map.numStations != stationsBefore) ctx.NewStation(name, result);
+	pos++;
+
+	map.stations.data[result].Add(EngineParseTemp(pos), ctx, result);
+}
+
+// One line into the map, pos ends up at the start of the next one
+template <typename Station, typename Context>
+__forceinline void EngineParseLine(EngineMap<Station>& map, char*& pos, Context& ctx)
+{
+	ctx.Line(pos);
+	HASH_T hash;
+	const String name = EngineParseName(pos, hash);
+	EngineAddLine(map, name, hash, pos, ctx);
+}
+
+// New names from a decompressed block still point into the decode buffer
+template <typename Station>
+void EnginePersistNames(EngineMap<Station>& map, UnitReader& reader, const u32 stationsBefore)
+{
+	for (u32 i = stationsBefore; i < map.numStations; i++)
+	{
+		typename EngineMap<Station>::Entry& e = map.items[map.stationToHeader.data[i]];
+		if (reader.NeedsCopy(e.name)) e.name = reader.Persist(e.name, e.namelen).data;
+	}
+}
+
+template <typename Station>
+struct EngineJob
+{
+	EngineThread<Station>* threads;
+	WorkQueue* work;
+};
+
+template <typename Station>
+void EngineParse(void* arg, const u32 thread)
+{
+	EngineJob<Station>& job = *(EngineJob<Station>*)arg;
+	EngineThread<Station>& mem = job.threads[thread];
+	EngineMap<Station>& map = mem.map;
+	EngineContext<Station> ctx;
+
+	for (;;)
+	{
+		WorkUnit* unit = job.work->Take();
+		if (unit == nullptr) break;
+
+		char* pos;
+		const char* parseEnd;
+		if (!mem.reader->Begin(*unit, pos, parseEnd))
+		{
+			mem.failed = true;
+			break;
+		}
+
+		const u32 stationsBefore = map.numStations;
+		ctx.Begin(map.stations, mem.reader->OffsetBase(*unit));
+		while (pos < parseEnd)
+		{
+			EngineParseLine(map, pos, ctx);
+		}
+		EnginePersistNames(map, *mem.reader, stationsBefore);
+		job.work->Done(*unit);
+	}
+}
+
+// Rows per unit for the windowed runs, text that has no chunk index is counted here. A line without a newline at the very end of a
+// file is still a row.
+inline void EngineCountLines(void* arg, const u32)
+{
+	WorkQueue& work = *(WorkQueue*)arg;
+	for (;;)
+	{
+		WorkUnit* unit = work.Take();
+		if (unit == nullptr) break;
+		if (unit->compressed != nullptr || unit->lines > 0) continue;
+		unit->lines = SIMD_CountChar(unit->pos, unit->parseEnd, '\n');
+		if (unit->parseEnd > unit->pos && unit->parseEnd[-1] != '\n') unit->lines++;
+	}
+}
+
+// A thread's own map for every window it parsed rows of
+template <typename Station>
+struct EngineWindowMap
+{
+	u64 window;
+	EngineMap<Station> map;
+};
+
+template <typename Station>
+struct EngineWindowThread
+{
+	Vector<EngineWindowMap<Station>> windows; // In the order the thread got to them, mostly ascending
+	u64 mapCapacity; // No more than a window's rows need, so narrow windows don't cost a full size map each
+	UnitReader* reader;
+	bool failed;
+
+	EngineMap<Station>& Window(const u64 window)
+	{
+		for (u64 i = windows.size; i > 0; i--)
+		{
+			if (windows.data[i - 1].window == window) return windows.data[i - 1].map;
+		}
+		windows.PushZero();
+		windows.Last().window = window;
+		windows.Last().map.Init(mapCapacity);
+		return windows.Last().map;
+	}
+};
+
+template <typename Station>
+struct EngineWindowJob
+{
+	EngineWindowThread<Station>* threads;
+	WorkQueue* work;
+	const u64* firstRows; // Of every unit
+	u64 windowRows;
+};
+
+// EngineParse with the units cut at window boundaries. The rows of a unit are known up front, so a segment is a counted loop
+// into one map instead of a check per line, and a window wider than a unit costs one map lookup per unit.
+template <typename Station>
+void EngineParseWindows(void* arg, const u32 thread)
+{
+	EngineWindowJob<Station>& job = *(EngineWindowJob<Station>*)arg;
+	EngineWindowThread<Station>& mem = job.threads[thread];
+	EngineContext<Station> ctx;
+
+	for (;;)
+	{
+		WorkUnit* unit = job.work->Take();
+		if (unit == nullptr) break;
+
+		char* pos;
+		const char* parseEnd;
+		if (!mem.reader->Begin(*unit, pos, parseEnd))
+		{
+			mem.failed = true;
+			break;
+		}
+
+		u64 row = job.firstRows[unit - job.work->units.data];
+		u64 rowsLeft = unit->lines;
+		while (rowsLeft > 0)
+		{
+			const u64 window = row / job.windowRows;
+			const u64 windowLeft = (window + 1) * job.windowRows - row;
+			const u64 segment = rowsLeft < windowLeft ? rowsLeft : windowLeft;
+			EngineMap<Station>& map = mem.Window(window);
+			const u32 stationsBefore = map.numStations;
+			ctx.Begin(map.stations, mem.reader->OffsetBase(*unit));
+			for (u64 i = 0; i < segment; i++)
+			{
+				EngineParseLine(map, pos, ctx);
+			}
+			EnginePersistNames(map, *mem.reader, stationsBefore);
+			row += segment;
+			rowsLeft -= segment;
+		}
+		job.work->Done(*unit);
+	}
+}
+
+template <typename Station>
+void EngineMergeMap(EngineMap<Station>& main, const EngineMap<Station>& other)
+{
+	EngineNoContext ctx;
+	for (u32 j = 0; j < other.numStations; j++)
+	{
+		const auto& otherEntry = other.Header(j);
+		const u32 result = main.FindOrInsert(String((char*)otherEntry.name, otherEntry.namelen), otherEntry.hash);
+		AggregateMergeExtremeOffsets(main.stations.data[result], other.stations.data[j]);
+		main.stations.data[result].Merge(other.stations.data[j], ctx, result, ctx, j);
+	}
+}
+
+// The merged map as a sorted result with its own copy of the names
+template <typename Station>
+void EngineCollect(const EngineMap<Station>& main, EngineResult& result)
+{
+	u64 nameBytes = 0;
+	for (u32 i = 0; i < main.numStations; i++)
+	{
+		nameBytes += main.Header(i).namelen;
+	}
+	result.Init(main.numStations, nameBytes);
+	for (u32 i = 0; i < main.numStations; i++)
+	{
+		const auto& entry = main.Header(i);
+		const Station& station = main.stations.data[i];
+		const AggSumSquares* squares = AggregateFind<AggSumSquares>(station);
+		const AggExtremeOffsets* offsets = AggregateFind<AggExtremeOffsets>(station);
+		AggregateMinMaxCountSum data;
+		data.min = station.min;
+		data.max = station.max;
+		data.count = station.count;
+		data.sum = station.sum;
+		result.Add(String((char*)entry.name, entry.namelen), entry.hash, data, squares != nullptr ? squares->sumSquares : 0,
+			offsets != nullptr ? offsets->minOffset : ENGINE_NO_OFFSET, offsets != nullptr ? offsets->maxOffset : ENGINE_NO_OFFSET);
+	}
+	result.Sort();
+}
+
+// Every window is merged by one thread, from the maps of the threads that parsed some of it
+template <typename Station>
+struct EngineWindowMergeJob
+{
+	EngineMap<Station>** maps; // numThreads per window, null where a thread has no rows of the window
+	u32 numThreads;
+	EngineWindows* out;
+	std::atomic<u64> next{ 0 };
+};
+
+template <typename Station>
+void EngineMergeWindows(void* arg, const u32)
+{
+	EngineWindowMergeJob<Station>& job = *(EngineWindowMergeJob<Station>*)arg;
+	for (;;)
+	{
+		const u64 window = job.next.fetch_add(1, std::memory_order_relaxed);
+		if (window >= job.out->windows.size) break;
+
+		EngineMap<Station>** maps = job.maps + window * job.numThreads;
+		EngineMap<Station>* main = nullptr;
+		for (u32 i = 0; i < job.numThreads; i++)
+		{
+			if (maps[i] == nullptr) continue;
+			if (main == nullptr) main = maps[i]; // Usually the only one, a window is only split where a unit ends
+			else EngineMergeMap(*main, *maps[i]);
+		}
+		if (main != nullptr) EngineCollect(*main, job.out->windows.data[window]);
+		else job.out->windows.data[window].Init(0, 0);
+	}
+}
+
+// Parse threads that sleep between runs, the thread calling Run works on the run too
+struct EnginePool
+{
+	Vector<std::thread*> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	void (*task)(void* arg, u32 thread) = nullptr;
+	void* arg = nullptr;
+	u64 round = 0;
+	u32 running = 0;
+	bool quit = false;
+
+	void Start(const u32 workers)
+	{
+		threads.Init(workers > 0 ? workers : 1);
+		for (u32 i = 0; i < workers; i++)
+		{
+			threads.Push(new std::thread(Worker, this, i));
+		}
+	}
+
+	static void Worker(EnginePool* pool, const u32 i)
+	{
+		u64 seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(pool->mutex);
+				pool->wake.wait(lock, [&] { return pool->round != seen || pool->quit; });
+				if (pool->quit) return;
+				seen = pool->round;
+			}
+			pool->task(pool->arg, i);
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			if (--pool->running == 0) pool->done.notify_one();
+		}
+	}
+
+	void Run(void (*runTask)(void*, u32), void* runArg)
+	{
+		const u32 workers = (u32)threads.size;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			task = runTask;
+			arg = runArg;
+			running = workers;
+			round++;
+		}
+		wake.notify_all();
+		runTask(runArg, workers);
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return running == 0; });
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (u64 i = 0; i < threads.size; i++)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+		threads.size = 0;
+	}
+};
+
+using EngineStationData = AggregateMinMaxCountSum;
+using EngineStationStdDev = Aggregate<AggMin, AggMax, AggCount, AggSum, AggSumSquares>;
+using EngineStationOffsets = Aggregate<AggMin, AggMax, AggCount, AggSum, AggExtremeOffsets>;
+using EngineStationStdDevOffsets = Aggregate<AggMin, AggMax, AggCount, AggSum, AggSumSquares, AggExtremeOffsets>;
+
+struct Engine
+{
+	EngineOptions options;
+	u32 numThreads = 0;
+	Array<UnitReader> readers; // One per thread, they keep their decode buffers between runs
+	EnginePool pool;
+	std::mutex runMutex;
+
+	void Init(const EngineOptions& engineOptions)
+	{
+		options = engineOptions;
+		numThreads = options.threads > 0 ? options.threads : std::thread::hardware_concurrency() - 1;
+		if (numThreads == 0) numThreads = 1;
+		readers.InitMallocZero(numThreads);
+		pool.Start(numThreads - 1);
+	}
+
+	// Also run by the destructor, the pool's threads have to be gone before its condition variables are
+	void Free()
+	{
+		if (readers.data == nullptr) return;
+		pool.Stop();
+		for (u64 i = 0; i < readers.size; i++)
+		{
+			BlockDecoder& decoder = readers[i].decoder;
+			if (decoder.context != nullptr) ZSTD_freeDCtx(decoder.context);
+			decoder.buffer.Free();
+			decoder.names.Free();
+		}
+		readers.Free();
+		readers.data = nullptr;
+	}
+
+	~Engine()
+	{
+		Free();
+	}
+
+	// A path or glob
+	bool Run(const char* pattern, EngineResult& result)
+	{
+		Vector<const char*> patterns(1);
+		patterns.Push(pattern);
+		return Run(patterns, result);
+	}
+
+	// Every path or glob is part of one logical input, like the solutions' arguments
+	bool Run(const Vector<const char*>& patterns, EngineResult& result)
+	{
+		return RunPatterns(patterns, result.error, [&](WorkQueue& work) { return RunWork(work, result); });
+	}
+
+	// Text that's already in memory. It doesn't need a newline at the end and is never read past.
+	bool Run(const char* data, const u64 len, EngineResult& result)
+	{
+		std::lock_guard<std::mutex> lock(runMutex);
+		WorkQueue work;
+		work.units.InitMalloc(len / WorkChunkBytes(len, numThreads) + 2);
+		work.units.size = 0;
+		char* tail = PushBufferUnits(work, data, len, false, 0);
+		const bool ok = RunWork(work, result);
+		free(tail);
+		work.units.Free();
+		return ok;
+	}
+
+	// An input that's already open, for callers that resume from a checkpoint or follow a file and so change its ranges
+	bool Run(InputSet& input, const InputOptions& inputOptions, EngineResult& result)
+	{
+		return RunInput(input, inputOptions, result.error, [&](WorkQueue& work) { return RunWork(work, result); });
+	}
+
+	// Tumbling windows of windowRows rows each, for inputs in time order. Rows are counted per unit in parallel first (indexed and
+	// compressed inputs already know theirs), a prefix sum gives every unit its first row and so the windows it has rows of, and
+	// then the units are parsed like in Run with every thread keeping its own map per window.
+	bool RunWindows(const char* pattern, const u64 windowRows, EngineWindows& windows)
+	{
+		Vector<const char*> patterns(1);
+		patterns.Push(pattern);
+		return RunWindows(patterns, windowRows, windows);
+	}
+
+	bool RunWindows(const Vector<const char*>& patterns, const u64 windowRows, EngineWindows& windows)
+	{
+		return RunPatterns(patterns, windows.error, [&](WorkQueue& work) { return RunWindowsWork(work, windowRows, windows); });
+	}
+
+	bool RunWindows(InputSet& input, const InputOptions& inputOptions, const u64 windowRows, EngineWindows& windows)
+	{
+		return RunInput(input, inputOptions, windows.error, [&](WorkQueue& work) { return RunWindowsWork(work, windowRows, windows); });
+	}
+
+	template <typename RunUnits>
+	bool RunPatterns(const Vector<const char*>& patterns, const char*& error, RunUnits runUnits)
+	{
+		if (options.io == ENGINE_IO_READ) return RunRead(patterns, error, runUnits);
+
+		InputSet input;
+		if (!input.Open(patterns, options.input, numThreads))
+		{
+			input.Close();
+			error = "can't open the input";
+			return false;
+		}
+		const bool ok = RunInput(input, options.input, error, runUnits);
+		input.Close();
+		return ok;
+	}
+
+	template <typename RunUnits>
+	bool RunInput(InputSet& input, const InputOptions& inputOptions, const char*& error, RunUnits runUnits)
+	{
+		std::lock_guard<std::mutex> lock(runMutex);
+		WorkQueue work;
+		if (!input.Partition(work, inputOptions, numThreads))
+		{
+			error = "can't partition the input";
+			return false;
+		}
+		const bool ok = runUnits(work);
+		work.units.Free();
+		return ok;
+	}
+
+	// The text before its last line is split into units in place. The last line is parsed from a padded copy that has its newline,
+	// which the returned pointer is, so no load runs past data + len. Buffers that are already padded are split as they are. The
+	// units are pushed in input order, offset is that of data in the logical input.
+	char* PushBufferUnits(WorkQueue& work, const char* data, u64 len, const bool padded, u64 offset)
+	{
+		if (len >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+		{
+			data += 3;
+			len -= 3;
+			offset += 3;
+		}
+		if (len == 0) return nullptr;
+
+		u64 bodyLen = len;
+		char* tail = nullptr;
+		if (!padded)
+		{
+			bodyLen = len - 1;
+			while (bodyLen > 0 && data[bodyLen - 1] != '\n') bodyLen--;
+			const u64 tailLen = len - bodyLen;
+			tail = (char*)calloc(tailLen + 1 + ENGINE_BUFFER_PADDING, 1);
+			memcpy(tail, data + bodyLen, tailLen);
+			if (data[len - 1] != '\n') tail[tailLen] = '\n';
+		}
+
+		// At most len / WorkChunkBytes(len) + 2 units with the tail
+		const u64 chunkBytes = WorkChunkBytes(len, numThreads);
+		const char* end = data + bodyLen;
+		for (const char* pos = data; pos < end;)
+		{
+			const char* unitEnd = end;
+			if ((u64)(end - pos) > chunkBytes)
+			{
+				unitEnd = (const char*)memchr(pos + chunkBytes, '\n', end - pos - chunkBytes);
+				unitEnd = unitEnd != nullptr ? unitEnd + 1 : end;
+			}
+			PushUnit(work, (char*)pos, unitEnd, offset + (pos - data));
+			pos = unitEnd;
+		}
+		if (tail != nullptr) PushUnit(work, tail, tail + len - bodyLen + (data[len - 1] != '\n' ? 1 : 0), offset + bodyLen);
+		return tail;
+	}
+
+	static void PushUnit(WorkQueue& work, char* pos, const char* parseEnd, const u64 offset)
+	{
+		WorkUnit& unit = work.units.data[work.units.size++];
+		unit.pos = pos;
+		unit.parseEnd = parseEnd;
+		unit.lines = 0;
+		unit.bytes = parseEnd - pos;
+		unit.compressed = nullptr;
+		unit.offset = offset;
+		work.totalBytes += unit.bytes;
+	}
+
+	// ENGINE_IO_READ: whole text files read into padded buffers, then parsed like a buffer
+	template <typename RunUnits>
+	bool RunRead(const Vector<const char*>& patterns, const char*& error, RunUnits runUnits)
+	{
+		if (options.input.hasRows || options.input.hasRange)
+		{
+			error = "rows and ranges need ENGINE_IO_MAPPED";
+			return false;
+		}
+
+		StringBuffer pathBuf(1 * MB);
+		Vector<String> paths(64);
+		Vector<char*> buffers(64);
+		bool ok = true;
+		for (u64 i = 0; i < patterns.size && ok; i++)
+		{
+			ok = ExpandFilePattern(patterns.data[i], pathBuf, paths);
+			if (!ok) error = "no files match";
+		}
+
+		u64 maxUnits = 0;
+		Vector<u64> lengths(64);
+		Vector<u64> offsets(64);
+		u64 nextOffset = 0;
+		for (u64 i = 0; i < paths.size && ok; i++)
+		{
+			FileIdentity identity;
+			FileHandle file = OpenFileRead(paths[i]);
+			if (!file.Good() || !GetFileIdentity(paths[i], identity))
+			{
+				file.Close();
+				ok = false;
+				error = "can't open an input file";
+				break;
+			}
+			if (identity.size == 0)
+			{
+				file.Close();
+				continue; // Empty shards are fine, like with the mapped files
+			}
+			char* buffer = (char*)calloc(identity.size + 1 + ENGINE_BUFFER_PADDING, 1);
+			u64 len = file.Read(buffer, identity.size);
+			file.Close();
+			if (len > 0 && buffer[len - 1] != '\n') buffer[len++] = '\n';
+			buffers.Push(buffer);
+			lengths.Push(len);
+			offsets.Push(nextOffset);
+			nextOffset += identity.size;
+			maxUnits += len / WorkChunkBytes(len, numThreads) + 2;
+		}
+
+		if (ok)
+		{
+			std::lock_guard<std::mutex> lock(runMutex);
+			WorkQueue work;
+			work.units.InitMalloc(maxUnits > 0 ? maxUnits : 1);
+			work.units.size = 0;
+			for (u64 i = 0; i < buffers.size; i++)
+			{
+				PushBufferUnits(work, buffers[i], lengths[i], true, offsets[i]);
+			}
+			ok = runUnits(work);
+			work.units.Free();
+		}
+
+		for (u64 i = 0; i < buffers.size; i++)
+		{
+			free(buffers[i]);
+		}
+		free(pathBuf.data);
+		return ok;
+	}
+
+	bool RunWork(WorkQueue& work, EngineResult& result)
+	{
+		const bool offsets = (options.aggregates & ENGINE_EXTREME_OFFSETS) != 0;
+		if (options.aggregates & ENGINE_STDDEV) return offsets ? RunWorkAs<EngineStationStdDevOffsets>(work, result) : RunWorkAs<EngineStationStdDev>(work, result);
+		return offsets ? RunWorkAs<EngineStationOffsets>(work, result) : RunWorkAs<EngineStationData>(work, result);
+	}
+
+	template <typename Station>
+	bool RunWorkAs(WorkQueue& work, EngineResult& result)
+	{
+		ProgressReporter progress;
+		if (options.input.progress) progress.Start(&work);
+
+		Array<EngineThread<Station>> threads;
+		threads.InitMallocZero(numThreads);
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			threads[i].map.Init(ENGINE_MAP_INITIAL_CAPACITY);
+			threads[i].reader = &readers[i];
+		}
+		EngineJob<Station> job = { threads.data, &work };
+		pool.Run(&EngineParse<Station>, &job);
+		progress.Stop();
+
+		// Merge results
+		EngineMap<Station>& main = threads[numThreads - 1].map;
+		bool failed = threads[numThreads - 1].failed;
+		for (u32 i = 0; i < numThreads - 1; i++)
+		{
+			failed |= threads[i].failed;
+			EngineMergeMap(main, threads[i].map);
+		}
+
+		bool ok = !failed;
+		if (ok)
+		{
+			EngineCollect(main, result);
+			result.bytes = work.totalBytes;
+		}
+		else
+		{
+			result.error = "can't decompress the input";
+		}
+
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			threads[i].map.Free();
+			readers[i].ForgetPersisted();
+		}
+		threads.Free();
+		return ok;
+	}
+
+	bool RunWindowsWork(WorkQueue& work, const u64 windowRows, EngineWindows& windows)
+	{
+		if (windowRows == 0)
+		{
+			windows.error = "windows need at least one row";
+			return false;
+		}
+		const bool offsets = (options.aggregates & ENGINE_EXTREME_OFFSETS) != 0;
+		if (options.aggregates & ENGINE_STDDEV) return offsets ? RunWindowsAs<EngineStationStdDevOffsets>(work, windowRows, windows) : RunWindowsAs<EngineStationStdDev>(work, windowRows, windows);
+		return offsets ? RunWindowsAs<EngineStationOffsets>(work, windowRows, windows) : RunWindowsAs<EngineStationData>(work, windowRows, windows);
+	}
+
+	template <typename Station>
+	bool RunWindowsAs(WorkQueue& work, const u64 windowRows, EngineWindows& windows)
+	{
+		if (!work.exactLines)
+		{
+			pool.Run(&EngineCountLines, &work);
+			work.next = 0;
+		}
+		Array<u64> firstRows;
+		firstRows.InitMalloc(work.units.size > 0 ? work.units.size : 1);
+		u64 rows = 0;
+		for (u64 i = 0; i < work.units.size; i++)
+		{
+			firstRows.data[i] = rows;
+			rows += work.units.data[i].lines;
+		}
+		work.totalLines = rows;
+		work.exactLines = true;
+		windows.Init(windowRows, rows);
+		windows.bytes = work.totalBytes;
+
+		ProgressReporter progress;
+		if (options.input.progress) progress.Start(&work);
+
+		Array<EngineWindowThread<Station>> threads;
+		threads.InitMallocZero(numThreads);
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			threads[i].windows.Init(16);
+			threads[i].mapCapacity = 4;
+			while (threads[i].mapCapacity < ENGINE_MAP_INITIAL_CAPACITY && threads[i].mapCapacity < windowRows * 2) threads[i].mapCapacity *= 2;
+			threads[i].reader = &readers[i];
+		}
+		EngineWindowJob<Station> job = { threads.data, &work, firstRows.data, windowRows };
+		pool.Run(&EngineParseWindows<Station>, &job);
+		progress.Stop();
+
+		bool failed = false;
+		Array<EngineMap<Station>*> maps;
+		maps.InitMallocZero(windows.windows.size * numThreads + 1);
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			failed |= threads[i].failed;
+			for (u64 j = 0; j < threads[i].windows.size; j++)
+			{
+				EngineWindowMap<Station>& w = threads[i].windows.data[j];
+				maps.data[w.window * numThreads + i] = &w.map;
+			}
+		}
+
+		if (!failed)
+		{
+			EngineWindowMergeJob<Station> merge;
+			merge.maps = maps.data;
+			merge.numThreads = numThreads;
+			merge.out = &windows;
+			pool.Run(&EngineMergeWindows<Station>, &merge);
+		}
+		else
+		{
+			windows.error = "can't decompress the input";
+		}
+
+		for (u32 i = 0; i < numThreads; i++)
+		{
+			for (u64 j = 0; j < threads[i].windows.size; j++)
+			{
+				threads[i].windows.data[j].map.Free();
+			}
+			free(threads[i].windows.data);
+			readers[i].ForgetPersisted();
+		}
+		threads.Free();
+		maps.Free();
+		firstRows.Free();
+		return !failed;
+	}
+};
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+#include <algorithm>
+
+#include "../base/simd.h"
+#include "../base/vector.h"
+
+// Exact per-station distributions of the scaled temperatures, which are always -999..999, for percentiles. A station starts out
+// as a short list of its readings and only once that passes HIST_MAX_LIST becomes a two-level histogram: a slot for each of 32
+// blocks of 64 u32 buckets, where blocks are allocated once a reading lands in them. With 10k+ stations most of them only see a
+// few readings per thread, so memory follows what was actually read instead of 8 KB for every station.
+// Stations that no query wants a distribution for use slot row 0, which points every bucket at block 0, a scratch block that is
+// never read, so they don't need a branch of their own in the per-line update.
+
+constexpr s32 HIST_MIN_TEMP = -999;
+constexpr u32 HIST_BUCKETS = 1999;
+constexpr u32 HIST_BLOCK_BUCKETS = 64;
+constexpr u32 HIST_BLOCKS = (HIST_BUCKETS + HIST_BLOCK_BUCKETS - 1) / HIST_BLOCK_BUCKETS;
+constexpr u32 HIST_FLAT_BUCKETS = HIST_BLOCKS * HIST_BLOCK_BUCKETS;
+constexpr u32 HIST_UNALLOCATED = ~0u;
+constexpr u16 HIST_FIRST_LIST = 8;
+constexpr u16 HIST_MAX_LIST = 512; // 1 KB of readings, about what the blocks they cover take
+
+struct HistogramRef
+{
+	u32 offset;   // Into values while listed, into slots once it has blocks
+	u16 used;
+	u16 capacity; // 0 once it has blocks
+};
+
+struct HistogramStore
+{
+	Vector<HistogramRef> refs; // Indexed like the map's stations
+	Vector<s16> values;        // Lists, a list that grows is copied to the end and the old one is abandoned
+	Vector<u32> slots;         // HIST_BLOCKS per station with blocks, row 0 is the scratch row
+	Vector<u32> buckets;       // HIST_BLOCK_BUCKETS per block, block 0 is the scratch block
+
+	void Init(const u64 initialStations)
+	{
+		refs.Init(initialStations);
+		values.Init(initialStations * HIST_FIRST_LIST);
+		slots.InitZero(initialStations * HIST_BLOCKS);
+		slots.size = HIST_BLOCKS;
+		buckets.InitZero(initialStations * HIST_BLOCK_BUCKETS);
+		buckets.size = HIST_BLOCK_BUCKETS;
+	}
+
+	void Free()
+	{
+		refs.~Vector();
+		values.~Vector();
+		slots.~Vector();
+		buckets.~Vector();
+	}
+
+	u32 NumStations() const
+	{
+		return (u32)refs.size;
+	}
+
+	// Stations have to be added in the same order as the map hands out their indices
+	void AddStation(const bool tracked)
+	{
+		HistogramRef r = {};
+		if (tracked)
+		{
+			r.offset = Reserve(values, HIST_FIRST_LIST);
+			r.capacity = HIST_FIRST_LIST;
+		}
+		refs.Push(r);
+	}
+
+	bool Tracked(const u32 station) const
+	{
+		const HistogramRef& r = refs.data[station];
+		return r.capacity != 0 || r.offset != 0;
+	}
+
+	template <typename T>
+	static u32 Reserve(Vector<T>& v, const u64 count)
+	{
+		u64 reserved = v.reserved;
+		while (v.size + count > reserved) reserved *= 2;
+		if (reserved != v.reserved) v._reserve(reserved);
+		const u32 offset = (u32)v.size;
+		v.size += count;
+		return offset;
+	}
+
+	u32 NewBlock()
+	{
+		const u32 offset = Reserve(buckets, HIST_BLOCK_BUCKETS);
+		memset(buckets.data + offset, 0, HIST_BLOCK_BUCKETS * sizeof(u32));
+		return offset / HIST_BLOCK_BUCKETS;
+	}
+
+	__forceinline void AddToBlocks(const u32 row, const s16 temp)
+	{
+		const u32 bucket = (u32)(temp - HIST_MIN_TEMP);
+		u32& slot = slots.data[row + bucket / HIST_BLOCK_BUCKETS];
+		if (slot == HIST_UNALLOCATED) slot = NewBlock();
+		buckets.data[slot * HIST_BLOCK_BUCKETS + bucket % HIST_BLOCK_BUCKETS]++;
+	}
+
+	// A full list moves to a list twice the size, or to blocks past HIST_MAX_LIST
+	void Spill(HistogramRef& r)
+	{
+		if (r.capacity < HIST_MAX_LIST)
+		{
+			const u32 offset = Reserve(values, r.capacity * 2u);
+			memcpy(values.data + offset, values.data + r.offset, r.used * sizeof(s16));
+			r.offset = offset;
+			r.capacity *= 2;
+			return;
+		}
+		ToBlocks(r);
+	}
+
+	void ToBlocks(HistogramRef& r)
+	{
+		const u32 row = Reserve(slots, HIST_BLOCKS);
+		for (u32 i = 0; i < HIST_BLOCKS; i++)
+		{
+			slots.data[row + i] = HIST_UNALLOCATED;
+		}
+		for (u32 i = 0; i < r.used; i++)
+		{
+			AddToBlocks(row, values.data[r.offset + i]);
+		}
+		r.offset = row;
+		r.used = 0;
+		r.capacity = 0;
+	}
+
+	__forceinline void Add(const u32 station, const s16 temp)
+	{
+		HistogramRef& r = refs.data[station];
+		if (r.capacity != 0)
+		{
+			if (r.used == r.capacity) Spill(r);
+			if (r.capacity != 0)
+			{
+				values.data[r.offset + r.used++] = temp;
+				return;
+			}
+		}
+		AddToBlocks(r.offset, temp);
+	}
+
+	// Adds the other store's station to ours, block by block once both have blocks
+	void Merge(const u32 station, const HistogramStore& other, const u32 otherStation)
+	{
+		if (!Tracked(station)) return;
+		const HistogramRef& from = other.refs.data[otherStation];
+		if (from.capacity != 0 || from.offset == 0)
+		{
+			for (u32 i = 0; i < from.used; i++)
+			{
+				Add(station, other.values.data[from.offset + i]);
+			}
+			return;
+		}
+
+		HistogramRef& r = refs.data[station];
+		if (r.capacity != 0) ToBlocks(r);
+		for (u32 i = 0; i < HIST_BLOCKS; i++)
+		{
+			const u32 block = other.slots.data[from.offset + i];
+			if (block == HIST_UNALLOCATED) continue;
+			if (slots.data[r.offset + i] == HIST_UNALLOCATED) slots.data[r.offset + i] = NewBlock();
+			SIMD_AddU32(buckets.data + slots.data[r.offset + i] * HIST_BLOCK_BUCKETS, other.buckets.data + block * HIST_BLOCK_BUCKETS, HIST_BLOCK_BUCKETS);
+		}
+	}
+
+	// Adds the station into a flat HIST_FLAT_BUCKETS array
+	void AddTo(u32* flat, const u32 station) const
+	{
+		const HistogramRef& r = refs.data[station];
+		if (r.capacity != 0)
+		{
+			for (u32 i = 0; i < r.used; i++)
+			{
+				flat[values.data[r.offset + i] - HIST_MIN_TEMP]++;
+			}
+			return;
+		}
+		for (u32 i = 0; i < HIST_BLOCKS && r.offset != 0; i++)
+		{
+			const u32 block = slots.data[r.offset + i];
+			if (block == HIST_UNALLOCATED) continue;
+			SIMD_AddU32(flat + i * HIST_BLOCK_BUCKETS, buckets.data + block * HIST_BLOCK_BUCKETS, HIST_BLOCK_BUCKETS);
+		}
+	}
+
+	// Sorts a listed station's readings in place, so only once the scan is done
+	s16 ValueAtRank(const u32 station, const u64 rank);
+};
+
+// The scaled temperature at a 1-based rank, block(i) gives the buckets of block i or nullptr if it's empty.
+// Whole blocks are skipped by their sum.
+template <typename GetBlock>
+s16 HistogramValueAtRank(GetBlock block, u64 rank)
+{
+	for (u32 i = 0; i < HIST_BLOCKS; i++)
+	{
+		const u32* buckets = block(i);
+		if (buckets == nullptr) continue;
+		const u64 inBlock = SIMD_SumU32(buckets, HIST_BLOCK_BUCKETS);
+		if (rank > inBlock)
+		{
+			rank -= inBlock;
+			continue;
+		}
+		for (u32 j = 0; j < HIST_BLOCK_BUCKETS; j++)
+		{
+			if (rank <= buckets[j]) return (s16)(HIST_MIN_TEMP + (s32)(i * HIST_BLOCK_BUCKETS + j));
+			rank -= buckets[j];
+		}
+	}
+	return (s16)(HIST_MIN_TEMP + (s32)HIST_BUCKETS - 1);
+}
+
+inline s16 HistogramStore::ValueAtRank(const u32 station, const u64 rank)
+{
+	const HistogramRef& r = refs.data[station];
+	if (r.capacity != 0)
+	{
+		s16* listed = values.data + r.offset;
+		std::nth_element(listed, listed + (rank - 1), listed + r.used);
+		return listed[rank - 1];
+	}
+	return HistogramValueAtRank([&](const u32 i) -> const u32* {
+		const u32 block = slots.data[r.offset + i];
+		return block == HIST_UNALLOCATED ? nullptr : buckets.data + block * HIST_BLOCK_BUCKETS;
+	}, rank);
+}
+
+// Nearest rank: the smallest value with at least p% of the readings at or below it, p is in thousandths of a percent
+inline u64 PercentileRank(const u32 pMilli, const u64 count)
+{
+	const u64 rank = ((u64)pMilli * count + 99999) / 100000;
+	return rank > 0 ? rank : 1;
+}
@@ -0,0 +1,579 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+#include "chunk_index.h"
+#include "compressed.h"
+
+// A line aligned byte range of one of the input files, or a block of a compressed file that the thread taking it decompresses
+struct WorkUnit
+{
+	char* pos;
+	const char* parseEnd;
+	u64 lines; // Only known when the file has a chunk index or is compressed
+	u64 bytes;
+	const CompressedFile* compressed;
+	u64 block;
+	u64 skipLines; // Lines at the start of the block that are outside of the requested rows
+	u64 offset; // Of pos in the logical input, for compressed units of the decompressed block's first byte
+};
+
+// Every thread pulls (file, chunk) units from the same list so a mix of many small files and a few huge ones still keeps all cores busy
+struct WorkQueue
+{
+	Array<WorkUnit> units;
+	std::atomic<u64> next{ 0 };
+	std::atomic<u64> bytesDone{ 0 };
+	std::atomic<u64> linesDone{ 0 };
+	u64 totalBytes = 0;
+	u64 totalLines = 0;
+	bool exactLines = false;
+
+	WorkUnit* Take()
+	{
+		const u64 unit = next.fetch_add(1, std::memory_order_relaxed);
+		if (unit >= units.size) return nullptr;
+		return &units[unit];
+	}
+
+	void Done(const WorkUnit& unit)
+	{
+		bytesDone.fetch_add(unit.bytes, std::memory_order_relaxed);
+		linesDone.fetch_add(unit.lines, std::memory_order_relaxed);
+	}
+};
+
+struct InputOptions
+{
+	bool useIndex = true;
+	bool buildIndex = false;
+	u64 indexChunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
+	bool hasRows = false;
+	u64 rowBegin = 0; // Rows of the logical input (all files in order), end is exclusive
+	u64 rowEnd = 0;
+	bool hasRange = false;
+	u64 rangeBegin = 0; // Bytes of the logical input, the lines that start in [begin, end) are parsed
+	u64 rangeEnd = 0;
+	bool progress = false;
+	const char* cacheDir = nullptr; // Result cache, see result_cache.h
+	bool cacheHash = false;
+	const char* checkpointPath = nullptr; // Incremental aggregation, see checkpoint.h
+	const char* partialPath = nullptr; // Exact aggregates to a file instead of printing them, see partial_aggregate.h
+};
+
+// Consumes the input options shared by the engines, returns false if argv[i] isn't one of them
+inline bool ParseInputOption(int argc, char* argv[], int& i, InputOptions& options, bool& error)
+{
+	if (_stricmp(argv[i], "-noindex") == 0)
+	{
+		options.useIndex = false;
+	}
+	else if (_stricmp(argv[i], "-buildindex") == 0)
+	{
+		options.buildIndex = true;
+	}
+	else if (_stricmp(argv[i], "-indexmb") == 0)
+	{
+		i++;
+		if (i >= argc)
+		{
+			printf("missing indexmb arg value\n");
+			error = true;
+			return true;
+		}
+		options.indexChunkBytes = strtoull(argv[i], nullptr, 10) * MB;
+		if (options.indexChunkBytes == 0) options.indexChunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
+	}
+	else if (_stricmp(argv[i], "-rows") == 0)
+	{
+		i++;
+		char* end = nullptr;
+		if (i < argc)
+		{
+			options.rowBegin = strtoull(argv[i], &end, 10);
+		}
+		if (i >= argc || *end != ':')
+		{
+			printf("-rows expects start:end\n");
+			error = true;
+			return true;
+		}
+		options.rowEnd = strtoull(end + 1, nullptr, 10);
+		options.hasRows = true;
+	}
+	else if (_stricmp(argv[i], "-range") == 0)
+	{
+		i++;
+		char* end = nullptr;
+		if (i < argc)
+		{
+			options.rangeBegin = strtoull(argv[i], &end, 10);
+		}
+		if (i >= argc || *end != ':')
+		{
+			printf("-range expects start:end\n");
+			error = true;
+			return true;
+		}
+		options.rangeEnd = end[1] == '\0' ? ~0ull : strtoull(end + 1, nullptr, 10); // start: runs to the end of the input
+		options.hasRange = true;
+	}
+	else if (_stricmp(argv[i], "-progress") == 0)
+	{
+		options.progress = true;
+	}
+	else if (_stricmp(argv[i], "-cache") == 0)
+	{
+		i++;
+		if (i >= argc)
+		{
+			printf("missing cache dir arg value\n");
+			error = true;
+			return true;
+		}
+		options.cacheDir = argv[i];
+	}
+	else if (_stricmp(argv[i], "-cachehash") == 0)
+	{
+		options.cacheHash = true;
+	}
+	else if (_stricmp(argv[i], "-checkpoint") == 0)
+	{
+		i++;
+		if (i >= argc)
+		{
+			printf("missing checkpoint arg value\n");
+			error = true;
+			return true;
+		}
+		options.checkpointPath = argv[i];
+	}
+	else if (_stricmp(argv[i], "-partial") == 0)
+	{
+		i++;
+		if (i >= argc)
+		{
+			printf("missing partial arg value\n");
+			error = true;
+			return true;
+		}
+		options.partialPath = argv[i];
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+inline char* SkipBOM(const MappedFileHandle& file)
+{
+	if (file.length >= 3 && file.data[0] == (char)0xEF && file.data[1] == (char)0xBB && file.data[2] == (char)0xBF)
+	{
+		return file.data + 3;
+	}
+	return file.data;
+}
+
+// Chunks are sized so each thread gets a bunch of them to balance out uneven files, but not so small that we pay much for the atomic
+inline u64 WorkChunkBytes(const u64 totalBytes, const u32 numThreads)
+{
+	u64 chunkBytes = totalBytes / (numThreads * 16ull);
+	if (chunkBytes < 1 * MB) chunkBytes = 1 * MB;
+	if (chunkBytes > 64 * MB) chunkBytes = 64 * MB;
+	return chunkBytes;
+}
+
+struct InputFile
+{
+	String path;
+	MappedFileHandle file;
+	ChunkIndex index;
+	CompressedFile compressed;
+	bool ranged; // Set by a checkpoint or -range, only [rangeBegin, rangeEnd) gets parsed
+	u64 rangeBegin;
+	u64 rangeEnd;
+};
+
+// All of the paths and globs given to an engine, treated as one logical input
+struct InputSet
+{
+	StringBuffer pathBuf;
+	Vector<String> paths;
+	Array<InputFile> files;
+	u64 totalBytes = 0;
+
+	bool Open(const Vector<const char*>& patterns, const InputOptions& options, const u32 numThreads)
+	{
+		pathBuf.Init(1 * MB);
+		paths.Init(64);
+		for (u64 i = 0; i < patterns.size; i++)
+		{
+			if (!ExpandFilePattern(patterns.data[i], pathBuf, paths))
+			{
+				printf("no files match %s\n", patterns.data[i]);
+				return false;
+			}
+		}
+
+		files.InitMallocZero(paths.size);
+		for (u64 i = 0; i < paths.size; i++)
+		{
+			InputFile& input = files[i];
+			input.file = MappedFileHandle(); // Zeroed memory would be fd 0, which OpenRead would close
+			input.path = paths[i];
+			if (!input.file.OpenRead(paths[i]))
+			{
+				FileIdentity identity;
+				if (GetFileIdentity(paths[i], identity) && identity.size == 0) continue; // Empty shards are fine, they just don't contribute anything
+				printf("can't open %s\n", (const char*)paths[i]);
+				return false;
+			}
+			totalBytes += input.file.length;
+
+			if (IsCompressedFile(input.file)) // Compressed files carry their own block index
+			{
+				if (input.compressed.Open(input.file)) continue;
+				printf("%s is a compressed file with a missing or damaged block index\n", (const char*)paths[i]);
+				return false;
+			}
+			if (!options.useIndex && !options.buildIndex) continue;
+
+			String indexPath = pathBuf.PushStringF(input.path, ".idx");
+			const char* dataStart = SkipBOM(input.file);
+			if (input.index.Load(indexPath, input.path, input.file, dataStart - input.file.data)) continue;
+
+			if (options.buildIndex)
+			{
+				BuildChunkIndex(input.index, input.file.data, dataStart - input.file.data, input.file.length, options.indexChunkBytes, numThreads);
+				if (!input.index.Write(indexPath, input.path))
+				{
+					printf("failed to write %s\n", (const char*)indexPath);
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// Only needed by long running processes, the solutions just exit
+	void Close()
+	{
+		for (u64 i = 0; i < files.size; i++)
+		{
+			files[i].file.Close();
+			free(files[i].index.entries.data); // InputFiles live in a malloced array so nothing runs their destructors
+		}
+		files.Free();
+		free(pathBuf.data);
+		pathBuf.data = nullptr;
+	}
+
+	bool AllIndexed() const
+	{
+		for (u64 i = 0; i < files.size; i++)
+		{
+			const InputFile& input = files.data[i];
+			if (input.file.Good() && (input.ranged || (!input.index.Good() && !input.compressed.Good()))) return false;
+		}
+		return true;
+	}
+
+	void PushIndexedUnits(WorkQueue& work, u64& numUnits, InputFile& input, const u64 rowBegin, const u64 rowEnd, const u64 fileOffset)
+	{
+		const ChunkIndex& index = input.index;
+		for (u64 c = index.FindChunkForRow(rowBegin); c < index.entries.size; c++)
+		{
+			const ChunkIndexEntry& e = index.entries.data[c];
+			const u64 chunkRowEnd = e.firstLine + e.lines;
+			if (e.firstLine >= rowEnd) break;
+			if (chunkRowEnd <= rowBegin || e.lines == 0) continue;
+
+			WorkUnit& unit = work.units[numUnits++];
+			const u64 first = rowBegin > e.firstLine ? rowBegin : e.firstLine;
+			const u64 last = rowEnd < chunkRowEnd ? rowEnd : chunkRowEnd;
+			unit.pos = first == e.firstLine ? input.file.data + e.offset : index.FindRow(input.file.data, first);
+			unit.parseEnd = last == chunkRowEnd ? input.file.data + index.ChunkEnd(c) : index.FindRow(input.file.data, last);
+			unit.lines = last - first;
+			unit.bytes = unit.parseEnd - unit.pos;
+			unit.compressed = nullptr;
+			unit.offset = fileOffset + (unit.pos - input.file.data);
+			work.totalLines += unit.lines;
+			work.totalBytes += unit.bytes;
+		}
+	}
+
+	void PushCompressedUnits(WorkQueue& work, u64& numUnits, const InputFile& input, const u64 rowBegin, const u64 rowEnd, const u64 fileOffset)
+	{
+		const CompressedFile& compressed = input.compressed;
+		const u64 firstBlock = compressed.FindBlockForRow(rowBegin);
+		u64 blockOffset = fileOffset; // Blocks are the decompressed text in order
+		for (u64 b = 0; b < firstBlock; b++)
+		{
+			blockOffset += compressed.blocks[b].rawBytes;
+		}
+		for (u64 b = firstBlock; b < compressed.trailer->numBlocks; blockOffset += compressed.blocks[b].rawBytes, b++)
+		{
+			const CompressedBlockEntry& e = compressed.blocks[b];
+			const u64 blockRowEnd = e.firstLine + e.lines;
+			if (e.firstLine >= rowEnd) break;
+			if (blockRowEnd <= rowBegin || e.lines == 0) continue;
+
+			WorkUnit& unit = work.units[numUnits++];
+			const u64 first = rowBegin > e.firstLine ? rowBegin : e.firstLine;
+			const u64 last = rowEnd < blockRowEnd ? rowEnd : blockRowEnd;
+			unit.pos = nullptr;
+			unit.parseEnd = nullptr;
+			unit.compressed = &compressed;
+			unit.block = b;
+			unit.skipLines = first - e.firstLine;
+			unit.lines = last - first;
+			unit.bytes = e.rawBytes;
+			unit.offset = blockOffset;
+			work.totalLines += unit.lines;
+			work.totalBytes += unit.bytes;
+		}
+	}
+
+	void PushSeekedUnits(WorkQueue& work, u64& numUnits, const InputFile& input, const u64 chunkBytes, const u64 fileOffset)
+	{
+		char* fileEnd = input.ranged ? input.file.data + input.rangeEnd : &input.file.data[input.file.length];
+		char* pos = input.ranged ? input.file.data + input.rangeBegin : SkipBOM(input.file);
+		while (pos < fileEnd)
+		{
+			WorkUnit& unit = work.units[numUnits++];
+			unit.pos = pos;
+			unit.lines = 0;
+			unit.offset = fileOffset + (pos - input.file.data);
+			if ((u64)(fileEnd - pos) <= chunkBytes)
+			{
+				pos = fileEnd;
+			}
+			else
+			{
+				pos += chunkBytes;
+				// No matter what kind of prefetching I try it just doesn't seem to beat default paging on windows
+				// PrefetchVirtualMemory(file.data, 64 * MB, 4 * MB);
+				SIMD_SeekToChar(pos, '\n');
+				pos++;
+			}
+			unit.parseEnd = pos;
+			unit.bytes = unit.parseEnd - unit.pos;
+			unit.compressed = nullptr;
+			work.totalBytes += unit.bytes;
+		}
+	}
+
+	// Restricts every file to its part of a byte range of the logical input. Both ends move forward to a line start, so ranges
+	// that tile the input give every line to exactly one of them, which is what lets separate processes split up an input.
+	bool ApplyByteRange(const InputOptions& options)
+	{
+		if (options.hasRows || options.checkpointPath != nullptr)
+		{
+			printf("-range can't be combined with -rows or -checkpoint\n");
+			return false;
+		}
+
+		u64 base = 0;
+		for (u64 i = 0; i < files.size; i++)
+		{
+			InputFile& input = files[i];
+			if (!input.file.Good()) continue;
+			if (input.compressed.Good())
+			{
+				printf("-range only works on text files, %s is compressed\n", (const char*)input.path);
+				return false;
+			}
+
+			const u64 dataStart = SkipBOM(input.file) - input.file.data;
+			auto lineStart = [&](const u64 logical) -> u64
+			{
+				const u64 offset = logical > base ? logical - base : 0;
+				if (offset <= dataStart) return dataStart;
+				if (offset >= input.file.length) return input.file.length;
+				if (input.file.data[offset - 1] == '\n') return offset;
+				const char* newline = (const char*)memchr(input.file.data + offset, '\n', input.file.length - offset);
+				return newline != nullptr ? newline - input.file.data + 1 : input.file.length;
+			};
+			input.ranged = true;
+			input.rangeBegin = lineStart(options.rangeBegin);
+			input.rangeEnd = lineStart(options.rangeEnd);
+			if (input.rangeEnd < input.rangeBegin) input.rangeEnd = input.rangeBegin;
+			base += input.file.length;
+		}
+		return true;
+	}
+
+	// Files with an index are split on its boundaries without touching the data, the rest seek to line ends
+	bool Partition(WorkQueue& work, const InputOptions& options, const u32 numThreads)
+	{
+		if (options.hasRange && !ApplyByteRange(options)) return false;
+		if (options.hasRows && !AllIndexed())
+		{
+			printf("-rows needs a chunk index for every input file (run once with -buildindex)\n");
+			return false;
+		}
+
+		u64 partitionBytes = 0;
+		for (u64 i = 0; i < files.size; i++)
+		{
+			partitionBytes += files[i].ranged ? files[i].rangeEnd - files[i].rangeBegin : files[i].file.length;
+		}
+		const u64 chunkBytes = WorkChunkBytes(partitionBytes, numThreads);
+		u64 maxUnits = 0;
+		for (u64 i = 0; i < files.size; i++)
+		{
+			if (files[i].compressed.Good()) maxUnits += files[i].compressed.trailer->numBlocks;
+			else maxUnits += files[i].index.Good() && !files[i].ranged ? files[i].index.entries.size : files[i].file.length / chunkBytes + 1;
+		}
+
+		work.units.InitMalloc(maxUnits > 0 ? maxUnits : 1);
+		work.exactLines = AllIndexed();
+		u64 numUnits = 0;
+		u64 rowBase = 0;
+		u64 nextFileOffset = 0; // Logical offsets are like -range's, compressed files count their decompressed text
+		for (u64 i = 0; i < files.size; i++)
+		{
+			InputFile& input = files[i];
+			if (!input.file.Good()) continue;
+			const u64 fileOffset = nextFileOffset;
+			nextFileOffset += input.compressed.Good() ? input.compressed.trailer->rawBytes : input.file.length;
+
+			if ((input.index.Good() || input.compressed.Good()) && !input.ranged)
+			{
+				const u64 fileRows = input.compressed.Good() ? input.compressed.trailer->totalLines : input.index.header.totalLines;
+				u64 rowBegin = 0;
+				u64 rowEnd = fileRows;
+				if (options.hasRows)
+				{
+					rowBegin = options.rowBegin > rowBase ? options.rowBegin - rowBase : 0;
+					rowEnd = options.rowEnd > rowBase ? options.rowEnd - rowBase : 0;
+					if (rowEnd > fileRows) rowEnd = fileRows;
+				}
+				if (rowBegin < rowEnd && input.compressed.Good())
+				{
+					PushCompressedUnits(work, numUnits, input, rowBegin, rowEnd, fileOffset);
+				}
+				else if (rowBegin < rowEnd)
+				{
+					PushIndexedUnits(work, numUnits, input, rowBegin, rowEnd, fileOffset);
+				}
+				rowBase += fileRows;
+			}
+			else
+			{
+				PushSeekedUnits(work, numUnits, input, chunkBytes, fileOffset);
+			}
+		}
+		work.units.size = numUnits;
+
+		return true;
+	}
+};
+
+// What a thread holds on to while parsing units, compressed blocks are decompressed into its own buffer
+struct UnitReader
+{
+	BlockDecoder decoder;
+
+	// Sets the range of text to parse for a unit
+	bool Begin(const WorkUnit& unit, char*& pos, const char*& parseEnd)
+	{
+		if (unit.compressed == nullptr)
+		{
+			pos = unit.pos;
+			parseEnd = unit.parseEnd;
+			return true;
+		}
+
+		const char* blockEnd;
+		if (!decoder.Decode(*unit.compressed, unit.block, pos, blockEnd)) return false;
+
+		parseEnd = blockEnd;
+		if (unit.skipLines > 0 || unit.lines < unit.compressed->blocks[unit.block].lines)
+		{
+			for (u64 i = 0; i < unit.skipLines; i++)
+			{
+				pos = (char*)memchr(pos, '\n', blockEnd - pos) + 1;
+			}
+			char* last = pos;
+			for (u64 i = 0; i < unit.lines; i++)
+			{
+				last = (char*)memchr(last, '\n', blockEnd - last) + 1;
+			}
+			parseEnd = last;
+		}
+		return true;
+	}
+
+	// Logical input offset of a line of the unit minus its address, the same for every line of the unit after Begin
+	u64 OffsetBase(const WorkUnit& unit) const
+	{
+		return unit.offset - (u64)(unit.compressed != nullptr ? decoder.buffer.data : unit.pos);
+	}
+
+	// Keys that point into the text have to be copied if the text is a decode buffer that the next block will overwrite
+	bool NeedsCopy(const char* name) const
+	{
+		return decoder.Owns(name);
+	}
+
+	String Persist(const char* name, const u64 len)
+	{
+		return decoder.Persist(name, len);
+	}
+
+	// Persisted names are kept until this, for threads that parse more than one input over their lifetime
+	void ForgetPersisted()
+	{
+		decoder.names.Clear();
+	}
+};
+
+// Prints how far along the parse is to stderr, in exact rows when every input is indexed
+struct ProgressReporter
+{
+	std::thread* thread = nullptr;
+	std::atomic<bool> stop{ false };
+
+	static void Report(const WorkQueue* work)
+	{
+		if (work->exactLines)
+		{
+			const u64 lines = work->linesDone.load(std::memory_order_relaxed);
+			fprintf(stderr, "\r%.1f%% (%llu / %llu rows)", work->totalLines ? 100.0 * lines / work->totalLines : 100.0, (unsigned long long)lines, (unsigned long long)work->totalLines);
+		}
+		else
+		{
+			const u64 bytes = work->bytesDone.load(std::memory_order_relaxed);
+			fprintf(stderr, "\r%.1f%% (%.1f / %.1f MB)", work->totalBytes ? 100.0 * bytes / work->totalBytes : 100.0, (double)bytes / MB, (double)work->totalBytes / MB);
+		}
+	}
+
+	void Start(const WorkQueue* work)
+	{
+		thread = new std::thread([this, work]()
+		{
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				Report(work);
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			}
+			Report(work);
+			fprintf(stderr, "\n");
+		});
+	}
+
+	void Stop()
+	{
+		if (thread == nullptr) return;
+		stop = true;
+		thread->join();
+		delete thread;
+		thread = nullptr;
+	}
+};
@@ -0,0 +1,374 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+
+// Exact per-station aggregates of part of an input, written by the threaded solutions with -partial and combined by tools/brc_merge.
+// Unlike the printed {name=min/mean/max} nothing is rounded, so merging the partials of any split of an input gives exactly the
+// output of one run over all of it. Stations are sorted by name in output order, so any number of files can be merged in one
+// streaming pass that only ever holds a buffer per file.
+//
+//   [PartialHeader]
+//   [PartialRecord][name bytes]    numStations times, sorted by name
+//   [PartialTrailer]               CRC32C of everything between header and trailer
+
+constexpr char PARTIAL_MAGIC[8] = { '1', 'B', 'R', 'C', 'P', 'A', 'G', '\0' };
+constexpr u32 PARTIAL_VERSION = 1;
+constexpr u64 PARTIAL_WRITE_BUFFER_BYTES = 1 * MB;
+constexpr u32 PARTIAL_MAX_NAME_BYTES = 4 * KB; // The challenge allows 100, anything this long is a corrupt file
+
+struct PartialHeader
+{
+	char magic[8];
+	u32 version;
+	u32 reserved;
+};
+static_assert(sizeof(PartialHeader) == 16, "PartialHeader is written to disk as-is");
+
+struct PartialRecord
+{
+	s64 sum;   // Tenths of a degree
+	u64 count; // u64 so merging thousands of partials can't overflow
+	s16 min;
+	s16 max;
+	u32 nameLen;
+
+	void Merge(const PartialRecord& other)
+	{
+		if (other.min < min) min = other.min;
+		if (other.max > max) max = other.max;
+		count += other.count;
+		sum += other.sum;
+	}
+};
+static_assert(sizeof(PartialRecord) == 24, "PartialRecord is written to disk as-is");
+
+struct PartialTrailer
+{
+	u64 numStations;
+	u64 totalRows;
+	u32 crc;
+	u32 reserved;
+};
+static_assert(sizeof(PartialTrailer) == 24, "PartialTrailer is written to disk as-is");
+
+// Streams stations out in name order through a fixed buffer, the file only shows up under its name once Close succeeded
+struct PartialWriter
+{
+	FileHandle fh;
+	StringBuffer paths;
+	String path;
+	String tempPath;
+	char* buffer = nullptr;
+	u64 used = 0;
+	PartialTrailer trailer = {};
+	bool good = false;
+
+	bool Open(const char* outputPath)
+	{
+		paths.Init(strlen(outputPath) * 2 + 16);
+		path = paths.PushStringF(outputPath);
+		tempPath = paths.PushStringF(outputPath, ".tmp");
+		fh = OpenFileWrite(tempPath);
+		if (!fh.Good()) return false;
+
+		buffer = (char*)malloc(PARTIAL_WRITE_BUFFER_BYTES);
+		used = 0;
+		trailer = {};
+		PartialHeader h = {};
+		memcpy(h.magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC));
+		h.version = PARTIAL_VERSION;
+		good = fh.Write(&h, sizeof(h));
+		return good;
+	}
+
+	bool Flush()
+	{
+		if (used > 0)
+		{
+			trailer.crc = SIMD_Crc32C(trailer.crc, buffer, used);
+			good = good && fh.Write(buffer, used);
+			used = 0;
+		}
+		return good;
+	}
+
+	void Append(const void* data, const u64 bytes)
+	{
+		if (used + bytes > PARTIAL_WRITE_BUFFER_BYTES) Flush();
+		memcpy(buffer + used, data, bytes);
+		used += bytes;
+	}
+
+	// Stations have to come in name order
+	void Push(const String& name, PartialRecord record)
+	{
+		assert(name.len > 0 && name.len <= PARTIAL_MAX_NAME_BYTES);
+		record.nameLen = (u32)name.len;
+		Append(&record, sizeof(record));
+		Append(name.data, name.len);
+		trailer.numStations++;
+		trailer.totalRows += record.count;
+	}
+
+	bool Close()
+	{
+		const bool flushed = Flush() && fh.Write(&trailer, sizeof(trailer));
+		fh.Close();
+		free(buffer);
+		buffer = nullptr;
+		const bool renamed = flushed && RenameFileOverwrite(tempPath, path);
+		free(paths.data);
+		return renamed;
+	}
+};
+
+// Writes the results of a solution, getStation(i, name, record) fills in station i of n in whatever order the solution keeps them
+template <typename GetStation>
+bool WritePartialAggregate(const char* path, const u64 numStations, GetStation getStation)
+{
+	Array<u64> order;
+	order.InitMalloc(numStations > 0 ? numStations : 1);
+	Array<String> names;
+	names.InitMalloc(numStations > 0 ? numStations : 1);
+	for (u64 i = 0; i < numStations; i++)
+	{
+		PartialRecord record;
+		getStation(i, names.data[i], record);
+		order.data[i] = i;
+	}
+	std::sort(order.data, order.data + numStations,
+		[&](const u64 a, const u64 b) {
+			return names.data[a] < names.data[b];
+		});
+
+	PartialWriter writer;
+	bool good = writer.Open(path);
+	for (u64 i = 0; i < numStations && good; i++)
+	{
+		String name;
+		PartialRecord record = {};
+		getStation(order.data[i], name, record);
+		writer.Push(name, record);
+	}
+	good = writer.Close() && good;
+	order.Free();
+	names.Free();
+	return good;
+}
+
+// Reads stations back one at a time through a fixed buffer, the name of the current station stays valid until the next call
+struct PartialReader
+{
+	FileHandle fh;
+	char* buffer = nullptr;
+	u64 bufferBytes = 0;
+	u64 pos = 0;
+	u64 end = 0;
+	u64 recordBytesLeft = 0; // Between the header and the trailer
+	u64 numStations = 0;
+	u64 totalRows = 0;
+	u32 crc = 0;
+	bool corrupt = false;
+
+	bool Open(const char* path, const u64 readBufferBytes)
+	{
+		FileIdentity identity;
+		if (!GetFileIdentity(path, identity) || identity.size < sizeof(PartialHeader) + sizeof(PartialTrailer)) return false;
+		fh = OpenFileRead(path);
+		if (!fh.Good()) return false;
+
+		PartialHeader h;
+		if (fh.Read(&h, sizeof(h)) != sizeof(h) || memcmp(h.magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) != 0 || h.version != PARTIAL_VERSION)
+		{
+			fh.Close();
+			return false;
+		}
+
+		bufferBytes = readBufferBytes > sizeof(PartialRecord) + PARTIAL_MAX_NAME_BYTES ? readBufferBytes : sizeof(PartialRecord) + PARTIAL_MAX_NAME_BYTES;
+		buffer = (char*)malloc(bufferBytes);
+		pos = 0;
+		end = 0;
+		recordBytesLeft = identity.size - sizeof(PartialHeader) - sizeof(PartialTrailer);
+		numStations = 0;
+		totalRows = 0;
+		crc = 0;
+		corrupt = false;
+		return true;
+	}
+
+	// Makes sure the next bytes are in the buffer
+	bool Ensure(const u64 bytes)
+	{
+		if (end - pos >= bytes) return true;
+		if (bytes > recordBytesLeft + (end - pos)) return false;
+
+		memmove(buffer, buffer + pos, end - pos);
+		end -= pos;
+		pos = 0;
+		const u64 want = bufferBytes - end < recordBytesLeft ? bufferBytes - end : recordBytesLeft;
+		const u64 read = fh.Read(buffer + end, want);
+		crc = SIMD_Crc32C(crc, buffer + end, read);
+		end += read;
+		recordBytesLeft -= read;
+		return end - pos >= bytes;
+	}
+
+	// False at the end of the file, or if it doesn't check out (then corrupt is set)
+	bool Next(String& name, PartialRecord& record)
+	{
+		if (recordBytesLeft == 0 && pos == end)
+		{
+			PartialTrailer trailer;
+			corrupt = fh.Read(&trailer, sizeof(trailer)) != sizeof(trailer) || trailer.crc != crc
+				|| trailer.numStations != numStations || trailer.totalRows != totalRows;
+			return false;
+		}
+
+		if (!Ensure(sizeof(PartialRecord)))
+		{
+			corrupt = true;
+			return false;
+		}
+		memcpy(&record, buffer + pos, sizeof(record));
+		if (record.nameLen == 0 || record.nameLen > PARTIAL_MAX_NAME_BYTES || record.count == 0 || !Ensure(sizeof(PartialRecord) + record.nameLen))
+		{
+			corrupt = true;
+			return false;
+		}
+		name = String(buffer + pos + sizeof(PartialRecord), record.nameLen);
+		pos += sizeof(PartialRecord) + record.nameLen;
+		numStations++;
+		totalRows += record.count;
+		return true;
+	}
+
+	void Close()
+	{
+		fh.Close();
+		free(buffer);
+		buffer = nullptr;
+	}
+};
+
+struct PartialCursor
+{
+	PartialReader reader;
+	String name; // Current station, points into the reader's buffer
+	PartialRecord record;
+};
+
+struct PartialMergeStats
+{
+	std::atomic<u64> filesRead{ 0 };
+	std::atomic<u64> recordsRead{ 0 };
+	std::atomic<u64> bytesRead{ 0 };
+};
+
+// Streaming k-way merge of partial files into emit(name, record) calls in name order, false if any of them doesn't check out.
+// Files sit in a min-heap on the name of their current station, so memory only depends on the number of files.
+template <typename Emit>
+bool MergePartialFiles(const String* paths, const u64 numPaths, const u64 bufferBytes, PartialMergeStats& stats, Emit emit)
+{
+	Array<PartialCursor> cursors;
+	cursors.InitMallocZero(numPaths);
+	Array<u32> heap;
+	heap.InitMalloc(numPaths);
+	heap.size = 0;
+	bool good = true;
+
+	auto less = [&](const u32 a, const u32 b)
+	{
+		return cursors.data[a].name < cursors.data[b].name;
+	};
+	auto siftDown = [&](u64 i)
+	{
+		for (;;)
+		{
+			const u64 left = 2 * i + 1;
+			if (left >= heap.size) return;
+			const u64 child = left + 1 < heap.size && less(heap.data[left + 1], heap.data[left]) ? left + 1 : left;
+			if (!less(heap.data[child], heap.data[i])) return;
+			std::swap(heap.data[child], heap.data[i]);
+			i = child;
+		}
+	};
+	auto finish = [&](PartialCursor& cursor, const String& path)
+	{
+		if (cursor.reader.corrupt)
+		{
+			printf("%.*s is truncated or corrupt\n", (int)path.len, path.data);
+			good = false;
+		}
+		stats.recordsRead += cursor.reader.numStations;
+		cursor.reader.Close();
+	};
+
+	for (u64 i = 0; i < numPaths && good; i++)
+	{
+		PartialCursor& cursor = cursors.data[i];
+		FileIdentity identity;
+		if (!cursor.reader.Open(paths[i], bufferBytes) || !GetFileIdentity(paths[i], identity))
+		{
+			printf("%.*s isn't a partial aggregate file\n", (int)paths[i].len, paths[i].data);
+			good = false;
+			break;
+		}
+		stats.filesRead++;
+		stats.bytesRead += identity.size;
+		if (cursor.reader.Next(cursor.name, cursor.record)) heap.data[heap.size++] = (u32)i;
+		else finish(cursor, paths[i]);
+	}
+	for (u64 i = heap.size / 2; i-- > 0;)
+	{
+		siftDown(i);
+	}
+
+	// The current station is copied out since the cursor it came from moves on
+	char currentName[PARTIAL_MAX_NAME_BYTES];
+	String current(currentName, 0);
+	PartialRecord merged = {};
+	while (heap.size > 0 && good)
+	{
+		PartialCursor& top = cursors.data[heap.data[0]];
+		if (current.len > 0 && top.name == current)
+		{
+			merged.Merge(top.record);
+		}
+		else
+		{
+			if (current.len > 0)
+			{
+				if (top.name < current)
+				{
+					printf("%.*s isn't sorted by station name\n", (int)paths[heap.data[0]].len, paths[heap.data[0]].data);
+					good = false;
+					break;
+				}
+				emit(current, merged);
+			}
+			memcpy(currentName, top.name.data, top.name.len);
+			current.len = top.name.len;
+			merged = top.record;
+		}
+
+		if (!top.reader.Next(top.name, top.record))
+		{
+			finish(top, paths[heap.data[0]]);
+			heap.data[0] = heap.data[--heap.size];
+		}
+		siftDown(0);
+	}
+	if (good && current.len > 0) emit(current, merged);
+
+	for (u64 i = 0; i < heap.size; i++)
+	{
+		cursors.data[heap.data[i]].reader.Close();
+	}
+	heap.Free();
+	cursors.Free();
+	return good;
+}
@@ -0,0 +1,746 @@
+#pragma once
+#include <algorithm>
+
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+#include "station_filter.h"
+#include "thresholds.h"
+
+// Query specs answered together by tools/brc_query in one pass over the input. A spec is a list of fields separated by ';', the one
+// character a station name can't contain, and station lists are separated by ','. Every field is optional:
+//
+//   stats                       {name=min/mean/max, ...} like the solutions print (the default)
+//   summary                     number of stations and rows, with the min/mean/max over all of them
+//   stations=Oslo,Las Vegas     only these stations
+//   exclude=Oslo,Hamburg        every station but these
+//   name=label                  printed in front of the result
+//   stddev                      population standard deviation, printed after min/mean/max
+//   p=50,95,99.9                exact percentiles (nearest rank), printed after that
+//   above=35.0 / below=-20.0    number of readings strictly above / below these, up to 8 over the batch, printed after that
+//   top=20 / bottom=50          only the stations with the highest / lowest by= value, in that order
+//   by=mean                     what top= and bottom= rank by: min, max, mean (the default), count or stddev
+//
+// e.g. "stats", "name=nordic;stations=Oslo,Helsinki,Stockholm;p=50,99", "summary;exclude=Oslo" or "top=20;by=mean"
+//
+// A spec that starts with SELECT is the same thing as a small query language (keywords in any case, names in single quotes):
+//
+//   SELECT station, min, p99, count(temp > 30) WHERE station IN ('Oslo', 'Abha') ORDER BY mean DESC LIMIT 20
+//
+//   columns                     station, min, max, mean (or avg), count (or count(*)), stddev, p50, p99.9 and count(temp > 30.0),
+//                               with < too, and >= / <= turned into the strict ones a tenth of a degree further. The values are
+//                               printed in this order. With station the result is per station like stats, without it it's a
+//                               summary over all of them, and * is station, min, mean, max.
+//   WHERE                       station IN (...), station NOT IN (...), station = '...' or station <> '...'
+//   ORDER BY                    station, min, max, mean, count or stddev, ASC (the default) or DESC
+//   LIMIT                       only the first this many stations
+//
+// Both forms are turned into the same QuerySpec, which picks the aggregates of the scan, its station filter and the output.
+
+constexpr u32 QUERY_MAX_PERCENTILES = 16;
+constexpr u32 QUERY_MAX_COLUMNS = 32;
+
+// What the scan has to keep per station beyond min/max/sum/count
+enum ScanFeature : u32
+{
+	SCAN_PERCENTILES = 1,
+	SCAN_STDDEV = 2,
+	SCAN_THRESHOLDS = 4,
+	SCAN_WIDE_THRESHOLDS = 8, // More than one group of thresholds over the batch
+	SCAN_AGGREGATES = SCAN_PERCENTILES | SCAN_STDDEV | SCAN_THRESHOLDS | SCAN_WIDE_THRESHOLDS,
+};
+
+enum QueryOutput : u32
+{
+	QUERY_STATS,
+	QUERY_SUMMARY,
+};
+
+enum QueryOrder : u32
+{
+	QUERY_BY_NAME,
+	QUERY_BY_MIN,
+	QUERY_BY_MAX,
+	QUERY_BY_MEAN,
+	QUERY_BY_COUNT,
+	QUERY_BY_STDDEV,
+};
+
+enum QueryFilter : u32
+{
+	QUERY_ALL,
+	QUERY_INCLUDE,
+	QUERY_EXCLUDE,
+};
+
+// The values printed for a station or a summary, in order
+enum QueryColumnKind : u8
+{
+	QUERY_COLUMN_MIN,
+	QUERY_COLUMN_MEAN,
+	QUERY_COLUMN_MAX,
+	QUERY_COLUMN_COUNT,
+	QUERY_COLUMN_STDDEV,
+	QUERY_COLUMN_PERCENTILE, // index into QuerySpec::percentiles
+	QUERY_COLUMN_THRESHOLD,  // index into QuerySpec::thresholds
+};
+
+struct QueryColumn
+{
+	QueryColumnKind kind;
+	u8 index;
+};
+
+struct QuerySpec
+{
+	String text;  // As given
+	String label; // Empty unless name= was given
+	QueryOutput output = QUERY_STATS;
+	QueryFilter filter = QUERY_ALL;
+	QueryOrder order = QUERY_BY_NAME;
+	bool descending = false; // top= rather than bottom=, or DESC
+	u32 limit = 0;           // Every station when 0
+	u64 firstStation = 0; // Sorted slice of QueryBatch::stations
+	u64 numStations = 0;
+	bool stddev = false;
+	u32 numPercentiles = 0;
+	u32 percentiles[QUERY_MAX_PERCENTILES]; // Thousandths of a percent
+	u32 numThresholds = 0;
+	u8 thresholds[THRESHOLD_MAX]; // Into QueryBatch::thresholds
+	u32 numColumns = 0;
+	QueryColumn columns[QUERY_MAX_COLUMNS];
+
+	bool AddColumn(const QueryColumnKind kind, const u32 index = 0)
+	{
+		if (numColumns == QUERY_MAX_COLUMNS) return false;
+		columns[numColumns++] = { kind, (u8)index };
+		return true;
+	}
+
+	u32 Features() const
+	{
+		return (numPercentiles > 0 ? (u32)SCAN_PERCENTILES : 0) | (stddev || order == QUERY_BY_STDDEV ? (u32)SCAN_STDDEV : 0) |
+			(numThresholds > 0 ? (u32)SCAN_THRESHOLDS : 0);
+	}
+};
+
+enum QueryTokenKind : u32
+{
+	QUERY_TOKEN_END,
+	QUERY_TOKEN_WORD,   // Keywords, columns and pNN
+	QUERY_TOKEN_NUMBER,
+	QUERY_TOKEN_NAME,   // 'quoted', with '' for a quote
+	QUERY_TOKEN_SYMBOL, // ( ) , * and the comparisons
+	QUERY_TOKEN_BAD,    // A quote that isn't closed
+};
+
+// Splits a SELECT into tokens, one ahead
+struct QueryLexer
+{
+	const char* pos;
+	const char* end;
+	QueryTokenKind kind;
+	String token;
+
+	static bool IsWordChar(const char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+	}
+
+	static bool IsDigit(const char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	void Init(const char* begin, const char* textEnd)
+	{
+		pos = begin;
+		end = textEnd;
+		Next();
+	}
+
+	void Next()
+	{
+		while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) pos++;
+		const char* start = pos;
+		if (pos == end)
+		{
+			kind = QUERY_TOKEN_END;
+		}
+		else if (IsDigit(*pos) || ((*pos == '-' || *pos == '.') && pos + 1 < end && IsDigit(pos[1])))
+		{
+			pos++;
+			while (pos < end && (IsDigit(*pos) || *pos == '.')) pos++;
+			kind = QUERY_TOKEN_NUMBER;
+		}
+		else if (IsWordChar(*pos))
+		{
+			while (pos < end && IsWordChar(*pos)) pos++;
+			kind = QUERY_TOKEN_WORD;
+		}
+		else if (*pos == '\'')
+		{
+			kind = QUERY_TOKEN_BAD;
+			for (pos++; pos < end; pos++)
+			{
+				if (*pos != '\'') continue;
+				if (pos + 1 < end && pos[1] == '\'')
+				{
+					pos++;
+					continue;
+				}
+				pos++;
+				kind = QUERY_TOKEN_NAME;
+				break;
+			}
+		}
+		else
+		{
+			const bool twoChars = pos + 1 < end && ((pos[0] == '<' && (pos[1] == '=' || pos[1] == '>')) || ((pos[0] == '>' || pos[0] == '!') && pos[1] == '='));
+			pos += twoChars ? 2 : 1;
+			kind = QUERY_TOKEN_SYMBOL;
+		}
+		token = String((char*)start, pos - start);
+	}
+
+	bool Is(const char* word) const
+	{
+		const u64 len = strlen(word);
+		return (kind == QUERY_TOKEN_WORD || kind == QUERY_TOKEN_SYMBOL) && token.len == len && _strnicmp(token.data, word, len) == 0;
+	}
+
+	bool Accept(const char* word)
+	{
+		if (!Is(word)) return false;
+		Next();
+		return true;
+	}
+};
+
+struct QueryBatch
+{
+	Vector<QuerySpec> specs;
+	Vector<String> stations;
+	Vector<char*> texts; // Every spec is parsed in place in its own copy
+	ThresholdSet thresholds;
+	const StationFilter* stationFilter = nullptr; // Applies to every query when set
+
+	void Init()
+	{
+		specs.Init(16);
+		stations.Init(64);
+		texts.Init(16);
+	}
+
+	void Free()
+	{
+		for (u64 i = 0; i < texts.size; i++)
+		{
+			free(texts[i]);
+		}
+	}
+
+	static String Trim(const char* begin, const char* end)
+	{
+		while (begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+		while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+		return String((char*)begin, end - begin);
+	}
+
+	// 0 < p <= 100 with up to 3 decimals, in thousandths
+	static bool ParsePercentile(const String& value, u32& pMilli)
+	{
+		u64 whole = 0;
+		u64 fraction = 0;
+		u32 decimals = 0;
+		bool dot = false;
+		for (u64 i = 0; i < value.len; i++)
+		{
+			const char c = value.data[i];
+			if (c == '.' && !dot)
+			{
+				dot = true;
+			}
+			else if (c < '0' || c > '9' || (dot && decimals == 3) || whole > 100)
+			{
+				return false;
+			}
+			else if (dot)
+			{
+				fraction = fraction * 10 + (c - '0');
+				decimals++;
+			}
+			else
+			{
+				whole = whole * 10 + (c - '0');
+			}
+		}
+		for (; decimals < 3; decimals++)
+		{
+			fraction *= 10;
+		}
+		const u64 milli = whole * 1000 + fraction;
+		if (value.len == 0 || milli == 0 || milli > 100000) return false;
+		pMilli = (u32)milli;
+		return true;
+	}
+
+	// A temperature with up to 1 decimal, scaled by 10
+	static bool ParseTemperature(const String& value, s32& scaled)
+	{
+		u64 i = 0;
+		const bool negative = value.len > 0 && value.data[0] == '-';
+		if (negative) i++;
+		s32 whole = 0;
+		u32 digits = 0;
+		for (; i < value.len && value.data[i] >= '0' && value.data[i] <= '9' && digits < 3; i++, digits++)
+		{
+			whole = whole * 10 + (value.data[i] - '0');
+		}
+		s32 decimal = 0;
+		if (i + 2 == value.len && value.data[i] == '.' && value.data[i + 1] >= '0' && value.data[i + 1] <= '9')
+		{
+			decimal = value.data[i + 1] - '0';
+			i += 2;
+		}
+		if (digits == 0 || i != value.len) return false;
+		scaled = (whole * 10 + decimal) * (negative ? -1 : 1);
+		return true;
+	}
+
+	static bool ParseLimit(const String& value, u32& limit)
+	{
+		u64 n = 0;
+		for (u64 i = 0; i < value.len; i++)
+		{
+			const char c = value.data[i];
+			if (c < '0' || c > '9' || n > 0xffffffff) return false;
+			n = n * 10 + (c - '0');
+		}
+		if (value.len == 0 || n == 0 || n > 0xffffffff) return false;
+		limit = (u32)n;
+		return true;
+	}
+
+	static bool FieldIs(const String& field, const char* key)
+	{
+		const u64 len = strlen(key);
+		return field.len == len && _strnicmp(field.data, key, len) == 0;
+	}
+
+	bool Add(const char* spec, const u64 len)
+	{
+		const String trimmed = Trim(spec, spec + len);
+		if (trimmed.len >= 6 && _strnicmp(trimmed.data, "select", 6) == 0 && (trimmed.len == 6 || !QueryLexer::IsWordChar(trimmed.data[6]))) return AddSelect(spec, len);
+
+		char* copy = (char*)malloc(len + 1);
+		memcpy(copy, spec, len);
+		copy[len] = '\0';
+		texts.Push(copy);
+
+		QuerySpec q;
+		q.text = Trim(copy, copy + len);
+		q.firstStation = stations.size;
+		bool ranked = false;
+		QueryOrder order = QUERY_BY_NAME;
+		const char* end = copy + len;
+		for (const char* field = copy; field < end;)
+		{
+			const char* fieldEnd = (const char*)memchr(field, ';', end - field);
+			if (fieldEnd == nullptr) fieldEnd = end;
+			const char* eq = (const char*)memchr(field, '=', fieldEnd - field);
+			const String key = Trim(field, eq != nullptr ? eq : fieldEnd);
+			const String value = eq != nullptr ? Trim(eq + 1, fieldEnd) : String();
+			field = fieldEnd + 1;
+
+			if (key.len == 0 && eq == nullptr) continue;
+			if (eq == nullptr && FieldIs(key, "stats")) q.output = QUERY_STATS;
+			else if (eq == nullptr && FieldIs(key, "summary")) q.output = QUERY_SUMMARY;
+			else if (eq == nullptr && FieldIs(key, "stddev")) q.stddev = true;
+			else if (eq != nullptr && FieldIs(key, "name")) q.label = value;
+			else if (eq != nullptr && (FieldIs(key, "above") || FieldIs(key, "below")))
+			{
+				const bool below = FieldIs(key, "below");
+				const char* valueEnd = value.data + value.len;
+				for (const char* t = value.data; t < valueEnd;)
+				{
+					const char* tEnd = (const char*)memchr(t, ',', valueEnd - t);
+					if (tEnd == nullptr) tEnd = valueEnd;
+					s32 scaled;
+					s32 index = -1;
+					if (ParseTemperature(Trim(t, tEnd), scaled)) index = thresholds.Add({ scaled, below });
+					if (index < 0 || q.numThresholds == THRESHOLD_MAX)
+					{
+						printf("bad threshold '%.*s' in query '%s' (a temperature like -20.5, up to %u different ones over all queries)\n", (int)(tEnd - t), t, q.text.data, THRESHOLD_MAX);
+						return false;
+					}
+					q.thresholds[q.numThresholds++] = (u8)index;
+					t = tEnd + 1;
+				}
+			}
+			else if (eq != nullptr && (FieldIs(key, "top") || FieldIs(key, "bottom")))
+			{
+				if (!ParseLimit(value, q.limit))
+				{
+					printf("bad %.*s count '%.*s' in query '%s'\n", (int)key.len, key.data, (int)value.len, value.data, q.text.data);
+					return false;
+				}
+				q.descending = FieldIs(key, "top");
+				ranked = true;
+			}
+			else if (eq != nullptr && FieldIs(key, "by"))
+			{
+				if (FieldIs(value, "min")) order = QUERY_BY_MIN;
+				else if (FieldIs(value, "max")) order = QUERY_BY_MAX;
+				else if (FieldIs(value, "mean")) order = QUERY_BY_MEAN;
+				else if (FieldIs(value, "count")) order = QUERY_BY_COUNT;
+				else if (FieldIs(value, "stddev")) order = QUERY_BY_STDDEV;
+				else
+				{
+					printf("can't rank by '%.*s' in query '%s' (min, max, mean, count or stddev)\n", (int)value.len, value.data, q.text.data);
+					return false;
+				}
+			}
+			else if (eq != nullptr && FieldIs(key, "p"))
+			{
+				const char* valueEnd = value.data + value.len;
+				for (const char* p = value.data; p < valueEnd;)
+				{
+					const char* pEnd = (const char*)memchr(p, ',', valueEnd - p);
+					if (pEnd == nullptr) pEnd = valueEnd;
+					u32 pMilli;
+					if (!ParsePercentile(Trim(p, pEnd), pMilli) || q.numPercentiles == QUERY_MAX_PERCENTILES)
+					{
+						printf("bad percentile '%.*s' in query '%s' (up to %u of 0 < p <= 100)\n", (int)(pEnd - p), p, q.text.data, QUERY_MAX_PERCENTILES);
+						return false;
+					}
+					q.percentiles[q.numPercentiles++] = pMilli;
+					p = pEnd + 1;
+				}
+			}
+			else if (eq != nullptr && (FieldIs(key, "stations") || FieldIs(key, "exclude")))
+			{
+				const QueryFilter filter = FieldIs(key, "stations") ? QUERY_INCLUDE : QUERY_EXCLUDE;
+				if (q.filter != QUERY_ALL && q.filter != filter)
+				{
+					printf("query '%s' can't have both stations= and exclude=\n", q.text.len > 0 ? q.text.data : "");
+					return false;
+				}
+				q.filter = filter;
+				const char* valueEnd = value.data + value.len;
+				for (const char* name = value.data; name < valueEnd;)
+				{
+					const char* nameEnd = (const char*)memchr(name, ',', valueEnd - name);
+					if (nameEnd == nullptr) nameEnd = valueEnd;
+					const String station = Trim(name, nameEnd);
+					if (station.len > 0) stations.Push(station);
+					name = nameEnd + 1;
+				}
+			}
+			else
+			{
+				printf("unknown field '%.*s' in query '%s'\n", (int)key.len, key.data, q.text.data);
+				return false;
+			}
+		}
+
+		if (ranked || order != QUERY_BY_NAME)
+		{
+			if (!ranked)
+			{
+				printf("query '%s' has by= without top= or bottom=\n", q.text.data);
+				return false;
+			}
+			if (q.output == QUERY_SUMMARY)
+			{
+				printf("query '%s' can't have top= or bottom= with summary\n", q.text.data);
+				return false;
+			}
+			q.order = order != QUERY_BY_NAME ? order : QUERY_BY_MEAN;
+		}
+
+		// min/mean/max, then stddev, the percentiles and the thresholds
+		q.AddColumn(QUERY_COLUMN_MIN);
+		q.AddColumn(QUERY_COLUMN_MEAN);
+		q.AddColumn(QUERY_COLUMN_MAX);
+		if (q.stddev) q.AddColumn(QUERY_COLUMN_STDDEV);
+		for (u32 i = 0; i < q.numPercentiles; i++)
+		{
+			q.AddColumn(QUERY_COLUMN_PERCENTILE, i);
+		}
+		for (u32 i = 0; i < q.numThresholds; i++)
+		{
+			q.AddColumn(QUERY_COLUMN_THRESHOLD, i);
+		}
+		return Push(q);
+	}
+
+	bool Add(const char* spec)
+	{
+		return Add(spec, strlen(spec));
+	}
+
+	// The station list of the query is the end of stations
+	bool Push(QuerySpec& q)
+	{
+		q.numStations = stations.size - q.firstStation;
+		if (q.filter == QUERY_INCLUDE && q.numStations == 0)
+		{
+			printf("query '%s' has an empty station list\n", q.text.data);
+			return false;
+		}
+		std::sort(stations.data + q.firstStation, stations.data + stations.size);
+		specs.Push(q);
+		return true;
+	}
+
+	// A SELECT turned into the QuerySpec of the fields it stands for
+	bool AddSelect(const char* spec, const u64 len)
+	{
+		char* copy = (char*)malloc(len + 1);
+		memcpy(copy, spec, len);
+		copy[len] = '\0';
+		texts.Push(copy);
+		char* names = (char*)malloc(len + 1); // The unquoted names
+		texts.Push(names);
+		u64 namesUsed = 0;
+
+		QuerySpec q;
+		q.text = Trim(copy, copy + len);
+		q.firstStation = stations.size;
+		q.output = QUERY_SUMMARY;
+		QueryLexer lex;
+		lex.Init(copy, copy + len);
+		auto expected = [&](const char* what)
+		{
+			if (lex.kind == QUERY_TOKEN_END) printf("expected %s at the end of query '%s'\n", what, q.text.data);
+			else printf("expected %s instead of '%.*s' in query '%s'\n", what, (int)lex.token.len, lex.token.data, q.text.data);
+			return false;
+		};
+		auto name = [&](String& station)
+		{
+			if (lex.kind != QUERY_TOKEN_NAME) return expected(lex.kind == QUERY_TOKEN_BAD ? "a closing quote" : "a station name in single quotes");
+			station.data = names + namesUsed;
+			for (u64 i = 1; i + 1 < lex.token.len; i++)
+			{
+				names[namesUsed++] = lex.token.data[i];
+				if (lex.token.data[i] == '\'') i++;
+			}
+			station.len = names + namesUsed - station.data;
+			lex.Next();
+			return true;
+		};
+
+		lex.Accept("select");
+		if (lex.Accept("*"))
+		{
+			q.output = QUERY_STATS;
+			q.AddColumn(QUERY_COLUMN_MIN);
+			q.AddColumn(QUERY_COLUMN_MEAN);
+			q.AddColumn(QUERY_COLUMN_MAX);
+		}
+		else
+		{
+			do
+			{
+				const QueryTokenKind kind = lex.kind;
+				const String column = lex.token;
+				if (kind != QUERY_TOKEN_WORD) return expected("a column");
+				lex.Next();
+				bool added = true;
+				if (FieldIs(column, "station"))
+				{
+					if (q.output == QUERY_STATS || q.numColumns > 0)
+					{
+						printf("station has to be the first column of query '%s'\n", q.text.data);
+						return false;
+					}
+					q.output = QUERY_STATS;
+				}
+				else if (FieldIs(column, "min")) added = q.AddColumn(QUERY_COLUMN_MIN);
+				else if (FieldIs(column, "max")) added = q.AddColumn(QUERY_COLUMN_MAX);
+				else if (FieldIs(column, "mean") || FieldIs(column, "avg")) added = q.AddColumn(QUERY_COLUMN_MEAN);
+				else if (FieldIs(column, "stddev"))
+				{
+					q.stddev = true;
+					added = q.AddColumn(QUERY_COLUMN_STDDEV);
+				}
+				else if (FieldIs(column, "count") && lex.Accept("("))
+				{
+					if (lex.Accept("*"))
+					{
+						added = q.AddColumn(QUERY_COLUMN_COUNT);
+					}
+					else
+					{
+						if (!lex.Accept("temp")) return expected("temp or *");
+						const bool below = lex.Is("<") || lex.Is("<=");
+						const bool inclusive = lex.Is("<=") || lex.Is(">=");
+						if (!below && !lex.Is(">") && !lex.Is(">=")) return expected(">, <, >= or <=");
+						lex.Next();
+						s32 scaled;
+						if (lex.kind != QUERY_TOKEN_NUMBER || !ParseTemperature(lex.token, scaled)) return expected("a temperature like -20.5");
+						lex.Next();
+						if (inclusive) scaled += below ? 1 : -1; // Readings are whole tenths
+						const s32 index = thresholds.Add({ scaled, below });
+						if (index < 0 || q.numThresholds == THRESHOLD_MAX)
+						{
+							printf("too many thresholds in query '%s' (up to %u different ones over all queries)\n", q.text.data, THRESHOLD_MAX);
+							return false;
+						}
+						q.thresholds[q.numThresholds] = (u8)index;
+						added = q.AddColumn(QUERY_COLUMN_THRESHOLD, q.numThresholds++);
+					}
+					if (!lex.Accept(")")) return expected(")");
+				}
+				else if (FieldIs(column, "count"))
+				{
+					added = q.AddColumn(QUERY_COLUMN_COUNT);
+				}
+				else if ((column.data[0] == 'p' || column.data[0] == 'P') && column.len > 1)
+				{
+					u32 pMilli;
+					if (!ParsePercentile(String(column.data + 1, column.len - 1), pMilli) || q.numPercentiles == QUERY_MAX_PERCENTILES)
+					{
+						printf("bad percentile '%.*s' in query '%s' (up to %u of 0 < p <= 100)\n", (int)column.len, column.data, q.text.data, QUERY_MAX_PERCENTILES);
+						return false;
+					}
+					q.percentiles[q.numPercentiles] = pMilli;
+					added = q.AddColumn(QUERY_COLUMN_PERCENTILE, q.numPercentiles++);
+				}
+				else
+				{
+					printf("unknown column '%.*s' in query '%s' (station, min, max, mean, count, stddev, pNN or count(temp > x))\n", (int)column.len, column.data, q.text.data);
+					return false;
+				}
+				if (!added)
+				{
+					printf("query '%s' has more than %u columns\n", q.text.data, QUERY_MAX_COLUMNS);
+					return false;
+				}
+			} while (lex.Accept(","));
+			if (q.output == QUERY_SUMMARY && q.numColumns == 0) return expected("a column");
+		}
+
+		if (lex.Accept("where"))
+		{
+			if (!lex.Accept("station")) return expected("station, the only column a query can filter on");
+			const bool negated = lex.Accept("not");
+			if (lex.Accept("in"))
+			{
+				if (!lex.Accept("(")) return expected("(");
+				do
+				{
+					String station;
+					if (!name(station)) return false;
+					if (station.len > 0) stations.Push(station);
+				} while (lex.Accept(","));
+				if (!lex.Accept(")")) return expected(")");
+				q.filter = negated ? QUERY_EXCLUDE : QUERY_INCLUDE;
+			}
+			else if (!negated && (lex.Is("=") || lex.Is("<>") || lex.Is("!=")))
+			{
+				q.filter = lex.Is("=") ? QUERY_INCLUDE : QUERY_EXCLUDE;
+				lex.Next();
+				String station;
+				if (!name(station)) return false;
+				if (station.len > 0) stations.Push(station);
+			}
+			else
+			{
+				return expected(negated ? "IN" : "IN, NOT IN, = or <>");
+			}
+		}
+
+		bool ordered = false;
+		QueryOrder order = QUERY_BY_NAME;
+		if (lex.Accept("order"))
+		{
+			if (!lex.Accept("by")) return expected("BY");
+			if (lex.Accept("station")) order = QUERY_BY_NAME;
+			else if (lex.Accept("min")) order = QUERY_BY_MIN;
+			else if (lex.Accept("max")) order = QUERY_BY_MAX;
+			else if (lex.Accept("mean") || lex.Accept("avg")) order = QUERY_BY_MEAN;
+			else if (lex.Accept("count")) order = QUERY_BY_COUNT;
+			else if (lex.Accept("stddev")) order = QUERY_BY_STDDEV;
+			else return expected("station, min, max, mean, count or stddev to order by");
+			q.descending = lex.Accept("desc");
+			if (!q.descending) lex.Accept("asc");
+			ordered = true;
+		}
+		if (lex.Accept("limit"))
+		{
+			if (!ParseLimit(lex.token, q.limit)) return expected("a row count");
+			lex.Next();
+			ordered = true;
+		}
+		if (lex.kind != QUERY_TOKEN_END) return expected(ordered ? "the end of the query" : q.filter != QUERY_ALL ? "ORDER BY or LIMIT" : "WHERE, ORDER BY or LIMIT");
+
+		if (ordered && q.output == QUERY_SUMMARY)
+		{
+			printf("query '%s' needs the station column for ORDER BY or LIMIT\n", q.text.data);
+			return false;
+		}
+		q.order = order;
+		if (order != QUERY_BY_NAME && q.limit == 0) q.limit = 0xffffffff; // Ranked, but all of them
+		return Push(q);
+	}
+
+	// One spec per line, empty lines and lines starting with # are skipped
+	bool AddFile(const char* path)
+	{
+		MappedFileHandle file;
+		if (!file.OpenRead(path))
+		{
+			printf("can't read queries from %s\n", path);
+			return false;
+		}
+		const char* end = file.data + file.length;
+		bool good = true;
+		for (const char* line = file.data; line < end && good;)
+		{
+			const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+			if (lineEnd == nullptr) lineEnd = end;
+			const String trimmed = Trim(line, lineEnd);
+			if (trimmed.len > 0 && trimmed.data[0] != '#') good = Add(trimmed.data, trimmed.len);
+			line = lineEnd + 1;
+		}
+		file.Close();
+		return good;
+	}
+
+	bool Lists(const QuerySpec& q, const String& name) const
+	{
+		const String* first = stations.data + q.firstStation;
+		return std::binary_search(first, first + q.numStations, name);
+	}
+
+	// Whether the station shows up in the result of the query
+	bool Wants(const QuerySpec& q, const String& name) const
+	{
+		if (stationFilter != nullptr && !stationFilter->Wants(name, StationFilter::Hash(name))) return false;
+		if (q.filter == QUERY_ALL) return true;
+		return Lists(q, name) == (q.filter == QUERY_INCLUDE);
+	}
+
+	// What a scan for these queries has to do
+	u32 Features(const u64 firstQuery, const u64 numQueries) const
+	{
+		u32 features = 0;
+		for (u64 i = firstQuery; i < firstQuery + numQueries; i++)
+		{
+			features |= specs.data[i].Features();
+		}
+		if ((features & SCAN_THRESHOLDS) && thresholds.Groups() > 1) features |= SCAN_WIDE_THRESHOLDS;
+		return features;
+	}
+
+	// Whether the scan has to keep the distribution of the station
+	bool WantsDistribution(const String& name) const
+	{
+		for (u64 i = 0; i < specs.size; i++)
+		{
+			if (specs.data[i].numPercentiles > 0 && Wants(specs.data[i], name)) return true;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,335 @@
+#pragma once
+#include "../base/platform_io.h"
+#include "../base/vector.h"
+#include "chunk_index.h"
+
+// Sidecar (<file>.agg) with per-station partial aggregates of every chunk of a measurement file and of every power of 2 run of
+// chunks on top of them, a segment tree stored level by level:
+//
+//   level 0     one node per chunk of the chunk index
+//   level k     node j covers chunks [j * 2^k, (j + 1) * 2^k), the last node of a level can cover fewer
+//
+// The stats of any run of whole chunks are the merge of at most 2 nodes per level, and a byte or row range only has to parse
+// the partial chunks at its two edges on top of that. Station ids index a dictionary sorted the same way the output is.
+//
+//   [RangeIndexHeader]
+//   [ChunkIndexEntry * numChunks]                    the leaves, so the sidecar doesn't depend on the .idx
+//   [RangeNode * numNodes]                           level 0 first
+//   u32 nameOffsets[numStations + 1] [name bytes] [padding to 8]
+//   u32 stationIds[numRecords] [padding to 8]
+//   [RangeStationData * numRecords]                  each node's records are sorted by station id
+
+constexpr char RANGE_INDEX_MAGIC[8] = { '1', 'B', 'R', 'C', 'A', 'G', 'G', '\0' };
+constexpr u32 RANGE_INDEX_VERSION = 2;
+
+struct RangeIndexHeader
+{
+	char magic[8];
+	u32 version;
+	u32 numLevels;
+	u64 fileLength;
+	u64 chunkBytes;
+	u64 numChunks;
+	u64 totalLines;
+	u64 numStations;
+	u64 namesBytes;
+	u64 numNodes;
+	u64 numRecords;
+	FileIdentity source; // A tree that doesn't match the file's identity is stale, even at the same length
+};
+static_assert(sizeof(RangeIndexHeader) == 120, "RangeIndexHeader is written to disk as-is");
+
+struct RangeNode
+{
+	u64 firstRecord;
+	u64 numRecords;
+};
+static_assert(sizeof(RangeNode) == 16, "RangeNode is written to disk as-is");
+
+struct RangeStationData
+{
+	s16 min = 32767;
+	s16 max = -32768;
+	u32 count = 0;
+	s64 sum = 0;
+
+	__forceinline void Add(s16 temp)
+	{
+		if (temp < min) min = temp;
+		if (temp > max) max = temp;
+		++count;
+		sum += temp;
+	}
+
+	__forceinline void Merge(const RangeStationData& other)
+	{
+		if (other.max > max) max = other.max;
+		if (other.min < min) min = other.min;
+		count += other.count;
+		sum += other.sum;
+	}
+};
+static_assert(sizeof(RangeStationData) == 16, "RangeStationData is written to disk as-is");
+
+inline u32 RangeIndexLevels(const u64 numChunks)
+{
+	u32 levels = 1;
+	while ((1ull << (levels - 1)) < numChunks) levels++;
+	return levels;
+}
+
+inline u64 RangeLevelNodes(const u64 numChunks, const u32 level)
+{
+	return (numChunks + (1ull << level) - 1) >> level;
+}
+
+// Node index of the first node of a level
+inline u64 RangeLevelStart(const u64 numChunks, const u32 level)
+{
+	u64 start = 0;
+	for (u32 l = 0; l < level; l++)
+	{
+		start += RangeLevelNodes(numChunks, l);
+	}
+	return start;
+}
+
+struct RangeIndexLayout
+{
+	u64 chunksOffset;
+	u64 nodesOffset;
+	u64 namesOffset;
+	u64 idsOffset;
+	u64 recordsOffset;
+	u64 fileBytes;
+
+	void Compute(const RangeIndexHeader& h)
+	{
+		chunksOffset = sizeof(RangeIndexHeader);
+		nodesOffset = chunksOffset + h.numChunks * sizeof(ChunkIndexEntry);
+		namesOffset = nodesOffset + h.numNodes * sizeof(RangeNode);
+		idsOffset = AlignTo8(namesOffset + (h.numStations + 1) * sizeof(u32) + h.namesBytes);
+		recordsOffset = AlignTo8(idsOffset + h.numRecords * sizeof(u32));
+		fileBytes = recordsOffset + h.numRecords * sizeof(RangeStationData);
+	}
+
+	static u64 AlignTo8(const u64 x)
+	{
+		return (x + 7) & ~7ull;
+	}
+};
+
+// Everything needed to write the tree, nodes are filled level by level by the builder
+struct RangeIndexWriter
+{
+	Vector<String> names; // Sorted, the id of a station is its position
+	Vector<RangeNode> nodes;
+	Vector<u32> ids;
+	Vector<RangeStationData> records;
+
+	void Init(const u64 numChunks)
+	{
+		names.Init(128);
+		nodes.Init(numChunks * 2 + 1);
+		ids.Init(numChunks * 128 + 1);
+		records.Init(numChunks * 128 + 1);
+	}
+
+	// Merges two nodes that are sorted by station id into a new node at the end, a level with an odd node count
+	// carries its last node up on its own
+	void PushMergedNode(const u64 left, const u64 right, const bool hasRight)
+	{
+		const RangeNode a = nodes[left];
+		const RangeNode b = hasRight ? nodes[right] : RangeNode{ 0, 0 };
+		RangeNode node = { ids.size, 0 };
+		u64 i = a.firstRecord;
+		u64 j = b.firstRecord;
+		const u64 iEnd = i + a.numRecords;
+		const u64 jEnd = j + b.numRecords;
+		while (i < iEnd || j < jEnd)
+		{
+			// Copies, pushing can move the arrays
+			u32 id;
+			RangeStationData data;
+			if (j >= jEnd || (i < iEnd && ids.data[i] < ids.data[j]))
+			{
+				id = ids.data[i];
+				data = records.data[i++];
+			}
+			else if (i >= iEnd || ids.data[j] < ids.data[i])
+			{
+				id = ids.data[j];
+				data = records.data[j++];
+			}
+			else
+			{
+				id = ids.data[i];
+				data = records.data[i++];
+				data.Merge(records.data[j++]);
+			}
+			ids.Push(id);
+			records.Push(data);
+		}
+		node.numRecords = ids.size - node.firstRecord;
+		nodes.Push(node);
+	}
+
+	// Adds every level above the leaves, which have to be in already
+	void BuildLevels(const u64 numChunks)
+	{
+		const u32 numLevels = RangeIndexLevels(numChunks);
+		for (u32 level = 1; level < numLevels; level++)
+		{
+			const u64 below = RangeLevelStart(numChunks, level - 1);
+			const u64 belowNodes = RangeLevelNodes(numChunks, level - 1);
+			for (u64 j = 0; j < RangeLevelNodes(numChunks, level); j++)
+			{
+				const u64 left = below + 2 * j;
+				PushMergedNode(left, left + 1, 2 * j + 1 < belowNodes);
+			}
+		}
+	}
+
+	// Stamped with the identity of dataPath, the file the leaves were parsed from
+	bool Write(const char* path, const char* dataPath, const ChunkIndex& index)
+	{
+		RangeIndexHeader h = {};
+		if (!GetFileIdentity(dataPath, h.source)) return false;
+		memcpy(h.magic, RANGE_INDEX_MAGIC, sizeof(RANGE_INDEX_MAGIC));
+		h.version = RANGE_INDEX_VERSION;
+		h.numLevels = RangeIndexLevels(index.entries.size);
+		h.fileLength = index.header.fileLength;
+		h.chunkBytes = index.header.chunkBytes;
+		h.numChunks = index.entries.size;
+		h.totalLines = index.header.totalLines;
+		h.numStations = names.size;
+		for (u64 i = 0; i < names.size; i++)
+		{
+			h.namesBytes += names[i].len;
+		}
+		h.numNodes = nodes.size;
+		h.numRecords = ids.size;
+		RangeIndexLayout layout;
+		layout.Compute(h);
+
+		FileHandle fh = OpenFileWrite(path);
+		if (!fh.Good()) return false;
+		static const char zeros[8] = {};
+		u64 offset = 0;
+		auto write = [&](const void* data, const u64 bytes)
+		{
+			offset += bytes;
+			return bytes == 0 || fh.Write(data, bytes);
+		};
+		auto pad = [&](const u64 to)
+		{
+			return write(zeros, to - offset);
+		};
+
+		bool ok = write(&h, sizeof(h)) && write(index.entries.data, index.entries.Bytes()) && write(nodes.data, nodes.Bytes());
+		u32 nameOffset = 0;
+		for (u64 i = 0; i <= names.size && ok; i++)
+		{
+			ok = write(&nameOffset, sizeof(nameOffset));
+			if (i < names.size) nameOffset += (u32)names[i].len;
+		}
+		for (u64 i = 0; i < names.size && ok; i++)
+		{
+			ok = write(names[i].data, names[i].len);
+		}
+		ok = ok && pad(layout.idsOffset) && write(ids.data, ids.Bytes()) && pad(layout.recordsOffset) && write(records.data, records.Bytes());
+		fh.Close();
+		return ok;
+	}
+};
+
+struct RangeIndex
+{
+	MappedFileHandle file;
+	const RangeIndexHeader* header = nullptr;
+	const RangeNode* nodes = nullptr;
+	const u32* nameOffsets = nullptr;
+	const char* names = nullptr;
+	const u32* ids = nullptr;
+	const RangeStationData* records = nullptr;
+	ChunkIndex chunks; // A copy of the leaves so row lookups work like they do with a chunk index
+
+	// The tree at path if it was built from dataPath as it is now
+	bool Open(const char* path, const char* dataPath, const u64 fileLength)
+	{
+		FileIdentity identity;
+		if (!GetFileIdentity(dataPath, identity)) return false;
+		if (!file.OpenRead(path) || file.length < sizeof(RangeIndexHeader)) return false;
+
+		header = (const RangeIndexHeader*)file.data;
+		RangeIndexLayout layout;
+		layout.Compute(*header);
+		if (memcmp(header->magic, RANGE_INDEX_MAGIC, sizeof(RANGE_INDEX_MAGIC)) != 0 || header->version != RANGE_INDEX_VERSION
+			|| header->fileLength != fileLength || memcmp(&header->source, &identity, sizeof(FileIdentity)) != 0 || header->numChunks == 0 || file.length != layout.fileBytes)
+		{
+			file.Close();
+			return false;
+		}
+
+		nodes = (const RangeNode*)(file.data + layout.nodesOffset);
+		nameOffsets = (const u32*)(file.data + layout.namesOffset);
+		names = (const char*)(nameOffsets + header->numStations + 1);
+		ids = (const u32*)(file.data + layout.idsOffset);
+		records = (const RangeStationData*)(file.data + layout.recordsOffset);
+
+		chunks.InitEntries(header->numChunks);
+		while (chunks.entries.size < header->numChunks) chunks.entries.PushReuse();
+		memcpy(chunks.entries.data, file.data + layout.chunksOffset, header->numChunks * sizeof(ChunkIndexEntry));
+		chunks.header.chunkBytes = header->chunkBytes;
+		chunks.header.fileLength = header->fileLength;
+		chunks.header.numChunks = header->numChunks;
+		chunks.header.totalLines = header->totalLines;
+		chunks.header.source = header->source;
+		return true;
+	}
+
+	String StationName(const u32 id) const
+	{
+		return String((char*)names + nameOffsets[id], nameOffsets[id + 1] - nameOffsets[id]);
+	}
+
+	// Last chunk that starts at or before a byte offset
+	u64 FindChunkForOffset(const u64 offset) const
+	{
+		u64 lo = 0;
+		u64 hi = chunks.entries.size;
+		while (hi - lo > 1)
+		{
+			const u64 mid = (lo + hi) / 2;
+			if (chunks.entries.data[mid].offset <= offset) lo = mid;
+			else hi = mid;
+		}
+		return lo;
+	}
+
+	// Calls visit(node) for the O(log n) nodes that exactly cover chunks [first, end)
+	template <typename Visit>
+	u64 VisitChunkRange(u64 first, u64 end, Visit visit) const
+	{
+		u64 visited = 0;
+		for (u32 level = 0; first < end; level++)
+		{
+			const u64 levelStart = RangeLevelStart(header->numChunks, level);
+			if (first & 1)
+			{
+				visit(nodes[levelStart + first]);
+				visited++;
+				first++;
+			}
+			if (end & 1)
+			{
+				end--;
+				visit(nodes[levelStart + end]);
+				visited++;
+			}
+			first >>= 1;
+			end >>= 1;
+		}
+		return visited;
+	}
+};
@@ -0,0 +1,227 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "../base/platform_io.h"
+#include "../base/simd.h"
+#include "input.h"
+#include "station_table.h"
+
+// Caches the final per-station aggregates of a run in <cache dir>/<key hash>.brccache so re-running over unchanged files
+// doesn't scan them again. The key is the engine, the options that change the result and for every input file (in order)
+// its path, device, inode, size, modified and changed time, and optionally a hash of its contents.
+//
+// The whole key is stored in the cache file and compared byte for byte, the hash in the name only finds the file.
+// A result is only stored if no input changed during the scan and none of them were modified in the couple of seconds before
+// it started, so a write landing in the same file time tick as the scan can't produce a stale entry that still matches.
+
+constexpr char RESULT_CACHE_MAGIC[8] = { '1', 'B', 'R', 'C', 'R', 'E', 'S', '\0' };
+constexpr u32 RESULT_CACHE_VERSION = 1;
+constexpr s64 RESULT_CACHE_RACY_SECONDS = 2; // Covers the coarsest common file time granularity (FAT)
+constexpr u64 RESULT_CACHE_HASH_CHUNK_BYTES = 16 * MB;
+
+struct ResultCacheHeader
+{
+	char magic[8];
+	u32 version;
+	u32 recordBytes;
+	u64 keyBytes;
+	u64 numStations;
+	u64 namesBytes;
+	u64 reserved;
+};
+static_assert(sizeof(ResultCacheHeader) == 48, "ResultCacheHeader is written to disk as-is");
+
+// CRC32C of fixed size pieces in parallel, folded in order so the result doesn't depend on the thread count
+inline u64 HashFileContents(const MappedFileHandle& file, u32 numThreads)
+{
+	if (!file.Good()) return 0;
+
+	const u64 numChunks = (file.length + RESULT_CACHE_HASH_CHUNK_BYTES - 1) / RESULT_CACHE_HASH_CHUNK_BYTES;
+	Array<u32> crcs;
+	crcs.InitMalloc(numChunks);
+	std::atomic<u64> next{ 0 };
+	auto work = [&]()
+	{
+		for (;;)
+		{
+			const u64 chunk = next.fetch_add(1, std::memory_order_relaxed);
+			if (chunk >= numChunks) return;
+			const u64 begin = chunk * RESULT_CACHE_HASH_CHUNK_BYTES;
+			const u64 end = begin + RESULT_CACHE_HASH_CHUNK_BYTES < file.length ? begin + RESULT_CACHE_HASH_CHUNK_BYTES : file.length;
+			crcs[chunk] = SIMD_Crc32C(0, file.data + begin, end - begin);
+		}
+	};
+
+	if (numThreads == 0) numThreads = 1;
+	Array<std::thread*> threads;
+	threads.InitMalloc(numThreads);
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i] = new std::thread(work);
+	}
+	work();
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	threads.Free();
+
+	const u64 hash = fnv1a(crcs.data, crcs.Bytes());
+	crcs.Free();
+	return hash;
+}
+
+struct ResultCache
+{
+	StringBuffer buf;
+	String key;
+	String path;
+	String tempPath;
+	Array<FileIdentity> identities;
+	s64 startTime = 0;
+	bool storable = true;
+
+	// Set by a successful Lookup
+	MappedFileHandle file;
+	const ResultCacheHeader* header = nullptr;
+	StationTableView stations;
+
+	bool Init(const char* dir, const char* engine, const u32 recordBytes, const InputSet& input, const InputOptions& options, const u32 numThreads)
+	{
+		startTime = FileTimeNow();
+
+		u64 keyReserve = 256 + strlen(engine);
+		for (u64 i = 0; i < input.paths.size; i++)
+		{
+			keyReserve += input.paths.data[i].len + sizeof(u32) + sizeof(FileIdentity) + sizeof(u64);
+		}
+		buf.Init(keyReserve * 2 + strlen(dir) * 2 + 256);
+
+		key = buf.PushUninitString();
+		const u32 engineLen = (u32)strlen(engine);
+		PushBytes(buf, &engineLen, sizeof(engineLen));
+		PushBytes(buf, engine, engineLen);
+		PushBytes(buf, &recordBytes, sizeof(recordBytes));
+		const u64 rows[6] = { options.hasRows ? 1ull : 0ull, options.rowBegin, options.rowEnd, options.hasRange ? 1ull : 0ull, options.rangeBegin, options.rangeEnd };
+		PushBytes(buf, rows, sizeof(rows));
+		PushBytes(buf, &input.paths.size, sizeof(u64));
+
+		identities.InitMallocZero(input.paths.size);
+		for (u64 i = 0; i < input.paths.size; i++)
+		{
+			const String& p = input.paths.data[i];
+			const u32 len = (u32)p.len;
+			GetFileIdentity(p, identities[i]); // A missing file just keys as all zeroes
+			const u64 mappedBytes = input.files.data[i].file.Good() ? input.files.data[i].file.length : 0;
+			if (identities[i].size != mappedBytes) storable = false; // Changed between mapping and now, we can't tell which version we'll read
+			const u64 contentHash = options.cacheHash ? HashFileContents(input.files.data[i].file, numThreads) : 0;
+			PushBytes(buf, &len, sizeof(len));
+			PushBytes(buf, p.data, p.len);
+			PushBytes(buf, &identities[i], sizeof(FileIdentity));
+			PushBytes(buf, &contentHash, sizeof(contentHash));
+		}
+		key.len = buf.size - (key.data - buf.data);
+
+		char hashHex[17];
+		snprintf(hashHex, sizeof(hashHex), "%016llx", (unsigned long long)fnv1a(key.data, key.len));
+		const u64 dirLen = strlen(dir);
+		if (dirLen > 0 && dir[dirLen - 1] != '/' && dir[dirLen - 1] != '\\')
+		{
+			path = buf.PushStringF(dir, '/', (const char*)hashHex, ".brccache");
+		}
+		else
+		{
+			path = buf.PushStringF(dir, (const char*)hashHex, ".brccache");
+		}
+		tempPath = buf.PushStringF(path, ".tmp");
+		return true;
+	}
+
+	bool Lookup()
+	{
+		if (!file.OpenRead(path)) return false;
+
+		bool good = file.length >= sizeof(ResultCacheHeader);
+		if (good)
+		{
+			header = (const ResultCacheHeader*)file.data;
+			good = memcmp(header->magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC)) == 0
+				&& header->version == RESULT_CACHE_VERSION
+				&& header->keyBytes == key.len
+				&& file.length == StationTableEnd(sizeof(ResultCacheHeader) + header->keyBytes, header->numStations, header->namesBytes, header->recordBytes)
+				&& memcmp(file.data + sizeof(ResultCacheHeader), key.data, key.len) == 0;
+		}
+
+		if (!good)
+		{
+			file.Close();
+			header = nullptr;
+			return false;
+		}
+
+		stations.Init(file.data, sizeof(ResultCacheHeader) + header->keyBytes, header->numStations, header->namesBytes, header->recordBytes);
+		return true;
+	}
+
+	u64 NumStations() const
+	{
+		return stations.numStations;
+	}
+
+	String Name(const u64 i) const
+	{
+		return stations.Name(i);
+	}
+
+	const void* Record(const u64 i) const
+	{
+		return stations.Record(i);
+	}
+
+	// True if every input still looks exactly like it did when the scan started and none of them could still be mid-write
+	bool InputsSettled(const InputSet& input) const
+	{
+		const s64 racyTime = startTime - RESULT_CACHE_RACY_SECONDS * FILE_TIME_TICKS_PER_SECOND;
+		for (u64 i = 0; i < input.paths.size; i++)
+		{
+			FileIdentity now;
+			GetFileIdentity(input.paths.data[i], now);
+			if (memcmp(&now, &identities.data[i], sizeof(FileIdentity)) != 0) return false;
+			if (now.modifiedTime >= racyTime || now.changedTime >= racyTime) return false;
+		}
+		return true;
+	}
+
+	// getStation(i, String& name, const void*& record) for every station, written to a temp file and renamed over the old entry
+	template <typename GetStation>
+	bool Store(const InputSet& input, const u64 numStations, const u32 recordBytes, GetStation getStation)
+	{
+		if (!storable || !InputsSettled(input)) return false;
+
+		StationTableWriter table;
+		table.Collect(numStations, recordBytes, getStation);
+		const u64 tableOffset = sizeof(ResultCacheHeader) + key.len;
+		StringBuffer out(table.End(tableOffset) + 1);
+		ResultCacheHeader h = {};
+		memcpy(h.magic, RESULT_CACHE_MAGIC, sizeof(RESULT_CACHE_MAGIC));
+		h.version = RESULT_CACHE_VERSION;
+		h.recordBytes = recordBytes;
+		h.keyBytes = key.len;
+		h.numStations = numStations;
+		h.namesBytes = table.namesBytes;
+		PushBytes(out, &h, sizeof(h));
+		PushBytes(out, key.data, key.len);
+		table.Push(out);
+		table.Free();
+
+		FileHandle fh = OpenFileWrite(tempPath);
+		if (!fh.Good()) return false;
+		const bool written = fh.Write(out.data, out.size);
+		fh.Close();
+		free(out.data);
+		return written && RenameFileOverwrite(tempPath, path);
+	}
+};
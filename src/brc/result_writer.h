@@ -0,0 +1,397 @@
+#pragma once
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+
+// Machine readable results, so consumers don't have to re-parse {name=min/mean/max, ...}. Every format is written through a fixed
+// buffer that's flushed as it fills, so a million stations never need the whole output in memory.
+//
+//   text     {Abha=-31.1/18.0/66.5, ...}, the challenge's output
+//   json     one {"station":"Abha","min":-31.1,"mean":18.0,"max":66.5,"count":5000,"sum":90012.3} per line
+//   csv      station,min,mean,max,count,sum with a header line, names quoted when they need to be
+//   binary   [ResultHeader][ResultRecord]numStations times[name bytes], names in station order
+//
+// The mean is rounded like the text output, sum is exact in tenths of a degree. Binary records are exact and fixed size, so
+// station i is at sizeof(ResultHeader) + i * sizeof(ResultRecord) and its name at namesOffset + nameOffset.
+//
+// With offsets, every station also gets the logical input offsets of the lines its min and max came from (see AggExtremeOffsets):
+// min@offset and max@offset in text, "minOffset" and "maxOffset" after "sum" in json, min_offset,max_offset columns after sum in
+// csv, and ResultRecordOffsets instead of ResultRecord in binary, which recordBytes tells apart.
+//
+// Results of row windows are written one after the other in window order: json gets a "window" key before "station", csv a window
+// column before station and one header for all of them, and binary is one whole result per window with offsets from its header.
+// Text has no room for it, the caller puts each window's {...} on its own line.
+
+enum ResultFormat
+{
+	RESULT_FORMAT_TEXT,
+	RESULT_FORMAT_JSON,
+	RESULT_FORMAT_CSV,
+	RESULT_FORMAT_BINARY,
+};
+
+constexpr char RESULT_MAGIC[8] = { '1', 'B', 'R', 'C', 'O', 'U', 'T', '\0' }; // Not RESULT_CACHE_MAGIC, the layouts differ
+constexpr u32 RESULT_VERSION = 1;
+constexpr u64 RESULT_WRITE_BUFFER_BYTES = 1 * MB;
+constexpr u64 RESULT_MAX_STATION_BYTES = 256; // Everything but the name of one station in any format
+constexpr u64 RESULT_NO_WINDOW = ~0ull;
+
+struct ResultHeader
+{
+	char magic[8];
+	u32 version;
+	u32 recordBytes;
+	u64 numStations;
+	u64 namesOffset; // From the start of the file
+};
+static_assert(sizeof(ResultHeader) == 32, "ResultHeader is written to disk as-is");
+
+struct ResultRecord
+{
+	u64 nameOffset; // From namesOffset
+	u32 nameLen;
+	s16 min; // Tenths of a degree
+	s16 max;
+	s64 sum;
+	u64 count;
+};
+static_assert(sizeof(ResultRecord) == 32, "ResultRecord is written to disk as-is");
+
+struct ResultRecordOffsets : ResultRecord
+{
+	u64 minOffset;
+	u64 maxOffset;
+};
+static_assert(sizeof(ResultRecordOffsets) == 48, "ResultRecordOffsets is written to disk as-is");
+
+inline bool ParseResultFormat(const char* arg, ResultFormat& format)
+{
+	if (_stricmp(arg, "text") == 0) format = RESULT_FORMAT_TEXT;
+	else if (_stricmp(arg, "json") == 0) format = RESULT_FORMAT_JSON;
+	else if (_stricmp(arg, "csv") == 0) format = RESULT_FORMAT_CSV;
+	else if (_stricmp(arg, "binary") == 0) format = RESULT_FORMAT_BINARY;
+	else return false;
+	return true;
+}
+
+// A file or stdout behind a fixed buffer
+struct ResultWriter
+{
+	FileHandle fh;
+	bool ownsHandle = false;
+	char* buffer = nullptr;
+	u64 used = 0;
+	bool good = false;
+
+	// nullptr for stdout
+	bool Open(const char* path)
+	{
+		if (path != nullptr)
+		{
+			fh = OpenFileWrite(path);
+			ownsHandle = true;
+		}
+		else
+		{
+#ifdef _WIN32
+			fh.handle = GetStdHandle(STD_OUTPUT_HANDLE);
+#else
+			fh.fd = 1;
+#endif
+			ownsHandle = false;
+		}
+		buffer = (char*)malloc(RESULT_WRITE_BUFFER_BYTES);
+		used = 0;
+		good = fh.Good();
+		return good;
+	}
+
+	bool Flush()
+	{
+		if (used > 0)
+		{
+			good = good && fh.Write(buffer, used);
+			used = 0;
+		}
+		return good;
+	}
+
+	bool Close()
+	{
+		const bool flushed = Flush();
+		if (ownsHandle) fh.Close();
+		free(buffer);
+		buffer = nullptr;
+		return flushed;
+	}
+
+	// Room for bytes more, which has to be at most the buffer size
+	__forceinline char* Reserve(const u64 bytes)
+	{
+		if (used + bytes > RESULT_WRITE_BUFFER_BYTES) Flush();
+		return buffer + used;
+	}
+
+	void Append(const void* data, u64 bytes)
+	{
+		const char* src = (const char*)data;
+		while (bytes > 0)
+		{
+			if (used == RESULT_WRITE_BUFFER_BYTES) Flush();
+			const u64 chunk = bytes < RESULT_WRITE_BUFFER_BYTES - used ? bytes : RESULT_WRITE_BUFFER_BYTES - used;
+			memcpy(buffer + used, src, chunk);
+			used += chunk;
+			src += chunk;
+			bytes -= chunk;
+		}
+	}
+
+	void Append(const char* str)
+	{
+		Append(str, strlen(str));
+	}
+};
+
+// Digits of x, most numbers here are short so this beats the fixed 16 digits of U64ToStringTreeTable
+__forceinline u32 WriteU64(char* out, u64 x)
+{
+	char digits[20];
+	u32 len = 0;
+	do
+	{
+		digits[19 - len++] = (char)('0' + x % 10);
+		x /= 10;
+	} while (x > 0);
+	memcpy(out, digits + 20 - len, len);
+	return len;
+}
+
+// A scaled temperature like Push1DecimalDouble in the solutions, returns the bytes written
+__forceinline u32 WriteDecimal(char* out, const s64 scaled)
+{
+	u32 written = 0;
+	if (scaled < 0) out[written++] = '-';
+	const u64 abs = scaled < 0 ? (u64)-scaled : (u64)scaled;
+	written += WriteU64(out + written, abs / 10);
+	out[written++] = '.';
+	out[written++] = (char)('0' + abs % 10);
+	return written;
+}
+
+// The text output's rounding of the mean
+__forceinline s64 ScaledMean(const ResultRecord& record)
+{
+	return static_cast<s64>(ceil(((record.sum * 0.1) / record.count) * 10));
+}
+
+// ,min,mean,max,count,sum with the JSON keys or without
+template <bool Json>
+__forceinline u32 WriteStats(char* out, const ResultRecord& record)
+{
+	u32 written = 0;
+	auto key = [&](const char* json, const u32 len)
+	{
+		out[written++] = ',';
+		if (!Json) return;
+		memcpy(out + written, json, len);
+		written += len;
+	};
+	key("\"min\":", 6);
+	written += WriteDecimal(out + written, record.min);
+	key("\"mean\":", 7);
+	written += WriteDecimal(out + written, ScaledMean(record));
+	key("\"max\":", 6);
+	written += WriteDecimal(out + written, record.max);
+	key("\"count\":", 8);
+	written += WriteU64(out + written, record.count);
+	key("\"sum\":", 6);
+	written += WriteDecimal(out + written, record.sum);
+	return written;
+}
+
+// JSON string contents, worst case 6 bytes per name byte
+inline u32 WriteJsonEscaped(char* out, const String& name)
+{
+	static const char hex[] = "0123456789abcdef";
+	u32 written = 0;
+	for (u64 i = 0; i < name.len; i++)
+	{
+		const u8 c = (u8)name.data[i];
+		if (c == '"' || c == '\\')
+		{
+			out[written++] = '\\';
+			out[written++] = (char)c;
+		}
+		else if (c < 0x20)
+		{
+			memcpy(out + written, "\\u00", 4);
+			out[written + 4] = hex[c >> 4];
+			out[written + 5] = hex[c & 15];
+			written += 6;
+		}
+		else
+		{
+			out[written++] = (char)c;
+		}
+	}
+	return written;
+}
+
+// A CSV field, quoted with doubled quotes only if it has a separator, quote or line break in it
+inline u32 WriteCsvField(char* out, const String& name)
+{
+	bool quote = false;
+	for (u64 i = 0; i < name.len && !quote; i++)
+	{
+		const char c = name.data[i];
+		quote = c == ',' || c == '"' || c == '\n' || c == '\r';
+	}
+	if (!quote)
+	{
+		memcpy(out, name.data, name.len);
+		return (u32)name.len;
+	}
+
+	u32 written = 0;
+	out[written++] = '"';
+	for (u64 i = 0; i < name.len; i++)
+	{
+		if (name.data[i] == '"') out[written++] = '"';
+		out[written++] = name.data[i];
+	}
+	out[written++] = '"';
+	return written;
+}
+
+// getStation(i, name, record) fills in the name and min/max/sum/count of station i of n, in output order, and the offsets if they
+// are written (it can take a ResultRecord& if not). Names longer than the buffer allows for are cut short in the text formats, the
+// challenge has them at 100 bytes at most. window is the row window these stations are from, if any.
+template <typename GetStation>
+bool WriteResults(ResultWriter& writer, const ResultFormat format, const u64 numStations, GetStation getStation, const u64 window = RESULT_NO_WINDOW, const bool offsets = false)
+{
+	const u64 recordBytes = offsets ? sizeof(ResultRecordOffsets) : sizeof(ResultRecord);
+	const bool windowed = window != RESULT_NO_WINDOW;
+	const u64 maxNameBytes = (RESULT_WRITE_BUFFER_BYTES - RESULT_MAX_STATION_BYTES) / 6;
+
+	if (format == RESULT_FORMAT_BINARY)
+	{
+		// Records first, then the names they point at
+		ResultHeader h = {};
+		memcpy(h.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC));
+		h.version = RESULT_VERSION;
+		h.recordBytes = (u32)recordBytes;
+		h.numStations = numStations;
+		h.namesOffset = sizeof(ResultHeader) + numStations * recordBytes;
+		writer.Append(&h, sizeof(h));
+		u64 nameOffset = 0;
+		for (u64 i = 0; i < numStations; i++)
+		{
+			String name;
+			ResultRecordOffsets record = {};
+			getStation(i, name, record);
+			record.nameOffset = nameOffset;
+			record.nameLen = (u32)name.len;
+			memcpy(writer.Reserve(recordBytes), &record, recordBytes);
+			writer.used += recordBytes;
+			nameOffset += name.len;
+		}
+		for (u64 i = 0; i < numStations; i++)
+		{
+			String name;
+			ResultRecordOffsets record;
+			getStation(i, name, record);
+			writer.Append(name.data, name.len);
+		}
+		return writer.good;
+	}
+
+	if (format == RESULT_FORMAT_CSV && (!windowed || window == 0))
+	{
+		if (windowed) writer.Append("window,");
+		writer.Append(offsets ? "station,min,mean,max,count,sum,min_offset,max_offset\n" : "station,min,mean,max,count,sum\n");
+	}
+	if (format == RESULT_FORMAT_TEXT) writer.Append("{");
+	for (u64 i = 0; i < numStations; i++)
+	{
+		String name;
+		ResultRecordOffsets record = {};
+		getStation(i, name, record);
+		if (name.len > maxNameBytes) name.len = maxNameBytes;
+
+		char* out = writer.Reserve(name.len * 6 + RESULT_MAX_STATION_BYTES);
+		u32 written = 0;
+		if (format == RESULT_FORMAT_TEXT)
+		{
+			if (i > 0)
+			{
+				out[written++] = ',';
+				out[written++] = ' ';
+			}
+			memcpy(out + written, name.data, name.len);
+			written += (u32)name.len;
+			out[written++] = '=';
+			written += WriteDecimal(out + written, record.min);
+			if (offsets)
+			{
+				out[written++] = '@';
+				written += WriteU64(out + written, record.minOffset);
+			}
+			out[written++] = '/';
+			written += WriteDecimal(out + written, ScaledMean(record));
+			out[written++] = '/';
+			written += WriteDecimal(out + written, record.max);
+			if (offsets)
+			{
+				out[written++] = '@';
+				written += WriteU64(out + written, record.maxOffset);
+			}
+		}
+		else if (format == RESULT_FORMAT_JSON)
+		{
+			out[written++] = '{';
+			if (windowed)
+			{
+				memcpy(out + written, "\"window\":", 9);
+				written += 9;
+				written += WriteU64(out + written, window);
+				out[written++] = ',';
+			}
+			memcpy(out + written, "\"station\":\"", 11);
+			written += 11;
+			written += WriteJsonEscaped(out + written, name);
+			out[written++] = '"';
+			written += WriteStats<true>(out + written, record);
+			if (offsets)
+			{
+				memcpy(out + written, ",\"minOffset\":", 13);
+				written += 13;
+				written += WriteU64(out + written, record.minOffset);
+				memcpy(out + written, ",\"maxOffset\":", 13);
+				written += 13;
+				written += WriteU64(out + written, record.maxOffset);
+			}
+			out[written++] = '}';
+			out[written++] = '\n';
+		}
+		else
+		{
+			if (windowed)
+			{
+				written += WriteU64(out, window);
+				out[written++] = ',';
+			}
+			written += WriteCsvField(out + written, name);
+			written += WriteStats<false>(out + written, record);
+			if (offsets)
+			{
+				out[written++] = ',';
+				written += WriteU64(out + written, record.minOffset);
+				out[written++] = ',';
+				written += WriteU64(out + written, record.maxOffset);
+			}
+			out[written++] = '\n';
+		}
+		writer.used += written;
+	}
+	if (format == RESULT_FORMAT_TEXT) writer.Append("}");
+	return writer.good;
+}
@@ -0,0 +1,278 @@
+#pragma once
+#include <cmath>
+
+#include "../base/buf_string.h"
+#include "../base/vector.h"
+
+// Approximate answers from a sample of the input, see tools/brc_sample. The input is cut into numSlots blocks in input order, and
+// the blocks into numStrata strata of consecutive blocks. Every stratum is sampled without replacement in its own random order
+// (Permute64, so nothing per block is stored), the same share of each, so a time ordered input gets every part of its time range.
+// A block is whole lines, the ones that start inside it, so the blocks split the input exactly and every line is in exactly one.
+//
+// Every sampled block is a cluster of lines, and the estimates are the textbook stratified cluster sampling ones (Cochran,
+// Sampling Techniques, ch. 5 and 6). With N_h blocks in stratum h of which n_h are sampled, and c and y a station's count and
+// sum of readings in a block:
+//   count total   X = sum_h N_h / n_h * sum_i c_hi
+//   reading sum   Y = sum_h N_h / n_h * sum_i y_hi
+//   mean          R = Y / X, a ratio estimate
+//   var(X)        sum_h N_h^2 (1 - n_h / N_h) / n_h * s^2(c)_h
+//   var(R)        sum_h N_h^2 (1 - n_h / N_h) / n_h * s^2(y - R c)_h / X^2, with s^2(y - R c) = s^2(y) - 2R s(c,y) + R^2 s^2(c)
+// so the five sums of c, c^2, y, y^2 and c*y per stratum and station are all that's needed, and blocks where a station isn't add
+// nothing to them. The intervals are the normal ones, z * sqrt(var). A stratum that has been read completely adds no variance,
+// and once every block is read the answer is exact. Min and max are only ever what the sample has seen, bounds of the real ones.
+
+constexpr u64 SAMPLE_DEFAULT_BLOCK_BYTES = 64 * KB;
+constexpr u32 SAMPLE_DEFAULT_STRATA = 64;
+constexpr double SAMPLE_DEFAULT_FRACTION = 0.01;
+constexpr double SAMPLE_DEFAULT_CONFIDENCE = 0.95;
+constexpr u64 SAMPLE_MIN_PER_STRATUM = 2; // A variance needs two blocks
+constexpr u64 SAMPLE_DEFAULT_SEED = 0x1b2c;
+
+// The z of a two-sided normal interval, P(|Z| <= z) = confidence, by bisection on erf
+inline double SampleZ(const double confidence)
+{
+	double low = 0;
+	double high = 10;
+	for (u32 i = 0; i < 64; i++)
+	{
+		const double mid = (low + high) * 0.5;
+		if (erf(mid / sqrt(2.0)) < confidence) low = mid;
+		else high = mid;
+	}
+	return (low + high) * 0.5;
+}
+
+struct SamplePick
+{
+	u64 slot;
+	u32 stratum;
+};
+
+struct SamplePlan
+{
+	u64 numSlots = 0;
+	u32 numStrata = 0;
+	u64 seed = SAMPLE_DEFAULT_SEED;
+	Array<u64> taken; // Blocks sampled so far per stratum, the first ones of its order
+
+	void Init(const u64 slots, const u32 strata, const u64 planSeed)
+	{
+		numSlots = slots;
+		numStrata = strata < slots ? strata : (u32)slots;
+		if (numStrata == 0) numStrata = 1;
+		seed = planSeed;
+		taken.InitMallocZero(numStrata);
+	}
+
+	void Free()
+	{
+		taken.Free();
+		taken.data = nullptr;
+	}
+
+	u64 StratumBegin(const u32 stratum) const
+	{
+		return numSlots * stratum / numStrata;
+	}
+
+	u64 StratumSlots(const u32 stratum) const
+	{
+		return StratumBegin(stratum + 1) - StratumBegin(stratum);
+	}
+
+	// The k-th block of the stratum's random order
+	u64 Slot(const u32 stratum, const u64 k) const
+	{
+		Permute64 order;
+		order.Init(StratumSlots(stratum), seed + stratum * 0x9E3779B97F4A7C15ull);
+		return StratumBegin(stratum) + order.Permute(k);
+	}
+
+	// Picks more blocks so that every stratum has at least fraction of its blocks (and two) sampled, returns how many
+	u64 Next(const double fraction, Vector<SamplePick>& picks)
+	{
+		const u64 before = picks.size;
+		for (u32 h = 0; h < numStrata; h++)
+		{
+			const u64 slots = StratumSlots(h);
+			u64 want = (u64)ceil(fraction * slots);
+			if (want < SAMPLE_MIN_PER_STRATUM) want = SAMPLE_MIN_PER_STRATUM;
+			if (want > slots) want = slots;
+			for (; taken.data[h] < want; taken.data[h]++)
+			{
+				picks.Push({ Slot(h, taken.data[h]), h });
+			}
+		}
+		return picks.size - before;
+	}
+
+	u64 Sampled() const
+	{
+		u64 sampled = 0;
+		for (u32 h = 0; h < numStrata; h++)
+		{
+			sampled += taken.data[h];
+		}
+		return sampled;
+	}
+
+	bool Complete() const
+	{
+		return Sampled() == numSlots;
+	}
+};
+
+// One station in one sampled block
+struct SampleObservation
+{
+	u32 station;
+	u32 count;
+	s64 sum;
+};
+
+struct SampleBlock
+{
+	u32 stratum;
+	u64 firstObservation;
+	u32 numObservations;
+};
+
+struct SampleEstimate
+{
+	double count; // Readings in the whole input
+	double countHalfWidth;
+	double sum; // Of the readings in tenths of a degree
+	double mean; // Tenths of a degree
+	double meanHalfWidth;
+};
+
+// Everything sampled so far, the estimates are recomputed from it after every round, which costs far less than parsing the blocks
+struct SampleEstimator
+{
+	struct Moments
+	{
+		double c, cc, y, yy, cy;
+	};
+	struct Totals
+	{
+		double x, y, varC, varY, covCY; // The last three already weighted by N_h^2 (1 - f_h) / n_h
+	};
+
+	Vector<SampleBlock> blocks;
+	Vector<SampleObservation> observations;
+
+	void Init()
+	{
+		blocks.Init(1024);
+		observations.Init(64 * 1024);
+	}
+
+	void Free()
+	{
+		free(blocks.data);
+		free(observations.data);
+		blocks.data = nullptr;
+		observations.data = nullptr;
+	}
+
+	// Then AddObservation for every station in the block
+	void BeginBlock(const u32 stratum)
+	{
+		blocks.Push({ stratum, observations.size, 0 });
+	}
+
+	void AddObservation(const u32 station, const u32 count, const s64 sum)
+	{
+		observations.Push({ station, count, sum });
+		blocks.Last().numObservations++;
+	}
+
+	void Estimate(const SamplePlan& plan, const u32 numStations, const double z, Array<SampleEstimate>& out)
+	{
+		// The blocks of every stratum together
+		Array<u64> stratumStart;
+		stratumStart.InitMallocZero(plan.numStrata + 1);
+		for (u64 i = 0; i < blocks.size; i++)
+		{
+			stratumStart.data[blocks.data[i].stratum + 1]++;
+		}
+		for (u32 h = 0; h < plan.numStrata; h++)
+		{
+			stratumStart.data[h + 1] += stratumStart.data[h];
+		}
+		Array<u64> order;
+		order.InitMalloc(blocks.size > 0 ? blocks.size : 1);
+		{
+			Array<u64> next;
+			next.InitMalloc(plan.numStrata);
+			memcpy(next.data, stratumStart.data, plan.numStrata * sizeof(u64));
+			for (u64 i = 0; i < blocks.size; i++)
+			{
+				order.data[next.data[blocks.data[i].stratum]++] = i;
+			}
+			next.Free();
+		}
+
+		Array<Moments> moments;
+		moments.InitMallocZero(numStations > 0 ? numStations : 1);
+		Array<Totals> totals;
+		totals.InitMallocZero(numStations > 0 ? numStations : 1);
+		Vector<u32> touched(1024);
+		for (u32 h = 0; h < plan.numStrata; h++)
+		{
+			const double n = (double)(stratumStart.data[h + 1] - stratumStart.data[h]);
+			const double slots = (double)plan.StratumSlots(h);
+			if (n == 0) continue;
+			for (u64 i = stratumStart.data[h]; i < stratumStart.data[h + 1]; i++)
+			{
+				const SampleBlock& block = blocks.data[order.data[i]];
+				for (u64 j = block.firstObservation; j < block.firstObservation + block.numObservations; j++)
+				{
+					const SampleObservation& o = observations.data[j];
+					Moments& m = moments.data[o.station];
+					if (m.c == 0) touched.Push(o.station);
+					const double c = o.count;
+					const double y = (double)o.sum;
+					m.c += c;
+					m.cc += c * c;
+					m.y += y;
+					m.yy += y * y;
+					m.cy += c * y;
+				}
+			}
+
+			const double expansion = slots / n;
+			const double weight = n > 1 ? slots * slots * (1 - n / slots) / n / (n - 1) : 0;
+			for (u64 i = 0; i < touched.size; i++)
+			{
+				Moments& m = moments.data[touched.data[i]];
+				Totals& t = totals.data[touched.data[i]];
+				t.x += expansion * m.c;
+				t.y += expansion * m.y;
+				t.varC += weight * (m.cc - m.c * m.c / n);
+				t.varY += weight * (m.yy - m.y * m.y / n);
+				t.covCY += weight * (m.cy - m.c * m.y / n);
+				m = Moments();
+			}
+			touched.Clear();
+		}
+
+		out.InitMalloc(numStations > 0 ? numStations : 1);
+		for (u32 i = 0; i < numStations; i++)
+		{
+			const Totals& t = totals.data[i];
+			SampleEstimate& e = out.data[i];
+			e.count = t.x;
+			e.countHalfWidth = z * sqrt(t.varC > 0 ? t.varC : 0);
+			e.sum = t.y;
+			e.mean = t.x > 0 ? t.y / t.x : 0;
+			const double varMean = t.varY - 2 * e.mean * t.covCY + e.mean * e.mean * t.varC;
+			e.meanHalfWidth = t.x > 0 && varMean > 0 ? z * sqrt(varMean) / t.x : 0;
+		}
+
+		moments.Free();
+		totals.Free();
+		order.Free();
+		stratumStart.Free();
+	}
+};
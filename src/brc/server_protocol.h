@@ -0,0 +1,77 @@
+#pragma once
+#include "../base/platform_socket.h"
+#include "../base/vector.h"
+
+// Line protocol spoken by tools/brc_server over a Unix domain socket, any number of requests per connection:
+//
+//   QUERY <file or glob>\t<file or glob>...\n     aggregate the files as one logical input
+//   STATS\n                                       server side latency percentiles
+//
+// Every request gets back either
+//
+//   OK <payload bytes> <server microseconds>\n<payload>
+//   ERR <message>\n
+//
+// where the payload of a query is the usual {name=min/mean/max, ...} output.
+
+constexpr const char* BRC_DEFAULT_SOCKET = "brc.sock";
+
+inline bool SendQuery(const LocalSocket& socket, const Vector<const char*>& patterns)
+{
+	u64 bytes = 16;
+	for (u64 i = 0; i < patterns.size; i++)
+	{
+		bytes += strlen(patterns.data[i]) + 1;
+	}
+
+	StringBuffer request(bytes);
+	request.Push("QUERY ");
+	for (u64 i = 0; i < patterns.size; i++)
+	{
+		if (i > 0) request.Push('\t');
+		request.Push(patterns.data[i]);
+	}
+	request.Push('\n');
+	const bool sent = socket.SendAll(request.data, request.size);
+	free(request.data);
+	return sent;
+}
+
+struct Response
+{
+	bool ok = false;
+	u64 serverMicros = 0;
+	Array<char> payload; // Reused between responses, only grows
+	u64 payloadBytes = 0;
+	char error[256] = {};
+};
+
+// False if the connection broke, a well formed ERR is still a true with ok = false
+inline bool ReadResponse(SocketReader& reader, Response& response)
+{
+	String line;
+	if (!reader.ReadLine(line)) return false;
+
+	if (line.len >= 4 && memcmp(line.data, "ERR ", 4) == 0)
+	{
+		const u64 len = line.len - 4 < sizeof(response.error) - 1 ? line.len - 4 : sizeof(response.error) - 1;
+		memcpy(response.error, line.data + 4, len);
+		response.error[len] = '\0';
+		response.ok = false;
+		return true;
+	}
+	if (line.len < 3 || memcmp(line.data, "OK ", 3) != 0) return false;
+
+	char header[64] = {};
+	memcpy(header, line.data + 3, line.len - 3 < sizeof(header) - 1 ? line.len - 3 : sizeof(header) - 1);
+	char* end = nullptr;
+	response.payloadBytes = strtoull(header, &end, 10);
+	response.serverMicros = strtoull(end, nullptr, 10);
+	if (response.payload.size < response.payloadBytes + 1)
+	{
+		response.payload.Free();
+		response.payload.InitMalloc(response.payloadBytes + 1);
+	}
+	response.ok = true;
+	return reader.ReadExact(response.payload.data, response.payloadBytes);
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+
+// A station include or exclude list compiled for the per-line check of a scan, so unwanted lines are dropped before their
+// temperature is parsed or they touch the station map. An include list first checks the first 3 bytes of the line against a bit
+// per hashed 3 byte prefix of the wanted names, 8 KB that stays in L1, and most lines of a short list are rejected right there
+// without even hashing their name. The rest, and every line of an exclude list, are checked by name in a small open addressing
+// set keyed by the same FNV hash the scan already computed.
+
+constexpr u32 FILTER_PREFIX_BITS = 1 << 16;
+
+struct StationFilter
+{
+	struct Entry
+	{
+		const char* name;
+		u32 namelen;
+		HASH_T hash;
+	};
+	bool exclude = false;
+	u64* prefixes = nullptr; // Only for include lists
+	Entry* items = nullptr;
+	u64 capacity = 0;
+	u32 numNames = 0;
+	Vector<char*> texts; // Copies of the lists the names point into
+
+	void Init(const bool excludeList)
+	{
+		exclude = excludeList;
+		prefixes = exclude ? nullptr : (u64*)calloc(FILTER_PREFIX_BITS / 64, sizeof(u64));
+		capacity = 64;
+		items = (Entry*)calloc(capacity, sizeof(Entry));
+		numNames = 0;
+		texts.Init(4);
+	}
+
+	void Free()
+	{
+		free(prefixes);
+		free(items);
+		for (u64 i = 0; i < texts.size; i++)
+		{
+			free(texts[i]);
+		}
+	}
+
+	// The hash the scan computes while seeking the ';'
+	static HASH_T Hash(const String& name)
+	{
+		HASH_T hash = FNV_PRIME;
+		for (u64 i = 0; i < name.len; i++)
+		{
+			fnv1aStep(name.data[i], hash);
+		}
+		return hash;
+	}
+
+	// Lines are at least "X;0.0\n", so the 4 byte load never leaves the line
+	__forceinline static u32 PrefixBit(const char* line)
+	{
+		u32 key;
+		memcpy(&key, line, sizeof(key));
+		return ((key & 0xffffff) * 0x9E3779B1u) >> 16;
+	}
+
+	void SetPrefix(const char* bytes)
+	{
+		const u32 bit = PrefixBit(bytes);
+		prefixes[bit / 64] |= 1ull << (bit % 64);
+	}
+
+	bool Contains(const String& name, const HASH_T hash) const
+	{
+		for (u64 idx = hash & (capacity - 1);; idx = (idx + 1) & (capacity - 1))
+		{
+			const Entry& e = items[idx];
+			if (e.namelen == 0) return false;
+			if (e.hash == hash && name.Equals(e.name, e.namelen)) return true;
+		}
+	}
+
+	void Grow()
+	{
+		const u64 newCapacity = capacity * 2;
+		Entry* newItems = (Entry*)calloc(newCapacity, sizeof(Entry));
+		for (u64 i = 0; i < capacity; i++)
+		{
+			if (items[i].namelen == 0) continue;
+			u64 idx = items[i].hash & (newCapacity - 1);
+			while (newItems[idx].namelen != 0) idx = (idx + 1) & (newCapacity - 1);
+			newItems[idx] = items[i];
+		}
+		free(items);
+		items = newItems;
+		capacity = newCapacity;
+	}
+
+	void Add(const String& name)
+	{
+		const HASH_T hash = Hash(name);
+		if (name.len == 0 || Contains(name, hash)) return;
+		u64 idx = hash & (capacity - 1);
+		while (items[idx].namelen != 0) idx = (idx + 1) & (capacity - 1);
+		items[idx] = { name.data, (u32)name.len, hash };
+		// Kept under a quarter full so a miss, the common case, usually ends on the first probe
+		if (++numNames * 4ull > capacity) Grow();
+		if (exclude) return;
+
+		// The 3 bytes of a 1 byte name run into the temperature, so that one gets a bit for every byte a temperature can start with
+		char prefix[4] = { name.data[0], name.len > 1 ? name.data[1] : ';', name.len > 2 ? name.data[2] : ';', 0 };
+		if (name.len > 1)
+		{
+			SetPrefix(prefix);
+			return;
+		}
+		const char starts[] = "-0123456789";
+		for (u32 i = 0; i < sizeof(starts) - 1; i++)
+		{
+			prefix[2] = starts[i];
+			SetPrefix(prefix);
+		}
+	}
+
+	// Names separated by separator
+	void AddList(const char* list, const u64 len, const char separator)
+	{
+		char* copy = (char*)malloc(len + 1);
+		memcpy(copy, list, len);
+		copy[len] = '\0';
+		texts.Push(copy);
+
+		const char* end = copy + len;
+		for (const char* name = copy; name < end;)
+		{
+			const char* nameEnd = (const char*)memchr(name, separator, end - name);
+			if (nameEnd == nullptr) nameEnd = end;
+			const char* begin = name;
+			const char* last = nameEnd;
+			while (begin < last && (*begin == ' ' || *begin == '\t')) begin++;
+			while (last > begin && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r')) last--;
+			if (last > begin) Add(String((char*)begin, last - begin));
+			name = nameEnd + 1;
+		}
+	}
+
+	// "Oslo,Hamburg", or @path for a file with one name per line
+	bool AddArg(const char* arg)
+	{
+		if (arg[0] != '@')
+		{
+			AddList(arg, strlen(arg), ',');
+			return true;
+		}
+
+		MappedFileHandle file;
+		if (!file.OpenRead(arg + 1))
+		{
+			printf("can't read stations from %s\n", arg + 1);
+			return false;
+		}
+		AddList(file.data, file.length, '\n');
+		file.Close();
+		return true;
+	}
+
+	// False means the line can't be wanted, true that it still has to be checked by name
+	__forceinline bool MayWant(const char* line) const
+	{
+		if (exclude) return true;
+		const u32 bit = PrefixBit(line);
+		return (prefixes[bit / 64] >> (bit % 64)) & 1;
+	}
+
+	__forceinline bool Wants(const String& name, const HASH_T hash) const
+	{
+		return Contains(name, hash) != exclude;
+	}
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include "../base/buf_string.h"
+#include "../base/platform_io.h"
+
+// Station metadata from data/weather_stations.csv (Name;latitude lines, # comments), joined onto a result after the scan and used
+// to re-aggregate its stations into groups like latitude bands. Everything here runs on the merged per-station result, at most
+// one lookup per station, so the scan itself doesn't change at all.
+//
+// The lookup is an open addressing table keyed by the FNV hash the engines already compute for their station maps, so a result
+// that kept its hashes (see src/brc/engine.h) joins without hashing a name again. A name that's in the file more than once (the
+// file has ~2000, largest city first) keeps its first latitude, like gen.cpp keeps the first spelling.
+
+constexpr double METADATA_DEFAULT_BAND_DEGREES = 10.0;
+
+struct StationMetadata
+{
+	struct Entry
+	{
+		const char* name; // Into the mapped file
+		u32 namelen;
+		float latitude;
+		HASH_T hash;
+	};
+	MappedFileHandle file;
+	Entry* items = nullptr;
+	u64 capacity = 0;
+	u32 numStations = 0;
+
+	// The hash of the engines' station maps
+	static HASH_T Hash(const String& name)
+	{
+		HASH_T hash = FNV_PRIME;
+		for (u64 i = 0; i < name.len; i++)
+		{
+			fnv1aStep(name.data[i], hash);
+		}
+		return hash;
+	}
+
+	bool Load(const char* path)
+	{
+		if (!file.OpenRead(path))
+		{
+			printf("can't read station metadata from %s\n", path);
+			return false;
+		}
+
+		u64 lines = 1;
+		for (u64 i = 0; i < file.length; i++)
+		{
+			lines += file.data[i] == '\n';
+		}
+		capacity = 64;
+		while (capacity < lines * 2) capacity *= 2; // At most half full
+		items = (Entry*)calloc(capacity, sizeof(Entry));
+		numStations = 0;
+
+		const char* end = file.data + file.length;
+		for (const char* line = file.data; line < end;)
+		{
+			const char* lineEnd = (const char*)memchr(line, '\n', end - line);
+			if (lineEnd == nullptr) lineEnd = end;
+			const char* separator = (const char*)memchr(line, ';', lineEnd - line);
+			if (line[0] != '#' && separator != nullptr && separator > line)
+			{
+				char latitude[32] = {};
+				const u64 fieldLen = (u64)(lineEnd - separator - 1);
+				const u64 latitudeLen = fieldLen < sizeof(latitude) - 1 ? fieldLen : sizeof(latitude) - 1;
+				memcpy(latitude, separator + 1, latitudeLen);
+				Insert(String((char*)line, separator - line), strtof(latitude, nullptr));
+			}
+			line = lineEnd + 1;
+		}
+		return true;
+	}
+
+	void Free()
+	{
+		free(items);
+		items = nullptr;
+		file.Close();
+	}
+
+	void Insert(const String& name, const float latitude)
+	{
+		const HASH_T hash = Hash(name);
+		u64 idx = hash & (capacity - 1);
+		for (;; idx = (idx + 1) & (capacity - 1))
+		{
+			const Entry& e = items[idx];
+			if (e.namelen == 0) break;
+			if (e.hash == hash && name.Equals(e.name, e.namelen)) return; // First one wins
+		}
+		items[idx] = { name.data, (u32)name.len, latitude, hash };
+		numStations++;
+	}
+
+	const Entry* Find(const String& name, const HASH_T hash) const
+	{
+		for (u64 idx = hash & (capacity - 1);; idx = (idx + 1) & (capacity - 1))
+		{
+			const Entry& e = items[idx];
+			if (e.namelen == 0) return nullptr;
+			if (e.hash == hash && name.Equals(e.name, e.namelen)) return &e;
+		}
+	}
+};
+
+// Min/max/sum/count of every station in a group, merged from the per-station aggregates so it's exact
+struct StationGroup
+{
+	s16 min = 32767;
+	s16 max = -32768;
+	s64 sum = 0;
+	u64 count = 0;
+	u32 stations = 0;
+
+	void Add(const s16 stationMin, const s16 stationMax, const s64 stationSum, const u64 stationCount)
+	{
+		if (stationMin < min) min = stationMin;
+		if (stationMax > max) max = stationMax;
+		sum += stationSum;
+		count += stationCount;
+		stations++;
+	}
+};
+
+// Bands of bandDegrees latitude from the south pole up, plus one last group for the stations that aren't in the metadata
+struct LatitudeBands
+{
+	double bandDegrees = METADATA_DEFAULT_BAND_DEGREES;
+	u32 numBands = 0;
+	Array<StationGroup> groups;
+	StringBuffer names;
+
+	void Init(const double degrees)
+	{
+		bandDegrees = degrees;
+		numBands = (u32)ceil(180.0 / bandDegrees);
+		groups.InitMalloc(numBands + 1);
+		for (u32 i = 0; i <= numBands; i++)
+		{
+			groups.data[i] = StationGroup();
+		}
+		names.Init((numBands + 1) * 64);
+	}
+
+	void Free()
+	{
+		groups.Free();
+		free(names.data);
+		names.data = nullptr;
+	}
+
+	u32 Band(const float latitude) const
+	{
+		const double band = floor((latitude + 90.0) / bandDegrees);
+		if (band < 0) return 0;
+		return band >= numBands ? numBands - 1 : (u32)band; // 90 is in the top band
+	}
+
+	void Add(const StationMetadata& metadata, const String& name, const HASH_T hash, const s16 min, const s16 max, const s64 sum, const u64 count)
+	{
+		const StationMetadata::Entry* e = metadata.Find(name, hash);
+		groups.data[e != nullptr ? Band(e->latitude) : numBands].Add(min, max, sum, count);
+	}
+
+	u32 NumGroups() const
+	{
+		return numBands + 1;
+	}
+
+	// [-10,0) style, "unknown" for the stations without metadata
+	String Name(const u32 group)
+	{
+		if (group == numBands) return names.PushStringF("unknown");
+		const double low = -90.0 + group * bandDegrees;
+		const double high = low + bandDegrees < 90.0 ? low + bandDegrees : 90.0;
+		char buf[64];
+		snprintf(buf, sizeof(buf), group == numBands - 1 ? "[%g,%g]" : "[%g,%g)", low, high);
+		return names.PushStringF(buf);
+	}
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include "../base/buf_string.h"
+#include "../base/vector.h"
+
+// The per-station part of the files that save aggregates (result_cache.h, checkpoint.h), after whatever prefix each of them starts
+// with:
+//
+//   u32 nameOffsets[numStations + 1] [name bytes] [padding to 8]
+//   [records]                                       recordBytes each, whatever the engine aggregates into
+
+inline void PushBytes(StringBuffer& buf, const void* data, const u64 bytes)
+{
+	assert(buf.size + bytes < buf.reserved);
+	memcpy(buf.data + buf.size, data, bytes);
+	buf.size += bytes;
+}
+
+inline u64 StationTableRecordsOffset(const u64 tableOffset, const u64 numStations, const u64 namesBytes)
+{
+	const u64 offset = tableOffset + (numStations + 1) * sizeof(u32) + namesBytes;
+	return (offset + 7) & ~7ull;
+}
+
+// Where a file with the table at tableOffset ends
+inline u64 StationTableEnd(const u64 tableOffset, const u64 numStations, const u64 namesBytes, const u32 recordBytes)
+{
+	return StationTableRecordsOffset(tableOffset, numStations, namesBytes) + numStations * recordBytes;
+}
+
+// The stations of a result, gathered with one getStation(i, String& name, const void*& record) call each. Names and records still
+// point at the caller's, which have to stay put until Push.
+struct StationTableWriter
+{
+	Array<String> names;
+	Array<const void*> records;
+	u64 numStations = 0;
+	u64 namesBytes = 0;
+	u32 recordBytes = 0;
+
+	template <typename GetStation>
+	void Collect(const u64 stations, const u32 stationRecordBytes, GetStation getStation)
+	{
+		numStations = stations;
+		recordBytes = stationRecordBytes;
+		names.InitMalloc(numStations + 1);
+		records.InitMalloc(numStations + 1);
+		namesBytes = 0;
+		for (u64 i = 0; i < numStations; i++)
+		{
+			getStation(i, names.data[i], records.data[i]);
+			namesBytes += names.data[i].len;
+		}
+	}
+
+	u64 End(const u64 tableOffset) const
+	{
+		return StationTableEnd(tableOffset, numStations, namesBytes, recordBytes);
+	}
+
+	// out has to hold exactly the prefix of the file
+	void Push(StringBuffer& out) const
+	{
+		const u64 tableOffset = out.size;
+		u32 offset = 0;
+		for (u64 i = 0; i <= numStations; i++)
+		{
+			PushBytes(out, &offset, sizeof(offset));
+			if (i < numStations) offset += (u32)names.data[i].len;
+		}
+		for (u64 i = 0; i < numStations; i++)
+		{
+			PushBytes(out, names.data[i].data, names.data[i].len);
+		}
+		const u64 zero = 0;
+		PushBytes(out, &zero, StationTableRecordsOffset(tableOffset, numStations, namesBytes) - out.size);
+		for (u64 i = 0; i < numStations; i++)
+		{
+			PushBytes(out, records.data[i], recordBytes);
+		}
+	}
+
+	void Free()
+	{
+		names.Free();
+		records.Free();
+	}
+};
+
+// A table inside a mapped file, the size of the file has to be checked against StationTableEnd first
+struct StationTableView
+{
+	const u32* nameOffsets = nullptr;
+	const char* names = nullptr;
+	const char* records = nullptr;
+	u64 numStations = 0;
+	u64 namesBytes = 0;
+	u32 recordBytes = 0;
+
+	void Init(const char* fileData, const u64 tableOffset, const u64 stations, const u64 stationNamesBytes, const u32 stationRecordBytes)
+	{
+		numStations = stations;
+		namesBytes = stationNamesBytes;
+		recordBytes = stationRecordBytes;
+		nameOffsets = (const u32*)(fileData + tableOffset);
+		names = (const char*)(nameOffsets + numStations + 1);
+		records = fileData + StationTableRecordsOffset(tableOffset, numStations, namesBytes);
+	}
+
+	String Name(const u64 i) const
+	{
+		return String((char*)names + nameOffsets[i], nameOffsets[i + 1] - nameOffsets[i]);
+	}
+
+	const void* Record(const u64 i) const
+	{
+		return records + i * recordBytes;
+	}
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <immintrin.h>
+
+#include "../base/type_macros.h"
+
+// Counts of the readings past up to 8 thresholds, like "above 35.0" or "below -20.0". Every threshold is turned into
+// sign * temp > bound, so a group of 4 is one broadcast, sign, compare and subtract of the all-ones mask in an SSE register with no
+// branch. The counts of a station live in its aggregate (AggThresholds in src/brc/aggregate.h), 16 bytes per group of 4.
+
+constexpr u32 THRESHOLD_MAX = 8;
+constexpr u32 THRESHOLD_GROUP = 4;
+constexpr u32 THRESHOLD_MAX_GROUPS = THRESHOLD_MAX / THRESHOLD_GROUP;
+
+struct Threshold
+{
+	s32 value; // Scaled by 10 like the temperatures
+	bool below;
+};
+
+// The thresholds of every query in a batch, each query points at the ones it asked for
+struct ThresholdSet
+{
+	Threshold thresholds[THRESHOLD_MAX];
+	u32 numThresholds = 0;
+
+	// The index of the threshold, -1 once there are THRESHOLD_MAX others
+	s32 Add(const Threshold t)
+	{
+		for (u32 i = 0; i < numThresholds; i++)
+		{
+			if (thresholds[i].value == t.value && thresholds[i].below == t.below) return (s32)i;
+		}
+		if (numThresholds == THRESHOLD_MAX) return -1;
+		thresholds[numThresholds] = t;
+		return (s32)numThresholds++;
+	}
+
+	u32 Groups() const
+	{
+		return (numThresholds + THRESHOLD_GROUP - 1) / THRESHOLD_GROUP;
+	}
+};
+
+// The sign and bound of every threshold, loaded into registers once per parse so the per-line update doesn't reload them
+struct ThresholdRegisters
+{
+	__m128i signs[THRESHOLD_MAX_GROUPS];
+	__m128i bounds[THRESHOLD_MAX_GROUPS];
+
+	void Load(const ThresholdSet& set)
+	{
+		s32 sign[THRESHOLD_MAX];
+		s32 bound[THRESHOLD_MAX];
+		for (u32 i = 0; i < THRESHOLD_MAX; i++)
+		{
+			// Unused lanes can never pass
+			sign[i] = 1;
+			bound[i] = 0x7fffffff;
+			if (i >= set.numThresholds) continue;
+			const Threshold& t = set.thresholds[i];
+			sign[i] = t.below ? -1 : 1;
+			bound[i] = t.below ? -t.value : t.value;
+		}
+		for (u32 g = 0; g < THRESHOLD_MAX_GROUPS; g++)
+		{
+			signs[g] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sign + g * THRESHOLD_GROUP));
+			bounds[g] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bound + g * THRESHOLD_GROUP));
+		}
+	}
+
+	// past holds Groups * THRESHOLD_GROUP counts
+	template <u32 Groups>
+	__forceinline void Add(u32* past, const s16 temp) const
+	{
+		const __m128i t = _mm_set1_epi32(temp);
+		for (u32 g = 0; g < Groups; g++)
+		{
+			__m128i* dst = reinterpret_cast<__m128i*>(past + g * THRESHOLD_GROUP);
+			_mm_storeu_si128(dst, _mm_sub_epi32(_mm_loadu_si128(dst), _mm_cmpgt_epi32(_mm_sign_epi32(t, signs[g]), bounds[g])));
+		}
+	}
+};
+
+template <u32 Groups>
+__forceinline void MergeThresholdCounts(u32* dst, const u32* src)
+{
+	for (u32 g = 0; g < Groups; g++)
+	{
+		__m128i* d = reinterpret_cast<__m128i*>(dst + g * THRESHOLD_GROUP);
+		_mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + g * THRESHOLD_GROUP))));
+	}
+}
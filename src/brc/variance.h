@@ -0,0 +1,43 @@
+#pragma once
+#include "../base/type_macros.h"
+
+// Exact variance of the scaled temperatures from count, sum and the sum of squares. A square is at most 999^2 < 2^20, so a u64 sum
+// of squares is exact for 18 trillion readings of one station, but count * sumSquares and sum^2 need 128 bits.
+
+struct U128
+{
+	u64 lo;
+	u64 hi;
+};
+
+inline U128 Mul64(const u64 a, const u64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	const unsigned __int128 p = (unsigned __int128)a * b;
+	return { (u64)p, (u64)(p >> 64) };
+#else
+	const u64 aLo = a & 0xffffffff, aHi = a >> 32;
+	const u64 bLo = b & 0xffffffff, bHi = b >> 32;
+	const u64 lolo = aLo * bLo;
+	const u64 hilo = aHi * bLo;
+	const u64 lohi = aLo * bHi;
+	const u64 hihi = aHi * bHi;
+	const u64 cross = (lolo >> 32) + (hilo & 0xffffffff) + lohi;
+	return { (cross << 32) | (lolo & 0xffffffff), hihi + (hilo >> 32) + (cross >> 32) };
+#endif
+}
+
+inline U128 Sub128(const U128 a, const U128 b)
+{
+	return { a.lo - b.lo, a.hi - b.hi - (a.lo < b.lo ? 1 : 0) };
+}
+
+// Population variance in scaled units squared, n * sum(x^2) - sum(x)^2 is computed exactly and only the division rounds
+inline double PopulationVariance(const u64 count, const s64 sum, const u64 sumSquares)
+{
+	if (count == 0) return 0;
+	const u64 absSum = sum < 0 ? (u64)-sum : (u64)sum;
+	const U128 spread = Sub128(Mul64(count, sumSquares), Mul64(absSum, absSum));
+	const double numerator = (double)spread.hi * 18446744073709551616.0 + (double)spread.lo;
+	return numerator / ((double)count * (double)count);
+}
@@ -9,6 +9,9 @@
 #include "base/simd.h"
 #include "base/type_macros.h"
 #include "base/Xoroshiro128Plus.h"
+#include "brc/chunk_index.h"
+#include "brc/columnar.h"
+#include "brc/compressed.h"
 
 char* pos = nullptr;
 char* dataEnd = nullptr;
@@ -82,6 +85,11 @@ struct GenerateDataJobInfo
 	StringBuffer writeBuf;
 	u64 lines = 0;
 	u64 maxLines = 0;
+
+	// Columnar output fills a block of ids and temperatures instead of text
+	bool columnar = false;
+	u32* ids = nullptr;
+	s16* temps = nullptr;
 };
 
 s64 ScaledRoundTowardPositive1Decimal(const double d)
@@ -111,22 +119,13 @@ void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
 	Push1DecimalDouble(writeBuf, scaled);
 }
 
-void GenerateLine(Xoroshiro128Plus::Random& rnd, StringBuffer& writeBuf, Array<StationData>* stations)
+void GenerateRow(Xoroshiro128Plus::Random& rnd, Array<StationData>* stations, u32& id, s64& scaled)
 {
-	StationData& stationData = (*stations)[rnd.Next() % stations->size];
-	writeBuf.PushF(stationData.name, ';');
+	id = rnd.Next() % stations->size;
+	StationData& stationData = (*stations)[id];
 
 	double temp = rnd.NextDouble(stationData.min, stationData.max);
-	s64 scaled = ScaledRoundTowardPositive1Decimal(temp);
-
-	Push1DecimalDouble(writeBuf, scaled);
-
-	writeBuf.Push('\n');
-
-	if (std::abs(temp) < 1.0)
-	{
-		printf("");
-	}
+	scaled = ScaledRoundTowardPositive1Decimal(temp);
 
 	temp = static_cast<double>(scaled) / 10.0;
 
@@ -136,6 +135,17 @@ void GenerateLine(Xoroshiro128Plus::Random& rnd, StringBuffer& writeBuf, Array<S
 	stationData.rSum += temp;
 }
 
+void GenerateLine(Xoroshiro128Plus::Random& rnd, StringBuffer& writeBuf, Array<StationData>* stations)
+{
+	u32 id;
+	s64 scaled;
+	GenerateRow(rnd, stations, id, scaled);
+
+	writeBuf.PushF((*stations)[id].name, ';');
+	Push1DecimalDouble(writeBuf, scaled);
+	writeBuf.Push('\n');
+}
+
 void GenerateDataJob(GenerateDataJobInfo* info, Array<StationData>* stations)
 {
 	Xoroshiro128Plus::Random rnd; // Faster random since we don't need perfect distributions
@@ -153,8 +163,17 @@ void GenerateDataJob(GenerateDataJobInfo* info, Array<StationData>* stations)
 		while (true)
 		{
 			if (info->lines >= info->maxLines) goto endGen;
-			if (info->writeBuf.Remaining() < 100) goto endGen; // A line is probably never longer than this
-			GenerateLine(rnd, info->writeBuf, stations);
+			if (info->columnar)
+			{
+				s64 scaled;
+				GenerateRow(rnd, stations, info->ids[info->lines], scaled);
+				info->temps[info->lines] = (s16)scaled;
+			}
+			else
+			{
+				if (info->writeBuf.Remaining() < 100) goto endGen; // A line is probably never longer than this
+				GenerateLine(rnd, info->writeBuf, stations);
+			}
 			info->lines++;
 		}
 		
@@ -168,6 +187,12 @@ int main(int argc, char* argv[])
 	u64 totalLines = NUM_BN;
 	u32 numStationsToUse = 100;
 	double bufferSize = 4.0;
+	bool writeIndex = false;
+	bool columnar = false;
+	bool compress = false;
+	int compressLevel = COMPRESSED_DEFAULT_LEVEL;
+	u64 compressBlockBytes = COMPRESSED_DEFAULT_BLOCK_BYTES;
+	u64 indexChunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
 	String inputDir = "../data/";
 	String outputPath = "../data/1brc.txt";
 	String validationPath = "../data/validation.txt";
@@ -184,6 +209,12 @@ int main(int argc, char* argv[])
 				printf("-stations [int (default 100)]\t\t\tNumber of station names to use (up to 41343)\n");
 				printf("-lines [int (default 1000000000)]\t\tNumber of lines to generate\n");
 				printf("-buffersize [double (default 4.0)]\t\tThe size of the generation buffer in GB\n");
+				printf("-columnar\t\t\t\tWrite the dictionary encoded columnar format instead of text\n");
+				printf("-compress\t\t\t\tWrite block compressed text (zstd frames with a block index)\n");
+				printf("-level [int (default %d)]\t\t\tzstd level for -compress\n", COMPRESSED_DEFAULT_LEVEL);
+				printf("-blockmb [int (default 4)]\t\t\tSize of the independently compressed blocks in MB\n");
+				printf("-index\t\t\t\t\tAlso write a line aligned chunk index next to the output ([output].idx)\n");
+				printf("-indexmb [int (default 16)]\t\t\tSpacing of the chunk index boundaries in MB\n");
 				return 0;
 			}
 
@@ -197,6 +228,50 @@ int main(int argc, char* argv[])
 				}
 				bufferSize = strtod(argv[i], nullptr);
 			}
+			else if (_stricmp(argv[i], "-columnar") == 0)
+			{
+				columnar = true;
+			}
+			else if (_stricmp(argv[i], "-compress") == 0)
+			{
+				compress = true;
+			}
+			else if (_stricmp(argv[i], "-level") == 0)
+			{
+				i++;
+				if (i >= argc)
+				{
+					printf("missing level arg value");
+					return 1;
+				}
+				compressLevel = strtol(argv[i], nullptr, 10);
+			}
+			else if (_stricmp(argv[i], "-blockmb") == 0)
+			{
+				i++;
+				if (i >= argc)
+				{
+					printf("missing blockmb arg value");
+					return 1;
+				}
+				compressBlockBytes = strtoull(argv[i], nullptr, 10) * MB;
+				if (compressBlockBytes == 0) compressBlockBytes = COMPRESSED_DEFAULT_BLOCK_BYTES;
+			}
+			else if (_stricmp(argv[i], "-index") == 0)
+			{
+				writeIndex = true;
+			}
+			else if (_stricmp(argv[i], "-indexmb") == 0)
+			{
+				i++;
+				if (i >= argc)
+				{
+					printf("missing indexmb arg value");
+					return 1;
+				}
+				indexChunkBytes = strtoull(argv[i], nullptr, 10) * MB;
+				if (indexChunkBytes == 0) indexChunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
+			}
 			else if (_stricmp(argv[i], "-stations") == 0)
 			{
 				i++;
@@ -258,6 +333,17 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if ((columnar || compress) && writeIndex)
+	{
+		printf("-index only applies to plain text output, the columnar and compressed formats have their own block index");
+		return 1;
+	}
+	if (columnar && compress)
+	{
+		printf("-columnar and -compress can't be combined");
+		return 1;
+	}
+
 	// Not sure why the original challenge didn't scrape the unique station names first
 	// I'm leaving the original input file in here to just use the same input for spiritual reasons
 
@@ -404,11 +490,48 @@ int main(int argc, char* argv[])
 	{
 		jobs[i].writeBuf.data = &writeBuf.data[i * workerMemory];
 		jobs[i].writeBuf.reserved = workerMemory;
+		if (columnar)
+		{
+			jobs[i].columnar = true;
+			jobs[i].ids = (u32*)malloc(COLUMNAR_DEFAULT_BLOCK_ROWS * sizeof(u32));
+			jobs[i].temps = (s16*)malloc(COLUMNAR_DEFAULT_BLOCK_ROWS * sizeof(s16));
+		}
 		threads.Push(new std::thread(GenerateDataJob, &jobs[i], &stations[i]));
 	}
 
-	FileHandle fh = OpenUTF8FileWrite(outputPath);
-	if (!fh.Good()) return 1;
+	FileHandle fh;
+	ColumnarWriter columnarWriter;
+	CompressedWriter compressedWriter;
+	if (columnar)
+	{
+		const u32 columnarFlags = COLUMNAR_SORTED_BLOCKS | (numStationsToUse > (1 << 16) ? (u32)COLUMNAR_WIDE_IDS : 0);
+		if (!columnarWriter.Open(outputPath, columnarFlags)) return 1;
+		for (u64 i = 0; i < numStationsToUse; i++)
+		{
+			columnarWriter.AddStation(stations[0][i].name); // Station ids are just the index into our station array
+		}
+	}
+	else if (compress)
+	{
+		// The workers are idle while we write so every core can compress
+		if (!compressedWriter.Open(outputPath, compressBlockBytes, compressLevel, std::thread::hardware_concurrency())) return 1;
+	}
+	else
+	{
+		fh = OpenUTF8FileWrite(outputPath);
+		if (!fh.Good()) return 1;
+	}
+
+	auto appendText = [&](const StringBuffer& buf)
+	{
+		if (compress) return compressedWriter.Append(buf.data, buf.size);
+		return fh.Append(buf);
+	};
+
+	// Every buffer we append ends on a full line so the index can be built as we go
+	ChunkIndex index;
+	ChunkIndexBuilder indexBuilder;
+	if (writeIndex) indexBuilder.Init(&index, 3, indexChunkBytes);
 
 	u64 linesRemaining = totalLines;
 	while (linesRemaining > 10000) // We can leave the remainder for the main thread
@@ -418,6 +541,7 @@ int main(int argc, char* argv[])
 			jobs[i].lines = 0;
 			jobs[i].writeBuf.Clear();
 			jobs[i].maxLines = linesRemaining / numWorkers;
+			if (columnar && jobs[i].maxLines > COLUMNAR_DEFAULT_BLOCK_ROWS) jobs[i].maxLines = COLUMNAR_DEFAULT_BLOCK_ROWS;
 			jobs[i].processing = true;
 		}
 
@@ -432,7 +556,14 @@ int main(int argc, char* argv[])
 				{
 					wait = true;
 				}
-				printf("\n[%d:\t%.1f%%]", i, (double)jobs[i].writeBuf.size / (jobs[i].writeBuf.reserved - 100) * 100);
+				if (columnar)
+				{
+					printf("\n[%d:\t%.1f%%]", i, (double)jobs[i].lines / jobs[i].maxLines * 100);
+				}
+				else
+				{
+					printf("\n[%d:\t%.1f%%]", i, (double)jobs[i].writeBuf.size / (jobs[i].writeBuf.reserved - 100) * 100);
+				}
 			}
 			if (!wait)
 			{
@@ -444,7 +575,7 @@ int main(int argc, char* argv[])
 		u64 totalToWrite = 0;
 		ForVector(jobs, i)
 		{
-			totalToWrite += jobs[i].writeBuf.Bytes();
+			totalToWrite += columnar ? jobs[i].lines * (sizeof(u16) + sizeof(s16)) : jobs[i].writeBuf.Bytes();
 			linesRemaining -= jobs[i].lines;
 		}
 
@@ -453,7 +584,13 @@ int main(int argc, char* argv[])
 
 		ForVector(jobs, i)
 		{
-			if (!fh.Append(jobs[i].writeBuf))
+			if (columnar)
+			{
+				if (!columnarWriter.WriteBlock(jobs[i].ids, jobs[i].temps, (u32)jobs[i].lines)) return 1;
+				continue;
+			}
+			if (writeIndex) indexBuilder.Feed(jobs[i].writeBuf.data, jobs[i].writeBuf.size);
+			if (!appendText(jobs[i].writeBuf))
 			{
 				return 1;
 			}
@@ -471,16 +608,46 @@ int main(int argc, char* argv[])
 
 	// Fill the remainder on the main thread and we're done
 
-	for (u64 i = linesRemaining; i > 0; i--)
+	if (columnar)
 	{
-		GenerateLine(rnd, writeBuf, &stations[0]);
+		for (u64 i = linesRemaining; i > 0; i--)
+		{
+			u32 id;
+			s64 scaled;
+			GenerateRow(rnd, &stations[0], id, scaled);
+			if (!columnarWriter.Add(id, (s16)scaled)) return 1;
+		}
+		if (!columnarWriter.Finish()) return 1;
 	}
+	else
+	{
+		for (u64 i = linesRemaining; i > 0; i--)
+		{
+			GenerateLine(rnd, writeBuf, &stations[0]);
+		}
 
-	if (!fh.Append(writeBuf)) return 1;
-	fh.Close();
+		if (writeIndex) indexBuilder.Feed(writeBuf.data, writeBuf.size);
+		if (!appendText(writeBuf)) return 1;
+		if (compress)
+		{
+			if (!compressedWriter.Finish()) return 1;
+		}
+		else
+		{
+			fh.Close();
+		}
+	}
 
 	system("cls");
-	printf("Generated %lld lines using %ld stations in %s\n", totalLines, numStationsToUse, (const char*)outputPath);
+	printf("Generated %lld lines using %u stations in %s\n", totalLines, numStationsToUse, (const char*)outputPath);
+
+	if (writeIndex)
+	{
+		indexBuilder.Finish();
+		String indexPath = strbuf.PushStringF(outputPath, ".idx");
+		if (!index.Write(indexPath, outputPath)) return 1;
+		printf("Generated chunk index with %llu chunks in %s\n", index.header.numChunks, (const char*)indexPath);
+	}
 
 	// Create validation file
 
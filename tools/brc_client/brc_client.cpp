@@ -0,0 +1,91 @@
+#include "../../src/base/platform_socket.h" // Before windows.h
+
+#include <chrono>
+#include <iostream>
+
+#include "../../src/base/platform_io.h"
+#include "../../src/brc/server_protocol.h"
+
+// Sends one query (or STATS) to a running brc_server and prints the result like a solution would,
+// the round trip and server side latency go to stderr.
+
+int main(int argc, char* argv[])
+{
+	const char* socketPath = BRC_DEFAULT_SOCKET;
+	bool stats = false;
+	Vector<const char*> patterns(16);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_client [options] [file or glob]...\n");
+			printf("-socket [path (default %s)]\tUnix domain socket of the server\n", BRC_DEFAULT_SOCKET);
+			printf("-stats\t\t\t\tPrint the server's query latency percentiles instead\n");
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-socket") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing socket arg value\n");
+				return 1;
+			}
+			socketPath = argv[i];
+		}
+		else if (_stricmp(argv[i], "-stats") == 0)
+		{
+			stats = true;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (!stats && patterns.size == 0)
+	{
+		printf("usage: %s [-socket path] [-stats] [file or glob]...\n", argv[0]);
+		return 1;
+	}
+
+	LocalSocket socket;
+	if (!InitSockets() || !ConnectLocal(socketPath, socket))
+	{
+		printf("can't connect to %s, is brc_server running?\n", socketPath);
+		return 1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool sent = stats ? socket.SendAll("STATS\n", 6) : SendQuery(socket, patterns);
+	SocketReader* reader = new SocketReader(&socket);
+	Response response;
+	if (!sent || !ReadResponse(*reader, response))
+	{
+		printf("lost the connection to %s\n", socketPath);
+		return 1;
+	}
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (!response.ok)
+	{
+		printf("%s\n", response.error);
+		return 1;
+	}
+
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+
+	std::cout.write(response.payload.data, response.payloadBytes);
+	if (stats) std::cout.put('\n');
+	std::cout.flush();
+	fprintf(stderr, "\n%.3f ms round trip, %.3f ms in the server\n", ms, response.serverMicros / 1000.0);
+
+	delete reader;
+	socket.Close();
+	return 0;
+}
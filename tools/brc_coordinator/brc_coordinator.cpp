@@ -0,0 +1,496 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/base/platform_process.h"
+#include "../../src/brc/partial_aggregate.h"
+
+// Scatter-gather over worker processes: the logical input is cut into byte ranges, every range goes to a worker process running
+// the fast engine with -range and -partial, and the partials are merged into the usual output once every range came back.
+// Workers are local processes here, but all they share with us is a filesystem, so they stand in for remote nodes.
+//
+// A worker that fails or gets killed has its range handed out again. One that runs for more than -slow times the median range
+// gets a backup copy once nothing is left waiting, whichever of the two finishes first wins and the other one is killed.
+
+constexpr u32 POLL_MS = 2;
+constexpr u64 OUTPUT_FLUSH_BYTES = 1 * MB;
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// A worker that was killed can leave its temporary file behind too
+void RemovePartial(const String& path)
+{
+	if (path.data == nullptr) return;
+	char temp[4 * KB];
+	snprintf(temp, sizeof(temp), "%s.tmp", path.data);
+	remove(path.data);
+	remove(temp);
+}
+
+struct RangeTask
+{
+	u64 begin;
+	u64 end;
+	u32 attempts;
+	u32 running;
+	bool done;
+	double ms;
+	String partialPath; // Of the attempt that finished first
+};
+
+struct Attempt
+{
+	ChildProcess process;
+	u32 task;
+	u32 attempt;
+	bool backup;
+	Clock::time_point start;
+	Clock::time_point killAt; // -killrate, to see re-issuing work
+	bool scheduledKill;
+	String partialPath;
+};
+
+struct Coordinator
+{
+	const char* engine = "markusaksli_fast_threaded";
+	const char* tempDir = ".";
+	u32 numWorkers = 4;
+	u32 threadsPerWorker = 0;
+	u32 numRanges = 0;
+	u32 maxAttempts = 3;
+	double slowFactor = 3.0;
+	double killRate = 0.0;
+	bool verbose = false;
+
+	StringBuffer pathBuf;
+	Vector<String> paths;
+	u64 totalBytes = 0;
+	Array<RangeTask> tasks;
+	Array<Attempt> slots;
+	Vector<u32> pending;
+	u64 tasksDone = 0;
+	u32 failures = 0;
+	u32 backups = 0;
+	std::mt19937_64 rng{ 0x1BC };
+
+	bool Launch(Attempt& slot, const u32 task, const bool backup)
+	{
+		RangeTask& t = tasks.data[task];
+		char range[64];
+		snprintf(range, sizeof(range), "%llu:%llu", (unsigned long long)t.begin, (unsigned long long)t.end);
+		char name[64];
+		snprintf(name, sizeof(name), "/brc_coordinator.%u.%u.partial", task, t.attempts);
+		char threads[16];
+		snprintf(threads, sizeof(threads), "%u", threadsPerWorker);
+
+		slot.partialPath = pathBuf.PushStringF(tempDir, name);
+		Vector<const char*> args(paths.size + 16);
+		args.Push(engine);
+		args.Push("-noindex");
+		args.Push("-range");
+		args.Push(range);
+		args.Push("-partial");
+		args.Push(slot.partialPath.data);
+		args.Push("-threads");
+		args.Push(threads);
+		for (u64 i = 0; i < paths.size; i++)
+		{
+			args.Push(paths[i].data);
+		}
+
+		slot.task = task;
+		slot.attempt = t.attempts++;
+		slot.backup = backup;
+		slot.start = Clock::now();
+		slot.scheduledKill = !backup && killRate > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < killRate;
+		if (slot.scheduledKill) slot.killAt = slot.start + std::chrono::milliseconds(std::uniform_int_distribution<int>(0, 100)(rng));
+		if (!slot.process.Start(args))
+		{
+			printf("can't start %s\n", engine);
+			return false;
+		}
+		t.running++;
+		if (verbose) fprintf(stderr, "range %u [%llu, %llu) attempt %u%s started\n", task, (unsigned long long)t.begin, (unsigned long long)t.end, slot.attempt, backup ? " (backup)" : "");
+		return true;
+	}
+
+	// A range that failed goes back in the queue unless another attempt at it is still running
+	bool Fail(const Attempt& slot, const char* why)
+	{
+		RangeTask& t = tasks.data[slot.task];
+		failures++;
+		RemovePartial(slot.partialPath);
+		fprintf(stderr, "range %u attempt %u %s\n", slot.task, slot.attempt, why);
+		if (t.done || t.running > 0) return true;
+		if (t.attempts >= maxAttempts)
+		{
+			printf("range %u failed %u times, giving up\n", slot.task, t.attempts);
+			return false;
+		}
+		pending.Push(slot.task);
+		return true;
+	}
+
+	double MedianMs()
+	{
+		Vector<double> times(tasks.size);
+		for (u64 i = 0; i < tasks.size; i++)
+		{
+			if (tasks.data[i].done) times.Push(tasks.data[i].ms);
+		}
+		double median = 0;
+		if (times.size > 0)
+		{
+			std::nth_element(times.data, times.data + times.size / 2, times.data + times.size);
+			median = times.data[times.size / 2];
+		}
+		return median;
+	}
+
+	bool Run()
+	{
+		// Even byte ranges, the workers move both ends to line starts so together they cover every line once
+		tasks.InitMallocZero(numRanges);
+		for (u32 i = 0; i < numRanges; i++)
+		{
+			tasks.data[i].begin = totalBytes * i / numRanges;
+			tasks.data[i].end = i + 1 == numRanges ? totalBytes : totalBytes * (i + 1) / numRanges;
+			tasks.data[i].partialPath = String();
+		}
+		pending.Init(numRanges);
+		for (u32 i = numRanges; i-- > 0;)
+		{
+			pending.Push(i);
+		}
+
+		slots.InitMallocZero(numWorkers);
+		for (u32 i = 0; i < numWorkers; i++)
+		{
+			slots.data[i].process = ChildProcess();
+		}
+
+		while (tasksDone < tasks.size)
+		{
+			const auto now = Clock::now();
+			for (u32 s = 0; s < numWorkers; s++)
+			{
+				Attempt& slot = slots.data[s];
+				if (!slot.process.Running()) continue;
+				RangeTask& t = tasks.data[slot.task];
+
+				if (slot.scheduledKill && now >= slot.killAt)
+				{
+					slot.process.Kill();
+					t.running--;
+					if (!Fail(slot, "was killed (-killrate)")) return false;
+					continue;
+				}
+
+				int exitCode = 0;
+				if (!slot.process.Finished(exitCode)) continue;
+				t.running--;
+
+				FileIdentity identity;
+				if (exitCode != 0 || !GetFileIdentity(slot.partialPath.data, identity))
+				{
+					char why[64];
+					snprintf(why, sizeof(why), "failed with exit code %d", exitCode);
+					if (!Fail(slot, why)) return false;
+					continue;
+				}
+				if (t.done)
+				{
+					RemovePartial(slot.partialPath); // The other attempt won
+					continue;
+				}
+
+				t.done = true;
+				t.ms = std::chrono::duration<double, std::milli>(now - slot.start).count();
+				t.partialPath = slot.partialPath;
+				tasksDone++;
+				if (verbose) fprintf(stderr, "range %u attempt %u done in %.1f ms\n", slot.task, slot.attempt, t.ms);
+
+				// Whatever else is still working on this range is wasted
+				for (u32 o = 0; o < numWorkers; o++)
+				{
+					Attempt& other = slots.data[o];
+					if (o == s || !other.process.Running() || other.task != slot.task) continue;
+					other.process.Kill();
+					t.running--;
+					RemovePartial(other.partialPath);
+				}
+			}
+
+			// Queued ranges first, then backups for ranges that take far longer than the rest
+			for (u32 s = 0; s < numWorkers; s++)
+			{
+				Attempt& slot = slots.data[s];
+				if (slot.process.Running()) continue;
+
+				if (pending.size > 0)
+				{
+					const u32 task = pending.Last();
+					pending.size--;
+					if (!Launch(slot, task, false)) return false;
+					continue;
+				}
+
+				const double median = MedianMs();
+				if (median <= 0) break;
+				for (u32 o = 0; o < numWorkers; o++)
+				{
+					const Attempt& other = slots.data[o];
+					if (!other.process.Running() || other.backup) continue;
+					const RangeTask& t = tasks.data[other.task];
+					const double elapsed = std::chrono::duration<double, std::milli>(now - other.start).count();
+					if (t.done || t.running > 1 || t.attempts >= maxAttempts || elapsed < median * slowFactor) continue;
+
+					fprintf(stderr, "range %u is slow (%.0f ms, median %.0f ms), starting a backup\n", other.task, elapsed, median);
+					backups++;
+					if (!Launch(slot, other.task, true)) return false;
+					break;
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+		}
+		return true;
+	}
+
+	void KillAll()
+	{
+		for (u32 i = 0; i < slots.size; i++)
+		{
+			slots.data[i].process.Kill();
+			RemovePartial(slots.data[i].partialPath);
+		}
+		for (u64 i = 0; i < tasks.size; i++)
+		{
+			RemovePartial(tasks.data[i].partialPath);
+		}
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	Coordinator coordinator;
+	const char* outputPath = nullptr;
+	Vector<const char*> patterns(16);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_coordinator [options] [file or glob]...\n");
+			printf("-workers [int (default 4)]\tWorker processes running at once\n");
+			printf("-ranges [int (default 4 * workers)]\tByte ranges the input is cut into\n");
+			printf("-threads [int]\t\t\tParse threads per worker (default hardware threads / workers)\n");
+			printf("-engine [path (default markusaksli_fast_threaded)]\tWorker executable, needs -range and -partial\n");
+			printf("-tempdir [dir (default .)]\tWhere workers write their partials, has to be shared with them\n");
+			printf("-attempts [int (default 3)]\tTimes a range is tried before giving up\n");
+			printf("-slow [float (default 3)]\tStart a backup for a range running this many times the median range time\n");
+			printf("-killrate [float (default 0)]\tKill this fraction of first attempts early, to exercise re-issuing\n");
+			printf("-output [file]\t\t\tWrite the merged partial aggregate instead of printing the result\n");
+			printf("-verbose\t\t\tLog every attempt\n");
+			return 0;
+		}
+
+		auto value = [&](const char* name) -> const char*
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing %s arg value\n", name);
+				return nullptr;
+			}
+			return argv[i];
+		};
+
+		const char* v = nullptr;
+		if (_stricmp(argv[i], "-workers") == 0)
+		{
+			if ((v = value("workers")) == nullptr) return 1;
+			coordinator.numWorkers = strtoul(v, nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-ranges") == 0)
+		{
+			if ((v = value("ranges")) == nullptr) return 1;
+			coordinator.numRanges = strtoul(v, nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			if ((v = value("threads")) == nullptr) return 1;
+			coordinator.threadsPerWorker = strtoul(v, nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-engine") == 0)
+		{
+			if ((coordinator.engine = value("engine")) == nullptr) return 1;
+		}
+		else if (_stricmp(argv[i], "-tempdir") == 0)
+		{
+			if ((coordinator.tempDir = value("tempdir")) == nullptr) return 1;
+		}
+		else if (_stricmp(argv[i], "-attempts") == 0)
+		{
+			if ((v = value("attempts")) == nullptr) return 1;
+			coordinator.maxAttempts = strtoul(v, nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-slow") == 0)
+		{
+			if ((v = value("slow")) == nullptr) return 1;
+			coordinator.slowFactor = strtod(v, nullptr);
+		}
+		else if (_stricmp(argv[i], "-killrate") == 0)
+		{
+			if ((v = value("killrate")) == nullptr) return 1;
+			coordinator.killRate = strtod(v, nullptr);
+		}
+		else if (_stricmp(argv[i], "-output") == 0)
+		{
+			if ((outputPath = value("output")) == nullptr) return 1;
+		}
+		else if (_stricmp(argv[i], "-verbose") == 0)
+		{
+			coordinator.verbose = true;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-workers n] [-ranges n] [-threads n] [-engine path] [-tempdir dir] [-attempts n] [-slow x] [-killrate p] [-output file] [-verbose] [file or glob]...\n", argv[0]);
+		return 1;
+	}
+	if (coordinator.numWorkers == 0) coordinator.numWorkers = 1;
+	if (coordinator.numRanges == 0) coordinator.numRanges = coordinator.numWorkers * 4;
+	if (coordinator.maxAttempts == 0) coordinator.maxAttempts = 1;
+	if (coordinator.threadsPerWorker == 0)
+	{
+		coordinator.threadsPerWorker = std::thread::hardware_concurrency() / coordinator.numWorkers;
+		if (coordinator.threadsPerWorker == 0) coordinator.threadsPerWorker = 1;
+	}
+
+	// Workers get the expanded paths so they all see the same files in the same order
+	coordinator.pathBuf.Init(1 * MB);
+	coordinator.paths.Init(64);
+	for (u64 i = 0; i < patterns.size; i++)
+	{
+		if (!ExpandFilePattern(patterns[i], coordinator.pathBuf, coordinator.paths))
+		{
+			printf("no files match %s\n", patterns[i]);
+			return 1;
+		}
+	}
+	for (u64 i = 0; i < coordinator.paths.size; i++)
+	{
+		FileIdentity identity;
+		if (GetFileIdentity(coordinator.paths[i], identity)) coordinator.totalBytes += identity.size;
+	}
+
+	const auto start = Clock::now();
+	if (!coordinator.Run())
+	{
+		coordinator.KillAll();
+		return 1;
+	}
+	const double scatterMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	Array<String> partials;
+	partials.InitMalloc(coordinator.tasks.size);
+	for (u64 i = 0; i < coordinator.tasks.size; i++)
+	{
+		partials.data[i] = coordinator.tasks.data[i].partialPath;
+	}
+
+	PartialMergeStats stats;
+	bool merged;
+	if (outputPath != nullptr)
+	{
+		PartialWriter writer;
+		merged = writer.Open(outputPath);
+		merged = MergePartialFiles(partials.data, partials.size, 64 * KB, stats, [&](const String& name, const PartialRecord& record)
+		{
+			writer.Push(name, record);
+		}) && merged;
+		merged = writer.Close() && merged;
+	}
+	else
+	{
+#ifdef _WIN32
+		SetConsoleOutputCP(CP_UTF8);
+#endif
+		setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+
+		StringBuffer writeBuf(OUTPUT_FLUSH_BYTES + PARTIAL_MAX_NAME_BYTES + 128);
+		writeBuf.Push('{');
+		bool first = true;
+		merged = MergePartialFiles(partials.data, partials.size, 64 * KB, stats, [&](const String& name, const PartialRecord& record)
+		{
+			if (!first) writeBuf.Push(", ");
+			writeBuf.Push(name);
+			writeBuf.Push('=');
+			Push1DecimalDouble(writeBuf, record.min * 0.1);
+			writeBuf.Push('/');
+			Push1DecimalDoubleRoundTowardPositive(writeBuf, (record.sum * 0.1) / record.count);
+			writeBuf.Push('/');
+			Push1DecimalDouble(writeBuf, record.max * 0.1);
+			first = false;
+
+			if (writeBuf.size >= OUTPUT_FLUSH_BYTES)
+			{
+				std::cout.write(writeBuf.data, writeBuf.size);
+				writeBuf.size = 0;
+			}
+		});
+		writeBuf.Push('}');
+		if (merged) std::cout.write(writeBuf.data, writeBuf.size);
+		std::cout.flush();
+		free(writeBuf.data);
+	}
+	for (u64 i = 0; i < partials.size; i++)
+	{
+		RemovePartial(partials.data[i]);
+	}
+	if (!merged) return 1;
+
+	const double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	fprintf(stderr, "\n%u ranges on %u workers x %u threads: %.1f ms to scatter, %.1f ms total, %.0f MB/s, %u failed attempts, %u backups\n",
+		coordinator.numRanges, coordinator.numWorkers, coordinator.threadsPerWorker, scatterMs, totalMs,
+		(double)coordinator.totalBytes / MB / (totalMs / 1000.0), coordinator.failures, coordinator.backups);
+	return 0;
+}
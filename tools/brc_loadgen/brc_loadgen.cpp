@@ -0,0 +1,176 @@
+#include "../../src/base/platform_socket.h" // Before windows.h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../../src/base/platform_io.h"
+#include "../../src/brc/server_protocol.h"
+
+// Load generator for brc_server: a number of clients, each on its own connection, send the same query back to back
+// and time every round trip. Prints latency percentiles over all of them and the total throughput.
+
+struct ClientMemory
+{
+	std::thread* thread;
+	const char* socketPath;
+	const Vector<const char*>* patterns;
+	u64 numQueries;
+	Array<u32> latencies; // Round trip microseconds
+	u64 serverMicros;
+	u64 payloadHash;
+	bool mismatch;
+	bool failed;
+};
+
+void RunClient(ClientMemory* mem)
+{
+	LocalSocket socket;
+	if (!ConnectLocal(mem->socketPath, socket))
+	{
+		mem->failed = true;
+		return;
+	}
+
+	SocketReader* reader = new SocketReader(&socket);
+	Response response;
+	for (u64 q = 0; q < mem->numQueries; q++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		if (!SendQuery(socket, *mem->patterns) || !ReadResponse(*reader, response) || !response.ok)
+		{
+			if (!response.ok && response.error[0] != '\0') fprintf(stderr, "%s\n", response.error);
+			mem->failed = true;
+			break;
+		}
+		mem->latencies.data[q] = (u32)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		mem->latencies.size = q + 1;
+		mem->serverMicros += response.serverMicros;
+
+		// Every answer to the same query should be the same
+		const u64 hash = fnv1a(response.payload.data, response.payloadBytes);
+		if (q == 0) mem->payloadHash = hash;
+		else mem->mismatch |= hash != mem->payloadHash;
+	}
+	delete reader;
+	socket.Close();
+}
+
+int main(int argc, char* argv[])
+{
+	const char* socketPath = BRC_DEFAULT_SOCKET;
+	u32 numClients = 8;
+	u64 numQueries = 1000;
+	Vector<const char*> patterns(16);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_loadgen [options] [file or glob]...\n");
+			printf("-socket [path (default %s)]\tUnix domain socket of the server\n", BRC_DEFAULT_SOCKET);
+			printf("-clients [int (default 8)]\tConcurrent connections\n");
+			printf("-queries [int (default 1000)]\tQueries per connection\n");
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-socket") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing socket arg value\n");
+				return 1;
+			}
+			socketPath = argv[i];
+		}
+		else if (_stricmp(argv[i], "-clients") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing clients arg value\n");
+				return 1;
+			}
+			numClients = strtoul(argv[i], nullptr, 10);
+			if (numClients == 0) numClients = 1;
+		}
+		else if (_stricmp(argv[i], "-queries") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing queries arg value\n");
+				return 1;
+			}
+			numQueries = strtoull(argv[i], nullptr, 10);
+			if (numQueries == 0) numQueries = 1;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-socket path] [-clients n] [-queries n] [file or glob]...\n", argv[0]);
+		return 1;
+	}
+	if (!InitSockets()) return 1;
+
+	Array<ClientMemory> mem;
+	mem.InitMallocZero(numClients);
+	const auto start = std::chrono::steady_clock::now();
+	for (u32 i = 0; i < numClients; i++)
+	{
+		mem[i].socketPath = socketPath;
+		mem[i].patterns = &patterns;
+		mem[i].numQueries = numQueries;
+		mem[i].latencies.InitMalloc(numQueries);
+		mem[i].latencies.size = 0;
+		mem[i].thread = new std::thread(RunClient, &mem[i]);
+	}
+
+	u64 total = 0;
+	u64 serverMicros = 0;
+	bool failed = false;
+	bool mismatch = false;
+	const ClientMemory* reference = nullptr;
+	for (u32 i = 0; i < numClients; i++)
+	{
+		mem[i].thread->join();
+		total += mem[i].latencies.size;
+		serverMicros += mem[i].serverMicros;
+		failed |= mem[i].failed;
+		if (mem[i].latencies.size == 0) continue;
+		if (reference == nullptr) reference = &mem[i];
+		mismatch |= mem[i].mismatch || mem[i].payloadHash != reference->payloadHash;
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (failed) printf("some clients failed, is brc_server running on %s?\n", socketPath);
+	if (total == 0) return 1;
+
+	Array<u32> all;
+	all.InitMalloc(total);
+	u64 n = 0;
+	for (u32 i = 0; i < numClients; i++)
+	{
+		memcpy(all.data + n, mem[i].latencies.data, mem[i].latencies.size * sizeof(u32));
+		n += mem[i].latencies.size;
+	}
+	std::sort(all.data, all.data + total);
+	auto percentile = [&](const double p) -> double
+	{
+		return all[(u64)(p * (total - 1))] / 1000.0;
+	};
+
+	printf("%llu queries over %u connections in %.2f s, %.0f queries/s\n", (unsigned long long)total, numClients, seconds, total / seconds);
+	printf("round trip ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+	printf("mean time in the server %.3f ms\n", serverMicros / 1000.0 / total);
+	if (mismatch) printf("the server didn't always give back the same result\n");
+
+	return failed || mismatch ? 1 : 0;
+}
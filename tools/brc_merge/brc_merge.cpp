@@ -0,0 +1,264 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/brc/partial_aggregate.h"
+
+// Streaming k-way merge of partial aggregate files (see src/brc/partial_aggregate.h) into the usual output, or into one more
+// partial with -output. Every file is read front to back through its own small buffer and the files sit in a min-heap on the name
+// of their current station, so memory only depends on the number of files. Past -fanin files the inputs are merged in passes
+// through temporary partials, groups of a pass in parallel, so we never keep more than that many open per thread.
+
+constexpr u64 OUTPUT_FLUSH_BYTES = 1 * MB;
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+bool MergeToPartial(const String* paths, const u64 numPaths, const u64 bufferBytes, PartialMergeStats& stats, const char* outputPath)
+{
+	PartialWriter writer;
+	if (!writer.Open(outputPath))
+	{
+		printf("can't write %s\n", outputPath);
+		return false;
+	}
+	const bool merged = MergePartialFiles(paths, numPaths, bufferBytes, stats, [&](const String& name, const PartialRecord& record)
+	{
+		writer.Push(name, record);
+	});
+	return writer.Close() && merged;
+}
+
+bool MergeToStdout(const String* paths, const u64 numPaths, const u64 bufferBytes, PartialMergeStats& stats)
+{
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+
+	StringBuffer writeBuf(OUTPUT_FLUSH_BYTES + PARTIAL_MAX_NAME_BYTES + 128);
+	writeBuf.Push('{');
+	bool first = true;
+	const bool merged = MergePartialFiles(paths, numPaths, bufferBytes, stats, [&](const String& name, const PartialRecord& record)
+	{
+		if (!first) writeBuf.Push(", ");
+		writeBuf.Push(name);
+		writeBuf.Push('=');
+		Push1DecimalDouble(writeBuf, record.min * 0.1);
+		writeBuf.Push('/');
+		Push1DecimalDoubleRoundTowardPositive(writeBuf, (record.sum * 0.1) / record.count);
+		writeBuf.Push('/');
+		Push1DecimalDouble(writeBuf, record.max * 0.1);
+		first = false;
+
+		if (writeBuf.size >= OUTPUT_FLUSH_BYTES)
+		{
+			std::cout.write(writeBuf.data, writeBuf.size);
+			writeBuf.size = 0;
+		}
+	});
+	if (!merged) return false;
+
+	writeBuf.Push('}');
+	std::cout.write(writeBuf.data, writeBuf.size);
+	std::cout.flush();
+	free(writeBuf.data);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* outputPath = nullptr;
+	const char* tempDir = ".";
+	u64 fanIn = 256;
+	u64 bufferBytes = 64 * KB;
+	u32 numThreads = std::thread::hardware_concurrency();
+	Vector<const char*> patterns(16);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_merge [options] [partial file or glob]...\n");
+			printf("-output [file]\t\t\tWrite the merged partial aggregate instead of printing the result\n");
+			printf("-fanin [int (default 256)]\tMost files merged at once, more go through temporary partials\n");
+			printf("-tempdir [dir (default .)]\tWhere the temporary partials go\n");
+			printf("-bufferkb [int (default 64)]\tRead buffer per file\n");
+			printf("-threads [int]\t\t\tThreads for the passes before the last one (default hardware threads)\n");
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-output") == 0 || _stricmp(argv[i], "-tempdir") == 0)
+		{
+			const bool output = _stricmp(argv[i], "-output") == 0;
+			i++;
+			if (i >= argc)
+			{
+				printf("missing %s arg value\n", output ? "output" : "tempdir");
+				return 1;
+			}
+			if (output) outputPath = argv[i];
+			else tempDir = argv[i];
+		}
+		else if (_stricmp(argv[i], "-fanin") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing fanin arg value\n");
+				return 1;
+			}
+			fanIn = strtoull(argv[i], nullptr, 10);
+			if (fanIn < 2) fanIn = 2;
+		}
+		else if (_stricmp(argv[i], "-bufferkb") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing bufferkb arg value\n");
+				return 1;
+			}
+			bufferBytes = strtoull(argv[i], nullptr, 10) * KB;
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing threads arg value\n");
+				return 1;
+			}
+			numThreads = strtoul(argv[i], nullptr, 10);
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-output file] [-fanin n] [-tempdir dir] [-bufferkb kb] [-threads n] [partial file or glob]...\n", argv[0]);
+		return 1;
+	}
+	if (numThreads == 0) numThreads = 1;
+
+	const auto start = std::chrono::steady_clock::now();
+	StringBuffer pathBuf(16 * MB);
+	Vector<String> paths(1024);
+	for (u64 i = 0; i < patterns.size; i++)
+	{
+		if (!ExpandFilePattern(patterns[i], pathBuf, paths))
+		{
+			printf("no files match %s\n", patterns[i]);
+			return 1;
+		}
+	}
+
+	// Passes of fanIn sized groups until one merge is left, every pass deletes the temporaries of the one before
+	PartialMergeStats stats;
+	u32 passes = 0;
+	Vector<String> temps(1024);
+	bool good = true;
+	while (paths.size > fanIn && good)
+	{
+		const u64 numGroups = (paths.size + fanIn - 1) / fanIn;
+		temps.size = 0;
+		for (u64 g = 0; g < numGroups; g++)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "/brc_merge.%u.%llu.partial", passes, (unsigned long long)g);
+			temps.Push(pathBuf.PushStringF(tempDir, name));
+		}
+
+		std::atomic<u64> next{ 0 };
+		std::atomic<bool> failed{ false };
+		auto work = [&]()
+		{
+			for (;;)
+			{
+				const u64 g = next.fetch_add(1, std::memory_order_relaxed);
+				if (g >= numGroups || failed) return;
+				const u64 first = g * fanIn;
+				const u64 count = paths.size - first < fanIn ? paths.size - first : fanIn;
+				if (!MergeToPartial(paths.data + first, count, bufferBytes, stats, temps[g])) failed = true;
+			}
+		};
+		const u32 passThreads = numGroups < numThreads ? (u32)numGroups : numThreads;
+		Array<std::thread*> threads;
+		threads.InitMalloc(passThreads);
+		for (u32 i = 0; i < passThreads - 1; i++)
+		{
+			threads[i] = new std::thread(work);
+		}
+		work();
+		for (u32 i = 0; i < passThreads - 1; i++)
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+		threads.Free();
+		good = !failed;
+
+		if (passes > 0)
+		{
+			for (u64 i = 0; i < paths.size; i++)
+			{
+				remove(paths[i]);
+			}
+		}
+		paths.size = 0;
+		for (u64 i = 0; i < temps.size; i++)
+		{
+			paths.Push(temps[i]);
+		}
+		passes++;
+	}
+
+	if (good)
+	{
+		good = outputPath != nullptr ? MergeToPartial(paths.data, paths.size, bufferBytes, stats, outputPath) : MergeToStdout(paths.data, paths.size, bufferBytes, stats);
+	}
+	if (passes > 0)
+	{
+		for (u64 i = 0; i < paths.size; i++)
+		{
+			remove(paths[i]);
+		}
+	}
+	if (!good) return 1;
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "\nmerged %llu files in %u passes, %llu records, %.2f MB in %.1f ms\n", (unsigned long long)stats.filesRead.load(), passes + 1,
+		(unsigned long long)stats.recordsRead.load(), (double)stats.bytesRead.load() / MB, ms);
+	return 0;
+}
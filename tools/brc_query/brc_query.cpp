@@ -0,0 +1,717 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/base/simd.h"
+#include "../../src/brc/aggregate.h"
+#include "../../src/brc/engine.h"
+#include "../../src/brc/histogram.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/query.h"
+#include "../../src/brc/station_filter.h"
+#include "../../src/brc/variance.h"
+
+// Answers a batch of query specs (see src/brc/query.h) with one shared scan. Every line is parsed and looked up once and feeds
+// the per-station aggregates every query is answered from, the filters and output stages only run on the merged stations at the
+// end, so K queries cost about as much as one. Percentiles need the distribution of a station, so once a query asks for them the
+// scan also counts every reading into a histogram (see src/brc/histogram.h) for the stations some query wants them for. What a
+// station keeps is put together from the aggregators the batch needs (see src/brc/aggregate.h), and the scan is instantiated for
+// each combination, so a batch only pays for what it asks for and plain min/mean/max runs on the 16 byte StationData. When every
+// query lists its stations, or -stations/-exclude is given, the scan also drops the lines of other stations before parsing them
+// (see src/brc/station_filter.h). -separate runs a full scan per query instead, to check and time against. A spec can also be a
+// SELECT, which is parsed into the same QuerySpec, so it plans onto the same kernels and output; -explain prints that plan.
+
+constexpr u64 OUTPUT_FLUSH_BYTES = 1 * MB;
+constexpr u64 FILTER_MAX_KEPT_RATIO = 3; // A scan stops filtering once more than 1 in 4 lines get through
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+// What a station aggregates in a scan with these features. Min/max/count/sum always come first so they're the 16 byte StationData
+// of the solutions, and the SSE merge of those 16 bytes applies to all of them.
+template <u32 Features>
+using StationAggregate = typename AggregateAppendIf<(Features & SCAN_PERCENTILES) != 0, AggHistogram,
+	typename AggregateAppendIf<(Features & SCAN_THRESHOLDS) != 0, AggThresholds<(Features & SCAN_WIDE_THRESHOLDS) != 0 ? THRESHOLD_MAX_GROUPS : 1>,
+	typename AggregateAppendIf<(Features & SCAN_STDDEV) != 0, AggSumSquares, AggregateMinMaxCountSum>::type>::type>::type;
+
+template <typename Station>
+struct ThreadMemory
+{
+	std::thread* thread;
+	WorkQueue* work;
+	brc::EngineMap<Station> map;
+	HistogramStore hist; // Only with AggHistogram, indexed like the map's stations
+	const QueryBatch* batch;
+	const StationFilter* filter; // Lines of other stations are dropped when set
+	UnitReader reader;
+};
+
+// What the aggregators use during the parse, with the threshold registers loaded once. A new station gets its histogram slot here,
+// before its first reading goes in.
+template <typename Station>
+struct ParseContext
+{
+	HistogramStore& hist;
+	const QueryBatch& batch;
+	ThresholdRegisters thresholds;
+
+	__forceinline void Line(const char*)
+	{
+	}
+
+	__forceinline void NewStation(const String& name, u32)
+	{
+		if (Station::template Has<AggHistogram>()) hist.AddStation(batch.WantsDistribution(name));
+	}
+};
+
+// Parses one unit with the engine's line kernel, kept and dropped count the lines the filter let through and rejected
+template <typename Station, bool Filter>
+void ParseUnit(ThreadMemory<Station>* mem, char* pos, const char* parseEnd, u64& kept, u64& dropped)
+{
+	ParseContext<Station> ctx = { mem->hist, *mem->batch, {} };
+	if (Station::template Has<AggThresholds<1>>() || Station::template Has<AggThresholds<THRESHOLD_MAX_GROUPS>>()) ctx.thresholds.Load(mem->batch->thresholds);
+	while (pos < parseEnd)
+	{
+		if (!Filter)
+		{
+			brc::EngineParseLine(mem->map, pos, ctx);
+			continue;
+		}
+
+		if (!mem->filter->MayWant(pos))
+		{
+			SIMD_SeekToChar(pos, '\n');
+			pos++;
+			dropped++;
+			continue;
+		}
+
+		HASH_T hash;
+		const String name = brc::EngineParseName(pos, hash);
+		if (!mem->filter->Wants(name, hash))
+		{
+			SIMD_SeekToChar(pos, '\n');
+			pos++;
+			dropped++;
+			continue;
+		}
+		kept++;
+		brc::EngineAddLine(mem->map, name, hash, pos, ctx);
+	}
+}
+
+template <typename Station>
+void Parse(ThreadMemory<Station>* mem)
+{
+	mem->map.Init(1024);
+	if (Station::template Has<AggHistogram>()) mem->hist.Init(1024);
+
+	bool filter = mem->filter != nullptr;
+	for (;;)
+	{
+		WorkUnit* unit = mem->work->Take();
+		if (unit == nullptr) break;
+
+		char* pos;
+		const char* parseEnd;
+		if (!mem->reader.Begin(*unit, pos, parseEnd)) exit(1);
+
+		const u32 stationsBefore = mem->map.numStations;
+		u64 kept = 0;
+		u64 dropped = 0;
+		if (filter) ParseUnit<Station, true>(mem, pos, parseEnd, kept, dropped);
+		else ParseUnit<Station, false>(mem, pos, parseEnd, kept, dropped);
+
+		// The filter only pays off while it drops most lines, past that it's a second lookup and a mispredicted branch per line on
+		// top of the usual work. Results are filtered again when they're printed, so a thread can stop using it after any unit.
+		if (filter && kept * FILTER_MAX_KEPT_RATIO > dropped) filter = false;
+
+		brc::EnginePersistNames(mem->map, mem->reader, stationsBefore);
+		mem->work->Done(*unit);
+	}
+}
+
+// One parse over the whole input on numThreads threads, the merged stations end up in the returned memory
+template <typename Station>
+ThreadMemory<Station>* Scan(InputSet& input, const InputOptions& inputOptions, const QueryBatch& batch, const StationFilter* filter, Array<ThreadMemory<Station>>& mem, u32 numThreads)
+{
+	WorkQueue work;
+	if (!input.Partition(work, inputOptions, numThreads)) return nullptr;
+	if (numThreads > work.units.size) numThreads = work.units.size > 0 ? (u32)work.units.size : 1;
+
+	mem.InitMallocZero(numThreads);
+	for (u32 i = 0; i < numThreads; i++)
+	{
+		mem[i].work = &work;
+		mem[i].batch = &batch;
+		mem[i].filter = filter;
+	}
+	ThreadMemory<Station>& mainMem = mem[numThreads - 1];
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		mem[i].thread = new std::thread(Parse<Station>, &mem[i]);
+	}
+	Parse(&mainMem);
+
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		ThreadMemory<Station>& other = mem[i];
+		other.thread->join();
+		delete other.thread;
+		for (u32 j = 0; j < other.map.numStations; j++)
+		{
+			const typename brc::EngineMap<Station>::Entry& otherEntry = other.map.Header(j);
+			const u32 result = mainMem.map.FindOrInsert(String((char*)otherEntry.name, otherEntry.namelen), otherEntry.hash);
+			if (Station::template Has<AggHistogram>() && result == mainMem.hist.NumStations()) mainMem.hist.AddStation(other.hist.Tracked(j));
+			mainMem.map.stations.data[result].Merge(other.map.stations.data[j], mainMem, result, other, j);
+		}
+	}
+	work.units.Free();
+	return &mainMem;
+}
+
+template <typename Station>
+void FreeScan(Array<ThreadMemory<Station>>& mem)
+{
+	for (u64 i = 0; i < mem.size; i++)
+	{
+		mem[i].map.Free();
+		if (Station::template Has<AggHistogram>()) mem[i].hist.Free();
+	}
+	mem.Free();
+}
+
+struct QueryOutputWriter
+{
+	StringBuffer buf;
+
+	void Init()
+	{
+		buf.Init(OUTPUT_FLUSH_BYTES + 4 * KB);
+	}
+
+	// Called between stations, so a single one never has to fit in more than the slack
+	void MaybeFlush()
+	{
+		if (buf.size >= OUTPUT_FLUSH_BYTES) Flush();
+	}
+
+	void Flush()
+	{
+		std::cout.write(buf.data, buf.size);
+		buf.size = 0;
+	}
+};
+
+// 0 when the aggregate doesn't have it, which only happens for queries that don't print it
+template <typename Station>
+u64 SumSquaresOf(const Station& stationData)
+{
+	const AggSumSquares* squares = AggregateFind<AggSumSquares>(stationData);
+	return squares != nullptr ? squares->sumSquares : 0;
+}
+
+template <typename Station>
+u32 PastCountOf(const Station& stationData, const u32 threshold)
+{
+	const AggThresholds<1>* narrow = AggregateFind<AggThresholds<1>>(stationData);
+	if (narrow != nullptr) return narrow->past[threshold];
+	const AggThresholds<THRESHOLD_MAX_GROUPS>* wide = AggregateFind<AggThresholds<THRESHOLD_MAX_GROUPS>>(stationData);
+	return wide != nullptr ? wide->past[threshold] : 0;
+}
+
+// One value of a station or a summary. valueAtRank(rank) gives the scaled temperature at a 1-based rank and past(t) the count past
+// the t-th threshold of the batch, they're only called for the columns that need them.
+template <typename ValueAtRank, typename Past>
+void PushColumn(StringBuffer& buf, const QuerySpec& q, const QueryColumn column, const s16 min, const s16 max, const s64 sum, const u64 count,
+	const u64 sumSquares, ValueAtRank valueAtRank, Past past)
+{
+	switch (column.kind)
+	{
+	case QUERY_COLUMN_MIN: Push1DecimalDouble(buf, min * 0.1); break;
+	case QUERY_COLUMN_MEAN: Push1DecimalDoubleRoundTowardPositive(buf, (sum * 0.1) / count); break;
+	case QUERY_COLUMN_MAX: Push1DecimalDouble(buf, max * 0.1); break;
+	case QUERY_COLUMN_COUNT: buf.Push(count); break;
+	case QUERY_COLUMN_STDDEV: Push1DecimalDouble(buf, sqrt(PopulationVariance(count, sum, sumSquares)) * 0.1); break;
+	case QUERY_COLUMN_PERCENTILE: Push1DecimalDouble(buf, valueAtRank(PercentileRank(q.percentiles[column.index], count)) * 0.1); break;
+	case QUERY_COLUMN_THRESHOLD: buf.Push((u64)past(q.thresholds[column.index])); break;
+	}
+}
+
+// The header of a summary column: min, p99.9, >30.0, ...
+void PushColumnName(StringBuffer& buf, const QueryBatch& batch, const QuerySpec& q, const QueryColumn column)
+{
+	switch (column.kind)
+	{
+	case QUERY_COLUMN_MIN: buf.Push("min"); break;
+	case QUERY_COLUMN_MEAN: buf.Push("mean"); break;
+	case QUERY_COLUMN_MAX: buf.Push("max"); break;
+	case QUERY_COLUMN_COUNT: buf.Push("count"); break;
+	case QUERY_COLUMN_STDDEV: buf.Push("stddev"); break;
+	case QUERY_COLUMN_PERCENTILE:
+	{
+		const u32 p = q.percentiles[column.index];
+		buf.PushF("p", p / 1000);
+		const u32 fraction = p % 1000;
+		if (fraction > 0)
+		{
+			const char digits[3] = { static_cast<char>('0' + fraction / 100), static_cast<char>('0' + fraction / 10 % 10), static_cast<char>('0' + fraction % 10) };
+			u32 numDigits = 3;
+			while (digits[numDigits - 1] == '0') numDigits--;
+			buf.Push('.');
+			buf.Push(digits, numDigits);
+		}
+		break;
+	}
+	case QUERY_COLUMN_THRESHOLD:
+	{
+		const Threshold& t = batch.thresholds.thresholds[q.thresholds[column.index]];
+		buf.Push(t.below ? "<" : ">");
+		Push1DecimalDouble(buf, (s64)t.value);
+		break;
+	}
+	}
+}
+
+// Scratch for the top=/bottom= queries, sized for every station
+struct RankScratch
+{
+	Array<double> keys; // Indexed by station
+	Array<u32> ranked;
+};
+
+// Fills ranked with the stations of a top=/bottom= query best first and returns how many of them to print. Only those are sorted,
+// nth_element splits them off from the rest without ordering it, so 20 out of 100k stations cost a linear pass and a tiny sort.
+template <typename Station>
+u64 RankStations(const QueryBatch& batch, const QuerySpec& q, ThreadMemory<Station>& result, RankScratch& scratch)
+{
+	const brc::EngineMap<Station>& map = result.map;
+	double* keys = scratch.keys.data;
+	u32* ranked = scratch.ranked.data;
+	u64 numRanked = 0;
+	for (u32 i = 0; i < map.numStations; i++)
+	{
+		if (!batch.Wants(q, map.Name(i))) continue;
+		const Station& stationData = map.stations.data[i];
+		double key;
+		switch (q.order)
+		{
+		case QUERY_BY_MIN: key = stationData.min; break;
+		case QUERY_BY_MAX: key = stationData.max; break;
+		case QUERY_BY_COUNT: key = (double)stationData.count; break;
+		case QUERY_BY_STDDEV: key = PopulationVariance(stationData.count, stationData.sum, SumSquaresOf(stationData)); break;
+		default: key = (double)stationData.sum / stationData.count; break;
+		}
+		keys[i] = q.descending ? -key : key;
+		ranked[numRanked++] = i;
+	}
+
+	// Ties go by name so the output doesn't depend on the thread count
+	const auto before = [&](const u32 a, const u32 b) {
+		if (keys[a] != keys[b]) return keys[a] < keys[b];
+		return map.Name(a) < map.Name(b);
+	};
+	const u64 count = q.limit < numRanked ? q.limit : numRanked;
+	if (count < numRanked) std::nth_element(ranked, ranked + count, ranked + numRanked, before);
+	std::sort(ranked, ranked + count, before);
+	return count;
+}
+
+template <typename Station>
+void PrintQuery(QueryOutputWriter& out, const QueryBatch& batch, const QuerySpec& q, ThreadMemory<Station>& result, const Array<u32>& sorted, RankScratch& scratch)
+{
+	if (q.label.len > 0) out.buf.PushF(q.label, ": ");
+
+	const brc::EngineMap<Station>& map = result.map;
+	if (q.output == QUERY_SUMMARY)
+	{
+		s16 totalMin = 32767;
+		s16 totalMax = -32768;
+		s64 totalSum = 0;
+		u64 totalCount = 0;
+		u64 totalSquares = 0;
+		u64 totalPast[THRESHOLD_MAX] = {}; // Indexed like the batch's thresholds
+		u32 numStations = 0;
+		Array<u32> flat;
+		if (q.numPercentiles > 0) flat.InitMallocZero(HIST_FLAT_BUCKETS);
+		for (u32 i = 0; i < map.numStations; i++)
+		{
+			if (!batch.Wants(q, map.Name(i))) continue;
+			const Station& stationData = map.stations.data[i];
+			if (stationData.min < totalMin) totalMin = stationData.min;
+			if (stationData.max > totalMax) totalMax = stationData.max;
+			totalSum += stationData.sum;
+			totalCount += stationData.count;
+			totalSquares += SumSquaresOf(stationData);
+			for (u32 t = 0; t < q.numThresholds; t++)
+			{
+				totalPast[q.thresholds[t]] += PastCountOf(stationData, q.thresholds[t]);
+			}
+			numStations++;
+			if (q.numPercentiles > 0) result.hist.AddTo(flat.data, i);
+		}
+		out.buf.PushF("stations=", numStations, " rows=", totalCount);
+		if (totalCount > 0)
+		{
+			out.buf.Push(' ');
+			for (u32 c = 0; c < q.numColumns; c++)
+			{
+				if (c > 0) out.buf.Push('/');
+				PushColumnName(out.buf, batch, q, q.columns[c]);
+			}
+			out.buf.Push('=');
+			for (u32 c = 0; c < q.numColumns; c++)
+			{
+				if (c > 0) out.buf.Push('/');
+				PushColumn(out.buf, q, q.columns[c], totalMin, totalMax, totalSum, totalCount, totalSquares,
+					[&](const u64 rank) { return HistogramValueAtRank([&](const u32 b) -> const u32* { return flat.data + b * HIST_BLOCK_BUCKETS; }, rank); },
+					[&](const u32 t) { return totalPast[t]; });
+			}
+		}
+		if (q.numPercentiles > 0) flat.Free();
+		out.buf.Push('\n');
+		return;
+	}
+
+	const u32* stations = sorted.data;
+	u64 numStations = sorted.size;
+	if (q.order != QUERY_BY_NAME)
+	{
+		numStations = RankStations(batch, q, result, scratch);
+		stations = scratch.ranked.data;
+	}
+
+	out.buf.Push('{');
+	const bool reversed = q.order == QUERY_BY_NAME && q.descending;
+	u64 printed = 0;
+	for (u64 i = 0; i < numStations && (q.limit == 0 || printed < q.limit); i++)
+	{
+		const u32 station = stations[reversed ? numStations - 1 - i : i];
+		const String name = map.Name(station);
+		if (!batch.Wants(q, name)) continue;
+		if (printed > 0) out.buf.Push(", ");
+		const Station& stationData = map.stations.data[station];
+		out.buf.Push(name);
+		if (q.numColumns > 0) out.buf.Push('=');
+		for (u32 c = 0; c < q.numColumns; c++)
+		{
+			if (c > 0) out.buf.Push('/');
+			PushColumn(out.buf, q, q.columns[c], stationData.min, stationData.max, stationData.sum, stationData.count, SumSquaresOf(stationData),
+				[&](const u64 rank) { return result.hist.ValueAtRank(station, rank); },
+				[&](const u32 t) { return PastCountOf(stationData, t); });
+		}
+		printed++;
+		out.MaybeFlush();
+	}
+	out.buf.Push("}\n");
+}
+
+// The results of every query, in the order they were given
+template <typename Station>
+void PrintQueries(QueryOutputWriter& out, const QueryBatch& batch, const u64 firstQuery, const u64 numQueries, ThreadMemory<Station>& result)
+{
+	bool byName = false;
+	bool ranked = false;
+	for (u64 i = firstQuery; i < firstQuery + numQueries; i++)
+	{
+		const QuerySpec& q = batch.specs.data[i];
+		if (q.output != QUERY_STATS) continue;
+		if (q.order == QUERY_BY_NAME) byName = true;
+		else ranked = true;
+	}
+
+	// Sorted by name once for all of them, and only if one of them lists stations in name order
+	const brc::EngineMap<Station>& map = result.map;
+	const u64 allocStations = map.numStations > 0 ? map.numStations : 1;
+	Array<u32> sorted;
+	sorted.InitMalloc(allocStations);
+	sorted.size = 0;
+	if (byName)
+	{
+		sorted.size = map.numStations;
+		for (u32 i = 0; i < map.numStations; i++)
+		{
+			sorted.data[i] = i;
+		}
+		std::sort(sorted.data, sorted.data + sorted.size,
+			[&](const u32 a, const u32 b) {
+				return map.Name(a) < map.Name(b);
+			});
+	}
+	RankScratch scratch;
+	if (ranked)
+	{
+		scratch.keys.InitMalloc(allocStations);
+		scratch.ranked.InitMalloc(allocStations);
+	}
+
+	for (u64 i = firstQuery; i < firstQuery + numQueries; i++)
+	{
+		PrintQuery(out, batch, batch.specs.data[i], result, sorted, scratch);
+		out.MaybeFlush();
+	}
+	sorted.Free();
+	if (ranked)
+	{
+		scratch.keys.Free();
+		scratch.ranked.Free();
+	}
+}
+
+// When every query lists its stations no other station can show up in a result, so the scan can drop their lines right away
+bool PushDownStations(const QueryBatch& batch, const u64 firstQuery, const u64 numQueries, StationFilter& filter)
+{
+	for (u64 i = firstQuery; i < firstQuery + numQueries; i++)
+	{
+		if (batch.specs.data[i].filter != QUERY_INCLUDE) return false;
+	}
+	filter.Init(false);
+	for (u64 i = firstQuery; i < firstQuery + numQueries; i++)
+	{
+		const QuerySpec& q = batch.specs.data[i];
+		for (u64 j = 0; j < q.numStations; j++)
+		{
+			filter.Add(batch.stations.data[q.firstStation + j]);
+		}
+	}
+	return true;
+}
+
+struct ScanJob
+{
+	InputSet& input;
+	const InputOptions& inputOptions;
+	const QueryBatch& batch;
+	const StationFilter* filter;
+	QueryOutputWriter& out;
+	u64 firstQuery;
+	u64 numQueries;
+	u32 numThreads;
+	double& scanMs;
+	bool explain;
+};
+
+// The plan of a scan on stderr: the kernel's aggregates and station filter and the output stage of every query
+template <typename Station>
+void ExplainScan(const ScanJob& job)
+{
+	const char* orderNames[] = { "name", "min", "max", "mean", "count", "stddev" };
+	fprintf(stderr, "scan: Aggregate<AggMin, AggMax, AggCount, AggSum%s%s%s%s> (%u bytes per station), ",
+		Station::template Has<AggSumSquares>() ? ", AggSumSquares" : "", Station::template Has<AggThresholds<1>>() ? ", AggThresholds<1>" : "",
+		Station::template Has<AggThresholds<THRESHOLD_MAX_GROUPS>>() ? ", AggThresholds<2>" : "", Station::template Has<AggHistogram>() ? ", AggHistogram" : "",
+		(u32)sizeof(Station));
+	if (job.filter == nullptr) fprintf(stderr, "every line\n");
+	else fprintf(stderr, "lines filtered by an %s list of %u stations\n", job.filter->exclude ? "exclude" : "include", job.filter->numNames);
+	for (u64 i = job.firstQuery; i < job.firstQuery + job.numQueries; i++)
+	{
+		const QuerySpec& q = job.batch.specs.data[i];
+		fprintf(stderr, "  query %llu: ", (unsigned long long)i + 1);
+		if (q.output == QUERY_SUMMARY) fprintf(stderr, "summary");
+		else if (q.order == QUERY_BY_NAME) fprintf(stderr, "stations by name%s", q.descending ? " descending" : "");
+		else fprintf(stderr, "stations ranked by %s%s", orderNames[q.order], q.descending ? " descending" : "");
+		if (q.output == QUERY_STATS && q.limit > 0 && q.limit != 0xffffffff) fprintf(stderr, ", first %u", q.limit);
+		if (q.filter != QUERY_ALL) fprintf(stderr, ", %s %llu stations", q.filter == QUERY_INCLUDE ? "only" : "without", (unsigned long long)q.numStations);
+		fprintf(stderr, ", %u columns\n", q.numColumns);
+	}
+}
+
+// Scans with Station as the per-station aggregate and prints the queries of the job
+template <typename Station>
+bool RunScan(const ScanJob& job)
+{
+	if (job.explain) ExplainScan<Station>(job);
+	const auto scanStart = std::chrono::steady_clock::now();
+	Array<ThreadMemory<Station>> mem;
+	ThreadMemory<Station>* result = Scan(job.input, job.inputOptions, job.batch, job.filter, mem, job.numThreads);
+	if (result == nullptr) return false;
+	job.scanMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - scanStart).count();
+
+	PrintQueries(job.out, job.batch, job.firstQuery, job.numQueries, *result);
+	FreeScan(mem);
+	return true;
+}
+
+// Calls the RunScan instantiated for the aggregates the runtime features need
+template <u32 Features>
+bool RunScanAs(const u32 features, const ScanJob& job)
+{
+	if (features == Features) return RunScan<StationAggregate<Features>>(job);
+	return RunScanAs<Features - 1>(features, job);
+}
+
+template <>
+bool RunScanAs<0>(const u32, const ScanJob& job)
+{
+	return RunScan<StationAggregate<0>>(job);
+}
+
+int main(int argc, char* argv[])
+{
+	InputOptions inputOptions;
+	QueryBatch batch;
+	batch.Init();
+	Vector<const char*> patterns(16);
+	bool separate = false;
+	bool pushdown = true;
+	bool explain = false;
+	StationFilter stationFilter;
+	bool hasStationFilter = false;
+	u32 numThreads = std::thread::hardware_concurrency() - 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_query [options] [file or glob]...\n");
+			printf("-query [spec]\t\t\tAdd a query, e.g. \"stats;stations=Oslo,Hamburg\" or \"SELECT station, min, p99 ORDER BY mean DESC LIMIT 20\"\n\t\t\t\t(see src/brc/query.h), can be repeated\n");
+			printf("-queries [file]\t\t\tAdd the queries in a file, one spec per line\n");
+			printf("-threads [int]\t\t\tParse threads (default hardware threads - 1)\n");
+			printf("-separate\t\t\tRun a full scan per query instead of one shared scan\n");
+			printf("-stations [list]\t\tOnly read these stations, e.g. \"Oslo,Hamburg\" or @file with one per line\n");
+			printf("-exclude [list]\t\t\tRead every station but these, same format\n");
+			printf("-nopushdown\t\t\tDon't drop the lines of stations no query lists during the scan\n");
+			printf("-explain\t\t\tPrint the plan of every scan to stderr\n");
+			printf("The input args of the threaded solutions (-rows, -range, -noindex, ...) work the same\n");
+			return 0;
+		}
+
+		bool error = false;
+		if (_stricmp(argv[i], "-query") == 0 || _stricmp(argv[i], "-queries") == 0)
+		{
+			const bool file = _stricmp(argv[i], "-queries") == 0;
+			i++;
+			if (i >= argc)
+			{
+				printf("missing %s arg value\n", file ? "queries" : "query");
+				return 1;
+			}
+			if (!(file ? batch.AddFile(argv[i]) : batch.Add(argv[i]))) return 1;
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing threads arg value\n");
+				return 1;
+			}
+			numThreads = strtoul(argv[i], nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-separate") == 0)
+		{
+			separate = true;
+		}
+		else if (_stricmp(argv[i], "-nopushdown") == 0)
+		{
+			pushdown = false;
+		}
+		else if (_stricmp(argv[i], "-explain") == 0)
+		{
+			explain = true;
+		}
+		else if (_stricmp(argv[i], "-stations") == 0 || _stricmp(argv[i], "-exclude") == 0)
+		{
+			const bool exclude = _stricmp(argv[i], "-exclude") == 0;
+			i++;
+			if (i >= argc)
+			{
+				printf("missing %s arg value\n", exclude ? "exclude" : "stations");
+				return 1;
+			}
+			if (hasStationFilter && stationFilter.exclude != exclude)
+			{
+				printf("-stations and -exclude can't be combined\n");
+				return 1;
+			}
+			if (!hasStationFilter) stationFilter.Init(exclude);
+			hasStationFilter = true;
+			batch.stationFilter = &stationFilter;
+			if (!stationFilter.AddArg(argv[i])) return 1;
+		}
+		else if (ParseInputOption(argc, argv, i, inputOptions, error))
+		{
+			if (error) return 1;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-query spec]... [-queries file] [-threads n] [-separate] [-stations list] [-exclude list] [-explain] [-noindex] [-rows start:end] [-range start:end] [file or glob]...\n", argv[0]);
+		return 1;
+	}
+	if (inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr || inputOptions.partialPath != nullptr)
+	{
+		printf("brc_query doesn't support -cache, -checkpoint or -partial\n");
+		return 1;
+	}
+	if (batch.specs.size == 0) batch.Add("stats");
+	if (numThreads == 0) numThreads = 1;
+
+	InputSet input;
+	if (!input.Open(patterns, inputOptions, numThreads)) return 1;
+
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+	QueryOutputWriter out;
+	out.Init();
+
+	const auto start = std::chrono::steady_clock::now();
+	double scanMs = 0;
+	const u64 numScans = separate ? batch.specs.size : 1;
+	for (u64 s = 0; s < numScans; s++)
+	{
+		const u64 firstQuery = separate ? s : 0;
+		const u64 numQueries = separate ? 1 : batch.specs.size;
+		StationFilter pushdownFilter;
+		const StationFilter* filter = hasStationFilter ? &stationFilter : nullptr;
+		if (filter == nullptr && pushdown && PushDownStations(batch, firstQuery, numQueries, pushdownFilter)) filter = &pushdownFilter;
+		const ScanJob job = { input, inputOptions, batch, filter, out, firstQuery, numQueries, numThreads, scanMs, explain };
+		const bool scanned = RunScanAs<SCAN_AGGREGATES>(batch.Features(firstQuery, numQueries) & SCAN_AGGREGATES, job);
+		if (filter == &pushdownFilter) pushdownFilter.Free();
+		if (!scanned) return 1;
+	}
+	out.Flush();
+	std::cout.flush();
+	free(out.buf.data);
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%llu queries in %llu scans: %.1f ms scanning, %.1f ms total, %.0f MB/s\n", (unsigned long long)batch.specs.size, (unsigned long long)numScans,
+		scanMs, ms, (double)input.totalBytes * numScans / MB / (scanMs / 1000.0));
+	input.Close();
+	batch.Free();
+	if (hasStationFilter) stationFilter.Free();
+	return 0;
+}
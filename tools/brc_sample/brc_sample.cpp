@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/brc/engine.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/result_writer.h"
+#include "../../src/brc/sampling.h"
+
+// Approximate answers from randomly chosen blocks of the input (see src/brc/sampling.h for the estimates). Text files are cut
+// into -blockkb blocks that are found with a seek to the next line start, compressed files into their own blocks, so nothing is
+// read but the sampled blocks. Every round parses its blocks on all threads with the fast threaded solution's loop, each block
+// into its own small map, then the per block station counts and sums go to the estimator. With -budgetms or -error the sample is
+// doubled round after round until the next round wouldn't fit in the budget or every station's mean is within the error.
+
+using SampleStation = brc::EngineStationData;
+
+// A station of one block, its name still points into the input or a persisted copy of it
+struct BlockStation
+{
+	const char* name;
+	u32 namelen;
+	HASH_T hash;
+	SampleStation data;
+};
+
+struct BlockResult
+{
+	u32 stratum;
+	u64 firstStation;
+	u32 numStations;
+};
+
+struct SampleThread
+{
+	brc::EngineMap<SampleStation> map;
+	Vector<BlockResult> blocks;
+	Vector<BlockStation> stations;
+	UnitReader reader;
+	bool failed;
+};
+
+// The input as consecutive blocks
+struct SampleSource
+{
+	InputSet* input;
+	u64 blockBytes;
+	Vector<u64> firstSlot; // Per file, plus the total at the end
+
+	void Init(InputSet& set, const u64 bytes)
+	{
+		input = &set;
+		blockBytes = bytes;
+		firstSlot.Init(set.files.size + 1);
+		u64 slots = 0;
+		for (u64 i = 0; i < set.files.size; i++)
+		{
+			firstSlot.Push(slots);
+			const InputFile& f = set.files.data[i];
+			if (!f.file.Good()) continue;
+			if (f.compressed.Good())
+			{
+				slots += f.compressed.trailer->numBlocks;
+			}
+			else
+			{
+				const u64 text = f.file.length - (SkipBOM(f.file) - f.file.data);
+				slots += (text + blockBytes - 1) / blockBytes;
+			}
+		}
+		firstSlot.Push(slots);
+	}
+
+	u64 NumSlots()
+	{
+		return firstSlot.Last();
+	}
+
+	// The first line that starts at or after offset, like -range
+	static u64 LineStart(const MappedFileHandle& file, const u64 dataStart, const u64 offset)
+	{
+		if (offset <= dataStart) return dataStart;
+		if (offset >= file.length) return file.length;
+		if (file.data[offset - 1] == '\n') return offset;
+		const char* newline = (const char*)memchr(file.data + offset, '\n', file.length - offset);
+		return newline != nullptr ? newline - file.data + 1 : file.length;
+	}
+
+	// The lines of a block
+	bool Begin(const u64 slot, UnitReader& reader, char*& pos, const char*& parseEnd)
+	{
+		u64 file = 0;
+		while (firstSlot.data[file + 1] <= slot) file++;
+		const InputFile& f = input->files.data[file];
+		const u64 block = slot - firstSlot.data[file];
+		if (f.compressed.Good())
+		{
+			WorkUnit unit = {};
+			unit.compressed = &f.compressed;
+			unit.block = block;
+			unit.lines = f.compressed.blocks[block].lines;
+			return reader.Begin(unit, pos, parseEnd);
+		}
+
+		const u64 dataStart = SkipBOM(f.file) - f.file.data;
+		pos = f.file.data + LineStart(f.file, dataStart, dataStart + block * blockBytes);
+		parseEnd = f.file.data + LineStart(f.file, dataStart, dataStart + (block + 1) * blockBytes);
+		return true;
+	}
+};
+
+struct SampleJob
+{
+	SampleSource* source;
+	const Vector<SamplePick>* picks;
+	std::atomic<u64> next{ 0 };
+	SampleThread* threads;
+};
+
+void SampleParse(void* arg, const u32 thread)
+{
+	SampleJob& job = *(SampleJob*)arg;
+	SampleThread& mem = job.threads[thread];
+	brc::EngineNoContext ctx;
+	for (;;)
+	{
+		const u64 pick = job.next.fetch_add(1, std::memory_order_relaxed);
+		if (pick >= job.picks->size) break;
+
+		char* pos;
+		const char* parseEnd;
+		if (!job.source->Begin(job.picks->data[pick].slot, mem.reader, pos, parseEnd))
+		{
+			mem.failed = true;
+			break;
+		}
+
+		mem.map.Init(brc::ENGINE_MAP_INITIAL_CAPACITY);
+		while (pos < parseEnd)
+		{
+			brc::EngineParseLine(mem.map, pos, ctx);
+		}
+		brc::EnginePersistNames(mem.map, mem.reader, 0);
+
+		mem.blocks.Push({ job.picks->data[pick].stratum, mem.stations.size, mem.map.numStations });
+		for (u32 i = 0; i < mem.map.numStations; i++)
+		{
+			const auto& e = mem.map.Header(i);
+			mem.stations.Push({ e.name, e.namelen, e.hash, mem.map.stations.data[i] });
+		}
+		mem.map.Free();
+		mem.map = brc::EngineMap<SampleStation>();
+	}
+}
+
+// A scaled value with two decimals, the intervals are finer than the readings
+u32 WriteHundredths(char* out, const double scaled)
+{
+	const s64 hundredths = (s64)llround(scaled * 10);
+	u32 written = 0;
+	if (hundredths < 0) out[written++] = '-';
+	const u64 abs = hundredths < 0 ? (u64)-hundredths : (u64)hundredths;
+	written += WriteU64(out + written, abs / 100);
+	out[written++] = '.';
+	out[written++] = (char)('0' + abs / 10 % 10);
+	out[written++] = (char)('0' + abs % 10);
+	return written;
+}
+
+bool WriteEstimates(const char* path, const ResultFormat format, const brc::EngineMap<SampleStation>& stations, const Array<SampleEstimate>& estimates)
+{
+	Vector<u32> order(stations.numStations > 0 ? stations.numStations : 1);
+	for (u32 i = 0; i < stations.numStations; i++)
+	{
+		order.Push(i);
+	}
+	auto name = [&](const u32 i)
+	{
+		const auto& e = stations.Header(i);
+		return String((char*)e.name, e.namelen);
+	};
+	std::sort(order.data, order.data + order.size, [&](const u32 a, const u32 b) { return name(a) < name(b); });
+
+	ResultWriter writer;
+	if (!writer.Open(path)) return false;
+	if (format == RESULT_FORMAT_TEXT) writer.Append("{");
+	if (format == RESULT_FORMAT_CSV) writer.Append("station,min,mean,mean_low,mean_high,max,count,count_low,count_high\n");
+	const u64 maxNameBytes = (RESULT_WRITE_BUFFER_BYTES - RESULT_MAX_STATION_BYTES) / 6;
+	for (u64 i = 0; i < order.size; i++)
+	{
+		String n = name(order.data[i]);
+		if (n.len > maxNameBytes) n.len = maxNameBytes;
+		const SampleStation& seen = stations.stations.data[order.data[i]];
+		const SampleEstimate& e = estimates.data[order.data[i]];
+		const double countLow = e.count - e.countHalfWidth > seen.count ? e.count - e.countHalfWidth : seen.count; // Never fewer than seen
+
+		char* out = writer.Reserve(n.len * 6 + RESULT_MAX_STATION_BYTES);
+		u32 written = 0;
+		auto field = [&](const char* json, const u32 len)
+		{
+			if (format == RESULT_FORMAT_JSON)
+			{
+				memcpy(out + written, json, len);
+				written += len;
+			}
+			else
+			{
+				out[written++] = ',';
+			}
+		};
+		if (format == RESULT_FORMAT_TEXT)
+		{
+			if (i > 0)
+			{
+				out[written++] = ',';
+				out[written++] = ' ';
+			}
+			memcpy(out + written, n.data, n.len);
+			written += (u32)n.len;
+			out[written++] = '=';
+			written += WriteDecimal(out + written, seen.min);
+			out[written++] = '/';
+			written += WriteDecimal(out + written, e.count > 0 ? (s64)ceil(((e.sum * 0.1) / e.count) * 10) : 0); // Rounded like the exact results
+			out[written++] = '/';
+			written += WriteDecimal(out + written, seen.max);
+		}
+		else
+		{
+			if (format == RESULT_FORMAT_JSON)
+			{
+				memcpy(out, "{\"station\":\"", 12);
+				written = 12;
+				written += WriteJsonEscaped(out + written, n);
+				out[written++] = '"';
+			}
+			else
+			{
+				written = WriteCsvField(out, n);
+			}
+			field(",\"min\":", 7);
+			written += WriteDecimal(out + written, seen.min);
+			field(",\"mean\":", 8);
+			written += WriteHundredths(out + written, e.mean);
+			field(",\"meanLow\":", 11);
+			written += WriteHundredths(out + written, e.mean - e.meanHalfWidth);
+			field(",\"meanHigh\":", 12);
+			written += WriteHundredths(out + written, e.mean + e.meanHalfWidth);
+			field(",\"max\":", 7);
+			written += WriteDecimal(out + written, seen.max);
+			field(",\"count\":", 9);
+			written += WriteU64(out + written, (u64)llround(e.count));
+			field(",\"countLow\":", 12);
+			written += WriteU64(out + written, (u64)llround(countLow));
+			field(",\"countHigh\":", 13);
+			written += WriteU64(out + written, (u64)llround(e.count + e.countHalfWidth));
+			if (format == RESULT_FORMAT_JSON) out[written++] = '}';
+			out[written++] = '\n';
+		}
+		writer.used += written;
+	}
+	if (format == RESULT_FORMAT_TEXT) writer.Append("}");
+	return writer.Close();
+}
+
+int main(int argc, char* argv[])
+{
+	InputOptions inputOptions;
+	Vector<const char*> patterns(16);
+	u32 numThreads = std::thread::hardware_concurrency() - 1;
+	u64 blockBytes = SAMPLE_DEFAULT_BLOCK_BYTES;
+	u32 strata = SAMPLE_DEFAULT_STRATA;
+	double fraction = SAMPLE_DEFAULT_FRACTION;
+	double confidence = SAMPLE_DEFAULT_CONFIDENCE;
+	u64 seed = SAMPLE_DEFAULT_SEED;
+	double budgetMs = 0;
+	double targetError = 0;
+	ResultFormat format = RESULT_FORMAT_TEXT;
+	const char* outputPath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_sample [options] [file or glob]...\n");
+			printf("-fraction [0-1]\t\t\tShare of the blocks the first round reads (default %g)\n", SAMPLE_DEFAULT_FRACTION);
+			printf("-budgetms [ms]\t\t\tKeep doubling the sample while the next round fits in this time\n");
+			printf("-error [degrees]\t\tKeep doubling the sample until every station's mean interval is within this\n");
+			printf("-confidence [0-1]\t\tOf the intervals (default %g)\n", SAMPLE_DEFAULT_CONFIDENCE);
+			printf("-blockkb [int]\t\t\tText is sampled in blocks of this size (default %llu)\n", (unsigned long long)(SAMPLE_DEFAULT_BLOCK_BYTES / KB));
+			printf("-strata [int]\t\t\tSampled separately, consecutive parts of the input (default %u)\n", SAMPLE_DEFAULT_STRATA);
+			printf("-seed [int]\t\t\tOf the block order\n");
+			printf("-threads [int]\t\t\tParse threads (default hardware threads - 1)\n");
+			printf("-format [text|json|csv]\t\ttext is {name=min/mean/max, ...}, json and csv add the intervals\n");
+			printf("-output [file]\t\t\tInstead of stdout\n");
+			printf("-noindex, -buildindex and -indexmb work like in the threaded solutions\n");
+			return 0;
+		}
+
+		bool error = false;
+		auto value = [&](const char* name) -> const char*
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing %s arg value\n", name);
+				exit(1);
+			}
+			return argv[i];
+		};
+		if (_stricmp(argv[i], "-fraction") == 0)
+		{
+			fraction = strtod(value("fraction"), nullptr);
+		}
+		else if (_stricmp(argv[i], "-budgetms") == 0)
+		{
+			budgetMs = strtod(value("budgetms"), nullptr);
+		}
+		else if (_stricmp(argv[i], "-error") == 0)
+		{
+			targetError = strtod(value("error"), nullptr);
+		}
+		else if (_stricmp(argv[i], "-confidence") == 0)
+		{
+			confidence = strtod(value("confidence"), nullptr);
+		}
+		else if (_stricmp(argv[i], "-blockkb") == 0)
+		{
+			blockBytes = strtoull(value("blockkb"), nullptr, 10) * KB;
+		}
+		else if (_stricmp(argv[i], "-strata") == 0)
+		{
+			strata = strtoul(value("strata"), nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-seed") == 0)
+		{
+			seed = strtoull(value("seed"), nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			numThreads = strtoul(value("threads"), nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-format") == 0)
+		{
+			if (!ParseResultFormat(value("format"), format) || format == RESULT_FORMAT_BINARY)
+			{
+				printf("-format takes text, json or csv\n");
+				return 1;
+			}
+		}
+		else if (_stricmp(argv[i], "-output") == 0)
+		{
+			outputPath = value("output");
+		}
+		else if (ParseInputOption(argc, argv, i, inputOptions, error))
+		{
+			if (error) return 1;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (patterns.size == 0)
+	{
+		printf("usage: %s [-fraction f] [-budgetms ms] [-error degrees] [-confidence c] [-blockkb kb] [-strata n] [-seed n] [-threads n] [-format text|json|csv] [-output file] [file or glob]...\n", argv[0]);
+		return 1;
+	}
+	if (fraction <= 0 || fraction > 1 || confidence <= 0 || confidence >= 1 || blockBytes == 0 || strata == 0)
+	{
+		printf("-fraction and -confidence take values in (0, 1], -blockkb and -strata at least 1\n");
+		return 1;
+	}
+	if (inputOptions.hasRows || inputOptions.hasRange || inputOptions.cacheDir != nullptr || inputOptions.checkpointPath != nullptr || inputOptions.partialPath != nullptr)
+	{
+		printf("brc_sample can't be combined with -rows, -range, -cache, -checkpoint or -partial\n");
+		return 1;
+	}
+	if (numThreads == 0) numThreads = 1;
+
+	const auto start = std::chrono::steady_clock::now();
+	auto elapsedMs = [&]()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+
+	InputSet input;
+	if (!input.Open(patterns, inputOptions, numThreads)) return 1;
+	SampleSource source;
+	source.Init(input, blockBytes);
+	SamplePlan plan;
+	plan.Init(source.NumSlots(), strata, seed);
+	const double z = SampleZ(confidence);
+
+	Array<SampleThread> threads;
+	threads.InitMallocZero(numThreads);
+	for (u32 i = 0; i < numThreads; i++)
+	{
+		threads[i].blocks.Init(256);
+		threads[i].stations.Init(4096);
+	}
+	brc::EnginePool pool;
+	pool.Start(numThreads - 1);
+
+	// Every station any block had, with what the sample has seen of it
+	brc::EngineMap<SampleStation> stations;
+	stations.Init(brc::ENGINE_MAP_INITIAL_CAPACITY);
+	SampleEstimator estimator;
+	estimator.Init();
+	Array<SampleEstimate> estimates;
+	Vector<SamplePick> picks(1024);
+	bool ok = true;
+	for (u32 round = 1;; round++)
+	{
+		const double roundStart = elapsedMs();
+		picks.Clear();
+		plan.Next(fraction, picks);
+
+		SampleJob job;
+		job.source = &source;
+		job.picks = &picks;
+		job.threads = threads.data;
+		pool.Run(&SampleParse, &job);
+
+		brc::EngineNoContext ctx;
+		for (u32 t = 0; t < numThreads; t++)
+		{
+			SampleThread& mem = threads[t];
+			ok &= !mem.failed;
+			for (u64 b = 0; b < mem.blocks.size; b++)
+			{
+				const BlockResult& block = mem.blocks.data[b];
+				estimator.BeginBlock(block.stratum);
+				for (u64 s = block.firstStation; s < block.firstStation + block.numStations; s++)
+				{
+					const BlockStation& bs = mem.stations.data[s];
+					const u32 station = stations.FindOrInsert(String((char*)bs.name, bs.namelen), bs.hash);
+					stations.stations.data[station].Merge(bs.data, ctx, station, ctx, 0);
+					estimator.AddObservation(station, bs.data.count, bs.data.sum);
+				}
+			}
+			mem.blocks.size = 0;
+			mem.stations.size = 0;
+		}
+		if (!ok) break;
+
+		if (estimates.data != nullptr) estimates.Free();
+		estimates.data = nullptr;
+		estimator.Estimate(plan, stations.numStations, z, estimates);
+		double widest = 0;
+		for (u32 i = 0; i < stations.numStations; i++)
+		{
+			if (estimates.data[i].meanHalfWidth > widest) widest = estimates.data[i].meanHalfWidth;
+		}
+		widest *= 0.1;
+
+		const double now = elapsedMs();
+		const double roundMs = now - roundStart;
+		fprintf(stderr, "round %u: %llu of %llu blocks (%.2f%%) after %.1f ms, %u stations, widest %g%% mean interval +-%.2f\n", round,
+			(unsigned long long)plan.Sampled(), (unsigned long long)plan.numSlots, plan.numSlots ? 100.0 * plan.Sampled() / plan.numSlots : 100.0,
+			now, stations.numStations, confidence * 100, widest);
+
+		if (plan.Complete()) break; // Exact
+		if (budgetMs <= 0 && targetError <= 0) break;
+		if (targetError > 0 && widest <= targetError) break;
+		if (budgetMs > 0 && now + roundMs * 2 > budgetMs) break; // The next round reads as many blocks as all of the ones before
+		fraction = 2.0 * plan.Sampled() / plan.numSlots; // At least two blocks per stratum can be more than the first fraction
+	}
+	pool.Stop();
+
+	if (!ok)
+	{
+		printf("can't decompress the input\n");
+		return 1;
+	}
+	if (outputPath == nullptr) setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+	if (!WriteEstimates(outputPath, format, stations, estimates))
+	{
+		fprintf(stderr, "failed to write %s\n", outputPath != nullptr ? outputPath : "stdout");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,413 @@
+#include "../../src/base/platform_socket.h" // Before windows.h
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/hash_map.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/brc/engine.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/result_cache.h"
+#include "../../src/brc/server_protocol.h"
+
+// Long running aggregation server, see src/brc/server_protocol.h for the protocol.
+// Aggregates are cached per file and keyed by its identity (see FileIdentity), so a query only parses files that are new or
+// changed since they were last seen and merges the rest. Parsing runs on a brc::Engine (src/brc/engine.h), whose threads stay
+// alive between scans, one file at a time, and every client gets its own connection thread so cached queries never wait on a parse.
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+// Per station aggregates of one file as it was when it was parsed, sorted by name with their own copies of the names so the file
+// doesn't have to stay mapped
+struct FileAggregate
+{
+	FileIdentity identity;
+	brc::EngineResult result;
+
+	~FileAggregate()
+	{
+		result.Free();
+	}
+};
+
+constexpr u32 MAX_CACHED_FILES = 1 << 16;
+constexpr u64 LATENCY_HISTORY = 1 << 20; // Latencies of the last million queries go into STATS
+
+struct Server
+{
+	InputOptions inputOptions;
+	u32 numThreads = 1;
+	bool verbose = false;
+	brc::Engine engine;
+	std::mutex scanMutex;
+
+	// path -> slot, slots are only ever added so the map and names need no cleanup
+	std::mutex cacheMutex;
+	HashMap<String, u32> cacheSlots{ 1024 };
+	StringBuffer cachePaths;
+	std::shared_ptr<FileAggregate>* cached = nullptr;
+	u32 numCached = 0;
+
+	std::mutex statsMutex;
+	Array<u32> latencies; // Microseconds, a ring buffer
+	u64 numQueries = 0;
+
+	void Start()
+	{
+		brc::EngineOptions options;
+		options.threads = numThreads;
+		options.input = inputOptions;
+		engine.Init(options);
+		cachePaths.Init(32 * MB);
+		cached = new std::shared_ptr<FileAggregate>[MAX_CACHED_FILES];
+		latencies.InitMalloc(LATENCY_HISTORY);
+	}
+
+	std::shared_ptr<FileAggregate> FindCached(const String& path, const FileIdentity& identity)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto slot = cacheSlots.Find(path);
+		if (slot == nullptr || !cached[slot->v]) return nullptr;
+		const std::shared_ptr<FileAggregate>& aggregate = cached[slot->v];
+		if (memcmp(&aggregate->identity, &identity, sizeof(FileIdentity)) != 0) return nullptr;
+		return aggregate;
+	}
+
+	void StoreCached(const String& path, const std::shared_ptr<FileAggregate>& aggregate)
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		u32* insertionIndex;
+		auto slot = cacheSlots.FindOrGetInsertionIndex(path, insertionIndex);
+		if (slot)
+		{
+			cached[slot->v] = aggregate;
+			return;
+		}
+		if (numCached == MAX_CACHED_FILES || cachePaths.Remaining() <= path.len + 1) return;
+		cacheSlots.InsertIndexed(cachePaths.PushStringF(path), numCached, insertionIndex);
+		cached[numCached++] = aggregate;
+	}
+
+	// Parses one file on the engine, the result is only cached if the file can't have changed without its identity changing
+	std::shared_ptr<FileAggregate> Scan(const String& path, const FileIdentity& identity)
+	{
+		std::lock_guard<std::mutex> lock(scanMutex);
+		std::shared_ptr<FileAggregate> aggregate = FindCached(path, identity); // Another client might have just parsed it
+		if (aggregate) return aggregate;
+
+		const s64 scanStart = FileTimeNow();
+		aggregate = std::make_shared<FileAggregate>();
+		aggregate->identity = identity;
+		if (!engine.Run((const char*)path, aggregate->result)) return nullptr;
+
+		FileIdentity after;
+		GetFileIdentity(path, after);
+		const s64 racyTime = scanStart - RESULT_CACHE_RACY_SECONDS * FILE_TIME_TICKS_PER_SECOND;
+		if (memcmp(&after, &identity, sizeof(FileIdentity)) == 0 && identity.modifiedTime < racyTime && identity.changedTime < racyTime)
+		{
+			StoreCached(path, aggregate);
+		}
+		return aggregate;
+	}
+
+	// The response of a QUERY line, in the same format as the solutions print
+	bool Query(const String& request, StringBuffer& payload, char* error, const u64 errorBytes)
+	{
+		StringBuffer pathBuf(64 * KB + request.len * 2);
+		Vector<String> paths(16);
+		const char* pos = request.data;
+		const char* end = request.data + request.len;
+		while (pos < end)
+		{
+			const char* tab = (const char*)memchr(pos, '\t', end - pos);
+			if (tab == nullptr) tab = end;
+			if (tab > pos)
+			{
+				const String pattern = pathBuf.PushStringF(String((char*)pos, tab - pos));
+				if (!ExpandFilePattern(pattern, pathBuf, paths))
+				{
+					snprintf(error, errorBytes, "no files match %s", (const char*)pattern);
+					free(pathBuf.data);
+					return false;
+				}
+			}
+			pos = tab + 1;
+		}
+		if (paths.size == 0)
+		{
+			snprintf(error, errorBytes, "no files given");
+			free(pathBuf.data);
+			return false;
+		}
+
+		std::vector<std::shared_ptr<FileAggregate>> aggregates; // Keeps the names alive until we're done merging and printing
+		u64 largest = 0;
+		bool good = true;
+		for (u64 i = 0; i < paths.size && good; i++)
+		{
+			FileIdentity identity;
+			if (!GetFileIdentity(paths[i], identity))
+			{
+				snprintf(error, errorBytes, "can't open %s", (const char*)paths[i]);
+				good = false;
+				break;
+			}
+			if (identity.size == 0) continue;
+
+			std::shared_ptr<FileAggregate> aggregate = FindCached(paths[i], identity);
+			if (!aggregate) aggregate = Scan(paths[i], identity);
+			if (!aggregate)
+			{
+				snprintf(error, errorBytes, "failed to read %s", (const char*)paths[i]);
+				good = false;
+				break;
+			}
+			if (verbose) fprintf(stderr, "%s: %llu stations\n", (const char*)paths[i], (unsigned long long)aggregate->result.stations.size);
+			if (aggregate->result.stations.size > largest) largest = aggregate->result.stations.size;
+			aggregates.push_back(aggregate);
+		}
+
+		if (good)
+		{
+			// A single file is already sorted, more are merged by the hashes they were parsed with
+			brc::EngineResult merged;
+			const brc::EngineResult* result = &merged;
+			if (aggregates.size() == 1)
+			{
+				result = &aggregates[0]->result;
+			}
+			else
+			{
+				u64 capacity = brc::ENGINE_MAP_INITIAL_CAPACITY;
+				while (capacity < largest * 2) capacity *= 2;
+				brc::EngineMap<brc::EngineStationData> map;
+				map.Init(capacity);
+				brc::EngineNoContext ctx;
+				for (const std::shared_ptr<FileAggregate>& aggregate : aggregates)
+				{
+					for (u64 j = 0; j < aggregate->result.stations.size; j++)
+					{
+						const brc::EngineStation& station = aggregate->result.stations.data[j];
+						const u32 index = map.FindOrInsert(station.name, station.hash);
+						map.stations.data[index].Merge(station.data, ctx, index, ctx, 0);
+					}
+				}
+				brc::EngineCollect(map, merged);
+				map.Free();
+			}
+
+			payload.Init(result->stations.size * 128 + 16);
+			payload.Push('{');
+			for (u64 i = 0; i < result->stations.size; i++)
+			{
+				if (i > 0) payload.Push(", ");
+				const brc::EngineStation& station = result->stations.data[i];
+				payload.Push(station.name);
+				payload.Push('=');
+				Push1DecimalDouble(payload, station.data.min * 0.1);
+				payload.Push('/');
+				Push1DecimalDoubleRoundTowardPositive(payload, station.Mean());
+				payload.Push('/');
+				Push1DecimalDouble(payload, station.data.max * 0.1);
+			}
+			payload.Push('}');
+			merged.Free();
+		}
+
+		free(pathBuf.data);
+		return good;
+	}
+
+	void RecordLatency(const u64 micros)
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		latencies[numQueries % LATENCY_HISTORY] = micros > U32_MAX ? U32_MAX : (u32)micros;
+		numQueries++;
+	}
+
+	void Stats(StringBuffer& payload)
+	{
+		Array<u32> sorted;
+		u64 total;
+		{
+			std::lock_guard<std::mutex> lock(statsMutex);
+			total = numQueries;
+			const u64 n = numQueries < LATENCY_HISTORY ? numQueries : LATENCY_HISTORY;
+			sorted.InitMalloc(n > 0 ? n : 1);
+			sorted.size = n;
+			memcpy(sorted.data, latencies.data, n * sizeof(u32));
+		}
+		std::sort(sorted.data, sorted.data + sorted.size);
+		auto percentile = [&](const double p) -> u64
+		{
+			return sorted.size > 0 ? sorted[(u64)(p * (sorted.size - 1))] : 0;
+		};
+
+		u32 files;
+		{
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			files = numCached;
+		}
+		payload.Init(256);
+		payload.PushF("queries ", total, " p50_us ", percentile(0.5), " p99_us ", percentile(0.99), " max_us ", percentile(1.0), " cached_files ", files);
+		sorted.Free();
+	}
+
+	void HandleClient(LocalSocket client)
+	{
+		SocketReader* reader = new SocketReader(&client);
+		String line;
+		while (reader->ReadLine(line))
+		{
+			const auto start = std::chrono::steady_clock::now();
+			StringBuffer payload;
+			char error[512] = {};
+			bool ok;
+			bool query = false;
+			if (line.len > 6 && memcmp(line.data, "QUERY ", 6) == 0)
+			{
+				query = true;
+				ok = Query(String(line.data + 6, line.len - 6), payload, error, sizeof(error));
+			}
+			else if (line == String("STATS"))
+			{
+				Stats(payload);
+				ok = true;
+			}
+			else
+			{
+				snprintf(error, sizeof(error), "unknown request, expected QUERY or STATS");
+				ok = false;
+			}
+
+			const u64 micros = (u64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			char header[600];
+			int headerLen;
+			if (ok)
+			{
+				headerLen = snprintf(header, sizeof(header), "OK %llu %llu\n", (unsigned long long)payload.size, (unsigned long long)micros);
+			}
+			else
+			{
+				headerLen = snprintf(header, sizeof(header), "ERR %s\n", error);
+			}
+			bool sent = client.SendAll(header, headerLen) && (!ok || client.SendAll(payload.data, payload.size));
+			free(payload.data);
+			if (query) RecordLatency(micros);
+			if (verbose) fprintf(stderr, "%.*s: %llu us\n", (int)(line.len < 80 ? line.len : 80), line.data, (unsigned long long)micros);
+			if (!sent) break;
+		}
+		delete reader;
+		client.Close();
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	const char* socketPath = BRC_DEFAULT_SOCKET;
+	Server server;
+	server.numThreads = std::thread::hardware_concurrency() - 1;
+	if (server.numThreads == 0) server.numThreads = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool error = false;
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("brc_server [options]\n");
+			printf("-socket [path (default %s)]\tUnix domain socket to listen on\n", BRC_DEFAULT_SOCKET);
+			printf("-threads [int]\t\t\tParse threads (default is one less than the core count)\n");
+			printf("-verbose\t\t\tLog every request and its latency to stderr\n");
+			printf("-noindex\t\t\tDon't use chunk index sidecars\n");
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-socket") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing socket arg value\n");
+				return 1;
+			}
+			socketPath = argv[i];
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing threads arg value\n");
+				return 1;
+			}
+			server.numThreads = strtoul(argv[i], nullptr, 10);
+			if (server.numThreads == 0) server.numThreads = 1;
+		}
+		else if (_stricmp(argv[i], "-verbose") == 0)
+		{
+			server.verbose = true;
+		}
+		else if (ParseInputOption(argc, argv, i, server.inputOptions, error))
+		{
+			if (error) return 1;
+		}
+		else
+		{
+			printf("unknown arg %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (server.inputOptions.hasRows || server.inputOptions.cacheDir != nullptr || server.inputOptions.checkpointPath != nullptr)
+	{
+		printf("-rows, -cache and -checkpoint don't apply to the server\n");
+		return 1;
+	}
+
+	LocalSocket listener;
+	if (!InitSockets() || !ListenLocal(socketPath, listener))
+	{
+		printf("failed to listen on %s\n", socketPath);
+		return 1;
+	}
+
+	server.Start();
+	fprintf(stderr, "listening on %s with %u parse threads\n", socketPath, server.numThreads);
+
+	for (;;)
+	{
+		LocalSocket client;
+		if (!AcceptLocal(listener, client)) continue;
+		std::thread(&Server::HandleClient, &server, client).detach();
+	}
+}
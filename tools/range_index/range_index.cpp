@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "../../src/base/buf_string.h"
+#include "../../src/base/hash_map.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/base/simd.h"
+#include "../../src/brc/input.h"
+#include "../../src/brc/range_index.h"
+
+// Builds and queries the segment tree of per chunk aggregates next to a measurement file (see src/brc/range_index.h).
+// Building parses every chunk once in parallel, a query then merges O(log n) tree nodes and parses at most the two
+// partial chunks at the edges of the range. -scan answers the same range with a plain parse to check against.
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const s64 scaled)
+{
+	s64 intPart = scaled / 10;
+	s64 decimal = std::abs(scaled % 10);
+
+	if (intPart == 0 && scaled < 0)
+	{
+		writeBuf.Push('-');
+	}
+
+	writeBuf.Push(intPart);
+	writeBuf.Push('.');
+	writeBuf.Push(static_cast<char>('0' + decimal));
+}
+
+void Push1DecimalDoubleRoundTowardPositive(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(ceil(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+void Push1DecimalDouble(StringBuffer& writeBuf, const double d)
+{
+	s64 scaled = static_cast<s64>(round(d * 10));
+	Push1DecimalDouble(writeBuf, scaled);
+}
+
+__forceinline s16 ParseTempAsS16(char*& pos)
+{
+	s16 sign = 1;
+	char c = *pos;
+	if (c == '-')
+	{
+		sign = -1;
+		++pos;
+		c = *pos;
+	}
+	s16 tens = (c - '0') * 10;
+
+	++pos;
+	c = *pos;
+	if (c != '.') {
+		tens = tens * 10 + (c - '0') * 10;
+		++pos;
+	}
+	++pos;
+
+	tens = sign * (tens + *pos - '0');
+	pos += 2;
+
+	return tens;
+}
+
+// Parses whole lines in [pos, end) into the map, names point into the file
+void ParseRange(char* pos, const char* end, HashMap<String, RangeStationData>& map)
+{
+	while (pos < end)
+	{
+		String readString;
+		readString.data = pos;
+		SIMD_SeekToChar(pos, ';');
+		readString.len = pos - readString.data;
+
+		u32* insertionIndex;
+		auto result = map.FindOrGetInsertionIndex(readString, insertionIndex);
+		RangeStationData* stationData;
+		if (result)
+		{
+			stationData = &result->v;
+		}
+		else
+		{
+			map.InsertIndexed(readString, RangeStationData(), insertionIndex);
+			stationData = &map.items.Last().v;
+		}
+		pos++;
+
+		stationData->Add(ParseTempAsS16(pos));
+	}
+}
+
+struct LeafStation
+{
+	String name;
+	u32 id;
+	RangeStationData data;
+};
+
+struct Leaf
+{
+	Array<LeafStation> stations;
+};
+
+int Build(const MappedFileHandle& file, const char* dataPath, const u64 chunkBytes, const u32 numThreads)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const char* dataStart = SkipBOM(file);
+	StringBuffer pathBuf(4 * KB);
+
+	ChunkIndex index;
+	if (!index.Load(pathBuf.PushStringF(dataPath, ".idx"), dataPath, file, dataStart - file.data) || index.header.chunkBytes != chunkBytes)
+	{
+		BuildChunkIndex(index, file.data, dataStart - file.data, file.length, chunkBytes, numThreads);
+	}
+	const u64 numChunks = index.entries.size;
+
+	// Leaves, one chunk at a time per thread
+	Array<Leaf> leaves;
+	leaves.InitMallocZero(numChunks);
+	std::atomic<u64> next{ 0 };
+	auto work = [&]()
+	{
+		HashMap<String, RangeStationData> map{ 128 };
+		for (;;)
+		{
+			const u64 chunk = next.fetch_add(1, std::memory_order_relaxed);
+			if (chunk >= numChunks) break;
+
+			map.items.Clear();
+			memset(map.buckets.data, 0, map.buckets.Bytes());
+			ParseRange(file.data + index.entries.data[chunk].offset, file.data + index.ChunkEnd(chunk), map);
+
+			Array<LeafStation>& stations = leaves[chunk].stations;
+			stations.InitMalloc(map.items.size > 0 ? map.items.size : 1);
+			stations.size = map.items.size;
+			for (u64 i = 0; i < map.items.size; i++)
+			{
+				stations.data[i] = { map.items[i].k, 0, map.items[i].v };
+			}
+		}
+	};
+	Array<std::thread*> threads;
+	threads.InitMalloc(numThreads);
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i] = new std::thread(work);
+	}
+	work();
+	for (u32 i = 0; i < numThreads - 1; i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+	}
+	threads.Free();
+
+	// Dictionary in output order
+	RangeIndexWriter writer;
+	writer.Init(numChunks);
+	HashMap<String, u32> dictionary{ 128 };
+	for (u64 chunk = 0; chunk < numChunks; chunk++)
+	{
+		const Array<LeafStation>& stations = leaves[chunk].stations;
+		for (u64 i = 0; i < stations.size; i++)
+		{
+			u32* insertionIndex;
+			if (dictionary.FindOrGetInsertionIndex(stations.data[i].name, insertionIndex) == nullptr)
+			{
+				dictionary.InsertIndexed(stations.data[i].name, 0, insertionIndex);
+				writer.names.Push(stations.data[i].name);
+			}
+		}
+	}
+	std::sort(writer.names.data, writer.names.data + writer.names.size);
+	for (u64 i = 0; i < writer.names.size; i++)
+	{
+		u32* insertionIndex;
+		dictionary.FindOrGetInsertionIndex(writer.names[i], insertionIndex)->v = (u32)i;
+	}
+
+	for (u64 chunk = 0; chunk < numChunks; chunk++)
+	{
+		Array<LeafStation>& stations = leaves[chunk].stations;
+		for (u64 i = 0; i < stations.size; i++)
+		{
+			u32* insertionIndex;
+			stations.data[i].id = dictionary.FindOrGetInsertionIndex(stations.data[i].name, insertionIndex)->v;
+		}
+		std::sort(stations.data, stations.data + stations.size,
+			[](const LeafStation& a, const LeafStation& b) {
+				return a.id < b.id;
+			});
+
+		writer.nodes.Push({ writer.ids.size, stations.size });
+		for (u64 i = 0; i < stations.size; i++)
+		{
+			writer.ids.Push(stations.data[i].id);
+			writer.records.Push(stations.data[i].data);
+		}
+		stations.Free();
+	}
+	leaves.Free();
+	writer.BuildLevels(numChunks);
+
+	String aggPath = pathBuf.PushStringF(dataPath, ".agg");
+	if (!writer.Write(aggPath, dataPath, index))
+	{
+		printf("failed to write %s\n", (const char*)aggPath);
+		free(pathBuf.data);
+		return 1;
+	}
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%s: %llu chunks, %u levels, %llu nodes, %llu records, %llu stations in %.1f ms\n", (const char*)aggPath,
+		(unsigned long long)numChunks, RangeIndexLevels(numChunks), (unsigned long long)writer.nodes.size,
+		(unsigned long long)writer.ids.size, (unsigned long long)writer.names.size, ms);
+	free(pathBuf.data);
+	return 0;
+}
+
+void PrintStation(StringBuffer& out, const String& name, const RangeStationData& data, const bool first)
+{
+	if (!first) out.Push(", ");
+	out.Push(name);
+	out.Push('=');
+	Push1DecimalDouble(out, data.min * 0.1);
+	out.Push('/');
+	Push1DecimalDoubleRoundTowardPositive(out, (data.sum * 0.1) / data.count);
+	out.Push('/');
+	Push1DecimalDouble(out, data.max * 0.1);
+}
+
+void WriteOut(const StringBuffer& out)
+{
+#ifdef _WIN32
+	SetConsoleOutputCP(CP_UTF8);
+#endif
+	setvbuf(stdout, nullptr, _IOFBF, 4 * KB);
+	std::cout.write(out.data, out.size);
+	std::cout.flush();
+}
+
+// Answers the lines that start in [begin, end) from the tree, begin and end are line starts
+int Query(const RangeIndex& tree, const MappedFileHandle& file, const u64 begin, const u64 end)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const u64 numStations = tree.header->numStations;
+	Array<RangeStationData> totals;
+	totals.InitMalloc(numStations > 0 ? numStations : 1);
+	for (u64 i = 0; i < numStations; i++)
+	{
+		totals.data[i] = RangeStationData();
+	}
+
+	HashMap<String, RangeStationData> edges{ 128 };
+	u64 edgeBytes = 0;
+	u64 nodesMerged = 0;
+	if (begin < end)
+	{
+		// Whole chunks go to the tree, the rest of the first and last chunk is parsed
+		const u64 firstChunk = tree.FindChunkForOffset(begin);
+		const u64 lastChunk = tree.FindChunkForOffset(end - 1);
+		const u64 fullBegin = begin == tree.chunks.entries.data[firstChunk].offset ? firstChunk : firstChunk + 1;
+		const u64 fullEnd = end == tree.chunks.ChunkEnd(lastChunk) ? lastChunk + 1 : lastChunk;
+		if (fullBegin >= fullEnd)
+		{
+			ParseRange(file.data + begin, file.data + end, edges);
+			edgeBytes = end - begin;
+		}
+		else
+		{
+			if (fullBegin > firstChunk)
+			{
+				ParseRange(file.data + begin, file.data + tree.chunks.ChunkEnd(firstChunk), edges);
+				edgeBytes += tree.chunks.ChunkEnd(firstChunk) - begin;
+			}
+			if (fullEnd <= lastChunk)
+			{
+				ParseRange(file.data + tree.chunks.entries.data[lastChunk].offset, file.data + end, edges);
+				edgeBytes += end - tree.chunks.entries.data[lastChunk].offset;
+			}
+			nodesMerged = tree.VisitChunkRange(fullBegin, fullEnd, [&](const RangeNode& node)
+			{
+				for (u64 r = node.firstRecord; r < node.firstRecord + node.numRecords; r++)
+				{
+					totals.data[tree.ids[r]].Merge(tree.records[r]);
+				}
+			});
+		}
+	}
+
+	// Edge stations are looked up in the sorted dictionary
+	for (u64 i = 0; i < edges.items.size; i++)
+	{
+		const String& name = edges.items[i].k;
+		u64 lo = 0;
+		u64 hi = numStations;
+		while (lo < hi)
+		{
+			const u64 mid = (lo + hi) / 2;
+			if (tree.StationName((u32)mid) < name) lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo >= numStations || !(tree.StationName((u32)lo) == name))
+		{
+			printf("%.*s isn't in the index, rebuild it with -build\n", (int)name.len, name.data);
+			return 1;
+		}
+		totals.data[lo].Merge(edges.items[i].v);
+	}
+
+	StringBuffer out(numStations * 128 + 16);
+	out.Push('{');
+	bool first = true;
+	for (u64 i = 0; i < numStations; i++)
+	{
+		if (totals.data[i].count == 0) continue;
+		PrintStation(out, tree.StationName((u32)i), totals.data[i], first);
+		first = false;
+	}
+	out.Push('}');
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	WriteOut(out);
+	fprintf(stderr, "\nbytes [%llu, %llu): merged %llu tree nodes, parsed %.2f MB of edge chunks, %.3f ms\n",
+		(unsigned long long)begin, (unsigned long long)end, (unsigned long long)nodesMerged, (double)edgeBytes / MB, ms);
+	free(out.data);
+	totals.Free();
+	return 0;
+}
+
+// The same range with a plain single threaded parse, to check the tree against
+int Scan(const MappedFileHandle& file, const u64 begin, const u64 end)
+{
+	const auto start = std::chrono::steady_clock::now();
+	HashMap<String, RangeStationData> map{ 128 };
+	ParseRange(file.data + begin, file.data + end, map);
+
+	Array<u64> sortedStations;
+	sortedStations.InitMalloc(map.items.size > 0 ? map.items.size : 1);
+	for (u64 i = 0; i < map.items.size; i++)
+	{
+		sortedStations.data[i] = i;
+	}
+	std::sort(sortedStations.data, sortedStations.data + map.items.size,
+		[&](const u64 a, const u64 b) {
+			return map.items.data[a].k < map.items.data[b].k;
+		});
+
+	StringBuffer out(map.items.size * 128 + 16);
+	out.Push('{');
+	for (u64 i = 0; i < map.items.size; i++)
+	{
+		const auto& station = map.items.data[sortedStations.data[i]];
+		PrintStation(out, station.k, station.v, i == 0);
+	}
+	out.Push('}');
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	WriteOut(out);
+	fprintf(stderr, "\nbytes [%llu, %llu): parsed %.2f MB, %.3f ms\n", (unsigned long long)begin, (unsigned long long)end, (double)(end - begin) / MB, ms);
+	free(out.data);
+	sortedStations.Free();
+	return 0;
+}
+
+bool ParseRangeArg(const char* arg, u64& begin, u64& end)
+{
+	char* pos = nullptr;
+	begin = strtoull(arg, &pos, 10);
+	if (*pos != ':') return false;
+	pos++;
+	end = *pos == '\0' ? ~0ull : strtoull(pos, &pos, 10); // start: runs to the end of the file
+	return *pos == '\0' && begin <= end;
+}
+
+int main(int argc, char* argv[])
+{
+	bool build = false;
+	bool scan = false;
+	bool haveRows = false;
+	bool haveBytes = false;
+	u64 rangeBegin = 0;
+	u64 rangeEnd = 0;
+	u64 chunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
+	u32 numThreads = std::thread::hardware_concurrency();
+	const char* dataPath = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("range_index [options] [measurement file]\n");
+			printf("-build\t\t\t\tWrite the tree of per chunk aggregates to [file].agg\n");
+			printf("-indexmb [int (default %llu)]\tChunk size in MB when building, an existing .idx of that size is reused\n", (unsigned long long)(CHUNK_INDEX_DEFAULT_CHUNK_BYTES / MB));
+			printf("-threads [int]\t\t\tThreads used to build (default hardware threads)\n");
+			printf("-rows [start:end]\t\tAggregate rows [start, end) using the tree\n");
+			printf("-bytes [start:end]\t\tAggregate the lines that start in bytes [start, end), an empty end is the end of the file\n");
+			printf("-scan\t\t\t\tAnswer the range with a plain parse instead, to check and time against\n");
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-build") == 0)
+		{
+			build = true;
+		}
+		else if (_stricmp(argv[i], "-scan") == 0)
+		{
+			scan = true;
+		}
+		else if (_stricmp(argv[i], "-indexmb") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing indexmb arg value\n");
+				return 1;
+			}
+			chunkBytes = strtoull(argv[i], nullptr, 10) * MB;
+			if (chunkBytes == 0) chunkBytes = CHUNK_INDEX_DEFAULT_CHUNK_BYTES;
+		}
+		else if (_stricmp(argv[i], "-threads") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing threads arg value\n");
+				return 1;
+			}
+			numThreads = strtoul(argv[i], nullptr, 10);
+		}
+		else if (_stricmp(argv[i], "-rows") == 0 || _stricmp(argv[i], "-bytes") == 0)
+		{
+			const bool rows = _stricmp(argv[i], "-rows") == 0;
+			i++;
+			if (i >= argc || !ParseRangeArg(argv[i], rangeBegin, rangeEnd))
+			{
+				printf("%s expects start:end\n", rows ? "-rows" : "-bytes");
+				return 1;
+			}
+			haveRows = rows;
+			haveBytes = !rows;
+		}
+		else
+		{
+			dataPath = argv[i];
+		}
+	}
+
+	if (dataPath == nullptr || (!build && !haveRows && !haveBytes))
+	{
+		printf("usage: %s [-build] [-indexmb n] [-rows start:end | -bytes start:end] [-scan] [measurement file]\n", argv[0]);
+		return 1;
+	}
+	if (numThreads == 0) numThreads = 1;
+
+	MappedFileHandle file;
+	if (!file.OpenRead(dataPath) || file.length == 0)
+	{
+		printf("can't open %s\n", dataPath);
+		return 1;
+	}
+
+	if (build)
+	{
+		const int result = Build(file, dataPath, chunkBytes, numThreads);
+		if (result != 0 || (!haveRows && !haveBytes)) return result;
+	}
+
+	StringBuffer pathBuf(4 * KB);
+	RangeIndex tree;
+	if (!tree.Open(pathBuf.PushStringF(dataPath, ".agg"), dataPath, file.length))
+	{
+		printf("no up to date %s.agg, build it with -build\n", dataPath);
+		return 1;
+	}
+
+	// Both ends move to the start of the line they fall in, or the next one
+	const u64 dataStart = SkipBOM(file) - file.data;
+	auto lineStart = [&](const u64 offset) -> u64
+	{
+		if (offset <= dataStart) return dataStart;
+		if (offset >= file.length) return file.length;
+		if (file.data[offset - 1] == '\n') return offset;
+		const char* newline = (const char*)memchr(file.data + offset, '\n', file.length - offset);
+		return newline != nullptr ? newline - file.data + 1 : file.length;
+	};
+
+	u64 begin;
+	u64 end;
+	if (haveRows)
+	{
+		begin = tree.chunks.FindRow(file.data, rangeBegin) - file.data;
+		end = tree.chunks.FindRow(file.data, rangeEnd) - file.data;
+	}
+	else
+	{
+		begin = lineStart(rangeBegin);
+		end = lineStart(rangeEnd);
+	}
+
+	return scan ? Scan(file, begin, end) : Query(tree, file, begin, end);
+}
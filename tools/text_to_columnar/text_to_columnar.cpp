@@ -0,0 +1,165 @@
+#include "../../src/base/buf_string.h"
+#include "../../src/base/hash_map.h"
+#include "../../src/base/platform_io.h"
+#include "../../src/base/simd.h"
+#include "../../src/brc/columnar.h"
+#include "../../src/brc/input.h"
+
+// Converts text measurement files into the columnar format (see src/brc/columnar.h).
+// It's a one time job per file so it just runs on one thread, the output is written block by block as we go.
+
+__forceinline s16 ParseTempAsS16(char*& pos)
+{
+	s16 sign = 1;
+	char c = *pos;
+	if (c == '-')
+	{
+		sign = -1;
+		++pos;
+		c = *pos;
+	}
+	s16 tens = (c - '0') * 10;
+
+	++pos;
+	c = *pos;
+	if (c != '.') {
+		tens = tens * 10 + (c - '0') * 10;
+		++pos;
+	}
+	++pos;
+
+	tens = sign * (tens + *pos - '0');
+	pos += 2;
+
+	return tens;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* outputPath = nullptr;
+	u32 flags = COLUMNAR_SORTED_BLOCKS;
+	u32 blockRows = COLUMNAR_DEFAULT_BLOCK_ROWS;
+	InputOptions inputOptions;
+	Vector<const char*> patterns(16);
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool error = false;
+		if (_stricmp(argv[i], "-help") == 0 || _stricmp(argv[i], "-h") == 0)
+		{
+			printf("text_to_columnar -output [file] [options] [text file or glob]...\n");
+			printf("-output [file]\t\t\tPath to the columnar output file\n");
+			printf("-wideids\t\t\tStore u32 station ids instead of u16 (needed past 65536 stations)\n");
+			printf("-keeporder\t\t\tKeep the original row order inside blocks instead of grouping rows by station\n");
+			printf("-blockrows [int (default %u)]\tRows per block\n", COLUMNAR_DEFAULT_BLOCK_ROWS);
+			return 0;
+		}
+
+		if (_stricmp(argv[i], "-output") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing output arg value\n");
+				return 1;
+			}
+			outputPath = argv[i];
+		}
+		else if (_stricmp(argv[i], "-wideids") == 0)
+		{
+			flags |= COLUMNAR_WIDE_IDS;
+		}
+		else if (_stricmp(argv[i], "-keeporder") == 0)
+		{
+			flags &= ~COLUMNAR_SORTED_BLOCKS;
+		}
+		else if (_stricmp(argv[i], "-blockrows") == 0)
+		{
+			i++;
+			if (i >= argc)
+			{
+				printf("missing blockrows arg value\n");
+				return 1;
+			}
+			blockRows = strtoul(argv[i], nullptr, 10);
+			if (blockRows == 0) blockRows = COLUMNAR_DEFAULT_BLOCK_ROWS;
+		}
+		else if (ParseInputOption(argc, argv, i, inputOptions, error))
+		{
+			if (error) return 1;
+		}
+		else
+		{
+			patterns.Push(argv[i]);
+		}
+	}
+
+	if (outputPath == nullptr || patterns.size == 0)
+	{
+		printf("usage: %s -output [file] [text file or glob]...\n", argv[0]);
+		return 1;
+	}
+
+	InputSet input;
+	if (!input.Open(patterns, inputOptions, 1)) return 1;
+	WorkQueue work;
+	if (!input.Partition(work, inputOptions, 1)) return 1;
+
+	ColumnarWriter writer;
+	if (!writer.Open(outputPath, flags, blockRows))
+	{
+		printf("failed to open %s\n", outputPath);
+		return 1;
+	}
+
+	HashMap<String, u32> stationIds(1024);
+	UnitReader reader;
+	for (u64 u = 0; u < work.units.size; u++)
+	{
+		char* pos;
+		const char* parseEnd;
+		if (!reader.Begin(work.units[u], pos, parseEnd)) return 1;
+		while (pos < parseEnd)
+		{
+			String name;
+			name.data = pos;
+			SIMD_SeekToChar(pos, ';');
+			name.len = pos - name.data;
+			pos++;
+
+			u32* insertionIndex;
+			auto station = stationIds.FindOrGetInsertionIndex(name, insertionIndex);
+			u32 id;
+			if (station)
+			{
+				id = station->v;
+			}
+			else
+			{
+				if (writer.NumStations() == writer.MaxStations())
+				{
+					printf("more than %u stations, convert with -wideids\n", writer.MaxStations());
+					return 1;
+				}
+				id = writer.AddStation(name);
+				if (reader.NeedsCopy(name.data)) name = reader.Persist(name.data, name.len);
+				stationIds.InsertIndexed(name, id, insertionIndex);
+			}
+
+			if (!writer.Add(id, ParseTempAsS16(pos)))
+			{
+				printf("failed writing %s\n", outputPath);
+				return 1;
+			}
+		}
+	}
+
+	if (!writer.Finish())
+	{
+		printf("failed writing %s\n", outputPath);
+		return 1;
+	}
+
+	printf("Converted %llu rows of %u stations into %llu blocks in %s\n", (unsigned long long)writer.numRows, writer.NumStations(), (unsigned long long)writer.blocks.size, outputPath);
+	return 0;
+}